@@ -322,6 +322,16 @@ T Link_createForInterface(const char *interface) {
 }
 
 
+T Link_copy(T L) {
+        assert(L);
+        T C;
+        NEW(C);
+        *C = *L;
+        C->object = Str_dup(L->object);
+        return C;
+}
+
+
 void Link_free(T *L) {
         FREE((*L)->object);
         FREE(*L);
@@ -63,6 +63,14 @@ T Link_createForAddress(const char *address);
 T Link_createForInterface(const char *interface);
 
 
+/**
+ * Get a copy of the Link object with the current data.
+ * @param L A Link object
+ * @return Link object copy. Use Link_free() to release it.
+ */
+T Link_copy(T L);
+
+
 /**
  * Destroy a Link object and release allocated resources.
  * @param L A Link object reference
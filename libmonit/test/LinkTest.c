@@ -13,6 +13,7 @@
 #include "Thread.h"
 #include "system/Link.h"
 #include "File.h"
+#include "AssertException.h"
 
 /**
  * Link unit tests.
@@ -25,6 +26,35 @@ int main(int argc, char **argv) {
 
         printf("============> Start Link Tests\n\n");
 
+        printf("=> Test1: copy\n");
+        {
+                Link_T L = Link_createForAddress("127.0.0.1");
+                TRY
+                {
+                        Link_update(L);
+                }
+                ELSE
+                {
+                        printf("\tLoopback statistics not available -- %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                Link_T C = Link_copy(L);
+                assert(C != L);
+                assert(Link_getBytesInTotal(C) == Link_getBytesInTotal(L));
+                assert(Link_getPacketsOutTotal(C) == Link_getPacketsOutTotal(L));
+                printf("\tResult: copy has %lld bytes in total\n", Link_getBytesInTotal(C));
+                // The copy is independent, it is not changed by a reset of the original and remains valid after the original is freed
+                long long bytes = Link_getBytesInTotal(C);
+                Link_reset(L);
+                assert(Link_getBytesInTotal(C) == bytes);
+                Link_free(&L);
+                assert(L == NULL);
+                assert(Link_getBytesInTotal(C) == bytes);
+                Link_free(&C);
+                assert(C == NULL);
+        }
+        printf("=> Test1: OK\n\n");
+
 
         printf("============> Link Tests: OK\n\n");
 
@@ -67,6 +67,16 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+static struct {
+        MailServer_T mta;                              /**< Mail server in use */
+        SMTP_T smtp;                                  /**< Open SMTP session */
+        time_t used;                       /**< When the session was last used */
+} _session = {};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -202,34 +212,82 @@ static MailServer_T _connectMTA() {
 }
 
 
+/**
+ * Close the SMTP session. QUIT is sent unless the connection is known to be broken
+ */
+static void _closeSession(boolean_t quit) {
+        if (_session.smtp) {
+                if (quit) {
+                        TRY
+                        {
+                                SMTP_quit(_session.smtp);
+                        }
+                        ELSE
+                        {
+                                DEBUG("Mail: QUIT failed -- %s\n", Exception_frame.message);
+                        }
+                        END_TRY;
+                }
+                // QUIT was sent already or the connection is broken, don't let SMTP_free() send it
+                SMTP_abort(_session.smtp);
+                SMTP_free(&(_session.smtp));
+        }
+        if (_session.mta && _session.mta->socket)
+                Socket_free(&(_session.mta->socket));
+        _session.mta = NULL;
+        _session.used = 0;
+}
+
+
+// Reuse the open SMTP session if it didn't exceed the idle limit and the server still responds, otherwise open a new one
+static void _openSession() {
+        if (_session.smtp) {
+                if (Time_now() - _session.used <= Run.mailserver_idle) {
+                        TRY
+                        {
+                                SMTP_reset(_session.smtp);
+                        }
+                        ELSE
+                        {
+                                DEBUG("Mail: cannot reuse the session with %s -- %s\n", _session.mta->host, Exception_frame.message);
+                                _closeSession(false);
+                        }
+                        END_TRY;
+                } else {
+                        _closeSession(true);
+                }
+        }
+        if (! _session.smtp) {
+                _session.mta = _connectMTA();
+                _session.smtp = SMTP_new(_session.mta->socket);
+                SMTP_greeting(_session.smtp);
+                SMTP_helo(_session.smtp, Run.mail_hostname ? Run.mail_hostname : Run.system->name);
+                if (_session.mta->ssl.flags == SSL_StartTLS)
+                        SMTP_starttls(_session.smtp, &(_session.mta->ssl));
+                if (_session.mta->username && _session.mta->password)
+                        SMTP_auth(_session.smtp, _session.mta->username, _session.mta->password);
+        }
+}
+
+
 static boolean_t _send(List_T list) {
         boolean_t failed = false;
         if (List_length(list)) {
                 volatile Mail_T m = NULL;
-                volatile SMTP_T smtp = NULL;
-                volatile MailServer_T mta = NULL;
                 TRY
                 {
-                        mta = _connectMTA();
-                        smtp = SMTP_new(mta->socket);
-                        SMTP_greeting(smtp);
-                        SMTP_helo(smtp, Run.mail_hostname ? Run.mail_hostname : Run.system->name);
-                        if (mta->ssl.flags == SSL_StartTLS)
-                                SMTP_starttls(smtp, &(mta->ssl));
-                        if (mta->username && mta->password)
-                                SMTP_auth(smtp, mta->username, mta->password);
+                        _openSession();
+                        Socket_T socket = _session.mta->socket;
                         char now[STRLEN];
                         Time_gmtstring(Time_now(), now);
                         while ((m = List_pop(list))) {
-                                SMTP_from(smtp, m->from->address);
-                                SMTP_to(smtp, m->to);
-                                SMTP_dataBegin(smtp);
+                                SMTP_transaction(_session.smtp, m->from->address, m->to);
                                 if (
-                                        (m->replyto && ((m->replyto->name ? Socket_print(mta->socket, "Reply-To: \"%s\" <%s>\r\n", m->replyto->name, m->replyto->address) : Socket_print(mta->socket, "Reply-To: %s\r\n", m->replyto->address)) <= 0))
+                                        (m->replyto && ((m->replyto->name ? Socket_print(socket, "Reply-To: \"%s\" <%s>\r\n", m->replyto->name, m->replyto->address) : Socket_print(socket, "Reply-To: %s\r\n", m->replyto->address)) <= 0))
                                         ||
-                                        ((m->from->name ? Socket_print(mta->socket, "From: \"%s\" <%s>\r\n", m->from->name, m->from->address) : Socket_print(mta->socket, "From: %s\r\n", m->from->address)) <= 0)
+                                        ((m->from->name ? Socket_print(socket, "From: \"%s\" <%s>\r\n", m->from->name, m->from->address) : Socket_print(socket, "From: %s\r\n", m->from->address)) <= 0)
                                         ||
-                                        Socket_print(mta->socket,
+                                        Socket_print(socket,
                                                 "To: %s\r\n"
                                                 "Subject: %s\r\n"
                                                 "Date: %s\r\n"
@@ -248,26 +306,27 @@ static boolean_t _send(List_T list) {
                                                 m->message) <= 0
                                    )
                                 {
-                                        THROW(IOException, "Error sending data to mail server %s -- %s", mta->host, STRERROR);
+                                        THROW(IOException, "Error sending data to mail server %s -- %s", _session.mta->host, STRERROR);
                                 }
-                                SMTP_dataCommit(smtp);
+                                SMTP_dataCommit(_session.smtp);
                                 gc_mail_list((Mail_T *)&m);
                         }
-                        SMTP_quit(smtp);
+                        // Keep the session open for the next alert if idle sessions are enabled
+                        if (Run.mailserver_idle > 0)
+                                _session.used = Time_now();
+                        else
+                                _closeSession(true);
                 }
                 ELSE
                 {
                         failed = true;
                         LogError("Mail: %s\n", Exception_frame.message);
+                        _closeSession(false);
                 }
                 FINALLY
                 {
                         if (m)
                                 gc_mail_list((Mail_T *)&m);
-                        if (smtp)
-                                SMTP_free((SMTP_T *)&smtp);
-                        if (mta && mta->socket)
-                                Socket_free(&(mta->socket));
                 }
                 END_TRY;
         }
@@ -314,3 +373,19 @@ Handler_Type handle_alert(Event_T E) {
         return rv;
 }
 
+
+/**
+ * Close the SMTP session kept open for reuse (if any)
+ */
+void handle_alert_close() {
+        _closeSession(true);
+}
+
+
+/**
+ * Close the SMTP session kept open for reuse if it exceeded the idle limit
+ */
+void handle_alert_idle() {
+        if (_session.smtp && Time_now() - _session.used > Run.mailserver_idle)
+                _closeSession(true);
+}
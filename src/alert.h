@@ -66,4 +66,20 @@
 Handler_Type handle_alert(Event_T E);
 
 
+/**
+ * Close the SMTP session which is kept open for reuse by subsequent
+ * alerts (see the mail server IDLE option). Must be called before
+ * the mail server list is released.
+ */
+void handle_alert_close();
+
+
+/**
+ * Close the SMTP session kept open for reuse if it was not used for
+ * longer than the mail server IDLE limit. Called after each cycle, so
+ * the idle session doesn't stay open until the next alert.
+ */
+void handle_alert_idle();
+
+
 #endif
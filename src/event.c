@@ -62,6 +62,7 @@
 #include "event.h"
 #include "ProcessTree.h"
 #include "MMonit.h"
+#include "eventstream.h"
 
 // libmonit
 #include "io/File.h"
@@ -113,9 +114,119 @@ EventTable_T Event_Table[] = {
 };
 
 
+static pthread_once_t once_control = PTHREAD_ONCE_INIT;
+static EventTable_T *_eventTableIndex[sizeof(int) * 8] = {}; // Event_Table entries indexed by event bit position
+
+
+static struct {
+        unsigned long long posted;                      /**< Number of posted events */
+        unsigned long long formatted;       /**< Number of formatted event messages */
+} _statistics = {};
+
+
+/* Event notification rate limiter state kept across reload, taken over by the new events */
+typedef struct Limiter_T {
+        char *service;
+        long id;
+        TokenBucket_T limiter;
+        /* For internal use */
+        struct Limiter_T *next;
+} *Limiter_T;
+
+
+static Limiter_T _limiters = NULL;
+
+
+/* Event structure version 4 (Monit <= 5.24), identical to the current version except the notification rate limiter */
+typedef struct myevent4 {
+        long              id;
+        struct timeval    collected;
+        struct Service_T *source;
+        Monitor_Mode      mode;
+        Service_Type      type;
+        State_Type        state;
+        boolean_t         state_changed;
+        Handler_Type      flag;
+        long long         state_map;
+        unsigned int      count;
+        char             *message;
+        EventAction_T     action;
+        struct myevent4  *next;
+} *Event4_T;
+
+
 /* ----------------------------------------------------------------- Private */
 
 
+static void _init_once(void) {
+        for (EventTable_T *et = Event_Table; (*et).id; et++)
+                _eventTableIndex[ffs((*et).id) - 1] = et;
+}
+
+
+static EventTable_T *_getEventTable(long id) {
+        pthread_once(&once_control, _init_once);
+        // Event ids are single bits, so the bit position is a direct index to the table
+        if (id <= 0 || id > Event_All || (id & (id - 1)))
+                return NULL;
+        return _eventTableIndex[ffs((int)id) - 1];
+}
+
+
+static unsigned int _hashEvent(long id, EventAction_T action) {
+        uintptr_t h = (uintptr_t)action ^ ((uintptr_t)id * 2654435761U);
+        return (unsigned int)(h ^ (h >> 16));
+}
+
+
+static void _insertEvent(Service_T S, Event_T E) {
+        unsigned int mask = S->eventindex.size - 1;
+        unsigned int i = _hashEvent(E->id, E->action) & mask;
+        while (S->eventindex.slots[i])
+                i = (i + 1) & mask;
+        S->eventindex.slots[i] = E;
+}
+
+
+/**
+ * Add the event to the service events index. The index is an open addressing table (linear probing) which is kept at most half full.
+ * @param S The service
+ * @param E An event object which was added to the service eventlist already
+ */
+static void _indexEvent(Service_T S, Event_T E) {
+        if (++S->eventindex.count * 2 > S->eventindex.size) {
+                // Grow the table and rebuild the index from the eventlist (which contains E already)
+                FREE(S->eventindex.slots);
+                S->eventindex.size = S->eventindex.size ? S->eventindex.size * 2 : 8;
+                S->eventindex.slots = CALLOC(S->eventindex.size, sizeof(Event_T));
+                for (Event_T e = S->eventlist; e; e = e->next)
+                        _insertEvent(S, e);
+        } else {
+                _insertEvent(S, E);
+        }
+}
+
+
+/**
+ * Find the service event by id and action
+ * @param S The service
+ * @param id The event identification
+ * @param action Description of the event action
+ * @return The event object or NULL if not found
+ */
+static Event_T _findEvent(Service_T S, long id, EventAction_T action) {
+        if (S->eventindex.size) {
+                unsigned int mask = S->eventindex.size - 1;
+                for (unsigned int i = _hashEvent(id, action) & mask; S->eventindex.slots[i]; i = (i + 1) & mask) {
+                        Event_T e = S->eventindex.slots[i];
+                        if (e->id == id && e->action == action)
+                                return e;
+                }
+        }
+        return NULL;
+}
+
+
 /**
  * Return the actual event state based on event state bitmap and event ratio needed to trigger the state change
  * @param E An event object
@@ -278,6 +389,131 @@ error:
 }
 
 
+/**
+ * Refill the token bucket according to the time elapsed since the last refill
+ * @param B A token bucket
+ * @param rate Number of tokens per window (the bucket capacity)
+ * @param window The window length [s]
+ * @param now The current time
+ */
+/**
+ * Convert the queued event version 4 to the current event structure, the
+ * notification rate limiter starts empty
+ * @param E The version 4 event, freed by this function
+ * @return The event
+ */
+static Event_T _convertV4(Event4_T E) {
+        Event_T e;
+        NEW(e);
+        e->id = E->id;
+        e->collected = E->collected;
+        e->mode = E->mode;
+        e->type = E->type;
+        e->state = E->state;
+        e->state_changed = E->state_changed;
+        e->flag = E->flag;
+        e->state_map = E->state_map;
+        e->count = E->count;
+        FREE(E);
+        return e;
+}
+
+
+static void _refillTokens(TokenBucket_T *B, uint32_t rate, uint32_t window, time_t now) {
+        if (! B->refilled) {
+                // The new bucket is full
+                B->tokens = rate;
+                B->refilled = now;
+        } else if (now > B->refilled) {
+                B->tokens = MIN(rate, B->tokens + (double)(now - B->refilled) * rate / window);
+                B->refilled = now;
+        }
+}
+
+
+static void _freeLimiters() {
+        for (Limiter_T l = _limiters, next = NULL; l; l = next) {
+                next = l->next;
+                FREE(l->service);
+                FREE(l);
+        }
+        _limiters = NULL;
+}
+
+
+/**
+ * Hand the limiter state kept across reload over to the new event with the same service and event type
+ * @param S The service
+ * @param E The new event
+ */
+static void _restoreLimiter(Service_T S, Event_T E) {
+        for (Limiter_T l = _limiters, prev = NULL; l; prev = l, l = l->next) {
+                if (l->id == E->id && IS(l->service, S->name)) {
+                        E->limiter = l->limiter;
+                        if (prev)
+                                prev->next = l->next;
+                        else
+                                _limiters = l->next;
+                        FREE(l->service);
+                        FREE(l);
+                        return;
+                }
+        }
+}
+
+
+/**
+ * Check the notification rate limits (per event and global). Only state change notifications are limited,
+ * the internal instance and action events are delivered always.
+ * @param E An event object
+ * @return true if the notification should be suppressed, otherwise false
+ */
+static boolean_t _isRateLimited(Event_T E) {
+        if (! E->state_changed || E->id == Event_Instance || E->id == Event_Action || (! Run.limits.eventNotificationRate && ! Run.limits.notificationRate))
+                return false;
+        time_t now = Time_now();
+        if (Run.limits.eventNotificationRate) {
+                _refillTokens(&(E->limiter), Run.limits.eventNotificationRate, Run.limits.eventNotificationWindow, now);
+                if (E->limiter.tokens < 1.) {
+                        E->limiter.suppressed++;
+                        LogWarning("'%s' %s notification suppressed -- event notification rate limit exceeded\n", E->source->name, Event_get_description(E));
+                        return true;
+                }
+        }
+        if (Run.limits.notificationRate) {
+                _refillTokens(&(Run.notificationLimiter), Run.limits.notificationRate, Run.limits.notificationWindow, now);
+                if (Run.notificationLimiter.tokens < 1.) {
+                        Run.notificationLimiter.suppressed++;
+                        LogWarning("'%s' %s notification suppressed -- notification rate limit exceeded\n", E->source->name, Event_get_description(E));
+                        return true;
+                }
+                Run.notificationLimiter.tokens--;
+        }
+        if (Run.limits.eventNotificationRate)
+                E->limiter.tokens--;
+        // Coalesce the notifications suppressed for this event into the message
+        if (E->limiter.suppressed) {
+                char *message = Str_cat("%s (%u similar notification%s suppressed)", NVLSTR(E->message), E->limiter.suppressed, E->limiter.suppressed > 1 ? "s were" : " was");
+                FREE(E->message);
+                E->message = message;
+                E->limiter.suppressed = 0;
+        }
+        return false;
+}
+
+
+/**
+ * We will handle only first succeeded event, recurrent succeeded events
+ * or insufficient succeeded events during failed service state are
+ * ignored. Failed events are handled each time.
+ * @param E An event object
+ * @return true if the event should be handled, otherwise false
+ */
+static boolean_t _isHandled(Event_T E) {
+        return E->state_changed || ! (E->state == State_Succeeded || E->state == State_ChangedNot || ((E->state_map & 0x1) ^ 0x1));
+}
+
+
 static void _handleAction(Event_T E, Action_T A) {
         ASSERT(E);
         ASSERT(A);
@@ -286,8 +522,10 @@ static void _handleAction(Event_T E, Action_T A) {
 
         if (A->id != Action_Ignored) {
                 /* Alert and mmonit event notification are common actions */
-                E->flag |= MMonit_send(E);
-                E->flag |= handle_alert(E);
+                if (! _isRateLimited(E)) {
+                        E->flag |= MMonit_send(E);
+                        E->flag |= handle_alert(E);
+                }
                 /* In the case that some subhandler failed, enqueue the event for partial reprocessing */
                 if (E->flag != Handler_Succeeded) {
                         if (Run.eventlist_dir)
@@ -321,10 +559,7 @@ static void _handleEvent(Service_T S, Event_T E) {
         ASSERT(E->action->failed);
         ASSERT(E->action->succeeded);
 
-        /* We will handle only first succeeded event, recurrent succeeded events
-         * or insufficient succeeded events during failed service state are
-         * ignored. Failed events are handled each time. */
-        if (! E->state_changed && (E->state == State_Succeeded || E->state == State_ChangedNot || ((E->state_map & 0x1) ^ 0x1))) {
+        if (! _isHandled(E)) {
                 DEBUG("'%s' %s\n", S->name, E->message);
                 return;
         }
@@ -389,32 +624,25 @@ void Event_post(Service_T service, long id, State_Type state, EventAction_T acti
         ASSERT(s);
         ASSERT(state == State_Failed || state == State_Succeeded || state == State_Changed || state == State_ChangedNot);
 
-        va_list ap;
-        va_start(ap, s);
-        char *message = Str_vcat(s, ap);
-        va_end(ap);
-
-        Event_T e = service->eventlist;
-        while (e) {
-                if (e->action == action && e->id == id) {
-                        gettimeofday(&e->collected, NULL);
-
-                        /* Shift the existing event flags to the left and set the first bit based on actual state */
-                        e->state_map <<= 1;
-                        e->state_map |= ((state == State_Succeeded || state == State_ChangedNot) ? 0 : 1);
+        _statistics.posted++;
+        Event_T e = _findEvent(service, id, action);
+        if (e) {
+                gettimeofday(&e->collected, NULL);
 
-                        /* Update the message */
-                        FREE(e->message);
-                        e->message = message;
-                        break;
-                }
-                e = e->next;
-        }
-        if (! e) {
+                /* Shift the existing event flags to the left and set the first bit based on actual state */
+                e->state_map <<= 1;
+                e->state_map |= ((state == State_Succeeded || state == State_ChangedNot) ? 0 : 1);
+        } else {
                 /* Only first failed/changed event can initialize the queue for given event type, thus succeeded events are ignored until first error. */
                 if (state == State_Succeeded || state == State_ChangedNot) {
-                        DEBUG("'%s' %s\n", service->name, message);
-                        FREE(message);
+                        if (Run.debug) {
+                                va_list ap;
+                                va_start(ap, s);
+                                char *message = Str_vcat(s, ap);
+                                va_end(ap);
+                                DEBUG("'%s' %s\n", service->name, message);
+                                FREE(message);
+                        }
                         return;
                 }
                 /* Initialize the event. The mandatory informations are cloned so the event is as standalone as possible and may be saved
@@ -428,9 +656,11 @@ void Event_post(Service_T service, long id, State_Type state, EventAction_T acti
                 e->state = State_Init;
                 e->state_map = 1;
                 e->action = action;
-                e->message = message;
                 e->next = service->eventlist;
                 service->eventlist = e;
+                _indexEvent(service, e);
+                if (_limiters)
+                        _restoreLimiter(service, e);
         }
         e->state_changed = _checkState(e, state);
         /* In the case that the state changed, update it and reset the counter */
@@ -440,10 +670,35 @@ void Event_post(Service_T service, long id, State_Type state, EventAction_T acti
         } else {
                 e->count++;
         }
+        /* Format the message only if the event will be handled, unchanged succeeded events would just drop it */
+        if (_isHandled(e) || Run.debug || ! e->message) {
+                va_list ap;
+                va_start(ap, s);
+                char *message = Str_vcat(s, ap);
+                va_end(ap);
+                FREE(e->message);
+                e->message = message;
+                _statistics.formatted++;
+        }
+        if (e->state_changed)
+                EventStream_post(e);
         _handleEvent(service, e);
 }
 
 
+/**
+ * Get the event statistics
+ * @param posted Output: number of events posted
+ * @param formatted Output: number of event messages formatted
+ */
+void Event_get_statistics(unsigned long long *posted, unsigned long long *formatted) {
+        ASSERT(posted);
+        ASSERT(formatted);
+        *posted = _statistics.posted;
+        *formatted = _statistics.formatted;
+}
+
+
 /**
  * Get a textual description of actual event type.
  * @param E An event object
@@ -452,25 +707,22 @@ void Event_post(Service_T service, long id, State_Type state, EventAction_T acti
  */
 const char *Event_get_description(Event_T E) {
         ASSERT(E);
-        EventTable_T *et = Event_Table;
-        while ((*et).id) {
-                if (E->id == (*et).id) {
-                        switch (E->state) {
-                                case State_Succeeded:
-                                        return (*et).description_succeeded;
-                                case State_Failed:
-                                        return (*et).description_failed;
-                                case State_Init:
-                                        return (*et).description_failed;
-                                case State_Changed:
-                                        return (*et).description_changed;
-                                case State_ChangedNot:
-                                        return (*et).description_changednot;
-                                default:
-                                        break;
-                        }
+        EventTable_T *et = _getEventTable(E->id);
+        if (et) {
+                switch (E->state) {
+                        case State_Succeeded:
+                                return (*et).description_succeeded;
+                        case State_Failed:
+                                return (*et).description_failed;
+                        case State_Init:
+                                return (*et).description_failed;
+                        case State_Changed:
+                                return (*et).description_changed;
+                        case State_ChangedNot:
+                                return (*et).description_changednot;
+                        default:
+                                break;
                 }
-                et++;
         }
         return NULL;
 }
@@ -521,6 +773,56 @@ const char *Event_get_action_description(Event_T E) {
 }
 
 
+/**
+ * Send a summary of the notifications suppressed by the global notification
+ * rate limit once the rate allows to send a notification again
+ */
+void Event_notification_summary() {
+        if (Run.limits.notificationRate && Run.notificationLimiter.suppressed) {
+                _refillTokens(&(Run.notificationLimiter), Run.limits.notificationRate, Run.limits.notificationWindow, Time_now());
+                if (Run.notificationLimiter.tokens >= 1.) {
+                        unsigned int suppressed = Run.notificationLimiter.suppressed;
+                        Run.notificationLimiter.suppressed = 0;
+                        Run.notificationLimiter.tokens--;
+                        Event_post(Run.system, Event_Instance, State_Changed, Run.system->action_MONIT_START, "%u notification%s suppressed by the notification rate limit (%u per %s)", suppressed, suppressed > 1 ? "s were" : " was", Run.limits.notificationRate, Str_milliToTime(Run.limits.notificationWindow * 1000., (char[23]){}));
+                }
+        }
+}
+
+
+/**
+ * Keep the notification rate limiter state of all events, before the
+ * services are freed on reload. Events of the same service and type,
+ * which differ only by action, keep the most restrictive state.
+ */
+void Event_save_limiters() {
+        _freeLimiters();
+        for (Service_T s = servicelist; s; s = s->next) {
+                for (Event_T e = s->eventlist; e; e = e->next) {
+                        if (! e->limiter.refilled)
+                                continue;
+                        Limiter_T l = _limiters;
+                        while (l && ! (l->id == e->id && IS(l->service, s->name)))
+                                l = l->next;
+                        if (! l) {
+                                NEW(l);
+                                l->service = Str_dup(s->name);
+                                l->id = e->id;
+                                l->limiter = e->limiter;
+                                l->next = _limiters;
+                                _limiters = l;
+                        } else if (e->limiter.tokens < l->limiter.tokens) {
+                                unsigned int suppressed = l->limiter.suppressed;
+                                l->limiter = e->limiter;
+                                l->limiter.suppressed += suppressed;
+                        } else {
+                                l->limiter.suppressed += e->limiter.suppressed;
+                        }
+                }
+        }
+}
+
+
 /**
  * Reprocess the partially handled event queue
  */
@@ -577,7 +879,7 @@ void Event_queue_process() {
                                 LogError("Aborting queued event %s - invalid size %lu\n", file_name, (unsigned long)size);
                                 goto error3;
                         }
-                        if (*version != EVENT_VERSION) {
+                        if (*version != EVENT_VERSION && *version != 4) {
                                 LogError("Aborting queued event %s - incompatible data format version %d\n", file_name, *version);
                                 goto error3;
                         }
@@ -586,8 +888,14 @@ void Event_queue_process() {
                         Event_T e = file_readQueue(file, &size);
                         if (! e)
                                 goto error3;
-                        if (size != sizeof(*e))
+                        if (*version == 4) {
+                                // Event queued by Monit <= 5.24, convert it (the event is written back in the current format on update)
+                                if (size != sizeof(struct myevent4))
+                                        goto error4;
+                                e = _convertV4((Event4_T)e);
+                        } else if (size != sizeof(*e)) {
                                 goto error4;
+                        }
 
                         /* read source */
                         char *service = file_readQueue(file, &size);
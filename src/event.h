@@ -103,6 +103,16 @@ extern EventTable_T Event_Table[];
 void Event_post(Service_T service, long id, State_Type state, EventAction_T action, char *s, ...) __attribute__((format (printf, 5, 6)));
 
 
+/**
+ * Get the event statistics. The event message is formatted only if the
+ * event is going to be handled, the difference between the posted and
+ * formatted counters is the number of message allocations saved.
+ * @param posted Output: number of events posted
+ * @param formatted Output: number of event messages formatted
+ */
+void Event_get_statistics(unsigned long long *posted, unsigned long long *formatted);
+
+
 /**
  * Get a textual description of actual event type. For instance if the
  * event type is possitive Event_Timestamp, the textual description is
@@ -136,6 +146,22 @@ Action_Type Event_get_action(Event_T E);
 const char *Event_get_action_description(Event_T E);
 
 
+/**
+ * If notifications were suppressed by the global notification rate limit,
+ * post a summary event as soon as the rate limit allows it. Should be called
+ * at the end of each validation cycle.
+ */
+void Event_notification_summary();
+
+
+/**
+ * Keep the notification rate limiter state of all events before the
+ * services are freed on reload. The events of the reloaded services
+ * take the state over when they are posted first.
+ */
+void Event_save_limiters();
+
+
 /**
  * Reprocess the partialy handled event queue
  */
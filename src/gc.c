@@ -36,9 +36,12 @@
 #include "util/List.h"
 
 #include "monit.h"
+#include "alert.h"
 #include "protocol.h"
 #include "ProcessTree.h"
 #include "engine.h"
+#include "snapshot.h"
+#include "resolver.h"
 
 
 /* Private prototypes */
@@ -49,6 +52,7 @@ static void _gc_mail_server(MailServer_T *);
 static void _gcportlist(Port_T *);
 static void _gcfilesystem(FileSystem_T *);
 static void _gcicmp(Icmp_T *);
+static void _gccertificate(Certificate_T *);
 static void _gcpql(Resource_T *);
 static void _gcptl(Timestamp_T *);
 static void _gcparl(ActionRate_T *);
@@ -90,6 +94,8 @@ static void _gcssloptions(SslOptions_T o);
 
 
 void gc() {
+        Snapshot_reset();
+        Util_resetServiceIndex();
         Engine_destroyAllow();
         if (Run.flags & Run_ProcessEngineEnabled)
                 ProcessTree_delete();
@@ -101,8 +107,10 @@ void gc() {
                 _gcath(&Run.httpd.credentials);
         if (Run.maillist)
                 gc_mail_list(&Run.maillist);
-        if (Run.mailservers)
+        if (Run.mailservers) {
+                handle_alert_close();
                 _gc_mail_server(&Run.mailservers);
+        }
         if (Run.mmonits)
                 _gc_mmonit(&Run.mmonits);
         FREE(Run.eventlist_dir);
@@ -120,6 +128,10 @@ void gc() {
         FREE(Run.MailFormat.subject);
         FREE(Run.MailFormat.message);
         FREE(Run.mail_hostname);
+        Resolver_reset();
+#ifdef HAVE_OPENSSL
+        Ssl_reset();
+#endif
 }
 
 
@@ -156,6 +168,16 @@ void gc_event(Event_T *e) {
 }
 
 
+void gc_service_events(Service_T s) {
+        ASSERT(s);
+        if (s->eventlist)
+                gc_event(&s->eventlist);
+        FREE(s->eventindex.slots);
+        s->eventindex.size = 0;
+        s->eventindex.count = 0;
+}
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -198,6 +220,8 @@ static void _gc_service(Service_T *s) {
                 _gcfilesystem(&(*s)->filesystemlist);
         if ((*s)->icmplist)
                 _gcicmp(&(*s)->icmplist);
+        if ((*s)->certificatelist)
+                _gccertificate(&(*s)->certificatelist);
         if ((*s)->maillist)
                 gc_mail_list(&(*s)->maillist);
         if ((*s)->resourcelist)
@@ -268,8 +292,7 @@ static void _gc_service(Service_T *s) {
                 _gc_eventaction(&(*s)->action_MONIT_STOP);
         if ((*s)->action_ACTION)
                 _gc_eventaction(&(*s)->action_ACTION);
-        if ((*s)->eventlist)
-                gc_event(&(*s)->eventlist);
+        gc_service_events(*s);
         switch ((*s)->type) {
                 case Service_Directory:
                         FREE((*s)->inf.directory);
@@ -375,6 +398,8 @@ static void _gcportlist(Port_T *p) {
                 FREE((*p)->target.unix.pathname);
         else
                 _gcssloptions(&((*p)->target.net.ssl.options));
+        if ((*p)->connection)
+                Socket_free(&(*p)->connection);
         FREE((*p)->hostname);
         FREE((*p)->outgoing.ip);
         if ((*p)->protocol->check == check_http) {
@@ -437,6 +462,19 @@ static void _gcicmp(Icmp_T *i) {
 }
 
 
+static void _gccertificate(Certificate_T *c) {
+        ASSERT(c&&*c);
+        if ((*c)->next)
+                _gccertificate(&(*c)->next);
+        FREE((*c)->hostname);
+        FREE((*c)->outgoing.ip);
+        _gcssloptions(&((*c)->options));
+        if ((*c)->action)
+                _gc_eventaction(&(*c)->action);
+        FREE(*c);
+}
+
+
 static void _gcpql(Resource_T *q) {
         ASSERT(q);
         if ((*q)->next)
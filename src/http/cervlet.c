@@ -60,6 +60,10 @@
 #include <sys/stat.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
@@ -71,6 +75,7 @@
 // libmonit
 #include "system/Time.h"
 #include "util/List.h"
+#include "exceptions/NumberFormatException.h"
 
 #include "monit.h"
 #include "cervlet.h"
@@ -84,6 +89,9 @@
 #include "protocol.h"
 #include "Color.h"
 #include "Box.h"
+#include "snapshot.h"
+#include "eventstream.h"
+#include "SslServer.h"
 
 
 #define ACTION(c) ! strncasecmp(req->url, c, sizeof(c))
@@ -103,6 +111,14 @@
 #define VIEWLOG     "/_viewlog"
 #define DOACTION    "/_doaction"
 #define FAVICON     "/favicon.ico"
+#define METRICS     "/metrics"
+#define EVENTS      "/events"
+
+/* Number of rendered pages kept in the render cache */
+#define CACHE_SIZE  16
+
+/* Number of log lines shown on the log page unless the tail parameter is set */
+#define VIEWLOG_LINES 1000
 
 
 typedef enum {
@@ -111,26 +127,48 @@ typedef enum {
 } __attribute__((__packed__)) Output_Type;
 
 
+/*
+ * Cache of rendered status pages. A page depends only on the request
+ * parameters and on the service status snapshot, so it is rendered once
+ * per snapshot generation and served from the cache until the next poll
+ * cycle publishes a new snapshot.
+ */
+static struct {
+        Mutex_T mutex;
+        int next;                                 /**< Next entry to replace */
+        struct {
+                char *key;               /**< URL and the relevant parameters */
+                unsigned long long generation;        /**< Snapshot generation */
+                char *contentType;
+                char *body;
+                void *compressed;                    /**< gzip compressed body */
+                size_t compressedLength;
+        } entries[CACHE_SIZE];
+} cache = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* Private prototypes */
 static boolean_t is_readonly(HttpRequest);
 static void printFavicon(HttpResponse);
 static void doGet(HttpRequest, HttpResponse);
 static void doPost(HttpRequest, HttpResponse);
+static void _printCached(HttpRequest, HttpResponse, void (*)(HttpRequest, HttpResponse));
 static void do_head(HttpResponse res, const char *path, const char *name, int refresh);
 static void do_foot(HttpResponse res);
-static void do_home(HttpResponse);
-static void do_home_system(HttpResponse);
-static void do_home_filesystem(HttpResponse);
-static void do_home_directory(HttpResponse);
-static void do_home_file(HttpResponse);
-static void do_home_fifo(HttpResponse);
-static void do_home_net(HttpResponse);
-static void do_home_process(HttpResponse);
-static void do_home_program(HttpResponse);
-static void do_home_host(HttpResponse);
+static void do_home(HttpRequest, HttpResponse);
+static void do_home_system(HttpResponse, Snapshot_T);
+static void do_home_filesystem(HttpResponse, Snapshot_T);
+static void do_home_directory(HttpResponse, Snapshot_T);
+static void do_home_file(HttpResponse, Snapshot_T);
+static void do_home_fifo(HttpResponse, Snapshot_T);
+static void do_home_net(HttpResponse, Snapshot_T);
+static void do_home_process(HttpResponse, Snapshot_T);
+static void do_home_program(HttpResponse, Snapshot_T);
+static void do_home_host(HttpResponse, Snapshot_T);
 static void do_about(HttpResponse);
 static void do_ping(HttpResponse);
 static void do_getid(HttpResponse);
+static void do_events(HttpRequest, HttpResponse);
 static void do_runtime(HttpRequest, HttpResponse);
 static void do_viewlog(HttpRequest, HttpResponse);
 static void handle_service(HttpRequest, HttpResponse);
@@ -148,6 +186,7 @@ static void print_service_rules_existence(HttpResponse, Service_T);
 static void print_service_rules_port(HttpResponse, Service_T);
 static void print_service_rules_socket(HttpResponse, Service_T);
 static void print_service_rules_icmp(HttpResponse, Service_T);
+static void print_service_rules_certificate(HttpResponse, Service_T);
 static void print_service_rules_perm(HttpResponse, Service_T);
 static void print_service_rules_uid(HttpResponse, Service_T);
 static void print_service_rules_euid(HttpResponse, Service_T);
@@ -170,8 +209,9 @@ static void print_service_rules_pid(HttpResponse, Service_T);
 static void print_service_rules_ppid(HttpResponse, Service_T);
 static void print_service_rules_program(HttpResponse, Service_T);
 static void print_service_rules_resource(HttpResponse, Service_T);
-static void print_status(HttpRequest, HttpResponse, int);
+static void print_status(HttpRequest, HttpResponse);
 static void print_summary(HttpRequest, HttpResponse);
+static void print_metrics(HttpRequest, HttpResponse);
 static void _printReport(HttpRequest req, HttpResponse res);
 static void status_service_txt(Service_T, HttpResponse);
 static char *get_monitoring_status(Output_Type, Service_T s, char *, int);
@@ -300,20 +340,20 @@ static void _printStatus(Output_Type type, HttpResponse res, Service_T s) {
         if (Util_hasServiceStatus(s)) {
                 switch (s->type) {
                         case Service_System:
-                                _formatStatus("load average", Event_Resource, type, res, s, true, "[%.2f] [%.2f] [%.2f]", systeminfo.loadavg[0], systeminfo.loadavg[1], systeminfo.loadavg[2]);
+                                _formatStatus("load average", Event_Resource, type, res, s, true, "[%.2f] [%.2f] [%.2f]", s->inf.system->loadavg[0], s->inf.system->loadavg[1], s->inf.system->loadavg[2]);
                                 _formatStatus("cpu", Event_Resource, type, res, s, true, "%.1f%%us %.1f%%sy"
 #ifdef HAVE_CPU_WAIT
                                         " %.1f%%wa"
 #endif
-                                        , systeminfo.cpu.usage.user > 0. ? systeminfo.cpu.usage.user : 0., systeminfo.cpu.usage.system > 0. ? systeminfo.cpu.usage.system : 0.
+                                        , s->inf.system->cpu.usage.user > 0. ? s->inf.system->cpu.usage.user : 0., s->inf.system->cpu.usage.system > 0. ? s->inf.system->cpu.usage.system : 0.
 #ifdef HAVE_CPU_WAIT
-                                        , systeminfo.cpu.usage.wait > 0. ? systeminfo.cpu.usage.wait : 0.
+                                        , s->inf.system->cpu.usage.wait > 0. ? s->inf.system->cpu.usage.wait : 0.
 #endif
                                 );
-                                _formatStatus("memory usage", Event_Resource, type, res, s, true, "%s [%.1f%%]", Str_bytesToSize(systeminfo.memory.usage.bytes, (char[10]){}), systeminfo.memory.usage.percent);
-                                _formatStatus("swap usage", Event_Resource, type, res, s, true, "%s [%.1f%%]", Str_bytesToSize(systeminfo.swap.usage.bytes, (char[10]){}), systeminfo.swap.usage.percent);
-                                _formatStatus("uptime", Event_Uptime, type, res, s, systeminfo.booted > 0, "%s", _getUptime(Time_now() - systeminfo.booted, (char[256]){}));
-                                _formatStatus("boot time", Event_Null, type, res, s, true, "%s", Time_string(systeminfo.booted, (char[32]){}));
+                                _formatStatus("memory usage", Event_Resource, type, res, s, true, "%s [%.1f%%]", Str_bytesToSize(s->inf.system->memory.usage.bytes, (char[10]){}), s->inf.system->memory.usage.percent);
+                                _formatStatus("swap usage", Event_Resource, type, res, s, true, "%s [%.1f%%]", Str_bytesToSize(s->inf.system->swap.usage.bytes, (char[10]){}), s->inf.system->swap.usage.percent);
+                                _formatStatus("uptime", Event_Uptime, type, res, s, s->inf.system->booted > 0, "%s", _getUptime(Time_now() - s->inf.system->booted, (char[256]){}));
+                                _formatStatus("boot time", Event_Null, type, res, s, true, "%s", Time_string(s->inf.system->booted, (char[32]){}));
                                 break;
 
                         case Service_File:
@@ -445,6 +485,12 @@ static void _printStatus(Output_Type type, HttpResponse res, Service_T s) {
                                 _formatStatus("ping response time", Event_Icmp, type, res, s, true, "connection failed");
                         else
                                 _formatStatus("ping response time", Event_Null, type, res, s, i->is_available != Connection_Init && i->response >= 0., "%s", Str_milliToTime(i->response, (char[23]){}));
+                        if (i->window.count) {
+                                if (i->statistics.average >= 0.)
+                                        _formatStatus("ping statistics", Event_Resource, type, res, s, true, "min/avg/max/p95 %s/%s/%s/%s, jitter %s, loss %.1f%% of %d requests", Str_milliToTime(i->statistics.minimum, (char[23]){}), Str_milliToTime(i->statistics.average, (char[23]){}), Str_milliToTime(i->statistics.maximum, (char[23]){}), Str_milliToTime(i->statistics.percentile95, (char[23]){}), Str_milliToTime(i->statistics.jitter, (char[23]){}), i->statistics.loss, i->window.count);
+                                else
+                                        _formatStatus("ping statistics", Event_Resource, type, res, s, true, "loss %.1f%% of %d requests", i->statistics.loss, i->window.count);
+                        }
                 }
                 for (Port_T p = s->portlist; p; p = p->next) {
                         if (p->is_available == Connection_Failed) {
@@ -455,6 +501,28 @@ static void _printStatus(Output_Type type, HttpResponse res, Service_T s) {
                                         snprintf(buf, sizeof(buf), "using TLS (certificate valid for %d days) ", p->target.net.ssl.certificate.validDays);
                                 _formatStatus("port response time", p->target.net.ssl.certificate.validDays < p->target.net.ssl.certificate.minimumDays ? Event_Timestamp : Event_Null, type, res, s, p->is_available != Connection_Init, "%s to %s:%d%s type %s/%s %sprotocol %s", Str_milliToTime(p->response, (char[23]){}), p->hostname, p->target.net.port, Util_portRequestDescription(p), Util_portTypeDescription(p), Util_portIpDescription(p), buf, p->protocol->name);
                         }
+                        if (p->addresses > 1 && p->is_available != Connection_Init) {
+                                StringBuffer_T addresses = StringBuffer_create(64);
+                                for (int i = 0; i < p->addresses; i++) {
+                                        if (p->address[i].is_available == Connection_Ok)
+                                                StringBuffer_append(addresses, "%s%s connected in %s", i ? ", " : "", p->address[i].ip, Str_milliToTime(p->address[i].connect, (char[23]){}));
+                                        else
+                                                StringBuffer_append(addresses, "%s%s %s", i ? ", " : "", p->address[i].ip, p->address[i].is_available == Connection_Failed ? "failed" : "not tested");
+                                }
+                                _formatStatus("port addresses", Event_Null, type, res, s, true, "%s", StringBuffer_toString(addresses));
+                                StringBuffer_free(&addresses);
+                        }
+                }
+                for (Certificate_T c = s->certificatelist; c; c = c->next) {
+                        if (c->is_available == Connection_Failed) {
+                                _formatStatus("certificate", Event_Connection, type, res, s, true, "FAILED to [%s]:%d", c->hostname, c->port);
+                        } else if (c->is_available != Connection_Init) {
+                                StringBuffer_T chain = StringBuffer_create(64);
+                                for (int i = 0; i < c->chainLength; i++)
+                                        StringBuffer_append(chain, "%s%s valid for %d days", i ? ", " : "", c->chain[i].subject, (int)((c->chain[i].validTo - Time_now()) / 86400));
+                                _formatStatus("certificate", Event_Null, type, res, s, true, "%s to [%s]:%d, %s chain: %s", Str_milliToTime(c->response, (char[23]){}), c->hostname, c->port, c->verified ? "verified" : "unchanged", StringBuffer_toString(chain));
+                                StringBuffer_free(&chain);
+                        }
                 }
                 for (Port_T p = s->socketlist; p; p = p->next) {
                         if (p->is_available == Connection_Failed) {
@@ -478,14 +546,12 @@ static void doPost(HttpRequest req, HttpResponse res) {
                 handle_runtime_action(req, res);
         else if (ACTION(VIEWLOG))
                 do_viewlog(req, res);
-        else if (ACTION(STATUS))
-                print_status(req, res, 1);
-        else if (ACTION(STATUS2))
-                print_status(req, res, 2);
+        else if (ACTION(STATUS) || ACTION(STATUS2))
+                _printCached(req, res, print_status);
         else if (ACTION(SUMMARY))
-                print_summary(req, res);
+                _printCached(req, res, print_summary);
         else if (ACTION(REPORT))
-                _printReport(req, res);
+                _printCached(req, res, _printReport);
         else if (ACTION(DOACTION))
                 handle_doaction(req, res);
         else
@@ -500,11 +566,11 @@ static void doPost(HttpRequest req, HttpResponse res) {
 static void doGet(HttpRequest req, HttpResponse res) {
         set_content_type(res, "text/html");
         if (ACTION(HOME)) {
-                LOCK(Run.mutex)
-                do_home(res);
-                END_LOCK;
+                _printCached(req, res, do_home);
         } else if (ACTION(RUNTIME)) {
                 handle_runtime(req, res);
+        } else if (ACTION(VIEWLOG)) {
+                do_viewlog(req, res);
         } else if (ACTION(TEST)) {
                 is_monit_running(res);
         } else if (ACTION(ABOUT)) {
@@ -515,14 +581,17 @@ static void doGet(HttpRequest req, HttpResponse res) {
                 do_ping(res);
         } else if (ACTION(GETID)) {
                 do_getid(res);
-        } else if (ACTION(STATUS)) {
-                print_status(req, res, 1);
-        } else if (ACTION(STATUS2)) {
-                print_status(req, res, 2);
+        } else if (ACTION(STATUS) || ACTION(STATUS2)) {
+                _printCached(req, res, print_status);
         } else if (ACTION(SUMMARY)) {
-                print_summary(req, res);
+                _printCached(req, res, print_summary);
         } else if (ACTION(REPORT)) {
-                _printReport(req, res);
+                _printCached(req, res, _printReport);
+        } else if (ACTION(METRICS)) {
+                // Not cached, the Monit uptime changes between scrapes within a poll cycle
+                print_metrics(req, res);
+        } else if (ACTION(EVENTS)) {
+                do_events(req, res);
         } else {
                 handle_service(req, res);
         }
@@ -532,20 +601,217 @@ static void doGet(HttpRequest req, HttpResponse res) {
 /* ----------------------------------------------------------------- Helpers */
 
 
+/**
+ * Get the latest service status snapshot for rendering. Sends an error
+ * if no snapshot was published yet
+ */
+static Snapshot_T _acquireSnapshot(HttpRequest req, HttpResponse res) {
+        Snapshot_T snapshot = Snapshot_acquire();
+        if (! snapshot)
+                send_error(req, res, SC_SERVICE_UNAVAILABLE, "The service status is not available yet");
+        return snapshot;
+}
+
+
+/**
+ * Flush callback for the status renderers
+ */
+static void _flush(void *res) {
+        flush_response(res);
+}
+
+
+static void *_copy(const void *data, size_t length) {
+        void *copy = ALLOC(length);
+        memcpy(copy, data, length);
+        return copy;
+}
+
+
+/**
+ * Build the render cache key from the URL and the request parameters
+ * and headers which the status pages depend on
+ */
+static StringBuffer_T _cacheKey(HttpRequest req) {
+        StringBuffer_T key = StringBuffer_new(req->url);
+        const char *format = get_parameter(req, "format");
+        StringBuffer_append(key, "?format=%s", format ? format : "");
+        const char *group = get_parameter(req, "group");
+        StringBuffer_append(key, "&group=%s", group ? group : "");
+        const char *service = get_parameter(req, "service");
+        StringBuffer_append(key, "&service=%s", service ? service : "");
+        const char *type = get_parameter(req, "type");
+        StringBuffer_append(key, "&type=%s", type ? type : "");
+        // The XML status contains the address the client connected to
+        if (format && Str_startsWith(format, "xml"))
+                StringBuffer_append(key, "&address=%s", Socket_getLocalHost(req->S, (char[STRLEN]){}, STRLEN));
+        return key;
+}
+
+
+static boolean_t _cacheGet(HttpResponse res, const char *key, unsigned long long generation) {
+        boolean_t found = false;
+        LOCK(cache.mutex)
+        {
+                for (int i = 0; i < CACHE_SIZE; i++) {
+                        if (cache.entries[i].generation == generation && IS(cache.entries[i].key, key)) {
+                                set_content_type(res, cache.entries[i].contentType);
+                                if (res->compress && cache.entries[i].compressed) {
+                                        res->compressed.data = _copy(cache.entries[i].compressed, cache.entries[i].compressedLength);
+                                        res->compressed.length = cache.entries[i].compressedLength;
+                                } else {
+                                        StringBuffer_append(res->outputbuffer, "%s", cache.entries[i].body);
+                                }
+                                found = true;
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+        return found;
+}
+
+
+static void _cachePut(HttpResponse res, const char *key, unsigned long long generation) {
+        const char *contentType = "text/html";
+        for (HttpHeader h = res->headers; h; h = h->next)
+                if (IS(h->name, "Content-Type"))
+                        contentType = h->value;
+        // A streamed page was partly sent already, the copy of the sent part precedes the output buffer
+        StringBuffer_T body = res->outputbuffer;
+        if (res->stream.started) {
+                body = res->stream.copy;
+                StringBuffer_append(body, "%s", StringBuffer_toString(res->outputbuffer));
+        }
+        char *newKey = Str_dup(key);
+        char *newContentType = Str_dup(contentType);
+        char *newBody = Str_dup(StringBuffer_toString(body));
+        void *newCompressed = NULL;
+        size_t newCompressedLength = 0;
+#ifdef HAVE_LIBZ
+        if (StringBuffer_length(body) > 0) {
+                const void *compressed = StringBuffer_toCompressed(body, 6, &newCompressedLength);
+                newCompressed = _copy(compressed, newCompressedLength);
+                if (res->compress && ! res->stream.started) {
+                        res->compressed.data = _copy(compressed, newCompressedLength);
+                        res->compressed.length = newCompressedLength;
+                }
+        }
+#endif
+        LOCK(cache.mutex)
+        {
+                int i = 0;
+                while (i < CACHE_SIZE && ! IS(cache.entries[i].key, key))
+                        i++;
+                if (i == CACHE_SIZE) {
+                        i = cache.next;
+                        cache.next = (cache.next + 1) % CACHE_SIZE;
+                }
+                // Swap the new page in and free the replaced one after unlock
+                char *oldKey = cache.entries[i].key;
+                cache.entries[i].key = newKey;
+                newKey = oldKey;
+                char *oldContentType = cache.entries[i].contentType;
+                cache.entries[i].contentType = newContentType;
+                newContentType = oldContentType;
+                char *oldBody = cache.entries[i].body;
+                cache.entries[i].body = newBody;
+                newBody = oldBody;
+                void *oldCompressed = cache.entries[i].compressed;
+                cache.entries[i].compressed = newCompressed;
+                cache.entries[i].compressedLength = newCompressedLength;
+                newCompressed = oldCompressed;
+                cache.entries[i].generation = generation;
+        }
+        END_LOCK;
+        FREE(newKey);
+        FREE(newContentType);
+        FREE(newBody);
+        FREE(newCompressed);
+}
+
+
+/**
+ * Serve a status page from the render cache or render and cache it. The
+ * ETag is derived from the snapshot generation, so a client which polls
+ * again within the same poll cycle gets 304 Not Modified
+ */
+static void _printCached(HttpRequest req, HttpResponse res, void (*print)(HttpRequest, HttpResponse)) {
+        Snapshot_T snapshot = Snapshot_acquire();
+        if (! snapshot) {
+                print(req, res);
+                return;
+        }
+        unsigned long long generation = snapshot->generation;
+        Snapshot_release(&snapshot);
+        StringBuffer_T key = _cacheKey(req);
+        char etag[STRLEN];
+        snprintf(etag, sizeof(etag), "W/\"%llx-%x\"", generation, Str_hash(StringBuffer_toString(key)));
+        const char *ifNoneMatch = get_header(req, "If-None-Match");
+        if (ifNoneMatch && Str_sub(ifNoneMatch, etag)) {
+                set_status(res, SC_NOT_MODIFIED);
+                set_header(res, "ETag", "%s", etag);
+        } else if (_cacheGet(res, StringBuffer_toString(key), generation)) {
+                set_header(res, "ETag", "%s", etag);
+        } else {
+                // The page may be streamed, so the headers are set before it is rendered
+                set_header(res, "ETag", "%s", etag);
+                res->stream.copy = StringBuffer_create(RES_CHUNKSIZE);
+                print(req, res);
+                // A streamed page is cached only if it was copied whole
+                if (res->status == SC_OK && (res->stream.started ? res->stream.copy != NULL : ! res->is_committed) && ! res->stream.failed)
+                        _cachePut(res, StringBuffer_toString(key), generation);
+                if (res->stream.copy)
+                        StringBuffer_free(&(res->stream.copy));
+        }
+        StringBuffer_free(&key);
+}
+
+
+/**
+ * Render the service page from the latest snapshot. The pending action is
+ * taken from the live service, so an action requested just now is shown
+ * before the validation cycle publishes a new snapshot
+ */
+static void _printService(HttpRequest req, HttpResponse res, const char *name) {
+        Snapshot_T snapshot = _acquireSnapshot(req, res);
+        if (snapshot) {
+                Service_T s = Snapshot_getService(snapshot, name);
+                if (s) {
+                        struct Service_T view = *s;
+                        // Reload stops the HTTP server and resets the snapshot before the service list is freed, so the service is live; don't trust it blindly though
+                        Service_T live = Util_getService(name);
+                        view.doaction = live ? live->doaction : Action_Ignored;
+                        do_service(req, res, &view);
+                } else {
+                        send_error(req, res, SC_NOT_FOUND, "There is no service named \"%s\"", name);
+                }
+                Snapshot_release(&snapshot);
+        }
+}
+
+
 static void is_monit_running(HttpResponse res) {
         set_status(res, exist_daemon() ? SC_OK : SC_GONE);
 }
 
 
+static size_t l;
+static unsigned char *favicon = NULL;
+static pthread_once_t faviconOnce = PTHREAD_ONCE_INIT;
+
+
+static void _decodeFavicon(void) {
+        favicon = CALLOC(sizeof(unsigned char), strlen(FAVICON_ICO));
+        l = decode_base64(favicon, FAVICON_ICO);
+}
+
+
 static void printFavicon(HttpResponse res) {
-        static size_t l;
         Socket_T S = res->S;
-        static unsigned char *favicon = NULL;
 
-        if (! favicon) {
-                favicon = CALLOC(sizeof(unsigned char), strlen(FAVICON_ICO));
-                l = decode_base64(favicon, FAVICON_ICO);
-        }
+        // The requests are processed by multiple threads, decode the icon only once
+        pthread_once(&faviconOnce, _decodeFavicon);
         if (l) {
                 res->is_committed = true;
                 Socket_print(S, "HTTP/1.0 200 OK\r\n");
@@ -636,7 +902,10 @@ static void do_foot(HttpResponse res) {
 }
 
 
-static void do_home(HttpResponse res) {
+static void do_home(HttpRequest req, HttpResponse res) {
+        Snapshot_T snapshot = _acquireSnapshot(req, res);
+        if (! snapshot)
+                return;
         do_head(res, "", "", Run.polltime);
         StringBuffer_append(res->outputbuffer,
                             "<table id='header' width='100%%'>"
@@ -648,17 +917,18 @@ static void do_home(HttpResponse res) {
                             " </tr>"
                             "</table>", Run.system->name);
 
-        do_home_system(res);
-        do_home_process(res);
-        do_home_program(res);
-        do_home_filesystem(res);
-        do_home_file(res);
-        do_home_fifo(res);
-        do_home_directory(res);
-        do_home_net(res);
-        do_home_host(res);
+        do_home_system(res, snapshot);
+        do_home_process(res, snapshot);
+        do_home_program(res, snapshot);
+        do_home_filesystem(res, snapshot);
+        do_home_file(res, snapshot);
+        do_home_fifo(res, snapshot);
+        do_home_directory(res, snapshot);
+        do_home_net(res, snapshot);
+        do_home_host(res, snapshot);
 
         do_foot(res);
+        Snapshot_release(&snapshot);
 }
 
 
@@ -695,6 +965,13 @@ static void do_getid(HttpResponse res) {
         StringBuffer_append(res->outputbuffer, "%s", Run.id);
 }
 
+
+static void do_events(HttpRequest req, HttpResponse res) {
+        if (! EventStream_subscribe(res))
+                send_error(req, res, SC_SERVICE_UNAVAILABLE, "Too many event stream clients, the limit is %d", EVENTSTREAM_MAX);
+}
+
+
 static void do_runtime(HttpRequest req, HttpResponse res) {
         int pid = exist_daemon();
         char buf[STRLEN];
@@ -739,6 +1016,14 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
                                     "<td>base directory %s with %d slots</td></tr>",
                                     Run.eventlist_dir, Run.eventlist_slots);
         }
+        {
+                unsigned long long posted, formatted;
+                Event_get_statistics(&posted, &formatted);
+                StringBuffer_append(res->outputbuffer,
+                                    "<tr><td>Events posted</td>"
+                                    "<td>%llu (messages formatted: %llu, saved: %llu)</td></tr>",
+                                    posted, formatted, posted - formatted);
+        }
 #ifdef HAVE_OPENSSL
         {
                 const char *options = Ssl_printOptions(&(Run.ssl), (char[STRLEN]){}, STRLEN);
@@ -746,6 +1031,15 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
                         StringBuffer_append(res->outputbuffer,
                                     "<tr><td>SSL options</td><td>%s</td></tr>", options);
         }
+        if (Run.httpd.socket.net.ssl.flags & SSL_Enabled) {
+                unsigned long long handshakes, resumed;
+                double cpu;
+                SslServer_getStatistics(&handshakes, &resumed, &cpu);
+                StringBuffer_append(res->outputbuffer,
+                                    "<tr><td>HTTPS handshakes</td>"
+                                    "<td>%llu (sessions resumed: %llu, CPU time: %.3f ms, %.3f ms per handshake)</td></tr>",
+                                    handshakes, resumed, cpu, handshakes ? cpu / handshakes : 0.);
+        }
 #endif
         if (Run.mmonits) {
                 StringBuffer_append(res->outputbuffer, "<tr><td>M/Monit server(s)</td><td>");
@@ -817,6 +1111,10 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
         StringBuffer_append(res->outputbuffer, "<tr><td>Limit for service stop timeout</td><td>%s</td></tr>", Str_milliToTime(Run.limits.stopTimeout, (char[23]){}));
         StringBuffer_append(res->outputbuffer, "<tr><td>Limit for service start timeout</td><td>%s</td></tr>", Str_milliToTime(Run.limits.startTimeout, (char[23]){}));
         StringBuffer_append(res->outputbuffer, "<tr><td>Limit for service restart timeout</td><td>%s</td></tr>", Str_milliToTime(Run.limits.restartTimeout, (char[23]){}));
+        if (Run.limits.notificationRate)
+                StringBuffer_append(res->outputbuffer, "<tr><td>Limit for notifications</td><td>%u per %s (%u suppressed)</td></tr>", Run.limits.notificationRate, Str_milliToTime(Run.limits.notificationWindow * 1000., (char[23]){}), Run.notificationLimiter.suppressed);
+        if (Run.limits.eventNotificationRate)
+                StringBuffer_append(res->outputbuffer, "<tr><td>Limit for notifications per event</td><td>%u per %s</td></tr>", Run.limits.eventNotificationRate, Str_milliToTime(Run.limits.eventNotificationWindow * 1000., (char[23]){}));
         StringBuffer_append(res->outputbuffer,
                             "<tr><td>On reboot</td><td>%s</td></tr>", onrebootnames[Run.onreboot]);
         StringBuffer_append(res->outputbuffer,
@@ -886,53 +1184,185 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
 }
 
 
+/**
+ * Return the offset of the first of the last lines in the log file. The
+ * file is read backwards from the end, so only the tail is read. Returns
+ * -1 if the file cannot be read.
+ */
+static off_t _tailOffset(int fd, off_t size, long long lines) {
+        char buf[8192];
+        off_t offset = size;
+        if (lines <= 0)
+                return size;
+        while (offset > 0) {
+                size_t n = offset < (off_t)sizeof(buf) ? (size_t)offset : sizeof(buf);
+                offset -= n;
+                if (pread(fd, buf, n, offset) != (ssize_t)n)
+                        return -1;
+                for (ssize_t i = n - 1; i >= 0; i--) {
+                        // The newline which terminates the last line doesn't start a new line
+                        if (buf[i] == '\n' && offset + i != size - 1 && --lines == 0)
+                                return offset + i + 1;
+                }
+        }
+        return 0;
+}
+
+
+/**
+ * Parse a single byte range from the Range header. Returns 1 if the range
+ * can be satisfied, 0 if the header is missing or not supported, in which
+ * case the whole file is sent, and -1 if the range cannot be satisfied.
+ */
+static int _getRange(HttpRequest req, off_t size, off_t *first, off_t *last) {
+        char *end;
+        const char *range = get_header(req, "Range");
+        if (! range || ! Str_startsWith(range, "bytes=") || strchr(range, ','))
+                return 0;
+        range += 6;
+        if (*range == '-') {
+                // Suffix range, the last N bytes
+                long long suffix = strtoll(range + 1, &end, 10);
+                if (end == range + 1 || *end)
+                        return 0;
+                if (suffix <= 0 || size == 0)
+                        return -1;
+                *first = suffix < size ? size - suffix : 0;
+                *last = size - 1;
+                return 1;
+        }
+        long long from = strtoll(range, &end, 10);
+        if (end == range || *end != '-' || from < 0)
+                return 0;
+        long long to = size - 1;
+        range = end + 1;
+        if (*range) {
+                to = strtoll(range, &end, 10);
+                if (*end || to < from)
+                        return 0;
+                if (to >= size)
+                        to = size - 1;
+        }
+        if (from >= size)
+                return -1;
+        *first = from;
+        *last = to;
+        return 1;
+}
+
+
+/**
+ * Send the raw log file. The file is streamed to the client, so the log
+ * doesn't have to fit in memory. The tail parameter limits the response
+ * to the last N lines, otherwise a single byte Range is supported.
+ */
+static void _printLog(HttpRequest req, HttpResponse res, int fd, off_t size, long long lines) {
+        off_t first = 0, last = size - 1;
+        if (lines > 0) {
+                if ((first = _tailOffset(fd, size, lines)) < 0) {
+                        close(fd);
+                        send_error(req, res, SC_INTERNAL_SERVER_ERROR, "Error reading logfile: %s", STRERROR);
+                        return;
+                }
+        } else {
+                switch (_getRange(req, size, &first, &last)) {
+                        case 1:
+                                set_status(res, SC_PARTIAL_CONTENT);
+                                set_header(res, "Content-Range", "bytes %lld-%lld/%lld", (long long)first, (long long)last, (long long)size);
+                                break;
+                        case -1:
+                                close(fd);
+                                send_error(req, res, SC_RANGE_NOT_SATISFIABLE, "The requested range is not satisfiable");
+                                set_header(res, "Content-Range", "bytes */%lld", (long long)size);
+                                return;
+                        default:
+                                break;
+                }
+        }
+        set_content_type(res, "text/plain");
+        set_header(res, "Accept-Ranges", "bytes");
+        set_file(res, fd, first, last - first + 1);
+}
+
+
 static void do_viewlog(HttpRequest req, HttpResponse res) {
         if (is_readonly(req)) {
                 send_error(req, res, SC_FORBIDDEN, "You do not have sufficient privileges to access this page");
                 return;
         }
-        do_head(res, "_viewlog", "View log", 100);
+        const char *format = get_parameter(req, "format");
+        boolean_t text = format && IS(format, "text");
+        const char *tail = get_parameter(req, "tail");
+        long long lines = text ? 0LL : VIEWLOG_LINES;
+        if (tail) {
+                TRY
+                {
+                        lines = Str_parseLLong(tail);
+                }
+                ELSE
+                {
+                        lines = -1LL;
+                }
+                END_TRY;
+                if (lines < 0) {
+                        send_error(req, res, SC_BAD_REQUEST, "Invalid tail parameter");
+                        return;
+                }
+        }
         if ((Run.flags & Run_Log) && ! (Run.flags & Run_UseSyslog)) {
                 struct stat sb;
-                if (! stat(Run.files.log, &sb)) {
-                        FILE *f = fopen(Run.files.log, "r");
-                        if (f) {
-#define BUFSIZE 512
-                                size_t n;
-                                char buf[BUFSIZE+1];
-                                StringBuffer_append(res->outputbuffer, "<br><p><form><textarea cols=120 rows=30 readonly>");
-                                while ((n = fread(buf, sizeof(char), BUFSIZE, f)) > 0) {
-                                        buf[n] = 0;
-                                        StringBuffer_append(res->outputbuffer, "%s", buf);
-                                }
-                                fclose(f);
-                                StringBuffer_append(res->outputbuffer, "</textarea></form>");
-                        } else {
-                                StringBuffer_append(res->outputbuffer, "Error opening logfile: %s", STRERROR);
-                        }
+                int fd = open(Run.files.log, O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                        send_error(req, res, SC_INTERNAL_SERVER_ERROR, "Error opening logfile: %s", STRERROR);
+                } else if (fstat(fd, &sb) || ! S_ISREG(sb.st_mode)) {
+                        close(fd);
+                        send_error(req, res, SC_INTERNAL_SERVER_ERROR, "Error stating logfile: %s", STRERROR);
+                } else if (text) {
+                        _printLog(req, res, fd, sb.st_size, lines);
                 } else {
-                        StringBuffer_append(res->outputbuffer, "Error stating logfile: %s", STRERROR);
+                        // Only the tail of the log is read, the full log is available in the text format
+                        off_t offset = _tailOffset(fd, sb.st_size, lines);
+                        if (offset < 0) {
+                                close(fd);
+                                send_error(req, res, SC_INTERNAL_SERVER_ERROR, "Error reading logfile: %s", STRERROR);
+                                return;
+                        }
+                        do_head(res, "_viewlog", "View log", 100);
+                        StringBuffer_append(res->outputbuffer, "<br><p><a href='_viewlog?format=text'>Full log</a> (%s)</p>", Str_bytesToSize(sb.st_size, (char[10]){}));
+                        StringBuffer_append(res->outputbuffer, "<p><form><textarea cols=120 rows=30 readonly>");
+                        char buf[8192];
+                        ssize_t n;
+                        while ((n = pread(fd, buf, sizeof(buf) - 1, offset)) > 0) {
+                                buf[n] = 0;
+                                escapeHTML(res->outputbuffer, buf);
+                                offset += n;
+                        }
+                        close(fd);
+                        StringBuffer_append(res->outputbuffer, "</textarea></form>");
+                        do_foot(res);
                 }
+        } else if (text) {
+                send_error(req, res, SC_NOT_FOUND, "Cannot view logfile: %s", (Run.flags & Run_Log) ? "Monit uses syslog" : "Monit was started without logging");
         } else {
+                do_head(res, "_viewlog", "View log", 100);
                 StringBuffer_append(res->outputbuffer,
                                     "<b>Cannot view logfile:</b><br>");
                 if (! (Run.flags & Run_Log))
                         StringBuffer_append(res->outputbuffer, "Monit was started without logging");
                 else
                         StringBuffer_append(res->outputbuffer, "Monit uses syslog");
+                do_foot(res);
         }
-        do_foot(res);
 }
 
 
 static void handle_service(HttpRequest req, HttpResponse res) {
         char *name = req->url;
-        Service_T s = Util_getService(++name);
-        if (! s) {
+        if (! Util_getService(++name)) {
                 send_error(req, res, SC_NOT_FOUND, "There is no service named \"%s\"", name ? name : "");
                 return;
         }
-        do_service(req, res, s);
+        _printService(req, res, name);
 }
 
 
@@ -964,7 +1394,7 @@ static void handle_service_action(HttpRequest req, HttpResponse res) {
                 Run.flags |= Run_ActionPending; /* set the global flag */
                 do_wakeupcall();
         }
-        do_service(req, res, s);
+        _printService(req, res, s->name);
 }
 
 
@@ -1068,7 +1498,7 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
         StringBuffer_append(res->outputbuffer, "<tr><td>Status</td><td>%s</td></tr>", get_service_status(HTML, s, buf, sizeof(buf)));
         for (ServiceGroup_T sg = servicegrouplist; sg; sg = sg->next)
                 for (list_t m = sg->members->head; m; m = m->next)
-                        if (m->e == s)
+                        if (IS(((Service_T)m->e)->name, s->name))
                                 StringBuffer_append(res->outputbuffer, "<tr><td>Group</td><td class='blue-text'>%s</td></tr>", sg->name);
         StringBuffer_append(res->outputbuffer,
                             "<tr><td>Monitoring status</td><td>%s</td></tr>", get_monitoring_status(HTML, s, buf, sizeof(buf)));
@@ -1126,6 +1556,7 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
         print_service_rules_nonexistence(res, s);
         print_service_rules_existence(res, s);
         print_service_rules_icmp(res, s);
+        print_service_rules_certificate(res, s);
         print_service_rules_port(res, s);
         print_service_rules_socket(res, s);
         print_service_rules_perm(res, s);
@@ -1157,8 +1588,8 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
 }
 
 
-static void do_home_system(HttpResponse res) {
-        Service_T s = Run.system;
+static void do_home_system(HttpResponse res, Snapshot_T snapshot) {
+        Service_T s = Snapshot_getService(snapshot, Run.system->name);
         char buf[STRLEN];
 
         StringBuffer_append(res->outputbuffer,
@@ -1190,19 +1621,19 @@ static void do_home_system(HttpResponse res) {
                                     ",&nbsp;%.1f%%wa"
 #endif
                                     "</td>",
-                                    systeminfo.loadavg[0], systeminfo.loadavg[1], systeminfo.loadavg[2],
-                                    systeminfo.cpu.usage.user > 0. ? systeminfo.cpu.usage.user : 0.,
-                                    systeminfo.cpu.usage.system > 0. ? systeminfo.cpu.usage.system : 0.
+                                    s->inf.system->loadavg[0], s->inf.system->loadavg[1], s->inf.system->loadavg[2],
+                                    s->inf.system->cpu.usage.user > 0. ? s->inf.system->cpu.usage.user : 0.,
+                                    s->inf.system->cpu.usage.system > 0. ? s->inf.system->cpu.usage.system : 0.
 #ifdef HAVE_CPU_WAIT
-                                    , systeminfo.cpu.usage.wait > 0. ? systeminfo.cpu.usage.wait : 0.
+                                    , s->inf.system->cpu.usage.wait > 0. ? s->inf.system->cpu.usage.wait : 0.
 #endif
                                     );
                 StringBuffer_append(res->outputbuffer,
                                     "<td class='right column'>%.1f%% [%s]</td>",
-                                    systeminfo.memory.usage.percent, Str_bytesToSize(systeminfo.memory.usage.bytes, buf));
+                                    s->inf.system->memory.usage.percent, Str_bytesToSize(s->inf.system->memory.usage.bytes, buf));
                 StringBuffer_append(res->outputbuffer,
                                     "<td class='right column'>%.1f%% [%s]</td>",
-                                    systeminfo.swap.usage.percent, Str_bytesToSize(systeminfo.swap.usage.bytes, buf));
+                                    s->inf.system->swap.usage.percent, Str_bytesToSize(s->inf.system->swap.usage.bytes, buf));
         }
         StringBuffer_append(res->outputbuffer,
                             "</tr>"
@@ -1210,12 +1641,12 @@ static void do_home_system(HttpResponse res) {
 }
 
 
-static void do_home_process(HttpResponse res) {
+static void do_home_process(HttpResponse res, Snapshot_T snapshot) {
         char      buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Process)
                         continue;
                 if (header) {
@@ -1274,18 +1705,19 @@ static void do_home_process(HttpResponse res) {
                 }
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
 }
 
 
-static void do_home_program(HttpResponse res) {
+static void do_home_program(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Program)
                         continue;
                 if (header) {
@@ -1343,6 +1775,7 @@ static void do_home_program(HttpResponse res) {
                 }
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
@@ -1350,12 +1783,12 @@ static void do_home_program(HttpResponse res) {
 }
 
 
-static void do_home_net(HttpResponse res) {
+static void do_home_net(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Net)
                         continue;
                 if (header) {
@@ -1385,18 +1818,19 @@ static void do_home_net(HttpResponse res) {
                 }
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
 }
 
 
-static void do_home_filesystem(HttpResponse res) {
+static void do_home_filesystem(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Filesystem)
                         continue;
                 if (header) {
@@ -1451,18 +1885,19 @@ static void do_home_filesystem(HttpResponse res) {
                 }
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
 }
 
 
-static void do_home_file(HttpResponse res) {
+static void do_home_file(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_File)
                         continue;
                 if (header) {
@@ -1504,18 +1939,19 @@ static void do_home_file(HttpResponse res) {
                         StringBuffer_append(res->outputbuffer, "<td class='right'>%d</td>", s->inf.file->gid);
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
 }
 
 
-static void do_home_fifo(HttpResponse res) {
+static void do_home_fifo(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Fifo)
                         continue;
                 if (header) {
@@ -1551,18 +1987,19 @@ static void do_home_fifo(HttpResponse res) {
                         StringBuffer_append(res->outputbuffer, "<td class='right'>%d</td>", s->inf.fifo->gid);
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
 }
 
 
-static void do_home_directory(HttpResponse res) {
+static void do_home_directory(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Directory)
                         continue;
                 if (header) {
@@ -1598,18 +2035,19 @@ static void do_home_directory(HttpResponse res) {
                         StringBuffer_append(res->outputbuffer, "<td class='right'>%d</td>", s->inf.directory->gid);
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
 }
 
 
-static void do_home_host(HttpResponse res) {
+static void do_home_host(HttpResponse res, Snapshot_T snapshot) {
         char buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type != Service_Host)
                         continue;
                 if (header) {
@@ -1674,6 +2112,7 @@ static void do_home_host(HttpResponse res) {
                 }
                 StringBuffer_append(res->outputbuffer, "</tr>");
                 on = ! on;
+                flush_response(res);
         }
         if (! header)
                 StringBuffer_append(res->outputbuffer, "</table>");
@@ -1907,6 +2346,18 @@ static void print_service_rules_icmp(HttpResponse res, Service_T s) {
 }
 
 
+static void print_service_rules_certificate(HttpResponse res, Service_T s) {
+        for (Certificate_T c = s->certificatelist; c; c = c->next) {
+                StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Certificate</td><td>");
+                if (c->minimumDays > 0)
+                        Util_printRule(res->outputbuffer, c->action, "If failed [%s]:%d with timeout %s or valid < %d days, every %d cycle(s)", c->hostname, c->port, Str_milliToTime(c->timeout, (char[23]){}), c->minimumDays, c->every);
+                else
+                        Util_printRule(res->outputbuffer, c->action, "If failed [%s]:%d with timeout %s, every %d cycle(s)", c->hostname, c->port, Str_milliToTime(c->timeout, (char[23]){}), c->every);
+                StringBuffer_append(res->outputbuffer, "</td></tr>");
+        }
+}
+
+
 static void print_service_rules_perm(HttpResponse res, Service_T s) {
         if (s->perm) {
                 StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Permissions</td><td>");
@@ -2279,6 +2730,30 @@ static void print_service_rules_resource(HttpResponse res, Service_T s) {
                                 StringBuffer_append(res->outputbuffer, "Disk write limit");
                                 break;
 
+                        case Resource_IcmpLoss:
+                                StringBuffer_append(res->outputbuffer, "Ping loss limit");
+                                break;
+
+                        case Resource_IcmpJitter:
+                                StringBuffer_append(res->outputbuffer, "Ping jitter limit");
+                                break;
+
+                        case Resource_IcmpResponseMinimum:
+                                StringBuffer_append(res->outputbuffer, "Ping minimum response time limit");
+                                break;
+
+                        case Resource_IcmpResponseAverage:
+                                StringBuffer_append(res->outputbuffer, "Ping average response time limit");
+                                break;
+
+                        case Resource_IcmpResponseMaximum:
+                                StringBuffer_append(res->outputbuffer, "Ping maximum response time limit");
+                                break;
+
+                        case Resource_IcmpResponsePercentile95:
+                                StringBuffer_append(res->outputbuffer, "Ping 95th percentile response time limit");
+                                break;
+
                         default:
                                 break;
                 }
@@ -2322,6 +2797,18 @@ static void print_service_rules_resource(HttpResponse res, Service_T s) {
                                 Util_printRule(res->outputbuffer, q->action, "if %s %.0f operations/s", operatornames[q->operator], q->limit);
                                 break;
 
+                        case Resource_IcmpLoss:
+                                Util_printRule(res->outputbuffer, q->action, "If %s %.1f%%", operatornames[q->operator], q->limit);
+                                break;
+
+                        case Resource_IcmpJitter:
+                        case Resource_IcmpResponseMinimum:
+                        case Resource_IcmpResponseAverage:
+                        case Resource_IcmpResponseMaximum:
+                        case Resource_IcmpResponsePercentile95:
+                                Util_printRule(res->outputbuffer, q->action, "If %s %s", operatornames[q->operator], Str_milliToTime(q->limit, (char[23]){}));
+                                break;
+
                         default:
                                 break;
                 }
@@ -2343,16 +2830,17 @@ static boolean_t is_readonly(HttpRequest req) {
 
 
 /* Print status in the given format. Text status is default. */
-static void print_status(HttpRequest req, HttpResponse res, int version) {
+static void print_status(HttpRequest req, HttpResponse res) {
+        int version = ACTION(STATUS2) ? 2 : 1;
         const char *stringFormat = get_parameter(req, "format");
         if (stringFormat && Str_startsWith(stringFormat, "xml")) {
                 char buf[STRLEN];
-                StringBuffer_T sb = StringBuffer_create(256);
-                status_xml(sb, NULL, version, Socket_getLocalHost(req->S, buf, sizeof(buf)));
-                StringBuffer_append(res->outputbuffer, "%s", StringBuffer_toString(sb));
-                StringBuffer_free(&sb);
                 set_content_type(res, "text/xml");
+                status_xml(res->outputbuffer, NULL, version, Socket_getLocalHost(req->S, buf, sizeof(buf)), _flush, res);
         } else {
+                Snapshot_T snapshot = _acquireSnapshot(req, res);
+                if (! snapshot)
+                        return;
                 set_content_type(res, "text/plain");
 
                 StringBuffer_append(res->outputbuffer, "Monit %s uptime: %s\n\n", VERSION, _getUptime(ProcessTree_getProcessUptime(getpid()), (char[256]){}));
@@ -2361,23 +2849,31 @@ static void print_status(HttpRequest req, HttpResponse res, int version) {
                 const char *stringGroup = Util_urlDecode((char *)get_parameter(req, "group"));
                 const char *stringService = Util_urlDecode((char *)get_parameter(req, "service"));
                 if (stringGroup) {
-                        for (ServiceGroup_T sg = servicegrouplist; sg; sg = sg->next) {
-                                if (IS(stringGroup, sg->name)) {
-                                        for (list_t m = sg->members->head; m; m = m->next) {
-                                                status_service_txt(m->e, res);
+                        ServiceGroup_T sg = Util_getServiceGroup(stringGroup);
+                        if (sg) {
+                                for (list_t m = sg->members->head; m; m = m->next) {
+                                        Service_T s = Snapshot_getService(snapshot, ((Service_T)m->e)->name);
+                                        if (s) {
+                                                status_service_txt(s, res);
+                                                flush_response(res);
                                                 found++;
                                         }
-                                        break;
                                 }
                         }
+                } else if (stringService) {
+                        Service_T s = Snapshot_getService(snapshot, stringService);
+                        if (s) {
+                                status_service_txt(s, res);
+                                found++;
+                        }
                 } else {
-                        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
-                                if (! stringService || IS(stringService, s->name)) {
-                                        status_service_txt(s, res);
-                                        found++;
-                                }
+                        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
+                                status_service_txt(s, res);
+                                flush_response(res);
+                                found++;
                         }
                 }
+                Snapshot_release(&snapshot);
                 if (found == 0) {
                         if (stringGroup)
                                 send_error(req, res, SC_BAD_REQUEST, "Service group '%s' not found", stringGroup);
@@ -2398,11 +2894,12 @@ static void _printServiceSummary(Box_T t, Service_T s) {
 }
 
 
-static int _printServiceSummaryByType(Box_T t, Service_Type type) {
+static int _printServiceSummaryByType(HttpResponse res, Box_T t, Snapshot_T snapshot, Service_Type type) {
         int found = 0;
-        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+        for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                 if (s->type == type) {
                         _printServiceSummary(t, s);
+                        flush_response(res);
                         found++;
                 }
         }
@@ -2411,6 +2908,9 @@ static int _printServiceSummaryByType(Box_T t, Service_Type type) {
 
 
 static void print_summary(HttpRequest req, HttpResponse res) {
+        Snapshot_T snapshot = _acquireSnapshot(req, res);
+        if (! snapshot)
+                return;
         set_content_type(res, "text/plain");
 
         StringBuffer_append(res->outputbuffer, "Monit %s uptime: %s\n", VERSION, _getUptime(ProcessTree_getProcessUptime(getpid()), (char[256]){}));
@@ -2424,34 +2924,35 @@ static void print_summary(HttpRequest req, HttpResponse res) {
                         {.name = "Type",         .width = 13, .wrap = false, .align = BoxAlign_Left}
                   }, true);
         if (stringGroup) {
-                for (ServiceGroup_T sg = servicegrouplist; sg; sg = sg->next) {
-                        if (IS(stringGroup, sg->name)) {
-                                for (list_t m = sg->members->head; m; m = m->next) {
-                                        _printServiceSummary(t, m->e);
+                ServiceGroup_T sg = Util_getServiceGroup(stringGroup);
+                if (sg) {
+                        for (list_t m = sg->members->head; m; m = m->next) {
+                                Service_T s = Snapshot_getService(snapshot, ((Service_T)m->e)->name);
+                                if (s) {
+                                        _printServiceSummary(t, s);
                                         found++;
                                 }
-                                break;
                         }
                 }
         } else if (stringService) {
-                for (Service_T s = servicelist_conf; s; s = s->next_conf) {
-                        if (IS(stringService, s->name)) {
-                                _printServiceSummary(t, s);
-                                found++;
-                        }
+                Service_T s = Snapshot_getService(snapshot, stringService);
+                if (s) {
+                        _printServiceSummary(t, s);
+                        found++;
                 }
         } else {
-                found += _printServiceSummaryByType(t, Service_System);
-                found += _printServiceSummaryByType(t, Service_Process);
-                found += _printServiceSummaryByType(t, Service_File);
-                found += _printServiceSummaryByType(t, Service_Fifo);
-                found += _printServiceSummaryByType(t, Service_Directory);
-                found += _printServiceSummaryByType(t, Service_Filesystem);
-                found += _printServiceSummaryByType(t, Service_Host);
-                found += _printServiceSummaryByType(t, Service_Net);
-                found += _printServiceSummaryByType(t, Service_Program);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_System);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Process);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_File);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Fifo);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Directory);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Filesystem);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Host);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Net);
+                found += _printServiceSummaryByType(res, t, snapshot, Service_Program);
         }
         Box_free(&t);
+        Snapshot_release(&snapshot);
         if (found == 0) {
                 if (stringGroup)
                         send_error(req, res, SC_BAD_REQUEST, "Service group '%s' not found", stringGroup);
@@ -2463,13 +2964,29 @@ static void print_summary(HttpRequest req, HttpResponse res) {
 }
 
 
+/**
+ * Export the status of all services for Prometheus. The OpenMetrics
+ * format is used if the scraper asks for it, otherwise the Prometheus
+ * text format which is understood by all scrapers
+ */
+static void print_metrics(HttpRequest req, HttpResponse res) {
+        const char *accept = get_header(req, "Accept");
+        boolean_t openmetrics = accept && Str_sub(accept, "application/openmetrics-text");
+        set_content_type(res, openmetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8" : "text/plain; version=0.0.4; charset=utf-8");
+        status_metrics(res->outputbuffer, openmetrics, _flush, res);
+}
+
+
 static void _printReport(HttpRequest req, HttpResponse res) {
+        Snapshot_T snapshot = _acquireSnapshot(req, res);
+        if (! snapshot)
+                return;
         set_content_type(res, "text/plain");
         const char *type = get_parameter(req, "type");
         int count = 0;
         if (! type) {
                 float up = 0, down = 0, init = 0, unmonitored = 0, total = 0;
-                for (Service_T s = servicelist; s; s = s->next) {
+                for (Service_T s = snapshot->servicelist; s; s = s->next_conf) {
                         if (s->monitor == Monitor_Not)
                                 unmonitored++;
                         else if (s->monitor & Monitor_Init)
@@ -2492,32 +3009,33 @@ static void _printReport(HttpRequest req, HttpResponse res) {
                         3, unmonitored, 100. * unmonitored / total,
                         3, total);
         } else if (Str_isEqual(type, "up")) {
-                for (Service_T s = servicelist; s; s = s->next)
+                for (Service_T s = snapshot->servicelist; s; s = s->next_conf)
                         if (s->monitor != Monitor_Not && ! (s->monitor & Monitor_Init) && ! s->error)
                                 count++;
                 StringBuffer_append(res->outputbuffer, "%d\n", count);
         } else if (Str_isEqual(type, "down")) {
-                for (Service_T s = servicelist; s; s = s->next)
+                for (Service_T s = snapshot->servicelist; s; s = s->next_conf)
                         if (s->monitor != Monitor_Not && ! (s->monitor & Monitor_Init) && s->error)
                                 count++;
                 StringBuffer_append(res->outputbuffer, "%d\n", count);
         } else if (Str_startsWith(type, "initiali")) { // allow 'initiali(s|z)ing'
-                for (Service_T s = servicelist; s; s = s->next)
+                for (Service_T s = snapshot->servicelist; s; s = s->next_conf)
                         if (s->monitor & Monitor_Init)
                                 count++;
                 StringBuffer_append(res->outputbuffer, "%d\n", count);
         } else if (Str_isEqual(type, "unmonitored")) {
-                for (Service_T s = servicelist; s; s = s->next)
+                for (Service_T s = snapshot->servicelist; s; s = s->next_conf)
                         if (s->monitor == Monitor_Not)
                                 count++;
                 StringBuffer_append(res->outputbuffer, "%d\n", count);
         } else if (Str_isEqual(type, "total")) {
-                for (Service_T s = servicelist; s; s = s->next)
+                for (Service_T s = snapshot->servicelist; s; s = s->next_conf)
                         count++;
                 StringBuffer_append(res->outputbuffer, "%d\n", count);
         } else {
                 send_error(req, res, SC_BAD_REQUEST, "Invalid report type: '%s'", type);
         }
+        Snapshot_release(&snapshot);
 }
 
 
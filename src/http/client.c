@@ -179,7 +179,14 @@ static boolean_t _client(const char *request, StringBuffer_T data) {
         }
         Socket_T S = NULL;
         if (Run.httpd.flags & Httpd_Net) {
-                S = Socket_create(Run.httpd.socket.net.address ? Run.httpd.socket.net.address : "localhost", Run.httpd.socket.net.port, Socket_Tcp, Socket_Ip, &(Run.httpd.socket.net.ssl), Run.limits.networkTimeout);
+                // Save the TLS session next to the id file, so the next command can resume it and skip the full handshake
+                struct SslOptions_T options = Run.httpd.socket.net.ssl;
+                char session[PATH_MAX];
+                if ((options.flags & SSL_Enabled) && Run.files.id) {
+                        snprintf(session, sizeof(session), "%s.session", Run.files.id);
+                        options.session = session;
+                }
+                S = Socket_create(Run.httpd.socket.net.address ? Run.httpd.socket.net.address : "localhost", Run.httpd.socket.net.port, Socket_Tcp, Socket_Ip, &options, Run.limits.networkTimeout);
         } else if (Run.httpd.flags & Httpd_Unix) {
                 S = Socket_createUnix(Run.httpd.socket.unix.path, Socket_Tcp, Run.limits.networkTimeout);
         } else {
@@ -76,6 +76,10 @@
 #include <netinet/in.h>
 #endif
 
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
@@ -89,25 +93,34 @@
 #include "net.h"
 #include "processor.h"
 #include "cervlet.h"
+#include "eventstream.h"
 #include "socket.h"
 #include "SslServer.h"
 
 // libmonit
 #include "system/Net.h"
+#include "system/Time.h"
+#include "thread/Thread.h"
 #include "exceptions/AssertException.h"
 #include "exceptions/IOException.h"
 
 
 /**
- *  A naive http 1.0 server. The server delegates handling of a HTTP
+ *  A small http 1.1 server. The server delegates handling of a HTTP
  *  request and response to the processor module.
  *
  *  NOTE
- *    This server does not use threads or forks; Requests are
- *    serialized and pending requests will be popped from the
- *    connection queue when the current request finish.
+ *    The engine thread polls the server sockets and all idle client
+ *    connections. It performs the SSL handshake and reads the request
+ *    without blocking, until the request is complete. Only then the
+ *    connection is passed to a small pool of worker threads which
+ *    process the request. If the client asked for a persistent
+ *    connection, the worker returns the connection to the engine
+ *    thread after the response was sent, so a slow or idle client
+ *    blocks neither the server nor other clients. The idle connections
+ *    are closed after KEEPALIVE_TIMEOUT, a request which is not
+ *    complete within REQUEST_TIMEOUT is dropped.
  *
- *    Since this server is written for monit, low traffic is expected.
  *    Connect from not-authenticated clients will be closed down
  *    promptly. The authentication schema or access control is based
  *    on client name/address/pam and only requests from known clients are
@@ -129,27 +142,51 @@ typedef struct HostsAllow_T {
 } *HostsAllow_T;
 
 
+typedef struct Connection_T {
+        int requests;                               // Number of requests served so far
+        time_t deadline;          // The connection is closed if idle after the deadline
+        Socket_T S;
+        struct {
+                char *data;                      // The request received so far
+                int length;
+                int size;
+        } request;
+        /* For internal use */
+        struct Connection_T *next;
+} *Connection_T;
+
+
 #define MAX_SERVER_SOCKETS 3
+#define MAX_CONNECTIONS    1024
+#define HTTP_WORKERS       4
 
 
 static struct {
         Socket_Family family;
-        union {
-                struct sockaddr_storage addr_in;
-                struct sockaddr_un addr_un;
-        } _addr;
-        struct sockaddr *addr;
-        socklen_t addrlen;
 #ifdef HAVE_OPENSSL
         SslServer_T ssl;
 #endif
 } data[MAX_SERVER_SOCKETS] = {};
 
 
+static struct {
+        Mutex_T mutex;
+        Sem_T ready;
+        Connection_T pending;                     // Connections with the request ready (FIFO)
+        Connection_T last;                    // The last connection in the pending queue
+        Connection_T returned;     // Persistent connections returned by the workers
+        int wakeup[2];         // Pipe used by the workers to wake up the engine thread
+        Thread_T workers[HTTP_WORKERS];
+} queue = {.wakeup = {-1, -1}};
+
+
 static volatile boolean_t stopped = false;
 static int myServerSocketsCount = 0;
 static struct pollfd myServerSockets[3] = {};
 static HostsAllow_T allowlist = NULL;
+static int idleCount = 0;
+static Connection_T idle[MAX_CONNECTIONS] = {};
+static struct pollfd fds[MAX_SERVER_SOCKETS + 1 + MAX_CONNECTIONS] = {};
 
 
 /* ----------------------------------------------------------------- Private */
@@ -396,32 +433,265 @@ static boolean_t _authenticateHost(struct sockaddr *addr) {
 }
 
 
-static Socket_T _socketProducer() {
-        int r = 0;
+static void _closeConnection(Connection_T C) {
+        if (C->S)
+                Socket_free(&(C->S));
+        FREE(C->request.data);
+        FREE(C);
+}
+
+
+static void _enqueue(Connection_T C) {
+        LOCK(queue.mutex)
+        {
+                C->next = NULL;
+                if (queue.last)
+                        queue.last->next = C;
+                else
+                        queue.pending = C;
+                queue.last = C;
+                Sem_signal(queue.ready);
+        }
+        END_LOCK;
+}
+
+
+static Connection_T _dequeue() {
+        Connection_T C = NULL;
+        LOCK(queue.mutex)
+        {
+                while (! queue.pending && ! stopped)
+                        Sem_wait(queue.ready, queue.mutex);
+                if (! stopped && (C = queue.pending)) {
+                        if (! (queue.pending = C->next))
+                                queue.last = NULL;
+                        C->next = NULL;
+                }
+        }
+        END_LOCK;
+        return C;
+}
+
+
+/**
+ * Return the persistent connection to the engine thread, which will wait for the next request
+ */
+static void _return(Connection_T C) {
+        C->deadline = Time_now() + KEEPALIVE_TIMEOUT;
+        LOCK(queue.mutex)
+        {
+                C->next = queue.returned;
+                queue.returned = C;
+        }
+        END_LOCK;
+        if (write(queue.wakeup[1], "", 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                LogError("HTTP server: cannot wake up the server -- %s\n", STRERROR);
+}
+
+
+static void _addIdle(Connection_T C) {
+        if (idleCount < MAX_CONNECTIONS) {
+                idle[idleCount++] = C;
+        } else {
+                LogError("HTTP server: too many connections, closing connection from [%s]\n", NVLSTR(Socket_getRemoteHost(C->S)));
+                _closeConnection(C);
+        }
+}
+
+
+static void _removeIdle(int i) {
+        idle[i] = idle[--idleCount];
+        idle[idleCount] = NULL;
+}
+
+
+static void *_worker(void *args) {
+        Connection_T C;
+        while ((C = _dequeue())) {
+                // Pass the buffered request to the processor, a pipelined request which follows stays in the socket for the engine
+                Socket_unread(C->S, C->request.data, C->request.length);
+                C->request.length = 0;
+                boolean_t persistent = http_processor(&(C->S), ! stopped && ++C->requests < KEEPALIVE_MAX);
+                if (! C->S) {
+                        // The connection was taken over by the cervlet
+                        FREE(C->request.data);
+                        FREE(C);
+                } else if (persistent) {
+                        _return(C);
+                } else {
+                        _closeConnection(C);
+                }
+        }
+#ifdef HAVE_OPENSSL
+        Ssl_threadCleanup();
+#endif
+        return NULL;
+}
+
+
+static boolean_t _startWorkers() {
+        if (pipe(queue.wakeup) == -1) {
+                LogError("HTTP server: cannot create pipe -- %s\n", STRERROR);
+                return false;
+        }
+        Net_setNonBlocking(queue.wakeup[0]);
+        Net_setNonBlocking(queue.wakeup[1]);
+        Mutex_init(queue.mutex);
+        Sem_init(queue.ready);
+        for (int i = 0; i < HTTP_WORKERS; i++)
+                Thread_create(queue.workers[i], _worker, NULL);
+        return true;
+}
+
+
+static void _stopWorkers() {
+        LOCK(queue.mutex)
+        {
+                Sem_broadcast(queue.ready);
+        }
+        END_LOCK;
+        for (int i = 0; i < HTTP_WORKERS; i++)
+                Thread_join(queue.workers[i]);
+        for (Connection_T C = queue.pending, next = NULL; C; C = next) {
+                next = C->next;
+                _closeConnection(C);
+        }
+        for (Connection_T C = queue.returned, next = NULL; C; C = next) {
+                next = C->next;
+                _closeConnection(C);
+        }
+        queue.pending = queue.last = queue.returned = NULL;
+        while (idleCount > 0)
+                _closeConnection(idle[--idleCount]);
+        Sem_destroy(queue.ready);
+        Mutex_destroy(queue.mutex);
+        Net_close(queue.wakeup[0]);
+        Net_close(queue.wakeup[1]);
+        queue.wakeup[0] = queue.wakeup[1] = -1;
+}
+
+
+/**
+ * Read the data available on the connection without blocking. When the request is complete, pass the connection to the workers,
+ * otherwise keep it idle until more data arrive. The connection is closed on error.
+ */
+static void _receive(Connection_T C) {
+        int n = 0, complete = 0;
         do {
-                r = poll(myServerSockets, myServerSocketsCount, 1000);
-        } while (r == -1 && errno == EINTR);
-        if (r > 0) {
-                for (int i = 0; i < myServerSocketsCount; i++) {
-                        if (myServerSockets[i].revents & POLLIN) {
-                                int client = accept(myServerSockets[i].fd, data[i].addr, &(data[i].addrlen));
-                                if (client < 0) {
-                                        LogError("HTTP server: cannot accept connection -- %s\n", stopped ? "service stopped" : STRERROR);
-                                        return NULL;
-                                }
-                                if (Net_setNonBlocking(client) < 0 || ! Net_canRead(client, 500) || ! Net_canWrite(client, 500) || ! _authenticateHost(data[i].addr)) {
-                                        Net_abort(client);
-                                        return NULL;
-                                }
+                if (C->request.size - C->request.length < REQ_STRLEN) {
+                        C->request.size += C->request.size ? C->request.size : 4 * REQ_STRLEN;
+                        RESIZE(C->request.data, C->request.size);
+                }
+                if ((n = Socket_readAvailable(C->S, C->request.data + C->request.length, C->request.size - C->request.length - 1)) > 0) {
+                        if (C->request.length == 0)
+                                C->deadline = Time_now() + REQUEST_TIMEOUT; // The request started
+                        C->request.length += n;
+                }
+                C->request.data[C->request.length] = 0;
+        } while (n > 0 && ! (complete = Processor_getRequestLength(C->request.data, C->request.length)));
+        if (complete > 0) {
+                _enqueue(C);
+        } else if (complete < 0) {
+                LogError("HTTP server: request from [%s] too large, closing connection\n", NVLSTR(Socket_getRemoteHost(C->S)));
+                _closeConnection(C);
+        } else if (n < 0) {
+                _closeConnection(C);
+        } else {
+                _addIdle(C);
+        }
+}
+
+
+static void _accept(int server) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int client = accept(myServerSockets[server].fd, (struct sockaddr *)&addr, &addrlen);
+        if (client < 0) {
+                LogError("HTTP server: cannot accept connection -- %s\n", stopped ? "service stopped" : STRERROR);
+                return;
+        }
+        if (Net_setNonBlocking(client) < 0 || ! _authenticateHost((struct sockaddr *)&addr)) {
+                Net_abort(client);
+                return;
+        }
+        if (addr.ss_family != AF_UNIX) {
+                // Don't delay the response body behind the header block on persistent connections
+                int nodelay = 1;
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        }
+        Connection_T C;
+        NEW(C);
 #ifdef HAVE_OPENSSL
-                                return Socket_createAccepted(client, data[i].addr, data[i].ssl);
+        C->S = Socket_createAccepted(client, (struct sockaddr *)&addr, data[server].ssl);
 #else
-                                return Socket_createAccepted(client, data[i].addr, NULL);
+        C->S = Socket_createAccepted(client, (struct sockaddr *)&addr, NULL);
 #endif
+        if (! C->S) {
+                // The socket was closed already
+                FREE(C);
+                return;
+        }
+        C->deadline = Time_now() + REQUEST_TIMEOUT;
+        _addIdle(C);
+}
+
+
+/**
+ * The engine thread loop: accept new connections, receive requests, pass connections with a complete request to the workers and close expired idle connections
+ */
+static void _serve() {
+        while (! stopped) {
+                int n = 0;
+                for (int i = 0; i < myServerSocketsCount; i++, n++)
+                        fds[n] = (struct pollfd){.fd = myServerSockets[i].fd, .events = POLLIN};
+                fds[n++] = (struct pollfd){.fd = queue.wakeup[0], .events = POLLIN};
+                int connections = n;
+                for (int i = 0; i < idleCount; i++, n++)
+                        fds[n] = (struct pollfd){.fd = Socket_getSocket(idle[i]->S), .events = POLLIN};
+                int r = 0;
+                do {
+                        r = poll(fds, n, 1000);
+                } while (r == -1 && errno == EINTR);
+                if (r == -1) {
+                        LogError("HTTP server: poll failed -- %s\n", STRERROR);
+                        break;
+                }
+                // Idle connections (iterate from the end, so the removal doesn't affect not yet processed connections)
+                time_t now = Time_now();
+                for (int i = idleCount - 1; i >= 0; i--) {
+                        Connection_T C = idle[i];
+                        if (fds[connections + i].revents) {
+                                _removeIdle(i);
+                                _receive(C);
+                        } else if (now > C->deadline) {
+                                _removeIdle(i);
+                                _closeConnection(C);
+                        }
+                }
+                // New connections
+                for (int i = 0; i < myServerSocketsCount; i++)
+                        if (fds[i].revents & POLLIN)
+                                _accept(i);
+                // Persistent connections returned by the workers
+                if (fds[myServerSocketsCount].revents & POLLIN) {
+                        char buf[STRLEN];
+                        while (read(queue.wakeup[0], buf, sizeof(buf)) > 0)
+                                ;
+                        Connection_T returned = NULL;
+                        LOCK(queue.mutex)
+                        {
+                                returned = queue.returned;
+                                queue.returned = NULL;
+                        }
+                        END_LOCK;
+                        for (Connection_T C = returned, next = NULL; C; C = next) {
+                                next = C->next;
+                                C->next = NULL;
+                                // A pipelined request may be buffered already
+                                _receive(C);
                         }
                 }
         }
-        return NULL;
 }
 
 
@@ -438,8 +708,6 @@ static void _createTcpServer(Socket_Family family, char error[STRLEN]) {
                 }
 #endif
                 data[myServerSocketsCount].family = family;
-                data[myServerSocketsCount].addr = (struct sockaddr *)&(data[myServerSocketsCount]._addr.addr_in);
-                data[myServerSocketsCount].addrlen = sizeof(struct sockaddr_storage);
                 myServerSockets[myServerSocketsCount].events = POLLIN;
                 myServerSocketsCount++;
         }
@@ -450,8 +718,6 @@ static void _createUnixServer(char error[STRLEN]) {
         myServerSockets[myServerSocketsCount].fd = create_server_socket_unix(Run.httpd.socket.unix.path, 1024, error);
         if (myServerSockets[myServerSocketsCount].fd != -1) {
                 data[myServerSocketsCount].family = Socket_Unix;
-                data[myServerSocketsCount].addr = (struct sockaddr *)&(data[myServerSocketsCount]._addr.addr_un);
-                data[myServerSocketsCount].addrlen = sizeof(struct sockaddr_un);
                 myServerSockets[myServerSocketsCount].events = POLLIN;
                 myServerSocketsCount++;
         }
@@ -479,10 +745,11 @@ void Engine_start() {
                         if (STR_DEF(error[i]))
                                 LogError("HTTP server -- %s\n", error[i]);
         } else {
-                while (! stopped) {
-                        Socket_T S = _socketProducer();
-                        if (S)
-                                http_processor(S);
+                if (_startWorkers()) {
+                        _serve();
+                        stopped = true;
+                        _stopWorkers();
+                        EventStream_stop();
                 }
                 for (int i = 0; i < myServerSocketsCount; i++) {
 #ifdef HAVE_OPENSSL
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
+// libmonit
+#include "system/Time.h"
+#include "exceptions/AssertException.h"
+
+#include "monit.h"
+#include "event.h"
+#include "snapshot.h"
+#include "processor.h"
+#include "eventstream.h"
+
+
+/**
+ * Implementation of the server-sent events stream. The messages are
+ * queued under one mutex which is held only to queue and to dequeue,
+ * the subscriber threads write to the sockets unlocked.
+ *
+ * @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+typedef struct Subscriber_T {
+        Socket_T socket;
+        char *queue[EVENTSTREAM_BUFFER];           /**< Ring buffer of messages */
+        int head;                                /**< Index of the oldest message */
+        int count;                                  /**< Number of queued messages */
+        boolean_t dropped;       /**< The queue overflowed, the client is too slow */
+        struct Subscriber_T *next;
+} *Subscriber_T;
+
+
+static struct {
+        Mutex_T mutex;
+        Sem_T ready;                            /**< Signaled when a message was queued */
+        Sem_T done;                         /**< Signaled when a subscriber finished */
+        Subscriber_T list;
+        int count;                      /**< Number of subscribers, including new ones */
+        boolean_t stopped;
+        unsigned long long id;                                /**< Last message id */
+        Snapshot_T snapshot;           /**< The snapshot the next update compares with */
+} streams = {.mutex = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+
+static const char *stateNames[] = {"succeeded", "failed", "changed", "changed not", "init"};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static boolean_t _hasSubscribers() {
+        boolean_t subscribed;
+        LOCK(streams.mutex)
+        {
+                subscribed = streams.count > 0 && ! streams.stopped;
+        }
+        END_LOCK;
+        return subscribed;
+}
+
+
+/**
+ * Queue the message for all subscribers. A subscriber whose queue is full
+ * is dropped, its thread closes the connection
+ */
+static void _publish(const char *event, StringBuffer_T data) {
+        LOCK(streams.mutex)
+        {
+                if (streams.list && ! streams.stopped) {
+                        char *message = Str_cat("id: %llu\nevent: %s\ndata: %s\n\n", ++streams.id, event, StringBuffer_toString(data));
+                        for (Subscriber_T S = streams.list; S; S = S->next) {
+                                if (S->dropped) {
+                                        continue;
+                                } else if (S->count == EVENTSTREAM_BUFFER) {
+                                        S->dropped = true;
+                                } else {
+                                        S->queue[(S->head + S->count) % EVENTSTREAM_BUFFER] = Str_dup(message);
+                                        S->count++;
+                                }
+                        }
+                        FREE(message);
+                        Sem_broadcast(streams.ready);
+                }
+        }
+        END_LOCK;
+}
+
+
+static boolean_t _send(Subscriber_T S, const char *message) {
+        size_t length = strlen(message);
+        return Socket_write(S->socket, (void *)message, length) == (int)length;
+}
+
+
+/**
+ * Subscriber thread: wait for queued messages and write them to the client.
+ * A comment is sent if nothing happened for EVENTSTREAM_HEARTBEAT seconds,
+ * so proxies keep the connection open and a disconnected client is noticed
+ */
+static void *_stream(void *args) {
+        Subscriber_T S = args;
+        char *batch[EVENTSTREAM_BUFFER];
+        boolean_t active = _send(S, "retry: 10000\n\n");
+        while (active) {
+                int n = 0;
+                LOCK(streams.mutex)
+                {
+                        time_t deadline = Time_now() + EVENTSTREAM_HEARTBEAT;
+                        while (! S->count && ! S->dropped && ! streams.stopped && Time_now() < deadline) {
+                                struct timespec wait = {.tv_sec = deadline, .tv_nsec = 0};
+                                Sem_timeWait(streams.ready, streams.mutex, wait);
+                        }
+                        if (S->dropped || streams.stopped) {
+                                active = false;
+                        } else {
+                                for (; S->count > 0; S->count--, S->head = (S->head + 1) % EVENTSTREAM_BUFFER)
+                                        batch[n++] = S->queue[S->head];
+                        }
+                }
+                END_LOCK;
+                if (active && n == 0)
+                        active = _send(S, ": keep-alive\n\n");
+                for (int i = 0; i < n; i++) {
+                        if (active)
+                                active = _send(S, batch[i]);
+                        FREE(batch[i]);
+                }
+        }
+        if (S->dropped)
+                LogWarning("HTTP server: event stream client [%s] doesn't read fast enough, closing connection\n", NVLSTR(Socket_getRemoteHost(S->socket)));
+        LOCK(streams.mutex)
+        {
+                for (Subscriber_T *p = &(streams.list); *p; p = &((*p)->next)) {
+                        if (*p == S) {
+                                *p = S->next;
+                                break;
+                        }
+                }
+                for (; S->count > 0; S->count--, S->head = (S->head + 1) % EVENTSTREAM_BUFFER)
+                        FREE(S->queue[S->head]);
+                streams.count--;
+                Sem_broadcast(streams.done);
+        }
+        END_LOCK;
+        Socket_free(&(S->socket));
+        FREE(S);
+#ifdef HAVE_OPENSSL
+        Ssl_threadCleanup();
+#endif
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t EventStream_subscribe(HttpResponse res) {
+        boolean_t accepted = false;
+        LOCK(streams.mutex)
+        {
+                if (! streams.stopped && streams.count < EVENTSTREAM_MAX) {
+                        streams.count++;
+                        accepted = true;
+                }
+        }
+        END_LOCK;
+        if (accepted) {
+                set_content_type(res, "text/event-stream");
+                set_header(res, "Cache-Control", "no-cache");
+                Subscriber_T S;
+                NEW(S);
+                if ((S->socket = detach_response(res))) {
+                        LOCK(streams.mutex)
+                        {
+                                S->next = streams.list;
+                                streams.list = S;
+                        }
+                        END_LOCK;
+                        Thread_T thread;
+                        Thread_create(thread, _stream, S);
+                        Thread_detach(thread);
+                } else {
+                        // The headers could not be sent, the server closes the connection
+                        FREE(S);
+                        LOCK(streams.mutex)
+                        {
+                                streams.count--;
+                                Sem_broadcast(streams.done);
+                        }
+                        END_LOCK;
+                }
+        }
+        return accepted;
+}
+
+
+void EventStream_post(Event_T E) {
+        ASSERT(E);
+        if (_hasSubscribers()) {
+                StringBuffer_T B = StringBuffer_create(256);
+                StringBuffer_append(B, "{\"service\":\"");
+                escapeJSON(B, E->source->name);
+                StringBuffer_append(B, "\",\"event\":\"");
+                escapeJSON(B, NVLSTR(Event_get_description(E)));
+                StringBuffer_append(B, "\",\"state\":\"%s\",\"collected\":%lld,\"message\":\"", stateNames[E->state], (long long)E->collected.tv_sec);
+                escapeJSON(B, NVLSTR(E->message));
+                StringBuffer_append(B, "\"}");
+                _publish("state", B);
+                StringBuffer_free(&B);
+        }
+}
+
+
+void EventStream_update() {
+        Snapshot_T previous = NULL, current = NULL;
+        LOCK(streams.mutex)
+        {
+                // Keep a reference to the latest snapshot only while there are subscribers
+                previous = streams.snapshot;
+                streams.snapshot = NULL;
+                if (streams.list && ! streams.stopped) {
+                        streams.snapshot = Snapshot_acquire();
+                        current = Snapshot_acquire();
+                }
+        }
+        END_LOCK;
+        if (previous && current && previous != current) {
+                StringBuffer_T B = StringBuffer_create(1024);
+                if (status_deltas(B, previous, current) > 0)
+                        _publish("update", B);
+                StringBuffer_free(&B);
+        }
+        Snapshot_release(&previous);
+        Snapshot_release(&current);
+}
+
+
+void EventStream_stop() {
+        Snapshot_T snapshot = NULL;
+        LOCK(streams.mutex)
+        {
+                streams.stopped = true;
+                // Interrupt the writes which wait for a client
+                for (Subscriber_T S = streams.list; S; S = S->next)
+                        shutdown(Socket_getSocket(S->socket), SHUT_RDWR);
+                Sem_broadcast(streams.ready);
+                while (streams.count > 0)
+                        Sem_wait(streams.done, streams.mutex);
+                streams.stopped = false;
+                snapshot = streams.snapshot;
+                streams.snapshot = NULL;
+        }
+        END_LOCK;
+        Snapshot_release(&snapshot);
+}
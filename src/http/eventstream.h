@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef EVENTSTREAM_H
+#define EVENTSTREAM_H
+
+#include "monit.h"
+#include "processor.h"
+
+
+/**
+ * Server-sent events stream of the service status changes.
+ *
+ * A client subscribes with a GET request for /events and keeps the
+ * connection open. Each subscriber has its own thread and a bounded
+ * queue of messages: event state transitions are queued as Event_post()
+ * handles them and the metric values which changed are queued once per
+ * poll cycle. A subscriber which doesn't read fast enough to keep its
+ * queue below EVENTSTREAM_BUFFER messages is disconnected, so a slow
+ * client cannot hold the daemon's memory or block the other clients.
+ *
+ *  @see https://html.spec.whatwg.org/multipage/server-sent-events.html
+ *  @file
+ */
+
+
+#define EVENTSTREAM_MAX       16      /**< Maximum number of subscribers */
+#define EVENTSTREAM_BUFFER    64  /**< Queued messages per subscriber */
+#define EVENTSTREAM_HEARTBEAT 15 /**< Seconds between keep-alive comments */
+
+
+/**
+ * Take over the connection of the given response and stream the status
+ * changes to the client until it disconnects or the HTTP server stops
+ * @param res The response to a request for the event stream
+ * @return true if the client was subscribed, false if the maximum
+ * number of subscribers was reached. The response is unchanged then
+ */
+boolean_t EventStream_subscribe(HttpResponse res);
+
+
+/**
+ * Queue the state transition of an event for all subscribers
+ * @param E An event object whose state changed
+ */
+void EventStream_post(Event_T E);
+
+
+/**
+ * Queue the metric values which changed since the previous call for all
+ * subscribers. Called by the validation thread after a snapshot was
+ * published
+ */
+void EventStream_update();
+
+
+/**
+ * Disconnect all subscribers and wait for their threads to finish. Called
+ * when the HTTP server stops
+ */
+void EventStream_stop();
+
+
+#endif
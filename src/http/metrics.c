@@ -0,0 +1,854 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+// libmonit
+#include "util/List.h"
+#include "system/Time.h"
+
+#include "monit.h"
+#include "ProcessTree.h"
+#include "snapshot.h"
+#include "processor.h"
+
+
+/**
+ *  OpenMetrics (Prometheus) exposition of the service status.
+ *
+ *  Every metric family is written in one pass over the latest service
+ *  status snapshot, directly into the output buffer. Samples carry the service name and
+ *  type as labels, group membership is exported as a separate info
+ *  metric so a service in several groups does not multiply its series.
+ *
+ *  @see https://github.com/OpenObservability/OpenMetrics
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+typedef enum {
+        Metric_Gauge = 0,
+        Metric_Counter
+} Metric_Type;
+
+
+typedef struct Metric_T {
+        int service;                  /**< Service type or -1 for any service */
+        Metric_Type type;                                      /**< Metric type */
+        const char *name;                          /**< Metric family name */
+        const char *help;                                 /**< Metric description */
+        boolean_t (*value)(Service_T S, double *value); /**< Getter, false if n/a */
+} Metric_T;
+
+
+static const char *typeNames[] = {"filesystem", "directory", "file", "process", "host", "system", "fifo", "program", "net"};
+
+
+/* ----------------------------------------------------------------- Getters */
+
+
+static boolean_t _monitored(Service_T S, double *value) {
+        *value = S->monitor;
+        return true;
+}
+
+
+static boolean_t _status(Service_T S, double *value) {
+        *value = S->error;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _collected(Service_T S, double *value) {
+        *value = (double)S->collected.tv_sec + (double)S->collected.tv_usec / 1000000.;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _hasStatistics(Service_T S, Statistics_T statistics, double *value) {
+        if (Util_hasServiceStatus(S) && Statistics_initialized(statistics)) {
+                *value = Statistics_raw(statistics);
+                return true;
+        }
+        return false;
+}
+
+
+static boolean_t _hasServiceTime(Service_T S, Statistics_T statistics, double *value) {
+        if (Util_hasServiceStatus(S) && Statistics_initialized(statistics)) {
+                *value = Statistics_deltaNormalize(statistics) / 1000.;
+                return true;
+        }
+        return false;
+}
+
+
+static boolean_t _fileSize(Service_T S, double *value) {
+        *value = S->inf.file->size;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _fileModify(Service_T S, double *value) {
+        *value = S->inf.file->timestamp.modify;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _directoryModify(Service_T S, double *value) {
+        *value = S->inf.directory->timestamp.modify;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _fifoModify(Service_T S, double *value) {
+        *value = S->inf.fifo->timestamp.modify;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _spaceUsage(Service_T S, double *value) {
+        *value = (double)S->inf.filesystem->space_total * (double)S->inf.filesystem->f_bsize;
+        return Util_hasServiceStatus(S) && S->inf.filesystem->f_bsize > 0;
+}
+
+
+static boolean_t _spaceTotal(Service_T S, double *value) {
+        *value = (double)S->inf.filesystem->f_blocks * (double)S->inf.filesystem->f_bsize;
+        return Util_hasServiceStatus(S) && S->inf.filesystem->f_bsize > 0;
+}
+
+
+static boolean_t _spacePercent(Service_T S, double *value) {
+        *value = S->inf.filesystem->space_percent;
+        return Util_hasServiceStatus(S) && S->inf.filesystem->f_bsize > 0;
+}
+
+
+static boolean_t _inodeUsage(Service_T S, double *value) {
+        *value = S->inf.filesystem->inode_total;
+        return Util_hasServiceStatus(S) && S->inf.filesystem->f_files > 0;
+}
+
+
+static boolean_t _inodeTotal(Service_T S, double *value) {
+        *value = S->inf.filesystem->f_files;
+        return Util_hasServiceStatus(S) && S->inf.filesystem->f_files > 0;
+}
+
+
+static boolean_t _inodePercent(Service_T S, double *value) {
+        *value = S->inf.filesystem->inode_percent;
+        return Util_hasServiceStatus(S) && S->inf.filesystem->f_files > 0;
+}
+
+
+static boolean_t _filesystemReadBytes(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.filesystem->read.bytes), value);
+}
+
+
+static boolean_t _filesystemReadOperations(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.filesystem->read.operations), value);
+}
+
+
+static boolean_t _filesystemWriteBytes(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.filesystem->write.bytes), value);
+}
+
+
+static boolean_t _filesystemWriteOperations(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.filesystem->write.operations), value);
+}
+
+
+static boolean_t _filesystemReadTime(Service_T S, double *value) {
+        return _hasServiceTime(S, &(S->inf.filesystem->time.read), value);
+}
+
+
+static boolean_t _filesystemWriteTime(Service_T S, double *value) {
+        return _hasServiceTime(S, &(S->inf.filesystem->time.write), value);
+}
+
+
+static boolean_t _processPid(Service_T S, double *value) {
+        *value = S->inf.process->pid;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _processUptime(Service_T S, double *value) {
+        *value = S->inf.process->uptime;
+        return Util_hasServiceStatus(S);
+}
+
+
+static boolean_t _processThreads(Service_T S, double *value) {
+        *value = S->inf.process->threads;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _processChildren(Service_T S, double *value) {
+        *value = S->inf.process->children;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _processCpu(Service_T S, double *value) {
+        *value = S->inf.process->cpu_percent;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled) && S->inf.process->cpu_percent >= 0;
+}
+
+
+static boolean_t _processCpuTotal(Service_T S, double *value) {
+        *value = S->inf.process->total_cpu_percent;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled) && S->inf.process->total_cpu_percent >= 0;
+}
+
+
+static boolean_t _processMemory(Service_T S, double *value) {
+        *value = S->inf.process->mem;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _processMemoryTotal(Service_T S, double *value) {
+        *value = S->inf.process->total_mem;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _processMemoryPercent(Service_T S, double *value) {
+        *value = S->inf.process->mem_percent;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _processMemoryTotalPercent(Service_T S, double *value) {
+        *value = S->inf.process->total_mem_percent;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _processReadBytes(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.process->read.bytes), value);
+}
+
+
+static boolean_t _processReadOperations(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.process->read.operations), value);
+}
+
+
+static boolean_t _processWriteBytes(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.process->write.bytes), value);
+}
+
+
+static boolean_t _processWriteOperations(Service_T S, double *value) {
+        return _hasStatistics(S, &(S->inf.process->write.operations), value);
+}
+
+
+static boolean_t _hasLink(Service_T S, long long counter, double *value) {
+        *value = counter;
+        return Util_hasServiceStatus(S) && counter >= 0;
+}
+
+
+static boolean_t _netState(Service_T S, double *value) {
+        return _hasLink(S, Link_getState(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netSpeed(Service_T S, double *value) {
+        return _hasLink(S, Link_getSpeed(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netDuplex(Service_T S, double *value) {
+        return _hasLink(S, Link_getDuplex(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netBytesIn(Service_T S, double *value) {
+        return _hasLink(S, Link_getBytesInTotal(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netPacketsIn(Service_T S, double *value) {
+        return _hasLink(S, Link_getPacketsInTotal(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netErrorsIn(Service_T S, double *value) {
+        return _hasLink(S, Link_getErrorsInTotal(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netBytesOut(Service_T S, double *value) {
+        return _hasLink(S, Link_getBytesOutTotal(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netPacketsOut(Service_T S, double *value) {
+        return _hasLink(S, Link_getPacketsOutTotal(S->inf.net->stats), value);
+}
+
+
+static boolean_t _netErrorsOut(Service_T S, double *value) {
+        return _hasLink(S, Link_getErrorsOutTotal(S->inf.net->stats), value);
+}
+
+
+static boolean_t _programStarted(Service_T S, double *value) {
+        *value = S->program->started;
+        return Util_hasServiceStatus(S) && S->program->started;
+}
+
+
+static boolean_t _programExitStatus(Service_T S, double *value) {
+        *value = S->program->exitStatus;
+        return Util_hasServiceStatus(S) && S->program->started;
+}
+
+
+static boolean_t _hasSystem(Service_T S, double metric, double *value) {
+        *value = metric;
+        return Util_hasServiceStatus(S) && (Run.flags & Run_ProcessEngineEnabled);
+}
+
+
+static boolean_t _load1(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->loadavg[0], value);
+}
+
+
+static boolean_t _load5(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->loadavg[1], value);
+}
+
+
+static boolean_t _load15(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->loadavg[2], value);
+}
+
+
+static boolean_t _cpus(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->cpu.count, value);
+}
+
+
+static boolean_t _cpuUser(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->cpu.usage.user, value) && S->inf.system->cpu.usage.user >= 0;
+}
+
+
+static boolean_t _cpuSystem(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->cpu.usage.system, value) && S->inf.system->cpu.usage.system >= 0;
+}
+
+
+#ifdef HAVE_CPU_WAIT
+static boolean_t _cpuWait(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->cpu.usage.wait, value) && S->inf.system->cpu.usage.wait >= 0;
+}
+#endif
+
+
+static boolean_t _memoryUsage(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->memory.usage.bytes, value);
+}
+
+
+static boolean_t _memoryTotal(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->memory.size, value);
+}
+
+
+static boolean_t _memoryPercent(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->memory.usage.percent, value);
+}
+
+
+static boolean_t _swapUsage(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->swap.usage.bytes, value);
+}
+
+
+static boolean_t _swapTotal(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->swap.size, value);
+}
+
+
+static boolean_t _swapPercent(Service_T S, double *value) {
+        return _hasSystem(S, S->inf.system->swap.usage.percent, value);
+}
+
+
+static Metric_T metrics[] = {
+        {-1, Metric_Gauge, "monit_service_monitored", "Monitoring state (0 = not monitored, 1 = monitored, 2 = initializing, 4 = waiting)", _monitored},
+        {-1, Metric_Gauge, "monit_service_status", "Bitmap of failed event types (0 = ok)", _status},
+        {-1, Metric_Gauge, "monit_service_collected_timestamp_seconds", "Time the service data were collected", _collected},
+        {Service_System, Metric_Gauge, "monit_system_load1", "System load average over 1 minute", _load1},
+        {Service_System, Metric_Gauge, "monit_system_load5", "System load average over 5 minutes", _load5},
+        {Service_System, Metric_Gauge, "monit_system_load15", "System load average over 15 minutes", _load15},
+        {Service_System, Metric_Gauge, "monit_system_cpus", "Number of CPUs", _cpus},
+        {Service_System, Metric_Gauge, "monit_system_cpu_user_percent", "CPU usage in user space", _cpuUser},
+        {Service_System, Metric_Gauge, "monit_system_cpu_system_percent", "CPU usage in kernel space", _cpuSystem},
+#ifdef HAVE_CPU_WAIT
+        {Service_System, Metric_Gauge, "monit_system_cpu_wait_percent", "CPU usage in I/O wait", _cpuWait},
+#endif
+        {Service_System, Metric_Gauge, "monit_system_memory_usage_bytes", "Real memory in use", _memoryUsage},
+        {Service_System, Metric_Gauge, "monit_system_memory_total_bytes", "Real memory size", _memoryTotal},
+        {Service_System, Metric_Gauge, "monit_system_memory_usage_percent", "Real memory in use in percent", _memoryPercent},
+        {Service_System, Metric_Gauge, "monit_system_swap_usage_bytes", "Swap in use", _swapUsage},
+        {Service_System, Metric_Gauge, "monit_system_swap_total_bytes", "Swap size", _swapTotal},
+        {Service_System, Metric_Gauge, "monit_system_swap_usage_percent", "Swap in use in percent", _swapPercent},
+        {Service_Process, Metric_Gauge, "monit_process_pid", "Process id", _processPid},
+        {Service_Process, Metric_Gauge, "monit_process_uptime_seconds", "Process uptime", _processUptime},
+        {Service_Process, Metric_Gauge, "monit_process_threads", "Number of process threads", _processThreads},
+        {Service_Process, Metric_Gauge, "monit_process_children", "Number of child processes", _processChildren},
+        {Service_Process, Metric_Gauge, "monit_process_cpu_percent", "Process CPU usage", _processCpu},
+        {Service_Process, Metric_Gauge, "monit_process_cpu_total_percent", "CPU usage of the process and its children", _processCpuTotal},
+        {Service_Process, Metric_Gauge, "monit_process_memory_bytes", "Process memory usage", _processMemory},
+        {Service_Process, Metric_Gauge, "monit_process_memory_total_bytes", "Memory usage of the process and its children", _processMemoryTotal},
+        {Service_Process, Metric_Gauge, "monit_process_memory_percent", "Process memory usage in percent", _processMemoryPercent},
+        {Service_Process, Metric_Gauge, "monit_process_memory_total_percent", "Memory usage of the process and its children in percent", _processMemoryTotalPercent},
+        {Service_Process, Metric_Counter, "monit_process_read_bytes", "Bytes read by the process", _processReadBytes},
+        {Service_Process, Metric_Counter, "monit_process_read_operations", "Read operations done by the process", _processReadOperations},
+        {Service_Process, Metric_Counter, "monit_process_write_bytes", "Bytes written by the process", _processWriteBytes},
+        {Service_Process, Metric_Counter, "monit_process_write_operations", "Write operations done by the process", _processWriteOperations},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_space_usage_bytes", "Filesystem space in use", _spaceUsage},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_space_total_bytes", "Filesystem size", _spaceTotal},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_space_usage_percent", "Filesystem space in use in percent", _spacePercent},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_inodes_usage", "Inodes in use", _inodeUsage},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_inodes_total", "Number of inodes", _inodeTotal},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_inodes_usage_percent", "Inodes in use in percent", _inodePercent},
+        {Service_Filesystem, Metric_Counter, "monit_filesystem_read_bytes", "Bytes read from the filesystem", _filesystemReadBytes},
+        {Service_Filesystem, Metric_Counter, "monit_filesystem_read_operations", "Read operations done on the filesystem", _filesystemReadOperations},
+        {Service_Filesystem, Metric_Counter, "monit_filesystem_write_bytes", "Bytes written to the filesystem", _filesystemWriteBytes},
+        {Service_Filesystem, Metric_Counter, "monit_filesystem_write_operations", "Write operations done on the filesystem", _filesystemWriteOperations},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_read_time_seconds", "Time spent by read operations per second", _filesystemReadTime},
+        {Service_Filesystem, Metric_Gauge, "monit_filesystem_write_time_seconds", "Time spent by write operations per second", _filesystemWriteTime},
+        {Service_File, Metric_Gauge, "monit_file_size_bytes", "File size", _fileSize},
+        {Service_File, Metric_Gauge, "monit_file_modify_timestamp_seconds", "File modification time", _fileModify},
+        {Service_Directory, Metric_Gauge, "monit_directory_modify_timestamp_seconds", "Directory modification time", _directoryModify},
+        {Service_Fifo, Metric_Gauge, "monit_fifo_modify_timestamp_seconds", "Fifo modification time", _fifoModify},
+        {Service_Net, Metric_Gauge, "monit_net_link_state", "Link state (0 = down, 1 = up)", _netState},
+        {Service_Net, Metric_Gauge, "monit_net_link_speed_bits", "Link speed in bits per second", _netSpeed},
+        {Service_Net, Metric_Gauge, "monit_net_link_duplex", "Link duplex (0 = half, 1 = full)", _netDuplex},
+        {Service_Net, Metric_Counter, "monit_net_download_bytes", "Bytes received", _netBytesIn},
+        {Service_Net, Metric_Counter, "monit_net_download_packets", "Packets received", _netPacketsIn},
+        {Service_Net, Metric_Counter, "monit_net_download_errors", "Receive errors", _netErrorsIn},
+        {Service_Net, Metric_Counter, "monit_net_upload_bytes", "Bytes sent", _netBytesOut},
+        {Service_Net, Metric_Counter, "monit_net_upload_packets", "Packets sent", _netPacketsOut},
+        {Service_Net, Metric_Counter, "monit_net_upload_errors", "Send errors", _netErrorsOut},
+        {Service_Program, Metric_Gauge, "monit_program_started_timestamp_seconds", "Time the program was last started", _programStarted},
+        {Service_Program, Metric_Gauge, "monit_program_exit_status", "Exit status of the last program run", _programExitStatus},
+        {0}
+};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Append a label value, escaping backslash, double quote and newline
+ * @param B Output StringBuffer object
+ * @param value Label value
+ */
+static void _labelValue(StringBuffer_T B, const char *value) {
+        if (! value) {
+                return;
+        } else if (! strpbrk(value, "\\\"\n")) {
+                StringBuffer_append(B, "%s", value);
+                return;
+        }
+        for (const char *p = value; *p; p++) {
+                switch (*p) {
+                        case '\\':
+                                StringBuffer_append(B, "\\\\");
+                                break;
+                        case '"':
+                                StringBuffer_append(B, "\\\"");
+                                break;
+                        case '\n':
+                                StringBuffer_append(B, "\\n");
+                                break;
+                        default:
+                                StringBuffer_append(B, "%c", *p);
+                                break;
+                }
+        }
+}
+
+
+/**
+ * Write the metric family descriptor. The OpenMetrics format names the
+ * counter family without the "_total" suffix, the Prometheus text format
+ * uses the sample name
+ */
+static void _family(StringBuffer_T B, boolean_t openmetrics, const char *name, Metric_Type type, const char *help) {
+        const char *suffix = (type == Metric_Counter && ! openmetrics) ? "_total" : "";
+        StringBuffer_append(B, "# HELP %s%s %s\n# TYPE %s%s %s\n", name, suffix, help, name, suffix, type == Metric_Counter ? "counter" : "gauge");
+}
+
+
+/**
+ * Open a sample: write the sample name and the common service labels.
+ * The caller may append more labels and must close the sample with
+ * _end()
+ */
+static void _begin(StringBuffer_T B, const char *name, Metric_Type type, Service_T S) {
+        StringBuffer_append(B, "%s%s{service=\"", name, type == Metric_Counter ? "_total" : "");
+        _labelValue(B, S->name);
+        StringBuffer_append(B, "\",type=\"%s\"", typeNames[S->type]);
+}
+
+
+static void _end(StringBuffer_T B, Metric_Type type, double value) {
+        StringBuffer_append(B, type == Metric_Counter ? "} %.17g\n" : "} %.15g\n", value);
+}
+
+
+static void _metric(StringBuffer_T B, Service_T list, boolean_t openmetrics, Metric_T *m) {
+        boolean_t described = false;
+        for (Service_T s = list; s; s = s->next_conf) {
+                double value;
+                if ((m->service < 0 || m->service == s->type) && m->value(s, &value)) {
+                        if (! described) {
+                                _family(B, openmetrics, m->name, m->type, m->help);
+                                described = true;
+                        }
+                        _begin(B, m->name, m->type, s);
+                        _end(B, m->type, value);
+                }
+        }
+}
+
+
+/**
+ * Write an info metric family descriptor. The OpenMetrics format has an
+ * info type whose samples get the "_info" suffix, the Prometheus text
+ * format exports the same samples as a gauge
+ */
+static void _info(StringBuffer_T B, boolean_t openmetrics, const char *name, const char *help) {
+        if (openmetrics)
+                StringBuffer_append(B, "# HELP %s %s\n# TYPE %s info\n", name, help, name);
+        else
+                StringBuffer_append(B, "# HELP %s_info %s\n# TYPE %s_info gauge\n", name, help, name);
+}
+
+
+static void _groups(StringBuffer_T B, boolean_t openmetrics) {
+        if (servicegrouplist) {
+                _info(B, openmetrics, "monit_service_group", "Service group membership");
+                for (ServiceGroup_T sg = servicegrouplist; sg; sg = sg->next) {
+                        for (list_t m = sg->members->head; m; m = m->next) {
+                                _begin(B, "monit_service_group_info", Metric_Gauge, m->e);
+                                StringBuffer_append(B, ",group=\"");
+                                _labelValue(B, sg->name);
+                                StringBuffer_append(B, "\"} 1\n");
+                        }
+                }
+        }
+}
+
+
+static void _port(StringBuffer_T B, Service_T S, Port_T p, const char *name, Metric_Type type, double value) {
+        _begin(B, name, type, S);
+        StringBuffer_append(B, ",hostname=\"");
+        _labelValue(B, p->hostname);
+        StringBuffer_append(B, "\",port=\"%d\",protocol=\"%s\"", p->target.net.port, p->protocol->name ? p->protocol->name : "");
+        _end(B, type, value);
+}
+
+
+static void _portAddress(StringBuffer_T B, Service_T S, Port_T p, int i, const char *name, Metric_Type type, double value) {
+        _begin(B, name, type, S);
+        StringBuffer_append(B, ",hostname=\"");
+        _labelValue(B, p->hostname);
+        StringBuffer_append(B, "\",port=\"%d\",address=\"%s\"", p->target.net.port, p->address[i].ip);
+        _end(B, type, value);
+}
+
+
+static void _ports(StringBuffer_T B, Service_T list, boolean_t openmetrics) {
+        _family(B, openmetrics, "monit_port_up", Metric_Gauge, "Port availability (0 = failed, 1 = ok)");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->is_available != Connection_Init)
+                                        _port(B, s, p, "monit_port_up", Metric_Gauge, p->is_available == Connection_Ok);
+        _family(B, openmetrics, "monit_port_response_seconds", Metric_Gauge, "Port response time");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->is_available == Connection_Ok)
+                                        _port(B, s, p, "monit_port_response_seconds", Metric_Gauge, p->response / 1000.);
+        _family(B, openmetrics, "monit_port_resolve_seconds", Metric_Gauge, "Port host name resolution time");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->is_available == Connection_Ok)
+                                        _port(B, s, p, "monit_port_resolve_seconds", Metric_Gauge, p->resolve / 1000.);
+        _family(B, openmetrics, "monit_port_connect_seconds", Metric_Gauge, "Port connection time, 0 if a persistent connection was reused");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->is_available == Connection_Ok)
+                                        _port(B, s, p, "monit_port_connect_seconds", Metric_Gauge, p->connect / 1000.);
+        _family(B, openmetrics, "monit_port_request_seconds", Metric_Gauge, "Port protocol test time without the connection time");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->is_available == Connection_Ok)
+                                        _port(B, s, p, "monit_port_request_seconds", Metric_Gauge, (p->response - p->connect) / 1000.);
+        _family(B, openmetrics, "monit_port_address_up", Metric_Gauge, "Port availability by address of the host name (0 = failed, 1 = ok), addresses not tested in the last cycle are omitted");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->addresses > 1 && p->is_available != Connection_Init)
+                                        for (int i = 0; i < p->addresses; i++)
+                                                if (p->address[i].is_available != Connection_Init)
+                                                        _portAddress(B, s, p, i, "monit_port_address_up", Metric_Gauge, p->address[i].is_available == Connection_Ok);
+        _family(B, openmetrics, "monit_port_certificate_valid_days", Metric_Gauge, "Days until the server certificate expires");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->portlist; p; p = p->next)
+                                if (p->target.net.ssl.options.flags && p->is_available == Connection_Ok)
+                                        _port(B, s, p, "monit_port_certificate_valid_days", Metric_Gauge, p->target.net.ssl.certificate.validDays);
+}
+
+
+static void _socket(StringBuffer_T B, Service_T S, Port_T p, const char *name, double value) {
+        _begin(B, name, Metric_Gauge, S);
+        StringBuffer_append(B, ",path=\"");
+        _labelValue(B, p->target.unix.pathname);
+        StringBuffer_append(B, "\",protocol=\"%s\"", p->protocol->name ? p->protocol->name : "");
+        _end(B, Metric_Gauge, value);
+}
+
+
+static void _sockets(StringBuffer_T B, Service_T list, boolean_t openmetrics) {
+        _family(B, openmetrics, "monit_unix_socket_up", Metric_Gauge, "Unix socket availability (0 = failed, 1 = ok)");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->socketlist; p; p = p->next)
+                                if (p->is_available != Connection_Init)
+                                        _socket(B, s, p, "monit_unix_socket_up", p->is_available == Connection_Ok);
+        _family(B, openmetrics, "monit_unix_socket_response_seconds", Metric_Gauge, "Unix socket response time");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Port_T p = s->socketlist; p; p = p->next)
+                                if (p->is_available == Connection_Ok)
+                                        _socket(B, s, p, "monit_unix_socket_response_seconds", p->response / 1000.);
+}
+
+
+static void _icmp(StringBuffer_T B, Service_T S, Icmp_T i, const char *name, double value) {
+        _begin(B, name, Metric_Gauge, S);
+        StringBuffer_append(B, ",icmp=\"%s\"", icmpnames[i->type]);
+        _end(B, Metric_Gauge, value);
+}
+
+
+static void _icmps(StringBuffer_T B, Service_T list, boolean_t openmetrics) {
+        _family(B, openmetrics, "monit_icmp_up", Metric_Gauge, "Host reachability by ICMP (0 = failed, 1 = ok)");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Icmp_T i = s->icmplist; i; i = i->next)
+                                if (i->is_available != Connection_Init)
+                                        _icmp(B, s, i, "monit_icmp_up", i->is_available == Connection_Ok);
+        _family(B, openmetrics, "monit_icmp_response_seconds", Metric_Gauge, "ICMP response time");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Icmp_T i = s->icmplist; i; i = i->next)
+                                if (i->is_available == Connection_Ok)
+                                        _icmp(B, s, i, "monit_icmp_response_seconds", i->response / 1000.);
+        _family(B, openmetrics, "monit_icmp_loss_ratio", Metric_Gauge, "ICMP echo packet loss in the window of the last requests");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Icmp_T i = s->icmplist; i; i = i->next)
+                                if (i->window.count)
+                                        _icmp(B, s, i, "monit_icmp_loss_ratio", i->statistics.loss / 100.);
+        _family(B, openmetrics, "monit_icmp_jitter_seconds", Metric_Gauge, "ICMP response time jitter in the window of the last requests");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Icmp_T i = s->icmplist; i; i = i->next)
+                                if (i->window.count && i->statistics.average >= 0.)
+                                        _icmp(B, s, i, "monit_icmp_jitter_seconds", i->statistics.jitter / 1000.);
+        _family(B, openmetrics, "monit_icmp_response_p95_seconds", Metric_Gauge, "ICMP response time 95th percentile in the window of the last requests");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Icmp_T i = s->icmplist; i; i = i->next)
+                                if (i->window.count && i->statistics.average >= 0.)
+                                        _icmp(B, s, i, "monit_icmp_response_p95_seconds", i->statistics.percentile95 / 1000.);
+}
+
+
+static void _certificate(StringBuffer_T B, Service_T S, Certificate_T c, const char *name, double value) {
+        _begin(B, name, Metric_Gauge, S);
+        StringBuffer_append(B, ",hostname=\"");
+        _labelValue(B, c->hostname);
+        StringBuffer_append(B, "\",port=\"%d\"", c->port);
+        _end(B, Metric_Gauge, value);
+}
+
+
+static void _certificateChain(StringBuffer_T B, Service_T S, Certificate_T c, int depth, const char *name, double value) {
+        _begin(B, name, Metric_Gauge, S);
+        StringBuffer_append(B, ",hostname=\"");
+        _labelValue(B, c->hostname);
+        StringBuffer_append(B, "\",port=\"%d\",depth=\"%d\",subject=\"", c->port, depth);
+        _labelValue(B, c->chain[depth].subject);
+        StringBuffer_append(B, "\"");
+        _end(B, Metric_Gauge, value);
+}
+
+
+static void _certificates(StringBuffer_T B, Service_T list, boolean_t openmetrics) {
+        _family(B, openmetrics, "monit_certificate_up", Metric_Gauge, "TLS certificate test availability (0 = failed, 1 = ok)");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Certificate_T c = s->certificatelist; c; c = c->next)
+                                if (c->is_available != Connection_Init)
+                                        _certificate(B, s, c, "monit_certificate_up", c->is_available == Connection_Ok);
+        _family(B, openmetrics, "monit_certificate_handshake_seconds", Metric_Gauge, "TLS certificate test handshake time");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Certificate_T c = s->certificatelist; c; c = c->next)
+                                if (c->is_available == Connection_Ok)
+                                        _certificate(B, s, c, "monit_certificate_handshake_seconds", c->response / 1000.);
+        _family(B, openmetrics, "monit_certificate_valid_days", Metric_Gauge, "Days until the certificate of the chain expires");
+        for (Service_T s = list; s; s = s->next_conf)
+                if (Util_hasServiceStatus(s))
+                        for (Certificate_T c = s->certificatelist; c; c = c->next)
+                                if (c->is_available == Connection_Ok)
+                                        for (int i = 0; i < c->chainLength; i++)
+                                                _certificateChain(B, s, c, i, "monit_certificate_valid_days", (int)((c->chain[i].validTo - Time_now()) / 86400));
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/**
+ * Append the status of all services in the OpenMetrics text format. The
+ * latest snapshot is used if one was published
+ * @param B StringBuffer object
+ * @param openmetrics true for the OpenMetrics 1.0 format, false for
+ * the Prometheus 0.0.4 text format
+ * @param flush Optional function called with the context after each
+ * metric family, it may send the buffer content and clear the buffer
+ * @param context The flush function argument
+ */
+void status_metrics(StringBuffer_T B, boolean_t openmetrics, void (*flush)(void *), void *context) {
+        _info(B, openmetrics, "monit", "Monit version");
+        StringBuffer_append(B,
+                            "monit_info{version=\"%s\",id=\"%s\"} 1\n"
+                            "# HELP monit_uptime_seconds Monit uptime\n# TYPE monit_uptime_seconds gauge\n"
+                            "monit_uptime_seconds %lld\n",
+                            VERSION,
+                            Run.id,
+                            (long long)ProcessTree_getProcessUptime(getpid()));
+        _groups(B, openmetrics);
+        Snapshot_T snapshot = Snapshot_acquire();
+        Service_T list = snapshot ? snapshot->servicelist : servicelist_conf;
+        for (int i = 0; metrics[i].name; i++) {
+                _metric(B, list, openmetrics, &metrics[i]);
+                if (flush)
+                        flush(context);
+        }
+        _ports(B, list, openmetrics);
+        _sockets(B, list, openmetrics);
+        _icmps(B, list, openmetrics);
+        _certificates(B, list, openmetrics);
+        Snapshot_release(&snapshot);
+        if (openmetrics)
+                StringBuffer_append(B, "# EOF\n");
+}
+
+
+/**
+ * Append the metric values which changed between two snapshots as a JSON
+ * object. Only the services with a changed value are listed, the values
+ * are keyed by the metric family name. The collection timestamp, which
+ * changes in every cycle, is left out
+ * @param B StringBuffer object
+ * @param previous The snapshot to compare with
+ * @param current The latest snapshot
+ * @return The number of services with changed values
+ */
+int status_deltas(StringBuffer_T B, struct Snapshot_T *previous, struct Snapshot_T *current) {
+        int changed = 0;
+        StringBuffer_append(B, "{\"generation\":%llu,\"services\":[", current->generation);
+        for (Service_T s = current->servicelist; s; s = s->next_conf) {
+                Service_T p = Snapshot_getService(previous, s->name);
+                boolean_t listed = false;
+                for (int i = 0; metrics[i].name; i++) {
+                        Metric_T *m = &metrics[i];
+                        double value, old;
+                        if (m->value == _collected || (m->service >= 0 && m->service != s->type) || ! m->value(s, &value))
+                                continue;
+                        if (p && p->type == s->type && m->value(p, &old) && old == value)
+                                continue;
+                        if (! listed) {
+                                StringBuffer_append(B, "%s{\"service\":\"", changed++ ? "," : "");
+                                escapeJSON(B, s->name);
+                                StringBuffer_append(B, "\"");
+                                listed = true;
+                        }
+                        StringBuffer_append(B, m->type == Metric_Counter ? ",\"%s\":%.17g" : ",\"%s\":%.15g", m->name, value);
+                }
+                if (listed)
+                        StringBuffer_append(B, "}");
+        }
+        StringBuffer_append(B, "]}");
+        return changed;
+}
@@ -68,6 +68,10 @@
 #include <limits.h>
 #endif
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #include "monit.h"
 #include "processor.h"
 #include "base64.h"
@@ -106,12 +110,14 @@ static int _httpPostLimit;
 /* -------------------------------------------------------------- Prototypes */
 
 
-static void do_service(Socket_T);
+static boolean_t do_service(Socket_T *, boolean_t);
 static void destroy_entry(void *);
 static char *get_date(char *, int);
 static char *get_server(char *, int);
 static void create_headers(HttpRequest);
 static void send_response(HttpRequest, HttpResponse);
+static void send_head(HttpResponse, long long);
+static void send_stream(HttpResponse, boolean_t);
 static boolean_t basic_authenticate(HttpRequest);
 static void done(HttpRequest, HttpResponse);
 static void destroy_HttpRequest(HttpRequest);
@@ -123,6 +129,8 @@ static HttpRequest create_HttpRequest(Socket_T);
 static void internal_error(Socket_T, int, char *);
 static HttpResponse create_HttpResponse(Socket_T);
 static boolean_t is_authenticated(HttpRequest, HttpResponse);
+static boolean_t is_persistent(HttpRequest);
+static boolean_t has_unread_body(HttpRequest);
 static int get_next_token(char *s, int *cursor, char **r);
 
 
@@ -142,17 +150,22 @@ struct  ServiceImpl {
 
 
 /**
- * Process a HTTP request. This is done by dispatching to the service
- * function.
- * @param s A Socket_T representing the client connection
+ * Process one HTTP request. This is done by dispatching to the service
+ * function. The caller owns the socket and should close it unless this
+ * function returns true. If the cervlet took the connection over with
+ * detach_response(), the socket is set to NULL.
+ * @param S A reference to the Socket_T representing the client connection
+ * @param keepalive true if the server can keep the connection open for
+ * another request
+ * @return true if the connection was kept open for the next request,
+ * otherwise false
  */
-void *http_processor(Socket_T s) {
-        if (! Net_canRead(Socket_getSocket(s), REQUEST_TIMEOUT * 1000))
-                internal_error(s, SC_REQUEST_TIMEOUT, "Time out when handling the Request");
-        else
-                do_service(s);
-        Socket_free(&s);
-        return NULL;
+boolean_t http_processor(Socket_T *S, boolean_t keepalive) {
+        if (! Socket_hasBufferedData(*S) && ! Net_canRead(Socket_getSocket(*S), REQUEST_TIMEOUT * 1000)) {
+                internal_error(*S, SC_REQUEST_TIMEOUT, "Time out when handling the Request");
+                return false;
+        }
+        return do_service(S, keepalive);
 }
 
 
@@ -167,6 +180,39 @@ void add_Impl(void(*doGet)(HttpRequest, HttpResponse), void(*doPost)(HttpRequest
 }
 
 
+/**
+ * Check if the data received from a client contain a complete request.
+ * The server buffers the request until it is complete, so the processor
+ * never waits for a slow client. The body is counted for every method if
+ * its Content-Length is within the POST limit. A body which the processor
+ * doesn't read closes the connection after the response, so it's never
+ * parsed as the next request.
+ * @param data The data received, terminated with '\0'
+ * @param length The length of the data
+ * @return The length of the first request if complete, 0 if more data
+ * are needed or -1 if the request headers are too large
+ */
+int Processor_getRequestLength(const char *data, int length) {
+        ASSERT(data);
+        int contentLength = 0;
+        for (int line = 0, i = 0; i < length; i++) {
+                if (data[i] == '\n') {
+                        // The headers end with an empty line, an empty request line is passed to the processor which rejects it
+                        if (i == line || (i == line + 1 && data[line] == '\r')) {
+                                int headers = i + 1;
+                                if (contentLength > 0 && contentLength <= _httpPostLimit)
+                                        return length - headers >= contentLength ? headers + contentLength : 0;
+                                return headers;
+                        }
+                        line = i + 1;
+                        if (Str_startsWith(data + line, "Content-Length:"))
+                                contentLength = atoi(data + line + 15);
+                }
+        }
+        return length > REQ_HEADERLIMIT ? -1 : 0;
+}
+
+
 void Processor_setHttpPostLimit() {
         // Base buffer size (space for e.g. "action=<name>")
         _httpPostLimit = STRLEN;
@@ -176,6 +222,20 @@ void Processor_setHttpPostLimit() {
 }
 
 
+void escapeJSON(StringBuffer_T sb, const char *s) {
+        for (int i = 0; s[i]; i++) {
+                if (s[i] == '"' || s[i] == '\\')
+                        StringBuffer_append(sb, "\\%c", s[i]);
+                else if (s[i] == '\n')
+                        StringBuffer_append(sb, "\\n");
+                else if ((unsigned char)s[i] < 0x20)
+                        StringBuffer_append(sb, "\\u%04x", (unsigned char)s[i]);
+                else
+                        StringBuffer_append(sb, "%c", s[i]);
+        }
+}
+
+
 void escapeHTML(StringBuffer_T sb, const char *s) {
         for (int i = 0; s[i]; i++) {
                 if (s[i] == '<')
@@ -199,6 +259,11 @@ void escapeHTML(StringBuffer_T sb, const char *s) {
 void send_error(HttpRequest req, HttpResponse res, int code, const char *msg, ...) {
         ASSERT(msg);
 
+        if (res->stream.started) {
+                // The headers were sent already, the connection is closed to signal the incomplete body
+                res->stream.failed = true;
+                return;
+        }
         const char *err = get_status_string(code);
         reset_response(res);
         set_content_type(res, "text/html");
@@ -293,6 +358,80 @@ void set_content_type(HttpResponse res, const char *mime) {
 }
 
 
+/**
+ * Send a region of a file as the response body instead of the output
+ * buffer. The file is streamed to the client without being read into
+ * memory. The response takes ownership of the file descriptor.
+ * @param res HttpResponse object
+ * @param fd An open file descriptor of a regular file
+ * @param offset The file offset of the body
+ * @param length The body length
+ */
+void set_file(HttpResponse res, int fd, off_t offset, size_t length) {
+        ASSERT(fd >= 0);
+        if (res->file.fd >= 0)
+                close(res->file.fd);
+        res->file.fd = fd;
+        res->file.offset = offset;
+        res->file.length = length;
+}
+
+
+/**
+ * Send the output buffer to the client if it grew over RES_CHUNKSIZE, so
+ * a large body doesn't have to be kept in memory. The first flush sends
+ * the headers, so the status and the headers cannot be changed after it.
+ * The rest of the body is sent when the cervlet returns.
+ * @param res HttpResponse object
+ */
+void flush_response(HttpResponse res) {
+        if (StringBuffer_length(res->outputbuffer) < RES_CHUNKSIZE)
+                return;
+        if (! res->stream.started) {
+                // Only a successful response with a rendered body can be streamed
+                if (res->is_committed || res->status != SC_OK || res->file.fd >= 0 || res->compressed.data)
+                        return;
+                res->stream.started = true;
+                res->stream.chunked = IS(res->protocol, "HTTP/1.1");
+                if (! res->stream.chunked)
+                        res->keepalive = false;
+#ifdef HAVE_LIBZ
+                if (res->compress) {
+                        z_stream *zstream = CALLOC(1, sizeof(z_stream));
+                        if (deflateInit2(zstream, 6, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+                                res->stream.zstream = zstream;
+                                set_header(res, "Content-Encoding", "gzip");
+                        } else {
+                                FREE(zstream);
+                        }
+                }
+#endif
+                send_head(res, -1);
+        }
+        send_stream(res, false);
+}
+
+
+/**
+ * Send the headers of an open ended response and take the connection
+ * over from the HTTP server. The body ends when the connection is closed.
+ * The caller writes the body directly to the returned socket and must
+ * free the socket when done. The response cannot be used after this call.
+ * @param res HttpResponse object
+ * @return The client socket or NULL if the headers could not be sent
+ */
+Socket_T detach_response(HttpResponse res) {
+        ASSERT(! res->is_committed);
+        res->keepalive = false;
+        res->stream.chunked = false;
+        send_head(res, -1);
+        if (res->stream.failed)
+                return NULL;
+        res->detached = true;
+        return res->S;
+}
+
+
 /**
  * Returns the value of the specified header
  * @param req HttpRequest object
@@ -437,12 +576,21 @@ const char *get_status_string(int status) {
 
 /**
  * Receives standard HTTP requests from a client socket and dispatches
- * them to the doXXX methods defined in a cervlet module.
+ * them to the doXXX methods defined in a cervlet module. Returns true
+ * if the connection should be kept open.
  */
-static void do_service(Socket_T s) {
-        volatile HttpResponse res = create_HttpResponse(s);
-        volatile HttpRequest req = create_HttpRequest(s);
+static boolean_t do_service(Socket_T *S, boolean_t keepalive) {
+        boolean_t persistent = false;
+        volatile HttpResponse res = create_HttpResponse(*S);
+        volatile HttpRequest req = create_HttpRequest(*S);
         if (res && req) {
+                if (IS(req->protocol, "1.1"))
+                        res->protocol = "HTTP/1.1";
+#ifdef HAVE_LIBZ
+                const char *acceptEncoding = get_header(req, "Accept-Encoding");
+                res->compress = acceptEncoding && Str_sub(acceptEncoding, "gzip") ? true : false;
+#endif
+                res->keepalive = keepalive && is_persistent(req);
                 if (Run.httpd.socket.net.ssl.flags & SSL_Enabled)
                         set_header(res, "Strict-Transport-Security", "max-age=63072000; includeSubdomains; preload");
                 if (is_authenticated(req, res)) {
@@ -454,9 +602,15 @@ static void do_service(Socket_T s) {
                         else
                                 send_error(req, res, SC_NOT_IMPLEMENTED, "Method not implemented");
                 }
-                send_response(req, res);
+                if (res->detached) {
+                        *S = NULL;
+                } else {
+                        send_response(req, res);
+                        persistent = res->keepalive;
+                }
         }
         done(req, res);
+        return persistent;
 }
 
 
@@ -481,46 +635,137 @@ static char *get_server(char *result, int size) {
 }
 
 
+/**
+ * Send the status line and the headers. If length is -1 the body is streamed
+ * with chunked transfer encoding or, for a HTTP/1.0 client, the body ends
+ * when the connection is closed.
+ */
+static void send_head(HttpResponse res, long long length) {
+        char date[STRLEN];
+        char server[STRLEN];
+        char *headers = get_headers(res);
+        res->is_committed = true;
+        get_date(date, STRLEN);
+        get_server(server, STRLEN);
+        // Send the header block with one write, so a persistent connection doesn't suffer from many small packets
+        StringBuffer_T head = StringBuffer_create(RES_STRLEN);
+        StringBuffer_append(head, "%s %d %s\r\n", res->protocol, res->status, res->status_msg);
+        StringBuffer_append(head, "Date: %s\r\n", date);
+        StringBuffer_append(head, "Server: %s\r\n", server);
+        if (length >= 0) {
+                if (res->status != SC_NOT_MODIFIED)
+                        StringBuffer_append(head, "Content-Length: %lld\r\n", length);
+        } else if (res->stream.chunked) {
+                StringBuffer_append(head, "Transfer-Encoding: chunked\r\n");
+        }
+        StringBuffer_append(head, "Connection: %s\r\n", res->keepalive ? "keep-alive" : "close");
+        if (res->keepalive)
+                StringBuffer_append(head, "Keep-Alive: timeout=%d\r\n", KEEPALIVE_TIMEOUT);
+        if (headers)
+                StringBuffer_append(head, "%s", headers);
+        StringBuffer_append(head, "\r\n");
+        if (Socket_write(res->S, (void *)StringBuffer_toString(head), StringBuffer_length(head)) < 0)
+                res->stream.failed = true;
+        StringBuffer_free(&head);
+        FREE(headers);
+}
+
+
+/**
+ * Write a part of a streamed body, framed as a chunk if chunked transfer
+ * encoding is used
+ */
+static void write_chunk(HttpResponse res, const void *data, size_t length) {
+        if (length > 0 && ! res->stream.failed) {
+                if (res->stream.chunked && Socket_print(res->S, "%zx\r\n", length) < 0)
+                        res->stream.failed = true;
+                else if (Socket_write(res->S, (void *)data, length) < 0)
+                        res->stream.failed = true;
+                else if (res->stream.chunked && Socket_write(res->S, "\r\n", 2) < 0)
+                        res->stream.failed = true;
+        }
+}
+
+
+/**
+ * Send the content of the output buffer as a part of the streamed body and
+ * clear the buffer. If finish is true, the body is completed.
+ */
+static void send_stream(HttpResponse res, boolean_t finish) {
+        if (res->stream.copy) {
+                if (StringBuffer_length(res->stream.copy) + StringBuffer_length(res->outputbuffer) > RES_COPYLIMIT)
+                        StringBuffer_free(&(res->stream.copy)); // Keep the memory bounded, the body is not copied whole
+                else
+                        StringBuffer_append(res->stream.copy, "%s", StringBuffer_toString(res->outputbuffer));
+        }
+#ifdef HAVE_LIBZ
+        if (res->stream.zstream) {
+                z_stream *zstream = res->stream.zstream;
+                unsigned char out[RES_CHUNKSIZE];
+                zstream->next_in = (unsigned char *)StringBuffer_toString(res->outputbuffer);
+                zstream->avail_in = StringBuffer_length(res->outputbuffer);
+                int status;
+                do {
+                        zstream->next_out = out;
+                        zstream->avail_out = sizeof(out);
+                        status = deflate(zstream, finish ? Z_FINISH : Z_NO_FLUSH);
+                        if (status == Z_STREAM_ERROR) {
+                                res->stream.failed = true;
+                                break;
+                        }
+                        write_chunk(res, out, sizeof(out) - zstream->avail_out);
+                } while (zstream->avail_out == 0 || (finish && status != Z_STREAM_END));
+        } else
+#endif
+        {
+                write_chunk(res, StringBuffer_toString(res->outputbuffer), StringBuffer_length(res->outputbuffer));
+        }
+        StringBuffer_clear(res->outputbuffer);
+        if (finish && res->stream.chunked && ! res->stream.failed && Socket_write(res->S, "0\r\n\r\n", 5) < 0)
+                res->stream.failed = true;
+}
+
+
 /**
  * Send the response to the client. If the response has already been
- * commited, this function does nothing.
+ * commited, this function does nothing except of disabling the keep-alive
+ * as the cervlet which committed the response closes the connection. A
+ * streamed response is completed with the rest of the output buffer.
  */
 static void send_response(HttpRequest req, HttpResponse res) {
         Socket_T S = res->S;
 
-        if (! res->is_committed) {
-                char date[STRLEN];
-                char server[STRLEN];
-#ifdef HAVE_LIBZ
-                const char *acceptEncoding = get_header(req, "Accept-Encoding");
-                boolean_t canCompress = acceptEncoding && Str_sub(acceptEncoding, "gzip") ? true : false;
-#else
-                boolean_t canCompress = false;
-#endif
+        if (res->stream.started) {
+                send_stream(res, true);
+                if (res->stream.failed || ! res->stream.chunked)
+                        res->keepalive = false;
+        } else if (res->is_committed) {
+                res->keepalive = false;
+        } else {
                 const void *body = NULL;
                 size_t bodyLength = 0;
-                if (canCompress && StringBuffer_length(res->outputbuffer) > 0) {
+                if (res->file.fd >= 0) {
+                        // The body is streamed from the file below
+                        bodyLength = res->file.length;
+                } else if (res->compress && res->compressed.data) {
+                        // The cervlet provided a precompressed body
+                        body = res->compressed.data;
+                        bodyLength = res->compressed.length;
+                        set_header(res, "Content-Encoding", "gzip");
+                } else if (res->compress && StringBuffer_length(res->outputbuffer) > 0) {
                         body = StringBuffer_toCompressed(res->outputbuffer, 6, &bodyLength);
                         set_header(res, "Content-Encoding", "gzip");
                 } else {
                         body = StringBuffer_toString(res->outputbuffer);
                         bodyLength = StringBuffer_length(res->outputbuffer);
                 }
-                char *headers = get_headers(res);
-                res->is_committed = true;
-                get_date(date, STRLEN);
-                get_server(server, STRLEN);
-                Socket_print(S, "%s %d %s\r\n", res->protocol, res->status, res->status_msg);
-                Socket_print(S, "Date: %s\r\n", date);
-                Socket_print(S, "Server: %s\r\n", server);
-                Socket_print(S, "Content-Length: %zu\r\n", bodyLength);
-                Socket_print(S, "Connection: close\r\n");
-                if (headers)
-                        Socket_print(S, "%s", headers);
-                Socket_print(S, "\r\n");
-                if (bodyLength)
+                send_head(res, bodyLength);
+                if (res->file.fd >= 0) {
+                        if (Socket_sendFile(S, res->file.fd, res->file.offset, res->file.length) != (long long)res->file.length)
+                                res->keepalive = false; // The client cannot find the end of a short body
+                } else if (bodyLength) {
                         Socket_write(S, (unsigned char *)body, bodyLength);
-                FREE(headers);
+                }
         }
 }
 
@@ -576,7 +821,9 @@ static HttpResponse create_HttpResponse(Socket_T S) {
         res->S = S;
         res->status = SC_OK;
         res->outputbuffer = StringBuffer_create(256);
+        res->file.fd = -1;
         res->is_committed = false;
+        res->keepalive = false;
         res->protocol = SERVER_PROTOCOL;
         res->status_msg = get_status_string(SC_OK);
         Util_getToken(res->token);
@@ -660,6 +907,10 @@ static void reset_response(HttpResponse res) {
                 res->headers = NULL; /* Release Pragma */
         }
         StringBuffer_clear(res->outputbuffer);
+        if (res->file.fd >= 0) {
+                close(res->file.fd);
+                res->file.fd = -1;
+        }
 }
 
 
@@ -697,6 +948,17 @@ static void destroy_HttpRequest(HttpRequest req) {
 static void destroy_HttpResponse(HttpResponse res) {
         if (res) {
                 StringBuffer_free(&(res->outputbuffer));
+                FREE(res->compressed.data);
+                if (res->file.fd >= 0)
+                        close(res->file.fd);
+#ifdef HAVE_LIBZ
+                if (res->stream.zstream) {
+                        deflateEnd(res->stream.zstream);
+                        FREE(res->stream.zstream);
+                }
+#endif
+                if (res->stream.copy)
+                        StringBuffer_free(&(res->stream.copy));
                 if (res->headers)
                         destroy_entry(res->headers);
                 FREE(res);
@@ -790,6 +1052,40 @@ static boolean_t is_authenticated(HttpRequest req, HttpResponse res) {
 }
 
 
+/**
+ * Check if the request has a body which the processor doesn't read: the body
+ * of other method than POST, a POST body over the limit or a chunked body
+ */
+static boolean_t has_unread_body(HttpRequest req) {
+        if (get_header(req, "Transfer-Encoding"))
+                return true;
+        const char *content_length = get_header(req, "Content-Length");
+        if (content_length) {
+                long long length;
+                if (sscanf(content_length, "%lld", &length) != 1 || length < 0)
+                        return true;
+                return length > 0 && (! IS(req->method, METHOD_POST) || length > _httpPostLimit);
+        }
+        return false;
+}
+
+
+/**
+ * Check if the client asked for persistent connection. HTTP/1.1 connections
+ * are persistent unless the client sent "Connection: close", HTTP/1.0 clients
+ * must ask for keep-alive explicitly. The connection is closed if the request
+ * body was not read, so the body is not taken for the next request.
+ */
+static boolean_t is_persistent(HttpRequest req) {
+        if (has_unread_body(req))
+                return false;
+        const char *connection = get_header(req, "Connection");
+        if (IS(req->protocol, "1.1"))
+                return ! (connection && Str_sub(connection, "close"));
+        return connection && Str_sub(connection, "keep-alive");
+}
+
+
 /**
  * Authenticate the basic-credentials (uname/password) submitted by
  * the user.
@@ -52,9 +52,24 @@
 #define RES_STRLEN         2048
 #define MAX_URL_LENGTH     512
 
+/* Maximum size of the request line and headers */
+#define REQ_HEADERLIMIT    (64 * REQ_STRLEN)
+
 /* Request timeout in seconds */
 #define REQUEST_TIMEOUT    30
 
+/* Idle persistent connection timeout in seconds */
+#define KEEPALIVE_TIMEOUT  15
+
+/* Maximum number of requests served over one persistent connection */
+#define KEEPALIVE_MAX      100
+
+/* Size of the response output buffer before its content is sent as a chunk */
+#define RES_CHUNKSIZE      16384
+
+/* Maximum size of the copy of a streamed body, a larger body is not copied */
+#define RES_COPYLIMIT      (64 * RES_CHUNKSIZE)
+
 struct entry {
         char *name;
         char *value;
@@ -86,16 +101,36 @@ typedef struct response {
         Socket_T S;
         const char *protocol;
         boolean_t is_committed;
+        boolean_t keepalive;
+        boolean_t detached;   /**< The connection was taken over by the cervlet */
         HttpHeader headers;
         const char *status_msg;
         StringBuffer_T outputbuffer;
+        boolean_t compress;      /**< The client accepts a gzip compressed body */
+        struct {
+                void *data;
+                size_t length;
+        } compressed;
+        struct {
+                boolean_t started;     /**< The headers were sent, the body follows */
+                boolean_t chunked;   /**< Chunked encoding, else the body ends on close */
+                boolean_t failed;       /**< The body could not be sent completely */
+                void *zstream;            /**< Deflate state of a compressed stream */
+                StringBuffer_T copy;  /**< If set, receives a copy of the body up to RES_COPYLIMIT, freed if the body is larger */
+        } stream;
+        struct {
+                int fd;                    /**< File sent as the body or -1 */
+                off_t offset;
+                size_t length;
+        } file;
         MD_T token;
         Ssl_T ssl;
 } *HttpResponse;
 
 
 /* Public prototypes */
-void *http_processor(Socket_T);
+boolean_t http_processor(Socket_T *, boolean_t keepalive);
+int Processor_getRequestLength(const char *data, int length);
 char *get_headers(HttpResponse res);
 void set_status(HttpResponse res, int status);
 const char *get_status_string(int status_code);
@@ -103,9 +138,13 @@ void add_Impl(void(*doGet)(HttpRequest, HttpResponse), void(*doPost)(HttpRequest
 void set_content_type(HttpResponse res, const char *mime);
 const char *get_header(HttpRequest req, const char *header_name);
 void escapeHTML(StringBuffer_T sb, const char *s);
+void escapeJSON(StringBuffer_T sb, const char *s);
 void send_error(HttpRequest, HttpResponse, int status, const char *message, ...) __attribute__((format (printf, 4, 5)));
 const char *get_parameter(HttpRequest req, const char *parameter_name);
 void set_header(HttpResponse res, const char *name, const char *value, ...) __attribute__((format (printf, 3, 4)));
+void set_file(HttpResponse res, int fd, off_t offset, size_t length);
+void flush_response(HttpResponse res);
+Socket_T detach_response(HttpResponse res);
 void Processor_setHttpPostLimit();
 
 #endif
@@ -56,6 +56,7 @@
 #include "event.h"
 #include "ProcessTree.h"
 #include "protocol.h"
+#include "snapshot.h"
 
 
 /**
@@ -426,10 +427,29 @@ static void status_service(Service_T S, StringBuffer_T B, int V) {
                         StringBuffer_append(B,
                                             "<icmp>"
                                             "<type>%s</type>"
-                                            "<responsetime>%.6f</responsetime>"
-                                            "</icmp>",
+                                            "<responsetime>%.6f</responsetime>",
                                             icmpnames[i->type],
                                             i->is_available == Connection_Ok ? i->response / 1000. : -1.); // We send the response time in [s] for backward compatibility (with microseconds precision)
+                        if (i->window.count)
+                                StringBuffer_append(B,
+                                            "<statistics>"
+                                            "<requests>%d</requests>"
+                                            "<loss>%.1f</loss>"
+                                            "<minimum>%.6f</minimum>"
+                                            "<average>%.6f</average>"
+                                            "<maximum>%.6f</maximum>"
+                                            "<percentile95>%.6f</percentile95>"
+                                            "<jitter>%.6f</jitter>"
+                                            "</statistics>",
+                                            i->window.count,
+                                            i->statistics.loss,
+                                            i->statistics.minimum >= 0. ? i->statistics.minimum / 1000. : -1.,
+                                            i->statistics.average >= 0. ? i->statistics.average / 1000. : -1.,
+                                            i->statistics.maximum >= 0. ? i->statistics.maximum / 1000. : -1.,
+                                            i->statistics.percentile95 >= 0. ? i->statistics.percentile95 / 1000. : -1.,
+                                            i->statistics.jitter / 1000.);
+                        StringBuffer_append(B,
+                                            "</icmp>");
                 }
                 for (Port_T p = S->portlist; p; p = p->next) {
                         StringBuffer_append(B,
@@ -490,18 +510,18 @@ static void status_service(Service_T S, StringBuffer_T B, int V) {
                                             "<kilobyte>%llu</kilobyte>"
                                             "</swap>"
                                             "</system>",
-                                            systeminfo.loadavg[0],
-                                            systeminfo.loadavg[1],
-                                            systeminfo.loadavg[2],
-                                            systeminfo.cpu.usage.user > 0. ? systeminfo.cpu.usage.user : 0.,
-                                            systeminfo.cpu.usage.system > 0. ? systeminfo.cpu.usage.system : 0.,
+                                            S->inf.system->loadavg[0],
+                                            S->inf.system->loadavg[1],
+                                            S->inf.system->loadavg[2],
+                                            S->inf.system->cpu.usage.user > 0. ? S->inf.system->cpu.usage.user : 0.,
+                                            S->inf.system->cpu.usage.system > 0. ? S->inf.system->cpu.usage.system : 0.,
 #ifdef HAVE_CPU_WAIT
-                                            systeminfo.cpu.usage.wait > 0. ? systeminfo.cpu.usage.wait : 0.,
+                                            S->inf.system->cpu.usage.wait > 0. ? S->inf.system->cpu.usage.wait : 0.,
 #endif
-                                            systeminfo.memory.usage.percent,
-                                            (unsigned long long)((double)systeminfo.memory.usage.bytes / 1024.),               // Send as kB for backward compatibility
-                                            systeminfo.swap.usage.percent,
-                                            (unsigned long long)((double)systeminfo.swap.usage.bytes / 1024.));             // Send as kB for backward compatibility
+                                            S->inf.system->memory.usage.percent,
+                                            (unsigned long long)((double)S->inf.system->memory.usage.bytes / 1024.),               // Send as kB for backward compatibility
+                                            S->inf.system->swap.usage.percent,
+                                            (unsigned long long)((double)S->inf.system->swap.usage.bytes / 1024.));             // Send as kB for backward compatibility
                 }
                 if (S->type == Service_Program && S->program->started) {
                         StringBuffer_append(B,
@@ -572,20 +592,29 @@ static void status_event(Event_T E, StringBuffer_T B) {
 
 /**
  * Get a XML formated message for event notification or general status
- * of monitored services and resources.
+ * of monitored services and resources. The event message is created by
+ * the validation thread from the live service list, the general status
+ * from the latest snapshot.
  * @param E An event object or NULL for general status
  * @param V Format version
  * @param myip The client-side IP address
+ * @param flush Optional function called with the context after each
+ * service, it may send the buffer content and clear the buffer
+ * @param context The flush function argument
  */
-void status_xml(StringBuffer_T B, Event_T E, int V, const char *myip) {
+void status_xml(StringBuffer_T B, Event_T E, int V, const char *myip, void (*flush)(void *), void *context) {
         Service_T S;
         ServiceGroup_T SG;
+        Snapshot_T snapshot = E ? NULL : Snapshot_acquire();
 
         document_head(B, V, myip);
         if (V == 2)
                 StringBuffer_append(B, "<services>");
-        for (S = servicelist_conf; S; S = S->next_conf)
+        for (S = snapshot ? snapshot->servicelist : servicelist_conf; S; S = S->next_conf) {
                 status_service(S, B, V);
+                if (flush)
+                        flush(context);
+        }
         if (V == 2) {
                 StringBuffer_append(B, "</services><servicegroups>");
                 for (SG = servicegrouplist; SG; SG = SG->next)
@@ -595,5 +624,6 @@ void status_xml(StringBuffer_T B, Event_T E, int V, const char *myip) {
         if (E)
                 status_event(E, B);
         document_foot(B);
+        Snapshot_release(&snapshot);
 }
 
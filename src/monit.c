@@ -74,8 +74,10 @@
 #include "net.h"
 #include "ProcessTree.h"
 #include "state.h"
+#include "snapshot.h"
 #include "event.h"
 #include "engine.h"
+#include "eventstream.h"
 #include "client.h"
 #include "MMonit.h"
 
@@ -344,6 +346,7 @@ static void do_reinit() {
         /* Save the current state (no changes are possible now since the http thread is stopped) */
         State_save();
         State_close();
+        Event_save_limiters();
 
         /* Run the garbage collector */
         gc();
@@ -378,6 +381,7 @@ static void do_reinit() {
         if (! State_open())
                 exit(1);
         State_restore();
+        Snapshot_publish();
 
         /* Start http interface */
         if (can_http())
@@ -413,13 +417,11 @@ static void do_action(char **args) {
                         int errors = 0;
                         List_T services = List_new();
                         if (Run.mygroup) {
-                                for (ServiceGroup_T sg = servicegrouplist; sg; sg = sg->next) {
-                                        if (IS(Run.mygroup, sg->name)) {
-                                                for (list_t m = sg->members->head; m; m = m->next) {
-                                                        Service_T s = m->e;
-                                                        List_append(services, s->name);
-                                                }
-                                                break;
+                                ServiceGroup_T sg = Util_getServiceGroup(Run.mygroup);
+                                if (sg) {
+                                        for (list_t m = sg->members->head; m; m = m->next) {
+                                                Service_T s = m->e;
+                                                List_append(services, s->name);
                                         }
                                 }
                                 if (List_length(services) == 0) {
@@ -543,6 +545,7 @@ static void do_default() {
                 if (! State_open())
                         exit(1);
                 State_restore();
+                Snapshot_publish();
 
                 atexit(file_finalize);
 
@@ -572,6 +575,8 @@ static void do_default() {
 
                 while (true) {
                         validate();
+                        Snapshot_publish();
+                        EventStream_update();
                         State_save();
 
                         /* In the case that there is no pending action then sleep */
@@ -331,7 +331,13 @@ typedef enum {
         Resource_ReadOperations,
         Resource_WriteBytes,
         Resource_WriteOperations,
-        Resource_ServiceTime
+        Resource_ServiceTime,
+        Resource_IcmpLoss,
+        Resource_IcmpJitter,
+        Resource_IcmpResponseMinimum,
+        Resource_IcmpResponseAverage,
+        Resource_IcmpResponseMaximum,
+        Resource_IcmpResponsePercentile95
 } __attribute__((__packed__)) Resource_Type;
 
 
@@ -382,6 +388,26 @@ typedef enum {
 #define ICMP_SIZE 64
 #define ICMP_MAXSIZE 1500
 #define ICMP_ATTEMPT_COUNT 3
+#define ICMP_INTERVAL 100 // Delay between the echo requests to one host [ms]
+#define ICMP_WINDOW 100   // Number of the last echo requests used for the ping statistics
+
+
+/* Addresses of a host name tested concurrently and the delay between the connection attempts [ms] (RFC 8305) */
+#define PORT_ADDRESS_MAX 8
+#define PORT_ATTEMPT_DELAY 250
+
+
+/* UDP probe: the largest request/response and the initial and minimum retransmission timeout [ms] */
+#define UDP_MAXSIZE 1500
+#define UDP_RTO_INITIAL 500
+#define UDP_RTO_MIN 100
+
+/* UDP probe: the maximum number of ICMP errors of earlier requests skipped by one send */
+#define UDP_PENDINGMAX 16
+
+
+/* Maximum number of certificates of the chain kept by the certificate test */
+#define CERTIFICATE_CHAIN_MAX 8
 
 
 /* Default limits */
@@ -449,9 +475,21 @@ typedef struct Limits_T {
         uint32_t stopTimeout;                     /**< Default stop timeout [ms] */
         uint32_t startTimeout;                   /**< Default start timeout [ms] */
         uint32_t restartTimeout;               /**< Default restart timeout [ms] */
+        uint32_t notificationRate;  /**< Max. notifications per window, 0 = no limit */
+        uint32_t notificationWindow;         /**< Notification rate window [s] */
+        uint32_t eventNotificationRate; /**< Max. notifications per event and window */
+        uint32_t eventNotificationWindow;   /**< Event notification rate window [s] */
 } Limits_T;
 
 
+/** Defines a token bucket used to limit the rate of notifications */
+typedef struct TokenBucket_T {
+        double tokens;                                     /**< Available tokens */
+        time_t refilled;                      /**< When the bucket was refilled last */
+        unsigned int suppressed;     /**< Notifications suppressed since last sent */
+} TokenBucket_T;
+
+
 /**
  * Defines a Command with ARGMAX optional arguments. The arguments
  * array must be NULL terminated and the first entry is the program
@@ -596,10 +634,26 @@ typedef struct SystemInfo_T {
 } SystemInfo_T;
 
 
+/** Defines a request/response exchange of a datagram protocol */
+typedef struct Transaction_T {
+        struct Port_T *port;                                       /**< The port test */
+        uint32_t id;          /**< Random identifier matching the response to the request */
+        char local[46];                           /**< Local address of the request */
+        int localPort;                               /**< Local port of the request */
+        int size;              /**< Size of the response to read from a stream socket */
+        int length;                                           /**< Request length */
+        unsigned char request[UDP_MAXSIZE];                               /**< Request */
+} *Transaction_T;
+
+
 /** Defines a protocol object with protocol functions */
 typedef struct Protocol_T {
         const char *name;                                       /**< Protocol name */
         void (*check)(Socket_T);          /**< Protocol verification function */
+        void (*ping)(Socket_T);  /**< Liveness test of a persistent connection */
+        void (*encode)(Transaction_T);             /**< Datagram request encoder */
+        boolean_t (*decode)(Transaction_T, const unsigned char *, int); /**< Datagram response decoder */
+        int (*pipeline)(Socket_T, struct Port_T **, int); /**< Test of several ports on one keep-alive connection */
 } *Protocol_T;
 
 
@@ -642,6 +696,24 @@ typedef struct Port_T {
         int retry;       /**< Number of connection retry before reporting an error */
         volatile int socket;                       /**< Socket used for connection */
         double response;                 /**< Socket connection response time [ms] */
+        double resolve;                     /**< Host name resolution time [ms] */
+        double connect;     /**< Connection time [ms], 0 if the connection was reused */
+        boolean_t persistent;          /**< Keep the connection open between tests */
+        Socket_T connection;                          /**< The persistent connection */
+        int addresses;                         /**< Number of the tested addresses */
+        struct {
+                char ip[46];                                /**< Numeric address */
+                Connection_State is_available; /**< Init if the attempt was cancelled */
+                double connect;                            /**< Connection time [ms] */
+        } address[PORT_ADDRESS_MAX];  /**< Connection results of the last test by address */
+        struct {
+                boolean_t done; /**< The UDP probe or the pipeline tested the port in this cycle */
+                double response;                          /**< Response time [ms] */
+                double srtt;         /**< Smoothed round-trip time [ms], 0 if unknown */
+                double rttvar;                      /**< Round-trip time variation [ms] */
+                int sent;                 /**< Number of requests sent in this cycle */
+                char error[STRLEN];               /**< Error description if failed */
+        } probe;
         Socket_Type type;           /**< Socket type used for connection (UDP/TCP) */
         Socket_Family family;    /**< Socket family used for connection (NET/UNIX) */
         Connection_State is_available;               /**< Server/port availability */
@@ -726,7 +798,21 @@ typedef struct Icmp_T {
         int timeout;         /**< The timeout in milliseconds to wait for response */
         Connection_State is_available;    /**< Flag for the server is availability */
         Socket_Family family;                 /**< ICMP family used for connection */
-        double response;                         /**< ICMP ECHO response time [ms] */
+        double response;                 /**< ICMP ECHO average response time [ms] */
+        struct {
+                int index;                           /**< Position of the next sample */
+                int count;                                     /**< Number of samples */
+                double response[ICMP_WINDOW];/**< Response time [ms], -1 if the reply was lost */
+        } window;                       /**< Ring buffer of the last echo requests */
+        struct {
+                double minimum;                       /**< Minimum response time [ms] */
+                double average;                       /**< Average response time [ms] */
+                double maximum;                       /**< Maximum response time [ms] */
+                double percentile95;          /**< 95th percentile response time [ms] */
+                double loss;                                     /**< Packet loss [%] */
+                double jitter;                             /**< Response jitter [ms] */
+        } statistics;                                 /**< Statistics of the window */
+        boolean_t swept;  /**< The response was collected by the sweep in this cycle */
         Outgoing_T outgoing;                                 /**< Outgoing address */
         EventAction_T action;  /**< Description of the action upon event occurence */
 
@@ -735,6 +821,30 @@ typedef struct Icmp_T {
 } *Icmp_T;
 
 
+/** Defines a TLS certificate test */
+typedef struct Certificate_T {
+        char *hostname;                                     /**< Hostname to check */
+        int port;                                                   /**< Port number */
+        int timeout;      /**< The timeout in [ms] to wait for connect and handshake */
+        int every;                                       /**< Test interval [cycles] */
+        int cycle;                                /**< Cycles since the last test */
+        int minimumDays;          /**< Minimum valid days of the chain, 0 if not tested */
+        Socket_Family family;                 /**< Socket family used for connection */
+        Outgoing_T outgoing;                                 /**< Outgoing address */
+        struct SslOptions_T options;
+        Connection_State is_available;    /**< Flag for the server is availability */
+        double response;                                 /**< Handshake time [ms] */
+        boolean_t verified;     /**< true if the last handshake verified the chain */
+        char fingerprint[65];   /**< SHA-256 fingerprint of the verified certificate */
+        int chainLength;                   /**< Number of certificates in the chain */
+        SslCertificate_T chain[CERTIFICATE_CHAIN_MAX]; /**< Chain of the last test */
+        EventAction_T action;  /**< Description of the action upon event occurence */
+
+        /** For internal use */
+        struct Certificate_T *next;                 /**< next certificate in chain */
+} *Certificate_T;
+
+
 typedef struct Dependant_T {
         char *dependant;                            /**< name of dependant service */
 
@@ -1093,7 +1203,7 @@ typedef struct NetInfo_T {
 
 /** Defines service data */
 typedef union Info_T {
-        //FIXME: move global SystemInfo_T systeminfo here (for System service context)
+        SystemInfo_T    *system;           /**< Points to the global systeminfo */
         DirectoryInfo_T  directory;
         FifoInfo_T       fifo;
         FileInfo_T       file;
@@ -1129,6 +1239,7 @@ typedef struct Service_T {
 
         /** Test rules and event handlers */
         ActionRate_T actionratelist;                    /**< ActionRate check list */
+        Certificate_T certificatelist;          /**< TLS certificate check list */
         Checksum_T  checksum;                                  /**< Checksum check */
         FileSystem_T filesystemlist;                    /**< Filesystem check list */
         Icmp_T      icmplist;                                 /**< ICMP check list */
@@ -1177,7 +1288,7 @@ typedef struct Service_T {
 
         /** Events */
         struct myevent {
-                #define           EVENT_VERSION  4      /**< The event structure version */
+                #define           EVENT_VERSION  5      /**< The event structure version */
                 long              id;                      /**< The event identification */
                 struct timeval    collected;                /**< When the event occurred */
                 struct Service_T *source;                              /**< Event source */
@@ -1190,9 +1301,15 @@ typedef struct Service_T {
                 unsigned int      count;                             /**< The event rate */
                 char             *message;    /**< Optional message describing the event */
                 EventAction_T     action;           /**< Description of the event action */
+                TokenBucket_T     limiter;            /**< Notification rate limiter */
                 /** For internal use */
                 struct myevent   *next;                         /**< next event in chain */
         } *eventlist;                                     /**< Pending events list */
+        struct {
+                int size;                   /**< Number of slots (power of two) */
+                int count;                          /**< Number of indexed events */
+                struct myevent **slots; /**< Open addressing table of eventlist */
+        } eventindex;                /**< Pending events index by id and action */
 
         /** Context specific parameters */
         char *path;  /**< Path to the filesys, file, directory or process pid file */
@@ -1239,8 +1356,10 @@ struct Run_T {
         int  facility;              /** The facility to use when running openlog() */
         int  eventlist_slots;          /**< The event queue size - number of slots */
         int mailserver_timeout; /**< Connect and read timeout ms for a SMTP server */
+        int mailserver_idle;  /**< Seconds an idle SMTP session is kept for reuse */
         time_t incarnation;              /**< Unique ID for running monit instance */
         int  handler_queue[Handler_Max + 1];       /**< The handlers queue counter */
+        TokenBucket_T notificationLimiter;  /**< Rate limiter for all notifications */
         Service_T system;                          /**< The general system service */
         char *eventlist_dir;                   /**< The event queue base directory */
 
@@ -1354,6 +1473,7 @@ void  gc();
 void  gc_mail_list(Mail_T *);
 void  gccmd(command_t *);
 void  gc_event(Event_T *e);
+void  gc_service_events(Service_T);
 boolean_t kill_daemon(int);
 int   exist_daemon();
 boolean_t sendmail(Mail_T);
@@ -1371,7 +1491,10 @@ State_Type check_fifo(Service_T);
 State_Type check_program(Service_T);
 State_Type check_net(Service_T);
 int  check_URL(Service_T s);
-void status_xml(StringBuffer_T, Event_T, int, const char *);
+void status_xml(StringBuffer_T, Event_T, int, const char *, void (*)(void *), void *);
+void status_metrics(StringBuffer_T, boolean_t, void (*)(void *), void *);
+struct Snapshot_T;
+int  status_deltas(StringBuffer_T, struct Snapshot_T *, struct Snapshot_T *);
 boolean_t  do_wakeupcall();
 
 #endif
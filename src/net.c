@@ -108,6 +108,17 @@
 #include <netinet/icmp6.h>
 #endif
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#ifdef IP_RECVERR
+#define UDP_RECVERR 1
+#endif
+#endif
+
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -138,6 +149,7 @@
 
 #include "monit.h"
 #include "net.h"
+#include "resolver.h"
 
 // libmonit
 #include "system/Net.h"
@@ -153,6 +165,83 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+typedef enum {
+        Probe_Waiting = 0,
+        Probe_Sent,
+        Probe_Received,
+        Probe_Lost
+} __attribute__((__packed__)) Probe_State;
+
+
+/* Echo request of the ping sweep, the index in the sweep is the ICMP sequence number */
+typedef struct Probe_T {
+        int host;                                   /**< Index of the host */
+        int round;                                 /**< Request number of the host */
+        Probe_State state;
+        int64_t sent;                                   /**< Send time [us] */
+        double response;                          /**< Response time [ms] */
+} Probe_T;
+
+
+/* Raw ICMP socket shared by all hosts with the same address family and outgoing address */
+typedef struct Raw_T {
+        int family;
+        int socket;
+        int error;                /**< errno if the socket cannot be used */
+        Outgoing_T *outgoing;
+} Raw_T;
+
+
+typedef struct Host_T {
+        IcmpEcho_T *echo;
+        struct addrinfo *result;
+        struct addrinfo *addr;                         /**< The pinged address */
+        Raw_T *raw;                       /**< Socket or NULL if not pinged */
+        int first;                         /**< Index of the first request */
+        Probe_T *probe;                            /**< The host's requests */
+        int received;                       /**< Number of received replies */
+} Host_T;
+
+
+typedef struct Sweep_T {
+        uint16_t id;                                  /**< ICMP identifier */
+        int hosts;
+        int probes;
+        int sockets;
+        int outstanding;         /**< Number of requests waiting for reply */
+        Host_T *host;
+        Probe_T *probe;
+        Raw_T *socket;
+} *Sweep_T;
+
+
+/* UDP socket shared by all port tests of the UDP probe with the same address family and outgoing address */
+typedef struct Udp_T {
+        int family;
+        int socket;
+        int port;                                            /**< Local port */
+        Outgoing_T *outgoing;
+} Udp_T;
+
+
+/* Request of a port test in the UDP probe */
+typedef struct Query_T {
+        struct Transaction_T transaction;
+        struct addrinfo *result;
+        struct addrinfo *addr;                         /**< The probed address */
+        Udp_T *udp;
+        boolean_t done;
+        int rto;                           /**< Retransmission timeout [ms] */
+        int64_t started;                        /**< First request time [us] */
+        int64_t sent;                            /**< Last request time [us] */
+        int64_t retransmit;              /**< Next retransmission time [us] */
+        int64_t deadline;                            /**< Response deadline [us] */
+} Query_T;
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -190,137 +279,100 @@ static void __attribute__((format (printf, 3, 4))) _LogWarningOrError(int attemp
 }
 
 
-/* ------------------------------------------------------------------ Public */
-
-
-int create_server_socket_tcp(const char *address, int port, Socket_Family family, int backlog, char error[STRLEN]) {
-        struct addrinfo *result, hints = {
-                .ai_flags = AI_PASSIVE,
-                .ai_socktype = SOCK_STREAM,
-                .ai_protocol = IPPROTO_TCP
-        };
+static void _setPingOptions(int socket, int family) {
+#ifdef HAVE_IPV6
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+#endif
+        int ttl = 255;
         switch (family) {
-                case Socket_Ip:
-                        hints.ai_family = AF_UNSPEC;
-                        break;
-                case Socket_Ip4:
-                        hints.ai_family = AF_INET;
+                case AF_INET:
+                        setsockopt(socket, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
                         break;
 #ifdef HAVE_IPV6
-                case Socket_Ip6:
-                        hints.ai_family = AF_INET6;
+                case AF_INET6:
+                        setsockopt(socket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+                        setsockopt(socket, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+                        setsockopt(socket, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(struct icmp6_filter));
                         break;
 #endif
                 default:
-                        snprintf(error, STRLEN, "Invalid socket family %d", family);
-                        return -1;
-        }
-        char _port[6];
-        snprintf(_port, sizeof(_port), "%d", port);
-        int status = getaddrinfo(address, _port, &hints, &result);
-        if (status) {
-                snprintf(error, STRLEN, "Cannot translate %s socket [%s]:%d -- %s", socketnames[family], NVLSTR(address), port, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
-                return -1;
-        }
-        int flag = 1;
-        for (struct addrinfo *_result = result; _result; _result = _result->ai_next) {
-                int s = socket(_result->ai_family, _result->ai_socktype, _result->ai_protocol);
-                if (s != -1) {
-                        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(flag)) == 0) {
-                                if (Net_setNonBlocking(s)) {
-                                        if (fcntl(s, F_SETFD, FD_CLOEXEC) != -1) {
-                                                if (family != Socket_Ip6 || setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(flag)) == 0) {
-                                                        if (bind(s, _result->ai_addr, _result->ai_addrlen) == 0) {
-                                                                if (listen(s, backlog) == 0) {
-                                                                        freeaddrinfo(result);
-                                                                        return s;
-                                                                } else {
-                                                                        snprintf(error, STRLEN, "Cannot listen: %s", STRERROR);
-                                                                }
-                                                        } else {
-                                                                snprintf(error, STRLEN, "Cannot bind: %s", STRERROR);
-                                                        }
-                                                } else {
-                                                        snprintf(error, STRLEN, "Cannot set IPV6_V6ONLY option: %s", STRERROR);
-                                                }
-                                        } else {
-                                                snprintf(error, STRLEN, "Cannot set close on exec option: %s", STRERROR);
-                                        }
-                                } else {
-                                        snprintf(error, STRLEN, "Cannot set nonblocking socket: %s", STRERROR);
-                                }
-                        } else {
-                                snprintf(error, STRLEN, "Cannot set reuseaddr option: %s", STRERROR);
-                        }
-                        if (close(s) < 0)
-                                LogError("Server socket %d close failed: %s\n", s, STRERROR);
-                } else {
-                        snprintf(error, STRLEN, "Cannot create socket: %s", STRERROR);
-                }
+                        break;
         }
-        freeaddrinfo(result);
-        return -1;
 }
 
 
-int create_server_socket_unix(const char *path, int backlog, char error[STRLEN]) {
-        int s = socket(AF_UNIX, SOCK_STREAM, 0);
-        if (s < 0) {
-                snprintf(error, STRLEN, "Cannot create socket -- %s", STRERROR);
-                return -1;
-        }
-        struct sockaddr_un addr = {
-                .sun_family = AF_UNIX
-        };
-        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
-        if (Net_setNonBlocking(s)) {
-                if (fcntl(s, F_SETFD, FD_CLOEXEC) != -1) {
-                        if (bind(s, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == 0) {
-                                if (listen(s, backlog) == 0) {
-                                        return s;
-                                } else {
-                                        snprintf(error, STRLEN, "Cannot listen -- %s", STRERROR);
-                                }
-                        } else {
-                                snprintf(error, STRLEN, "Cannot bind -- %s", STRERROR);
-                        }
-                } else {
-                        snprintf(error, STRLEN, "Cannot set close on exec option -- %s", STRERROR);
-                }
-        } else {
-                snprintf(error, STRLEN, "Cannot set nonblocking socket: %s", STRERROR);
-        }
-        if (close(s) < 0)
-                LogError("Socket %d close failed -- %s\n", s, STRERROR);
-        return -1;
+static boolean_t _isSameOutgoing(Outgoing_T *a, Outgoing_T *b) {
+        return a->addrlen == b->addrlen && (a->addrlen == 0 || memcmp(&(a->addr), &(b->addr), a->addrlen) == 0);
 }
 
 
-static void _setPingOptions(int socket, struct addrinfo *addr) {
+static boolean_t _isSameAddress(struct sockaddr_storage *a, struct sockaddr *b) {
+        if (a->ss_family == b->sa_family) {
+                switch (b->sa_family) {
+                        case AF_INET:
+                                return memcmp(&((struct sockaddr_in *)a)->sin_addr, &((struct sockaddr_in *)b)->sin_addr, sizeof(struct in_addr)) == 0;
 #ifdef HAVE_IPV6
-        struct icmp6_filter filter;
-        ICMP6_FILTER_SETBLOCKALL(&filter);
-        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+                        case AF_INET6:
+                                return memcmp(&((struct sockaddr_in6 *)a)->sin6_addr, &((struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr)) == 0;
 #endif
-        int ttl = 255;
-        switch (addr->ai_family) {
+                        default:
+                                break;
+                }
+        }
+        return false;
+}
+
+
+/*
+ * Get the raw socket for the given address family and outgoing address, the
+ * socket is created on the first use and shared by all hosts of the sweep
+ */
+static Raw_T *_getSocket(Sweep_T S, int family, Outgoing_T *outgoing) {
+        for (int i = 0; i < S->sockets; i++)
+                if (S->socket[i].family == family && _isSameOutgoing(S->socket[i].outgoing, outgoing))
+                        return &S->socket[i];
+        Raw_T *raw = &S->socket[S->sockets++];
+        raw->family = family;
+        raw->outgoing = outgoing;
+        switch (family) {
                 case AF_INET:
-                        setsockopt(socket, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+                        raw->socket = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
                         break;
 #ifdef HAVE_IPV6
                 case AF_INET6:
-                        setsockopt(socket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
-                        setsockopt(socket, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
-                        setsockopt(socket, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(struct icmp6_filter));
+                        raw->socket = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
                         break;
 #endif
                 default:
+                        raw->socket = -1;
+                        errno = EAFNOSUPPORT;
                         break;
         }
+        if (raw->socket < 0) {
+                raw->error = errno;
+                if (errno == EACCES || errno == EPERM)
+                        DEBUG("Ping -- cannot create socket: %s\n", STRERROR);
+                else
+                        LogError("Ping -- cannot create socket: %s\n", STRERROR);
+        } else if (outgoing->ip && bind(raw->socket, (struct sockaddr *)&(outgoing->addr), outgoing->addrlen) < 0) {
+                raw->error = errno;
+                LogError("Cannot bind to outgoing address -- %s\n", STRERROR);
+                Net_close(raw->socket);
+                raw->socket = -1;
+        } else {
+                // The replies of all hosts arrive at once, make room for them
+                int size = S->hosts * ICMP_MAXSIZE;
+                setsockopt(raw->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+                Net_setNonBlocking(raw->socket);
+                _setPingOptions(raw->socket, family);
+        }
+        return raw;
 }
 
 
-static boolean_t _sendPing(const char *hostname, int socket, struct addrinfo *addr, int size, int retry, int maxretries, int id, int64_t started) {
+static boolean_t _sendPing(const char *hostname, int socket, struct addrinfo *addr, int size, int sequence, int retry, int maxretries, int id, int64_t started) {
         char buf[ICMP_MAXSIZE] = {};
         int header_len = 0;
         int out_len = 0;
@@ -336,7 +388,7 @@ static boolean_t _sendPing(const char *hostname, int socket, struct addrinfo *ad
                         out_icmp4->icmp_code = 0;
                         out_icmp4->icmp_cksum = 0;
                         out_icmp4->icmp_id = htons(id);
-                        out_icmp4->icmp_seq = htons(retry);
+                        out_icmp4->icmp_seq = htons(sequence);
                         memcpy((int64_t *)(out_icmp4->icmp_data), &started, sizeof(int64_t)); // set data to timestamp
                         header_len = offsetof(struct icmp, icmp_data);
                         out_len = header_len + size;
@@ -350,7 +402,7 @@ static boolean_t _sendPing(const char *hostname, int socket, struct addrinfo *ad
                         out_icmp6->icmp6_code = 0;
                         out_icmp6->icmp6_cksum = 0;
                         out_icmp6->icmp6_id = htons(id);
-                        out_icmp6->icmp6_seq = htons(retry);
+                        out_icmp6->icmp6_seq = htons(sequence);
                         memcpy((int64_t *)(out_icmp6 + 1), &started, sizeof(int64_t)); // set data to timestamp
                         header_len = sizeof(struct icmp6_hdr);
                         out_len = header_len + size;
@@ -367,7 +419,7 @@ static boolean_t _sendPing(const char *hostname, int socket, struct addrinfo *ad
         ssize_t n;
         do {
                 n = sendto(socket, out_icmp, out_len, 0, addr->ai_addr, addr->ai_addrlen);
-        } while (n == -1 && errno == EINTR);
+        } while (n == -1 && (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && Net_canWrite(socket, ICMP_INTERVAL))));
         if (n < 0) {
                 _LogWarningOrError(retry, maxretries, "Ping request for %s %d/%d failed -- %s\n", hostname, retry, maxretries, STRERROR);
                 return false;
@@ -376,94 +428,396 @@ static boolean_t _sendPing(const char *hostname, int socket, struct addrinfo *ad
 }
 
 
-static double _receivePing(const char *hostname, int socket, struct addrinfo *addr, int retry, int maxretries, int out_id, int64_t started, int timeout) {
-        int in_len = 0, read_timeout = timeout;
-        uint16_t in_id = 0, in_seq = 0;
-        unsigned char *data = NULL;
-        struct icmp *in_icmp4;
-        struct ip *in_iphdr4;
-#ifdef HAVE_IPV6
-        struct icmp6_hdr *in_icmp6;
-#endif
-        ssize_t n;
-        char buf[ICMP_MAXSIZE] = {};
-        switch (addr->ai_family) {
-                case AF_INET:
-                        in_len = sizeof(struct ip) + sizeof(struct icmp);
-                        break;
-#ifdef HAVE_IPV6
-                case AF_INET6:
-                        in_len = sizeof(struct icmp6_hdr);
-                        break;
-#endif
-                default:
-                        break;
-        }
-        while (read_timeout > 0 && Net_canRead(socket, read_timeout) && ! (Run.flags & Run_Stopped)) {
-                int64_t stopped = Time_micro();
-                struct sockaddr_storage in_addr;
+/*
+ * Read all pending replies from the raw socket. The raw socket provides
+ * all ICMP messages regardless of origin, the reply is matched to the echo
+ * request by the sequence number and verified by the identifier and the
+ * source address
+ */
+static void _receivePings(Sweep_T S, Raw_T *raw) {
+        char buf[ICMP_MAXSIZE];
+        struct sockaddr_storage in_addr;
+        while (true) {
+                ssize_t n;
                 socklen_t addrlen = sizeof(in_addr);
-                boolean_t in_addrmatch = false, in_typematch = false;
                 do {
-                        n = recvfrom(socket, buf, sizeof(buf), 0, (struct sockaddr *)&in_addr, &addrlen);
+                        n = recvfrom(raw->socket, buf, sizeof(buf), 0, (struct sockaddr *)&in_addr, &addrlen);
                 } while (n == -1 && errno == EINTR);
                 if (n < 0) {
-                        _LogWarningOrError(retry, maxretries, "Ping response from %s %d/%d failed -- %s\n", hostname, retry, maxretries, STRERROR);
-                        return -1.;
-                } else if (n >= in_len) {
-                        /* read from raw socket via recvfrom() provides messages regardless of origin, we have to check the IP and skip responses belonging to other conversations or different ICMP types (n < in_len) */
-                        switch (in_addr.ss_family) {
-                                case AF_INET:
-                                        in_addrmatch = memcmp(&((struct sockaddr_in *)&in_addr)->sin_addr, &((struct sockaddr_in *)(addr->ai_addr))->sin_addr, sizeof(struct in_addr)) ? false : true;
-                                        in_iphdr4 = (struct ip *)buf;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                LogError("Ping response failed -- %s\n", STRERROR);
+                        return;
+                }
+                int64_t received = Time_micro();
+                boolean_t in_typematch = false;
+                uint16_t in_id = 0, in_seq = 0;
+                struct ip *in_iphdr4;
+                struct icmp *in_icmp4;
+#ifdef HAVE_IPV6
+                struct icmp6_hdr *in_icmp6;
+#endif
+                switch (in_addr.ss_family) {
+                        case AF_INET:
+                                in_iphdr4 = (struct ip *)buf;
+                                if (n >= sizeof(struct ip) && n >= in_iphdr4->ip_hl * 4 + offsetof(struct icmp, icmp_data)) {
                                         in_icmp4 = (struct icmp *)(buf + in_iphdr4->ip_hl * 4);
                                         in_typematch = in_icmp4->icmp_type == ICMP_ECHOREPLY ? true : false;
                                         in_id = ntohs(in_icmp4->icmp_id);
                                         in_seq = ntohs(in_icmp4->icmp_seq);
-                                        data = (unsigned char *)in_icmp4->icmp_data;
-                                        break;
+                                }
+                                break;
 #ifdef HAVE_IPV6
-                                case AF_INET6:
-                                        in_addrmatch = memcmp(&((struct sockaddr_in6 *)&in_addr)->sin6_addr, &((struct sockaddr_in6 *)(addr->ai_addr))->sin6_addr, sizeof(struct in6_addr)) ? false : true;
+                        case AF_INET6:
+                                if (n >= sizeof(struct icmp6_hdr)) {
                                         in_icmp6 = (struct icmp6_hdr *)buf;
                                         in_typematch = in_icmp6->icmp6_type == ICMP6_ECHO_REPLY ? true : false;
                                         in_id = ntohs(in_icmp6->icmp6_id);
                                         in_seq = ntohs(in_icmp6->icmp6_seq);
-                                        data = (unsigned char *)(in_icmp6 + 1);
-                                        break;
+                                }
+                                break;
 #endif
-                                default:
-                                        LogError("Invalid address family: %d\n", in_addr.ss_family);
-                                        return -1.;
+                        default:
+                                break;
+                }
+                // Skip responses belonging to other conversations, different ICMP types and late replies
+                if (! in_typematch || in_id != S->id || in_seq >= S->probes)
+                        continue;
+                Probe_T *probe = &S->probe[in_seq];
+                Host_T *host = &S->host[probe->host];
+                if (probe->state != Probe_Sent || ! _isSameAddress(&in_addr, host->addr->ai_addr))
+                        continue;
+                probe->state = Probe_Received;
+                probe->response = (double)(received - probe->sent) / 1000.; // Convert microseconds to milliseconds
+                host->received++;
+                S->outstanding--;
+                DEBUG("Ping response for %s %d/%d succeeded -- received id=%d sequence=%d response_time=%s\n", host->echo->hostname, probe->round + 1, host->echo->icmp->count, in_id, in_seq, Str_milliToTime(probe->response, (char[23]){}));
+        }
+}
+
+
+/*
+ * Resolve the host and prepare its echo requests, return false if the host
+ * cannot be pinged
+ */
+static boolean_t _prepareHost(Sweep_T S, Host_T *host) {
+        Icmp_T icmp = host->echo->icmp;
+        struct addrinfo hints = {};
+        switch (icmp->family) {
+                case Socket_Ip:
+                        hints.ai_family = AF_UNSPEC;
+                        break;
+                case Socket_Ip4:
+                        hints.ai_family = AF_INET;
+                        break;
+#ifdef HAVE_IPV6
+                case Socket_Ip6:
+                        hints.ai_family = AF_INET6;
+                        break;
+#endif
+                default:
+                        LogError("Invalid socket family %d\n", icmp->family);
+                        return false;
+        }
+        int status;
+        if (! (host->result = Resolver_get(host->echo->hostname, 0, &hints, &status))) {
+                LogError("Ping for %s -- getaddrinfo failed: %s\n", host->echo->hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
+                return false;
+        }
+        // Ping the first address which matches the outgoing address family
+        for (host->addr = host->result; host->addr; host->addr = host->addr->ai_next)
+                if (icmp->outgoing.addrlen == 0 || icmp->outgoing.addrlen == host->addr->ai_addrlen)
+                        break;
+        if (! host->addr) {
+                LogError("Ping for %s -- no address matching the outgoing address %s\n", host->echo->hostname, NVLSTR(icmp->outgoing.ip));
+                return false;
+        }
+        host->raw = _getSocket(S, host->addr->ai_family, &(icmp->outgoing));
+        if (host->raw->socket < 0) {
+                if (host->raw->error == EACCES || host->raw->error == EPERM)
+                        icmp->response = -2.;
+                return false;
+        }
+        host->first = S->probes;
+        S->probes += icmp->count;
+        return true;
+}
+
+
+static int _compareResponse(const void *a, const void *b) {
+        double x = *(const double *)a, y = *(const double *)b;
+        return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+/*
+ * Update the statistics of the last ICMP_WINDOW echo requests. The jitter
+ * is the mean difference of the response times of consecutive replies, the
+ * percentile uses the nearest rank method
+ */
+static void _updateStatistics(Icmp_T icmp) {
+        int received = 0, pairs = 0;
+        double sum = 0., jitter = 0., last = -1., sorted[ICMP_WINDOW];
+        // Iterate the ring buffer from the oldest sample
+        for (int i = 0, j = (icmp->window.index - icmp->window.count + ICMP_WINDOW) % ICMP_WINDOW; i < icmp->window.count; i++, j = (j + 1) % ICMP_WINDOW) {
+                double response = icmp->window.response[j];
+                if (response >= 0.) {
+                        sorted[received++] = response;
+                        sum += response;
+                        if (last >= 0.) {
+                                jitter += response > last ? response - last : last - response;
+                                pairs++;
                         }
+                        last = response;
                 }
-                if (n < in_len || in_addr.ss_family != addr->ai_family || ! in_addrmatch || ! in_typematch || in_id != out_id || in_seq > (uint16_t)maxretries) {
-                        // Try to read next packet, but don't exceed the timeout while waiting for our response so we won't loop forever if the socket is flooded with other ICMP packets
-                        if (stopped < started) {
-                                // Time jumped
-                                break;
-                        } else {
-                                read_timeout = timeout - (stopped - started) / 1000.;
+        }
+        icmp->statistics.loss = icmp->window.count ? 100. * (icmp->window.count - received) / icmp->window.count : 0.;
+        icmp->statistics.jitter = pairs ? jitter / pairs : 0.;
+        if (received) {
+                qsort(sorted, received, sizeof(double), _compareResponse);
+                icmp->statistics.minimum = sorted[0];
+                icmp->statistics.average = sum / received;
+                icmp->statistics.maximum = sorted[received - 1];
+                icmp->statistics.percentile95 = sorted[(95 * received + 99) / 100 - 1];
+        } else {
+                icmp->statistics.minimum = icmp->statistics.average = icmp->statistics.maximum = icmp->statistics.percentile95 = -1.;
+        }
+}
+
+
+static void _finishHost(Host_T *host) {
+        Icmp_T icmp = host->echo->icmp;
+        double sum = 0.;
+        for (int i = 0; i < icmp->count; i++) {
+                Probe_T *probe = host->probe + i;
+                if (probe->state == Probe_Received || probe->state == Probe_Lost) {
+                        icmp->window.response[icmp->window.index] = probe->state == Probe_Received ? probe->response : -1.;
+                        icmp->window.index = (icmp->window.index + 1) % ICMP_WINDOW;
+                        if (icmp->window.count < ICMP_WINDOW)
+                                icmp->window.count++;
+                        if (probe->state == Probe_Received)
+                                sum += probe->response;
+                }
+        }
+        _updateStatistics(icmp);
+        if (host->received == 0) {
+                LogError("Ping response for %s timed out -- no response within %s\n", host->echo->hostname, Str_milliToTime(icmp->timeout, (char[23]){}));
+                return;
+        }
+        icmp->response = sum / host->received;
+        DEBUG("Ping for %s -- %d/%d responses received, response time %s, loss %.1f%% and jitter %s in the last %d requests\n", host->echo->hostname, host->received, icmp->count, Str_milliToTime(icmp->response, (char[23]){}), icmp->statistics.loss, Str_milliToTime(icmp->statistics.jitter, (char[23]){}), icmp->window.count);
+}
+
+
+/*
+ * Ping the hosts concurrently: the echo requests of all hosts are sent in
+ * rounds ICMP_INTERVAL apart via one raw socket per address family and the
+ * replies are collected until all requests were answered or timed out
+ */
+static void _sweep(IcmpEcho_T *echo, int count) {
+        struct Sweep_T S = {.id = getpid() & 0xFFFF, .hosts = count};
+        S.host = CALLOC(count, sizeof(Host_T));
+        S.socket = CALLOC(count, sizeof(Raw_T));
+        int rounds = 0;
+        for (int i = 0; i < count; i++) {
+                Host_T *host = &S.host[i];
+                host->echo = &echo[i];
+                host->echo->icmp->response = -1.;
+                if (_prepareHost(&S, host))
+                        rounds = MAX(rounds, host->echo->icmp->count);
+                else
+                        host->raw = NULL;
+        }
+        if (S.probes) {
+                S.probe = CALLOC(S.probes, sizeof(Probe_T));
+                for (int i = 0; i < count; i++) {
+                        Host_T *host = &S.host[i];
+                        if (host->raw) {
+                                host->probe = S.probe + host->first;
+                                for (int j = 0; j < host->echo->icmp->count; j++)
+                                        host->probe[j] = (Probe_T){.host = i, .round = j, .response = -1.};
                         }
-                } else {
-                        memcpy(&started, data, sizeof(int64_t));
-                        double response = (double)(stopped - started) / 1000.; // Convert microseconds to milliseconds
-                        DEBUG("Ping response for %s %d/%d succeeded -- received id=%d sequence=%d response_time=%s\n", hostname, retry, maxretries, in_id, in_seq, Str_milliToTime(response, (char[23]){}));
-                        return response; // Wait for one response only
                 }
         }
-        _LogWarningOrError(retry, maxretries, "Ping response for %s %d/%d timed out -- no response within %s\n", hostname, retry, maxretries, Str_milliToTime(timeout, (char[23]){}));
-        return -1.;
+        struct pollfd fds[S.sockets + 1];
+        int64_t start = Time_micro();
+        for (int round = 0; S.probes && ! (Run.flags & Run_Stopped);) {
+                int64_t now = Time_micro();
+                for (; round < rounds && now >= start + round * ICMP_INTERVAL * 1000LL; round++) {
+                        for (int i = 0; i < count; i++) {
+                                Host_T *host = &S.host[i];
+                                Icmp_T icmp = host->echo->icmp;
+                                if (host->raw && round < icmp->count) {
+                                        Probe_T *probe = host->probe + round;
+                                        probe->sent = Time_micro();
+                                        if (_sendPing(host->echo->hostname, host->raw->socket, host->addr, icmp->size, host->first + round, round + 1, icmp->count, S.id, probe->sent)) {
+                                                probe->state = Probe_Sent;
+                                                S.outstanding++;
+                                        } else {
+                                                probe->state = Probe_Lost;
+                                        }
+                                }
+                        }
+                }
+                // Expire the requests without reply and compute the time of the next event
+                now = Time_micro();
+                int64_t next = round < rounds ? start + round * ICMP_INTERVAL * 1000LL : INT64_MAX;
+                for (int i = 0; i < S.probes; i++) {
+                        Probe_T *probe = &S.probe[i];
+                        if (probe->state == Probe_Sent) {
+                                int64_t deadline = probe->sent + S.host[probe->host].echo->icmp->timeout * 1000LL;
+                                if (now >= deadline) {
+                                        probe->state = Probe_Lost;
+                                        S.outstanding--;
+                                        DEBUG("Ping response for %s %d/%d timed out\n", S.host[probe->host].echo->hostname, probe->round + 1, S.host[probe->host].echo->icmp->count);
+                                } else {
+                                        next = MIN(next, deadline);
+                                }
+                        }
+                }
+                if (round >= rounds && S.outstanding == 0)
+                        break;
+                int nfds = 0;
+                for (int i = 0; i < S.sockets; i++)
+                        if (S.socket[i].socket >= 0)
+                                fds[nfds++] = (struct pollfd){.fd = S.socket[i].socket, .events = POLLIN};
+                int n = poll(fds, nfds, (int)((next - now + 999) / 1000));
+                if (n < 0 && errno != EINTR) {
+                        LogError("Ping -- poll failed: %s\n", STRERROR);
+                        break;
+                }
+                for (int i = 0, k = 0; i < S.sockets && n > 0; i++)
+                        if (S.socket[i].socket >= 0 && fds[k++].revents)
+                                _receivePings(&S, &S.socket[i]);
+        }
+        for (int i = 0; i < count; i++) {
+                if (S.host[i].raw)
+                        _finishHost(&S.host[i]);
+                Resolver_free(&(S.host[i].result));
+        }
+        for (int i = 0; i < S.sockets; i++)
+                if (S.socket[i].socket >= 0)
+                        Net_close(S.socket[i].socket);
+        FREE(S.probe);
+        FREE(S.socket);
+        FREE(S.host);
 }
 
 
-double icmp_echo(const char *hostname, Socket_Family family, Outgoing_T *outgoing, int size, int timeout, int maxretries) {
-        ASSERT(hostname);
-        ASSERT(size > 0);
-        int rv;
-        double response = -1.;
-        struct addrinfo *result, hints = {};
-        switch (family) {
+static int _getAddressPort(struct sockaddr_storage *addr) {
+        switch (addr->ss_family) {
+                case AF_INET:
+                        return ntohs(((struct sockaddr_in *)addr)->sin_port);
+#ifdef HAVE_IPV6
+                case AF_INET6:
+                        return ntohs(((struct sockaddr_in6 *)addr)->sin6_port);
+#endif
+                default:
+                        return -1;
+        }
+}
+
+
+/*
+ * Get the UDP socket for the given address family and outgoing address, the
+ * socket is created on the first use and shared by all port tests of the
+ * probe. Returns NULL if the socket cannot be created
+ */
+static Udp_T *_getUdpSocket(Udp_T *udp, int *sockets, int family, Outgoing_T *outgoing, int queries, char error[STRLEN]) {
+        for (int i = 0; i < *sockets; i++)
+                if (udp[i].family == family && _isSameOutgoing(udp[i].outgoing, outgoing))
+                        return udp[i].socket >= 0 ? &udp[i] : NULL;
+        Udp_T *u = &udp[(*sockets)++];
+        u->family = family;
+        u->outgoing = outgoing;
+        struct sockaddr_storage addr = {.ss_family = family};
+        socklen_t addrlen = family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+        if (outgoing->ip) {
+                memcpy(&addr, &(outgoing->addr), outgoing->addrlen);
+                addrlen = outgoing->addrlen;
+        }
+        // Bind the socket explicitly, the local port is part of the SIP request
+        if ((u->socket = socket(family, SOCK_DGRAM, 0)) < 0) {
+                snprintf(error, STRLEN, "Cannot create socket -- %s", STRERROR);
+        } else if (bind(u->socket, (struct sockaddr *)&addr, addrlen) < 0 || getsockname(u->socket, (struct sockaddr *)&addr, &addrlen) < 0) {
+                snprintf(error, STRLEN, "Cannot bind to %s address -- %s", outgoing->ip ? "outgoing" : "local", STRERROR);
+                Net_close(u->socket);
+                u->socket = -1;
+        } else {
+                // The responses of all port tests arrive at once, make room for them
+                int size = queries * UDP_MAXSIZE;
+                setsockopt(u->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+                Net_setNonBlocking(u->socket);
+#ifdef UDP_RECVERR
+                // Queue the ICMP errors with the request destination, so the test of a closed port fails immediately (the socket is not connected)
+                int on = 1;
+                if (family == AF_INET)
+                        setsockopt(u->socket, IPPROTO_IP, IP_RECVERR, &on, sizeof(on));
+#if defined(HAVE_IPV6) && defined(IPV6_RECVERR)
+                else
+                        setsockopt(u->socket, IPPROTO_IPV6, IPV6_RECVERR, &on, sizeof(on));
+#endif
+#endif
+                u->port = _getAddressPort(&addr);
+                return u;
+        }
+        return NULL;
+}
+
+
+static boolean_t _isSameEndpoint(struct sockaddr_storage *a, struct addrinfo *b) {
+        return _isSameAddress(a, b->ai_addr) && _getAddressPort(a) == _getAddressPort((struct sockaddr_storage *)b->ai_addr);
+}
+
+
+/*
+ * Get the local address used for the destination: connecting a UDP socket
+ * selects the route without sending any data
+ */
+static void _getLocalAddress(Query_T *query) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int s = socket(query->addr->ai_family, SOCK_DGRAM, 0);
+        if (s >= 0) {
+                if (connect(s, query->addr->ai_addr, query->addr->ai_addrlen) == 0 && getsockname(s, (struct sockaddr *)&addr, &addrlen) == 0)
+                        getnameinfo((struct sockaddr *)&addr, addrlen, query->transaction.local, sizeof(query->transaction.local), NULL, 0, NI_NUMERICHOST);
+                close(s);
+        }
+}
+
+
+static void _finishQuery(Query_T *query, const char *error) {
+        Port_T p = query->transaction.port;
+        query->done = true;
+        if (error) {
+                Str_copy(p->probe.error, error, sizeof(p->probe.error) - 1);
+                DEBUG("UDP probe of [%s]:%d failed -- %s\n", p->hostname, p->target.net.port, error);
+        }
+}
+
+
+/*
+ * Test if the socket call failed with the ICMP error of an earlier request on
+ * the shared socket. The error is queued with its destination and handled by
+ * _receiveErrors(), it doesn't belong to the current call
+ */
+static boolean_t _isPendingError(int error) {
+#ifdef UDP_RECVERR
+        return error == ECONNREFUSED || error == EHOSTUNREACH || error == ENETUNREACH || error == EHOSTDOWN || error == EPROTO;
+#else
+        return false;
+#endif
+}
+
+
+/*
+ * Resolve the host, prepare the request and get the socket, return false if
+ * the port cannot be probed
+ */
+static boolean_t _prepareQuery(Query_T *query, Udp_T *udp, int *sockets, int queries) {
+        char error[STRLEN];
+        Port_T p = query->transaction.port;
+        struct addrinfo hints = {.ai_socktype = SOCK_DGRAM, .ai_protocol = IPPROTO_UDP};
+        switch (p->family) {
                 case Socket_Ip:
                         hints.ai_family = AF_UNSPEC;
                         break;
@@ -476,64 +830,363 @@ double icmp_echo(const char *hostname, Socket_Family family, Outgoing_T *outgoin
                         break;
 #endif
                 default:
-                        LogError("Invalid socket family %d\n", family);
-                        return response;
+                        snprintf(error, sizeof(error), "Invalid socket family %d", p->family);
+                        _finishQuery(query, error);
+                        return false;
         }
-        int status = getaddrinfo(hostname, NULL, &hints, &result);
-        if (status) {
-                LogError("Ping for %s -- getaddrinfo failed: %s\n", hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
-                return response;
-        }
-        struct addrinfo *addr = result;
-        int s = -1;
-        while (addr && s < 0) {
-                if (outgoing->addrlen == 0 || outgoing->addrlen == addr->ai_addrlen) {
-                        switch (addr->ai_family) {
-                                case AF_INET:
-                                        s = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
-                                        break;
-#ifdef HAVE_IPV6
-                                case AF_INET6:
-                                        s = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
-                                        break;
+        int status;
+        if (! (query->result = Resolver_get(p->hostname, p->target.net.port, &hints, &status))) {
+                snprintf(error, sizeof(error), "Cannot translate '%s' to IP address -- %s", p->hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
+                _finishQuery(query, error);
+                return false;
+        }
+        // Probe the first address which matches the outgoing address family
+        for (query->addr = query->result; query->addr; query->addr = query->addr->ai_next)
+                if (p->outgoing.addrlen == 0 || p->outgoing.addrlen == query->addr->ai_addrlen)
+                        break;
+        if (! query->addr) {
+                snprintf(error, sizeof(error), "No address of %s matching the outgoing address %s", p->hostname, NVLSTR(p->outgoing.ip));
+                _finishQuery(query, error);
+                return false;
+        }
+        if (! (query->udp = _getUdpSocket(udp, sockets, query->addr->ai_family, &(p->outgoing), queries, error))) {
+                _finishQuery(query, error);
+                return false;
+        }
+        query->transaction.localPort = query->udp->port;
+        _getLocalAddress(query);
+        TRY
+        {
+                p->protocol->encode(&(query->transaction));
+        }
+        ELSE
+        {
+                _finishQuery(query, Exception_frame.message);
+        }
+        END_TRY;
+        return ! query->done;
+}
+
+
+static void _sendQuery(Query_T *query, int64_t now) {
+        Port_T p = query->transaction.port;
+        ssize_t n;
+        int pending = 0;
+        do {
+                n = sendto(query->udp->socket, query->transaction.request, query->transaction.length, 0, query->addr->ai_addr, query->addr->ai_addrlen);
+        } while (n == -1 && (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && Net_canWrite(query->udp->socket, UDP_RTO_MIN)) || (_isPendingError(errno) && pending++ < UDP_PENDINGMAX)));
+        if (n < 0) {
+                char error[STRLEN];
+                snprintf(error, sizeof(error), "%s: error sending request -- %s", p->protocol->name, STRERROR);
+                _finishQuery(query, error);
+                return;
+        }
+        if (p->probe.sent++) {
+                query->rto *= 2; // Exponential backoff of the retransmissions
+        } else {
+                // The response time and the deadline start with the first request, not with the resolution of all ports in the probe
+                query->started = now;
+                // The test allows the same total time as the retries of a blocking test
+                query->deadline = now + (int64_t)p->timeout * MAX(p->retry, 1) * 1000LL;
+        }
+        query->sent = now;
+        query->retransmit = now + query->rto * 1000LL;
+}
+
+
+/*
+ * Update the port's round-trip time estimate (RFC 6298). Per Karn's algorithm
+ * only the responses to requests which were not retransmitted are sampled
+ */
+static void _updateRoundTrip(Port_T p, double rtt) {
+        if (p->probe.srtt == 0.) {
+                p->probe.srtt = rtt;
+                p->probe.rttvar = rtt / 2.;
+        } else {
+                p->probe.rttvar = .75 * p->probe.rttvar + .25 * (p->probe.srtt > rtt ? p->probe.srtt - rtt : rtt - p->probe.srtt);
+                p->probe.srtt = .875 * p->probe.srtt + .125 * rtt;
+        }
+}
+
+
+#ifdef UDP_RECVERR
+/*
+ * Read the ICMP errors from the socket error queue. The error carries the
+ * destination of the request, so the test of a closed port or unreachable
+ * host fails immediately
+ */
+static void _receiveErrors(Query_T *queries, int count, Udp_T *udp) {
+        unsigned char buf[UDP_MAXSIZE];
+        char control[512];
+        struct sockaddr_storage addr;
+        while (true) {
+                struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf)};
+                struct msghdr msg = {.msg_name = &addr, .msg_namelen = sizeof(addr), .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+                if (recvmsg(udp->socket, &msg, MSG_ERRQUEUE) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return;
+                }
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                        boolean_t error = cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR;
+#if defined(HAVE_IPV6) && defined(IPV6_RECVERR)
+                        error = error || (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
 #endif
-                                default:
-                                        break;
+                        if (! error)
+                                continue;
+                        struct sock_extended_err *e = (struct sock_extended_err *)CMSG_DATA(cmsg);
+                        if (e->ee_origin != SO_EE_ORIGIN_ICMP && e->ee_origin != SO_EE_ORIGIN_ICMP6)
+                                continue;
+                        for (int i = 0; i < count; i++) {
+                                Query_T *query = &queries[i];
+                                if (! query->done && query->udp == udp && _isSameEndpoint(&addr, query->addr)) {
+                                        char message[STRLEN];
+                                        snprintf(message, sizeof(message), "%s: error receiving response -- %s", query->transaction.port->protocol->name, strerror(e->ee_errno));
+                                        _finishQuery(query, message);
+                                }
                         }
-                        if (outgoing->ip) {
-                                if (bind(s, (struct sockaddr *)&(outgoing->addr), outgoing->addrlen) < 0) {
-                                        LogError("Cannot bind to outgoing address -- %s\n", STRERROR);
-                                        goto error1;
+                }
+        }
+}
+#endif
+
+
+/*
+ * Read all pending datagrams from the socket. The response is matched to the
+ * request by the source address and port and by the protocol decoder which
+ * verifies the transaction identifier
+ */
+static void _receiveResponses(Query_T *queries, int count, Udp_T *udp) {
+        unsigned char buf[UDP_MAXSIZE];
+        struct sockaddr_storage in_addr;
+#ifdef UDP_RECVERR
+        _receiveErrors(queries, count, udp);
+#endif
+        while (true) {
+                ssize_t n;
+                socklen_t addrlen = sizeof(in_addr);
+                do {
+                        n = recvfrom(udp->socket, buf, sizeof(buf), 0, (struct sockaddr *)&in_addr, &addrlen);
+                } while (n == -1 && errno == EINTR);
+                if (n < 0) {
+                        if (_isPendingError(errno))
+                                continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                DEBUG("UDP probe response failed -- %s\n", STRERROR);
+                        return;
+                }
+                int64_t received = Time_micro();
+                for (int i = 0; i < count; i++) {
+                        Query_T *query = &queries[i];
+                        if (query->done || query->udp != udp || ! _isSameEndpoint(&in_addr, query->addr))
+                                continue;
+                        Port_T p = query->transaction.port;
+                        TRY
+                        {
+                                if (p->protocol->decode(&(query->transaction), buf, (int)n)) {
+                                        if (p->probe.sent == 1)
+                                                _updateRoundTrip(p, (double)(received - query->sent) / 1000.);
+                                        p->probe.response = (double)(received - query->started) / 1000.; // Convert microseconds to milliseconds
+                                        _finishQuery(query, NULL);
                                 }
                         }
+                        ELSE
+                        {
+                                _finishQuery(query, Exception_frame.message);
+                        }
+                        END_TRY;
+                        if (query->done)
+                                break;
                 }
-                if (s < 0)
-                        addr = addr->ai_next;
         }
-        if (s < 0) {
-                if (errno == EACCES || errno == EPERM) {
-                        DEBUG("Ping for %s -- cannot create socket: %s\n", hostname, STRERROR);
-                        response = -2.;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int create_server_socket_tcp(const char *address, int port, Socket_Family family, int backlog, char error[STRLEN]) {
+        struct addrinfo *result, hints = {
+                .ai_flags = AI_PASSIVE,
+                .ai_socktype = SOCK_STREAM,
+                .ai_protocol = IPPROTO_TCP
+        };
+        switch (family) {
+                case Socket_Ip:
+                        hints.ai_family = AF_UNSPEC;
+                        break;
+                case Socket_Ip4:
+                        hints.ai_family = AF_INET;
+                        break;
+#ifdef HAVE_IPV6
+                case Socket_Ip6:
+                        hints.ai_family = AF_INET6;
+                        break;
+#endif
+                default:
+                        snprintf(error, STRLEN, "Invalid socket family %d", family);
+                        return -1;
+        }
+        char _port[6];
+        snprintf(_port, sizeof(_port), "%d", port);
+        int status = getaddrinfo(address, _port, &hints, &result);
+        if (status) {
+                snprintf(error, STRLEN, "Cannot translate %s socket [%s]:%d -- %s", socketnames[family], NVLSTR(address), port, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
+                return -1;
+        }
+        int flag = 1;
+        for (struct addrinfo *_result = result; _result; _result = _result->ai_next) {
+                int s = socket(_result->ai_family, _result->ai_socktype, _result->ai_protocol);
+                if (s != -1) {
+                        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(flag)) == 0) {
+                                if (Net_setNonBlocking(s)) {
+                                        if (fcntl(s, F_SETFD, FD_CLOEXEC) != -1) {
+                                                if (family != Socket_Ip6 || setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(flag)) == 0) {
+                                                        if (bind(s, _result->ai_addr, _result->ai_addrlen) == 0) {
+                                                                if (listen(s, backlog) == 0) {
+                                                                        freeaddrinfo(result);
+                                                                        return s;
+                                                                } else {
+                                                                        snprintf(error, STRLEN, "Cannot listen: %s", STRERROR);
+                                                                }
+                                                        } else {
+                                                                snprintf(error, STRLEN, "Cannot bind: %s", STRERROR);
+                                                        }
+                                                } else {
+                                                        snprintf(error, STRLEN, "Cannot set IPV6_V6ONLY option: %s", STRERROR);
+                                                }
+                                        } else {
+                                                snprintf(error, STRLEN, "Cannot set close on exec option: %s", STRERROR);
+                                        }
+                                } else {
+                                        snprintf(error, STRLEN, "Cannot set nonblocking socket: %s", STRERROR);
+                                }
+                        } else {
+                                snprintf(error, STRLEN, "Cannot set reuseaddr option: %s", STRERROR);
+                        }
+                        if (close(s) < 0)
+                                LogError("Server socket %d close failed: %s\n", s, STRERROR);
                 } else {
-                        LogError("Ping for %s -- cannot create socket: %s\n", hostname, STRERROR);
+                        snprintf(error, STRLEN, "Cannot create socket: %s", STRERROR);
                 }
-                goto error2;
         }
-        _setPingOptions(s, addr);
-        uint16_t id = getpid() & 0xFFFF;
-        for (int retry = 1; retry <= maxretries; retry++) {
-                int64_t started = Time_micro();
-                if (_sendPing(hostname, s, addr, size, retry, maxretries, id, started) && (response = _receivePing(hostname, s, addr, retry, maxretries, id, started, timeout)) >= 0.)
-                        break;
+        freeaddrinfo(result);
+        return -1;
+}
+
+
+int create_server_socket_unix(const char *path, int backlog, char error[STRLEN]) {
+        int s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0) {
+                snprintf(error, STRLEN, "Cannot create socket -- %s", STRERROR);
+                return -1;
         }
-error1:
-        do {
-                rv = close(s);
-        } while (rv == -1 && errno == EINTR);
-        if (rv == -1)
+        struct sockaddr_un addr = {
+                .sun_family = AF_UNIX
+        };
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+        if (Net_setNonBlocking(s)) {
+                if (fcntl(s, F_SETFD, FD_CLOEXEC) != -1) {
+                        if (bind(s, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == 0) {
+                                if (listen(s, backlog) == 0) {
+                                        return s;
+                                } else {
+                                        snprintf(error, STRLEN, "Cannot listen -- %s", STRERROR);
+                                }
+                        } else {
+                                snprintf(error, STRLEN, "Cannot bind -- %s", STRERROR);
+                        }
+                } else {
+                        snprintf(error, STRLEN, "Cannot set close on exec option -- %s", STRERROR);
+                }
+        } else {
+                snprintf(error, STRLEN, "Cannot set nonblocking socket: %s", STRERROR);
+        }
+        if (close(s) < 0)
                 LogError("Socket %d close failed -- %s\n", s, STRERROR);
-error2:
-        freeaddrinfo(result);
-        return response;
+        return -1;
+}
+
+
+void icmp_sweep(IcmpEcho_T *echo, int count) {
+        ASSERT(echo);
+        // The sequence number identifies the echo request in the sweep => split the hosts into sweeps with at most 65535 requests
+        for (int first = 0, probes = 0, i = 0; i <= count; i++) {
+                if (i == count || probes + echo[i].icmp->count > 0xFFFF) {
+                        if (i > first)
+                                _sweep(echo + first, i - first);
+                        first = i;
+                        probes = 0;
+                }
+                if (i < count)
+                        probes += echo[i].icmp->count;
+        }
 }
 
+
+void udp_sweep(Port_T *ports, int count) {
+        ASSERT(ports);
+        Query_T *queries = CALLOC(count, sizeof(Query_T));
+        Udp_T *udp = CALLOC(count, sizeof(Udp_T));
+        int sockets = 0;
+        for (int i = 0; i < count; i++) {
+                Port_T p = ports[i];
+                Query_T *query = &queries[i];
+                p->probe.done = true;
+                p->probe.sent = 0;
+                p->probe.response = -1.;
+                *p->probe.error = 0;
+                query->transaction = (struct Transaction_T){.port = p, .id = (uint32_t)random()};
+                if (_prepareQuery(query, udp, &sockets, count))
+                        query->rto = p->probe.srtt > 0. ? MAX(UDP_RTO_MIN, (int)(p->probe.srtt + 4. * p->probe.rttvar)) : UDP_RTO_INITIAL;
+        }
+        struct pollfd fds[sockets + 1];
+        while (! (Run.flags & Run_Stopped)) {
+                int64_t now = Time_micro();
+                int64_t next = INT64_MAX;
+                for (int i = 0; i < count; i++) {
+                        Query_T *query = &queries[i];
+                        if (query->done)
+                                continue;
+                        if (query->transaction.port->probe.sent == 0) {
+                                _sendQuery(query, now);
+                        } else if (now >= query->deadline) {
+                                char error[STRLEN];
+                                Port_T p = query->transaction.port;
+                                snprintf(error, sizeof(error), "%s: no response within %s", p->protocol->name, Str_milliToTime((double)(query->deadline - query->started) / 1000., (char[23]){}));
+                                _finishQuery(query, error);
+                                continue;
+                        } else if (now >= query->retransmit && query->retransmit < query->deadline) {
+                                _sendQuery(query, now);
+                        }
+                        if (! query->done)
+                                next = MIN(next, MIN(query->retransmit, query->deadline));
+                }
+                if (next == INT64_MAX)
+                        break;
+                int nfds = 0;
+                for (int i = 0; i < sockets; i++)
+                        if (udp[i].socket >= 0)
+                                fds[nfds++] = (struct pollfd){.fd = udp[i].socket, .events = POLLIN};
+                now = Time_micro();
+                int n = poll(fds, nfds, next > now ? (int)((next - now + 999) / 1000) : 0);
+                if (n < 0 && errno != EINTR) {
+                        LogError("UDP probe -- poll failed: %s\n", STRERROR);
+                        break;
+                }
+                for (int i = 0, k = 0; i < sockets && n > 0; i++)
+                        if (udp[i].socket >= 0 && fds[k++].revents)
+                                _receiveResponses(queries, count, &udp[i]);
+        }
+        for (int i = 0; i < count; i++) {
+                // Tests interrupted by the shutdown are left to the blocking test
+                if (! queries[i].done)
+                        ports[i]->probe.done = false;
+                Resolver_free(&(queries[i].result));
+        }
+        for (int i = 0; i < sockets; i++)
+                if (udp[i].socket >= 0)
+                        Net_close(udp[i].socket);
+        FREE(udp);
+        FREE(queries);
+}
@@ -37,6 +37,13 @@
  */
 
 
+/** ICMP echo test of one host in the ping sweep */
+typedef struct IcmpEcho_T {
+        const char *hostname;
+        Icmp_T icmp;
+} IcmpEcho_T;
+
+
 /**
  * Create a non-blocking server socket and bind it to the specified local
  * port number, with the specified backlog. Set a socket option to
@@ -66,16 +73,35 @@ int create_server_socket_unix(const char *path, int backlog, char error[STRLEN])
 
 
 /**
- * Create a ICMP socket against hostname, send echo and wait for response.
- * The 'count' echo requests  is send and we expect at least one reply.
- * @param hostname The host to open a socket at
- * @param family The socket family to use
- * @param outgoing Outgoing IP address (optional)
- * @param size The ping size
- * @param timeout If response will not come within timeout milliseconds abort
- * @param count How many pings to send
- * @return response time on succes, -1 on error
+ * Ping the hosts concurrently. The ICMP echo requests of all hosts are
+ * sent at once via one raw socket per address family, the requests of
+ * each host are spaced ICMP_INTERVAL apart. The replies are collected
+ * until all requests were answered or timed out, so the sweep takes one
+ * timeout at maximum regardless of the number of unreachable hosts. The
+ * result is stored in the ICMP test: the average response time (-1 if no
+ * reply was received, -2 if the ping is not permitted). The requests are
+ * added to the test's window of the last ICMP_WINDOW requests and its
+ * statistics are updated.
+ * @param echo The hosts and their ping tests
+ * @param count The number of hosts
+ */
+void icmp_sweep(IcmpEcho_T *echo, int count);
+
+
+/**
+ * Test the UDP ports concurrently. The requests of all ports are encoded
+ * by the port's protocol and sent at once via one UDP socket per address
+ * family and outgoing address. Unanswered requests are retransmitted with
+ * exponential backoff starting at the port's retransmission timeout, which
+ * is derived from its smoothed round-trip time (RFC 6298), until the
+ * timeout of all retries of the test expires. The response is matched to
+ * the request by the source address and the protocol's transaction
+ * identifier. The result is stored in the port's probe and used by the
+ * next Socket_test() of the port.
+ * @param ports The UDP port tests, their protocol must have an encoder
+ * @param count The number of ports
  */
-double icmp_echo(const char *hostname, Socket_Family family, Outgoing_T *outgoing, int size, int timeout, int count);
+void udp_sweep(Port_T *ports, int count);
+
 
 #endif
@@ -72,6 +72,7 @@
  * Implementation of the SMTP interface.
  *
  * RFCs:
+ *      https://tools.ietf.org/html/rfc2920
  *      https://tools.ietf.org/html/rfc3207
  *      https://tools.ietf.org/html/rfc4616
  *      https://tools.ietf.org/html/rfc4954
@@ -89,7 +90,8 @@ typedef enum {
         MTA_None      = 0x0,
         MTA_StartTLS  = 0x1,
         MTA_AuthPlain = 0x2,
-        MTA_AuthLogin = 0x4
+        MTA_AuthLogin = 0x4,
+        MTA_Pipelining = 0x8
 } __attribute__((__packed__)) MTA_Flags;
 
 
@@ -103,6 +105,7 @@ typedef enum {
         SMTP_RcptTo,
         SMTP_DataBegin,
         SMTP_DataCommit,
+        SMTP_Reset,
         SMTP_Quit
 } __attribute__((__packed__)) SMTP_State;
 
@@ -129,6 +132,8 @@ static void _parseFlags(T S, const char *line) {
                         S->flags |= MTA_AuthPlain;
                 if (Str_sub(flag, " LOGIN"))
                         S->flags |= MTA_AuthLogin;
+        } else if (Str_startsWith(flag, "PIPELINING")) {
+                S->flags |= MTA_Pipelining;
         }
 }
 
@@ -322,9 +327,44 @@ void SMTP_dataCommit(T S) {
 }
 
 
+void SMTP_transaction(T S, const char *from, const char *to) {
+        ASSERT(S);
+        ASSERT(from);
+        ASSERT(to);
+        if (S->flags & MTA_Pipelining) {
+                // Send the whole envelope in one write and collect the responses afterwards (see RFC 2920 section 3.1)
+                _send(S, "MAIL FROM: <%s>\r\nRCPT TO: <%s>\r\nDATA\r\n", from, to);
+                _receive(S, 250, NULL);
+                S->state = SMTP_MailFrom;
+                _receive(S, 250, NULL);
+                S->state = SMTP_RcptTo;
+                _receive(S, 354, NULL);
+                S->state = SMTP_DataBegin;
+        } else {
+                SMTP_from(S, from);
+                SMTP_to(S, to);
+                SMTP_dataBegin(S);
+        }
+}
+
+
+void SMTP_reset(T S) {
+        ASSERT(S);
+        _send(S, "RSET\r\n");
+        _receive(S, 250, NULL);
+        S->state = SMTP_Reset;
+}
+
+
 void SMTP_quit(T S) {
         _send(S, "QUIT\r\n");
         _receive(S, 221, NULL);
         S->state = SMTP_Quit;
 }
 
+
+void SMTP_abort(T S) {
+        ASSERT(S);
+        S->state = SMTP_Quit;
+}
+
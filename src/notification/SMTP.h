@@ -79,6 +79,7 @@
  * SMTP interface
  *
  * RFCs:
+ *      https://www.ietf.org/rfc/rfc2920.txt
  *      https://www.ietf.org/rfc/rfc3207.txt
  *      https://www.ietf.org/rfc/rfc5321.txt
  *
@@ -184,6 +185,30 @@ void SMTP_dataBegin(T S);
 void SMTP_dataCommit(T S);
 
 
+/**
+ * Send the MAIL FROM, RCPT TO and DATA commands to the SMTP server
+ * and check for status codes 250, 250 and 354 in response. If the
+ * server supports the PIPELINING extension, the commands are sent in
+ * one batch, otherwise one by one.
+ * @param S The SMTP protocol object
+ * @param from A sender address
+ * @param to A recipient address
+ * @exception AssertException if S, from or to is NULL, IOException if
+ * failed
+ */
+void SMTP_transaction(T S, const char *from, const char *to);
+
+
+/**
+ * Send a RSET command to the SMTP server and check for status code
+ * 250 in response. Can be used to test that an idle session is still
+ * usable before starting a new mail transaction.
+ * @param S The SMTP protocol object
+ * @exception AssertException if S is NULL, IOException if failed
+ */
+void SMTP_reset(T S);
+
+
 /**
  * Send a QUIT command to the SMTP server and check for status
  * code 221 in response.
@@ -193,6 +218,15 @@ void SMTP_dataCommit(T S);
 void SMTP_quit(T S);
 
 
+/**
+ * Mark the session as closed, so SMTP_free() doesn't send QUIT. Use it
+ * if the connection is broken or QUIT was sent already.
+ * @param S The SMTP protocol object
+ * @exception AssertException if S is NULL
+ */
+void SMTP_abort(T S);
+
+
 #undef T
 #endif
 
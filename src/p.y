@@ -189,6 +189,7 @@ static struct LinkSaturation_T linksaturationset = {};
 static struct Bandwidth_T bandwidthset = {};
 static struct Match_T matchset = {};
 static struct Icmp_T icmpset = {};
+static struct Certificate_T certificateset = {};
 static struct Mail_T mailset = {};
 static struct SslOptions_T sslset = {};
 static struct Port_T portset = {};
@@ -240,6 +241,7 @@ static void  addlinksaturation(Service_T, LinkSaturation_T);
 static void  addbandwidth(Bandwidth_T *, Bandwidth_T);
 static void  addfilesystem(FileSystem_T);
 static void  addicmp(Icmp_T);
+static void  addcertificate(Certificate_T);
 static void  addgeneric(Port_T, char*, char*);
 static void  addcommand(int, unsigned);
 static void  addargument(char *);
@@ -292,6 +294,7 @@ static void  reset_gidset();
 static void  reset_statusset();
 static void  reset_filesystemset();
 static void  reset_icmpset();
+static void  reset_certificateset();
 static void  reset_rateset(struct rate_t *);
 static void  check_name(char *);
 static int   check_perm(int);
@@ -315,16 +318,16 @@ static void _setSSLOptions(SslOptions_T options);
 }
 
 %token IF ELSE THEN FAILED
-%token SET LOGFILE FACILITY DAEMON SYSLOG MAILSERVER HTTPD ALLOW REJECTOPT ADDRESS INIT TERMINAL BATCH
+%token SET LOGFILE FACILITY DAEMON SYSLOG MAILSERVER IDLE HTTPD ALLOW REJECTOPT ADDRESS INIT TERMINAL BATCH
 %token READONLY CLEARTEXT MD5HASH SHA1HASH CRYPT DELAY
 %token PEMFILE ENABLE DISABLE SSL CIPHER CLIENTPEMFILE ALLOWSELFCERTIFICATION SELFSIGNED VERIFY CERTIFICATE CACERTIFICATEFILE CACERTIFICATEPATH VALID
 %token INTERFACE LINK PACKET BYTEIN BYTEOUT PACKETIN PACKETOUT SPEED SATURATION UPLOAD DOWNLOAD TOTAL
 %token IDFILE STATEFILE SEND EXPECT CYCLE COUNT REMINDER REPEAT
-%token LIMITS SENDEXPECTBUFFER EXPECTBUFFER FILECONTENTBUFFER HTTPCONTENTBUFFER PROGRAMOUTPUT NETWORKTIMEOUT PROGRAMTIMEOUT STARTTIMEOUT STOPTIMEOUT RESTARTTIMEOUT
+%token LIMITS SENDEXPECTBUFFER EXPECTBUFFER FILECONTENTBUFFER HTTPCONTENTBUFFER PROGRAMOUTPUT NETWORKTIMEOUT PROGRAMTIMEOUT STARTTIMEOUT STOPTIMEOUT RESTARTTIMEOUT NOTIFICATIONS EVENTNOTIFICATIONS
 %token PIDFILE START STOP PATHTOK
 %token HOST HOSTNAME PORT IPV4 IPV6 TYPE UDP TCP TCPSSL PROTOCOL CONNECTION
 %token ALERT NOALERT MAILFORMAT UNIXSOCKET SIGNATURE
-%token TIMEOUT RETRY RESTART CHECKSUM EVERY NOTEVERY
+%token TIMEOUT RETRY PERSISTENT RESTART CHECKSUM EVERY NOTEVERY
 %token DEFAULT HTTP HTTPS APACHESTATUS FTP SMTP SMTPS POP POPS IMAP IMAPS CLAMAV NNTP NTP3 MYSQL DNS WEBSOCKET
 %token SSH DWP LDAP2 LDAP3 RDATE RSYNC TNS PGSQL POSTFIXPOLICY SIP LMTP GPS RADIUS MEMCACHE REDIS MONGODB SIEVE SPAMASSASSIN FAIL2BAN
 %token <string> STRING PATH MAILADDR MAILFROM MAILREPLYTO MAILSUBJECT
@@ -351,6 +354,7 @@ static void _setSSLOptions(SslOptions_T options);
 %token <string> TARGET TIMESPEC HTTPHEADER
 %token <number> MAXFORWARD
 %token FIPS
+%token LOSS JITTER RTT MINIMUM AVERAGE MAXIMUM PERCENTILE95
 
 %left GREATER GREATEROREQUAL LESS LESSOREQUAL EQUAL NOTEQUAL
 
@@ -501,6 +505,8 @@ opthost         : start
                 | connection
                 | connectionurl
                 | icmp
+                | icmpresource
+                | certificate
                 | actionrate
                 | alert
                 | every
@@ -694,6 +700,14 @@ limit           : SENDEXPECTBUFFER ':' NUMBER unit {
                 | RESTARTTIMEOUT ':' NUMBER SECOND {
                         Run.limits.restartTimeout = $3 * 1000;
                   }
+                | NOTIFICATIONS ':' NUMBER time {
+                        Run.limits.notificationRate = $3;
+                        Run.limits.notificationWindow = $<number>4;
+                  }
+                | EVENTNOTIFICATIONS ':' NUMBER time {
+                        Run.limits.eventNotificationRate = $3;
+                        Run.limits.eventNotificationWindow = $<number>4;
+                  }
                 ;
 
 setfips         : SET FIPS {
@@ -923,10 +937,19 @@ certmd5         : CERTMD5 STRING { // Backward compatibility
                   }
                 ;
 
-setmailservers  : SET MAILSERVER mailserverlist nettimeout hostname {
+setmailservers  : SET MAILSERVER mailserverlist nettimeout hostname mailidle {
                         if (($<number>4) > SMTP_TIMEOUT)
                                 Run.mailserver_timeout = $<number>4;
                         Run.mail_hostname = $<string>5;
+                        Run.mailserver_idle = $<number>6;
+                  }
+                ;
+
+mailidle        : /* EMPTY */ {
+                        $<number>$ = 0;
+                  }
+                | IDLE NUMBER SECOND {
+                        $<number>$ = $2;
                   }
                 ;
 
@@ -1345,6 +1368,7 @@ connectionopt   : ip
                 | connectiontimeout
                 | outgoing
                 | retry
+                | persistent
                 | ssl
                 | sslchecksum
                 | sslexpire
@@ -1384,6 +1408,7 @@ connectionuxopt : type
                 | sendexpect
                 | connectiontimeout
                 | retry
+                | persistent
                 ;
 
 icmp            : IF FAILED ICMP icmptype icmpoptlist rate1 THEN action1 recovery {
@@ -1409,6 +1434,68 @@ icmp            : IF FAILED ICMP icmptype icmpoptlist rate1 THEN action1 recover
                  }
                 ;
 
+icmpresource    : IF LOSS operator value PERCENT rate1 THEN action1 recovery {
+                        resourceset.resource_id = Resource_IcmpLoss;
+                        resourceset.operator = $<number>3;
+                        resourceset.limit = $<real>4;
+                        addeventaction(&(resourceset).action, $<number>8, $<number>9);
+                        addresource(&resourceset);
+                  }
+                | IF icmpstatistic operator NUMBER MILLISECOND rate1 THEN action1 recovery {
+                        resourceset.resource_id = $<number>2;
+                        resourceset.operator = $<number>3;
+                        resourceset.limit = $<number>4;
+                        addeventaction(&(resourceset).action, $<number>8, $<number>9);
+                        addresource(&resourceset);
+                  }
+                | IF icmpstatistic operator value SECOND rate1 THEN action1 recovery {
+                        resourceset.resource_id = $<number>2;
+                        resourceset.operator = $<number>3;
+                        resourceset.limit = $<real>4 * 1000;
+                        addeventaction(&(resourceset).action, $<number>8, $<number>9);
+                        addresource(&resourceset);
+                  }
+                ;
+
+certificate     : IF FAILED CERTIFICATE host certificateport certificateoptlist rate1 THEN action1 recovery {
+                        addeventaction(&(certificateset).action, $<number>9, $<number>10);
+                        addcertificate(&certificateset);
+                  }
+                ;
+
+certificateport : /* EMPTY */
+                | PORT NUMBER {
+                        certificateset.port = $2;
+                  }
+                ;
+
+certificateoptlist : /* EMPTY */
+                | certificateoptlist certificateopt
+                ;
+
+certificateopt  : ip
+                | connectiontimeout
+                | outgoing
+                | ssl
+                | sslchecksum
+                | VALID expireoperator NUMBER DAY {
+                        certificateset.minimumDays = $<number>3;
+                  }
+                | EVERY NUMBER CYCLE {
+                        if ($<number>2 < 1)
+                                yyerror2("The certificate test interval must be at least 1 cycle");
+                        certificateset.every = $<number>2;
+                  }
+                ;
+
+icmpstatistic   : JITTER                { $<number>$ = Resource_IcmpJitter; }
+                | RTT                   { $<number>$ = Resource_IcmpResponseAverage; }
+                | RTT MINIMUM           { $<number>$ = Resource_IcmpResponseMinimum; }
+                | RTT AVERAGE           { $<number>$ = Resource_IcmpResponseAverage; }
+                | RTT MAXIMUM           { $<number>$ = Resource_IcmpResponseMaximum; }
+                | RTT PERCENTILE95      { $<number>$ = Resource_IcmpResponsePercentile95; }
+                ;
+
 icmpoptlist     : /* EMPTY */
                 | icmpoptlist icmpopt
                 ;
@@ -1912,6 +1999,11 @@ retry           : RETRY NUMBER {
                   }
                 ;
 
+persistent      : PERSISTENT {
+                        portset.persistent = true;
+                  }
+                ;
+
 actionrate      : IF NUMBER RESTART NUMBER CYCLE THEN action1 {
                         actionrateset.count = $2;
                         actionrateset.cycle = $4;
@@ -2953,12 +3045,17 @@ static void preparse() {
         Run.limits.stopTimeout       = LIMIT_STOPTIMEOUT;
         Run.limits.startTimeout      = LIMIT_STARTTIMEOUT;
         Run.limits.restartTimeout    = LIMIT_RESTARTTIMEOUT;
+        Run.limits.notificationRate        = 0;
+        Run.limits.notificationWindow      = Time_Minute;
+        Run.limits.eventNotificationRate   = 0;
+        Run.limits.eventNotificationWindow = Time_Minute;
         Run.onreboot                 = Onreboot_Start;
         Run.mmonitcredentials        = NULL;
         Run.httpd.flags              = Httpd_Disabled | Httpd_Signature;
         Run.httpd.credentials        = NULL;
         memset(&(Run.httpd.socket), 0, sizeof(Run.httpd.socket));
         Run.mailserver_timeout       = SMTP_TIMEOUT;
+        Run.mailserver_idle          = 0;
         Run.eventlist_dir            = NULL;
         Run.eventlist_slots          = -1;
         Run.system                   = NULL;
@@ -2988,6 +3085,7 @@ static void preparse() {
         reset_portset();
         reset_permset();
         reset_icmpset();
+        reset_certificateset();
         reset_linkstatusset();
         reset_linkspeedset();
         reset_linksaturationset();
@@ -3120,6 +3218,9 @@ static Service_T createservice(Service_Type type, char *name, char *value, State
                 case Service_Process:
                         NEW(current->inf.process);
                         break;
+                case Service_System:
+                        current->inf.system = &systeminfo;
+                        break;
                 default:
                         break;
         }
@@ -3164,7 +3265,7 @@ static void addservice(Service_T s) {
         switch (s->type) {
                 case Service_Host:
                         // Verify that a remote service has a port or an icmp list
-                        if (! s->portlist && ! s->icmplist) {
+                        if (! s->portlist && ! s->icmplist && ! s->certificatelist) {
                                 LogError("'check host' statement is incomplete: Please specify a port number to test\n or an icmp test at the remote host: '%s'\n", s->name);
                                 cfg_errflag++;
                         }
@@ -3233,6 +3334,7 @@ static void addservice(Service_T s) {
                 servicelist_conf = s;
         }
         tail = s;
+        Util_indexService(s);
 }
 
 
@@ -3245,16 +3347,13 @@ static void addservicegroup(char *name) {
         ASSERT(name);
 
         /* Check if service group with the same name is defined already */
-        for (g = servicegrouplist; g; g = g->next)
-                if (IS(g->name, name))
-                        break;
-
-        if (! g) {
+        if (! (g = Util_getServiceGroup(name))) {
                 NEW(g);
                 g->name = Str_dup(name);
                 g->members = List_new();
                 g->next = servicegrouplist;
                 servicegrouplist = g;
+                Util_indexServiceGroup(g);
         }
 
         List_append(g->members, current);
@@ -3314,6 +3413,8 @@ static void addport(Port_T *list, Port_T port) {
 
         if (port->protocol->check == check_radius && port->type != Socket_Udp)
                 yyerror("Radius protocol test supports UDP only");
+        if (port->persistent && ! port->protocol->ping)
+                yyerror2("The %s protocol test doesn't support persistent connections", port->protocol->name);
 
         Port_T p;
         NEW(p);
@@ -3324,6 +3425,7 @@ static void addport(Port_T *list, Port_T port) {
         p->action             = port->action;
         p->timeout            = port->timeout;
         p->retry              = port->retry;
+        p->persistent         = port->persistent;
         p->protocol           = port->protocol;
         p->hostname           = port->hostname;
         p->url_request        = port->url_request;
@@ -3338,6 +3440,8 @@ static void addport(Port_T *list, Port_T port) {
                         if (sslset.flags && (p->target.net.port == 25 || p->target.net.port == 587))
                                 sslset.flags = SSL_StartTLS;
                         _setSSLOptions(&(p->target.net.ssl.options));
+                        // The certificate expiration must be tested on the chain the server presents now, not on the chain of a resumed session
+                        p->target.net.ssl.options.noResume = p->target.net.ssl.certificate.minimumDays > 0;
 #else
                         yyerror("SSL check cannot be activated -- Monit was not built with SSL support");
 #endif
@@ -3396,7 +3500,8 @@ static void addhttpheader(Port_T port, const char *header) {
  */
 static void addresource(Resource_T rr) {
         ASSERT(rr);
-        if (Run.flags & Run_ProcessEngineEnabled) {
+        // The ping statistics don't depend on the process status engine
+        if ((Run.flags & Run_ProcessEngineEnabled) || current->type == Service_Host) {
                 Resource_T r;
                 NEW(r);
                 r->resource_id = rr->resource_id;
@@ -3939,6 +4044,38 @@ static void addicmp(Icmp_T is) {
 }
 
 
+/*
+ * Add a new TLS certificate test to the current service's certificate list
+ */
+static void addcertificate(Certificate_T cs) {
+        ASSERT(cs);
+#ifdef HAVE_OPENSSL
+        Certificate_T c;
+        NEW(c);
+        c->hostname     = portset.hostname;
+        c->port         = cs->port;
+        c->family       = portset.family;
+        c->timeout      = portset.timeout;
+        c->outgoing     = portset.outgoing;
+        c->every        = cs->every;
+        c->minimumDays  = cs->minimumDays;
+        c->action       = cs->action;
+        c->is_available = Connection_Init;
+        c->response     = -1.;
+        sslset.flags = SSL_Enabled;
+        _setSSLOptions(&(c->options));
+
+        c->next                  = current->certificatelist;
+        current->certificatelist = c;
+#else
+        yyerror("SSL certificate test cannot be activated -- Monit was not built with SSL support");
+        reset_sslset();
+#endif
+        reset_portset();
+        reset_certificateset();
+}
+
+
 /*
  * Set EventAction object
  */
@@ -4709,6 +4846,17 @@ static void reset_icmpset() {
 }
 
 
+/*
+ * Reset the certificate set to default values
+ */
+static void reset_certificateset() {
+        certificateset.port = 443;
+        certificateset.every = 1;
+        certificateset.minimumDays = 0;
+        certificateset.action = NULL;
+}
+
+
 /*
  * Reset the Rate set to default values
  */
@@ -49,18 +49,21 @@
  *
  *  @file
  */
-void check_dns(Socket_T socket) {
-        int            offset_request  = 0;
-        int            offset_response = 0;
-        int            rc;
-        unsigned char  buf[STRLEN];
-        unsigned char *response = NULL;
-        unsigned char  request[19] = {
-                0x00,          /** Request Length field for DNS via TCP */
-                0x11,
-
-                0x00,                                /** Transaction ID */
-                0x01,
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void encode_dns(Transaction_T t) {
+        ASSERT(t);
+        int offset = 0;
+        if (t->port->type == Socket_Tcp) {
+                offset = 2; // Request length field for DNS via TCP
+                t->size = 15; // Response length field and header
+        }
+        unsigned char query[17] = {
+                (t->id >> 8) & 0xff,                 /** Transaction ID */
+                t->id & 0xff,
 
                 0x01,                                         /** Flags */
                 0x00,
@@ -87,35 +90,30 @@ void check_dns(Socket_T socket) {
                 0x00,                                     /** Class: IN */
                 0x01
         };
-
-        ASSERT(socket);
-
-        switch (Socket_getType(socket)) {
-                case Socket_Udp:
-                        offset_request  = 2; /*  Skip Length field in request */
-                        offset_response = 0;
-                        break;
-                case Socket_Tcp:
-                        offset_request  = 0;
-                        offset_response = 2; /*  Skip Length field in response */
-                        break;
-                default:
-                        THROW(IOException, "DNS: unsupported socket type -- protocol test skipped");
-                        break;
+        if (offset) {
+                t->request[0] = 0x00;
+                t->request[1] = sizeof(query);
         }
+        memcpy(t->request + offset, query, sizeof(query));
+        t->length = offset + sizeof(query);
+}
 
-        if (Socket_write(socket, (unsigned char *)request + offset_request, sizeof(request) - offset_request) < 0)
-                THROW(IOException, "DNS: error sending query -- %s", STRERROR);
 
-        /* Response should have at least 14 bytes */
-        if (Socket_read(socket, (unsigned char *)buf, 15) <= 14)
-                THROW(IOException, "DNS: error receiving response -- %s", STRERROR);
+boolean_t decode_dns(Transaction_T t, const unsigned char *response, int length) {
+        ASSERT(t);
+        ASSERT(response);
+        if (t->port->type == Socket_Tcp) {
+                response += 2; // Skip Length field in response
+                length -= 2;
+        }
 
-        response = buf + offset_response;
+        /* Response should have at least the 12 bytes header */
+        if (length < 12)
+                THROW(IOException, "DNS: error receiving response -- received %d bytes", length);
 
         /* Compare transaction ID (it should be the same as in our request): */
-        if (response[0] != 0x00 && response[1] != 0x01)
-                THROW(ProtocolException, "DNS: response transaction ID mismatch -- received 0x%x%x, expected 0x1", response[0], response[1]);
+        if (response[0] != ((t->id >> 8) & 0xff) || response[1] != (t->id & 0xff))
+                return false;
 
         /* Compare flags: */
 
@@ -124,16 +122,34 @@ void check_dns(Socket_T socket) {
                 THROW(ProtocolException, "DNS: invalid response type: 0x%x", response[2] & 0x80);
 
         /* Response code: accept request refusal as correct response as the server may disallow NS root query but the negative response means, it reacts to requests */
-        rc = response[3] & 0x0F;
+        int rc = response[3] & 0x0F;
         if (rc != 0x0 && rc != 0x5)
                 THROW(ProtocolException, "DNS: invalid response code: 0x%x", rc);
 
         /* Compare queries count (it should be one as in our request): */
-        if (response[4] != 0x00 && response[5] != 0x01)
+        if (response[4] != 0x00 || response[5] != 0x01)
                 THROW(ProtocolException, "DNS: invalid query count in response -- received 0x%x%x, expected 1", response[4], response[5]);
 
         /* Compare answer and authority resource record counts (they shouldn't be both zero) */
         if (rc == 0 && response[6] == 0x00 && response[7] == 0x00 && response[8] == 0x00 && response[9] == 0x00)
                 THROW(ProtocolException, "DNS: no answer or authority records returned");
+        return true;
+}
+
+
+void check_dns(Socket_T socket) {
+        ASSERT(socket);
+        switch (Socket_getType(socket)) {
+                case Socket_Udp:
+                case Socket_Tcp:
+                        break;
+                default:
+                        THROW(IOException, "DNS: unsupported socket type -- protocol test skipped");
+                        break;
+        }
+        struct Transaction_T t = {.port = Socket_getPort(socket), .id = (uint32_t)random()};
+        ASSERT(t.port);
+        encode_dns(&t);
+        Protocol_exchange(socket, &t);
 }
 
@@ -38,19 +38,70 @@
 #include "exceptions/IOException.h"
 #include "exceptions/ProtocolException.h"
 
-/* Escape zero i.e. '\0' in expect buffer with "\0" so zero can be tested in expect strings as "\0". If there are no '\0' in the buffer it is returned as it is */
-static char *_escapeZeroInExpectBuffer(char *buf, int buflen, int n) {
-        for (int i = 0, j = 0; i < n && j < buflen; i++, j++) {
-                if (buf[j] == '\0') {
-                        if (j + 1 < buflen) {
-                                memmove(buf + j + 1, buf + j, n - i);
-                                buf[j] = '\\';
-                                buf[j + 1] = '0';
-                                j++;
-                        }
+#define DRAIN_MAX 65536     /**< Limit of the discarded response rest, so a server streaming data cannot block the test */
+
+/* Append the byte to the expect buffer. Zero i.e. '\0' is escaped with "\0" so zero can be tested in expect strings as "\0" */
+static boolean_t _append(char *buf, int buflen, int *n, int c) {
+        if (c == '\0') {
+                if (*n + 2 > buflen)
+                        return false;
+                buf[(*n)++] = '\\';
+                buf[(*n)++] = '0';
+        } else {
+                if (*n + 1 > buflen)
+                        return false;
+                buf[(*n)++] = c;
+        }
+        return true;
+}
+
+
+/* Read the response and test it each time new data arrived, so a match completes the expect without waiting. Only if the data don't match we wait for more data until the timeout or EOF. While more data can arrive, the end of the buffer is not the end of the line (REG_NOTEOL). If the server pauses for 200 ms, the data are considered complete and '$' can match the end of the buffer, so a server which keeps the connection open doesn't make a '$' anchored expect wait for the timeout */
+static void _expect(Socket_T socket, Generic_T g, char *buf, int buflen) {
+        int n = 0, c, regex_return = REG_NOMATCH;
+        int timeout = Socket_getTimeout(socket);
+        boolean_t full = false, paused = false;
+        while (! full) {
+                if ((c = Socket_readByte(socket)) < 0) {
+                        // EOF or timeout
+                        if (! paused)
+                                break;
+                        // The server paused, test the end of the line and wait for more data until the timeout if it doesn't match
+                        if ((regex_return = regexec(g->expect, buf, 0, NULL, 0)) == 0)
+                                break;
+                        paused = false;
+                        Socket_setTimeout(socket, timeout);
+                        continue;
                 }
+                // Take the data which arrived already without waiting
+                Socket_setTimeout(socket, 0);
+                do {
+                        full = ! _append(buf, buflen, &n, c);
+                } while (! full && (c = Socket_readByte(socket)) >= 0);
+                buf[n] = 0;
+                if ((regex_return = regexec(g->expect, buf, 0, NULL, full ? 0 : REG_NOTEOL)) == 0)
+                        break;
+                paused = true;
+                Socket_setTimeout(socket, 200);
+        }
+        if (regex_return == 0) {
+                // Discard the rest of the response which arrived already, so the next expect step doesn't read it
+                Socket_setTimeout(socket, 0);
+                for (int i = 0; i < DRAIN_MAX && Socket_readByte(socket) >= 0; i++)
+                        ;
+        } else if (n > 0 && ! full) {
+                // EOF or timeout: the data are complete
+                regex_return = regexec(g->expect, buf, 0, NULL, 0);
+        }
+        Socket_setTimeout(socket, timeout);
+        if (n == 0)
+                THROW(IOException, "GENERIC: error receiving data -- %s", STRERROR);
+        if (regex_return != 0) {
+                char e[STRLEN];
+                regerror(regex_return, g->expect, e, STRLEN);
+                THROW(ProtocolException, "GENERIC: received unexpected data [%s] -- %s", Str_trunc(Str_trim(buf), STRLEN - 128), e);
         }
-        return buf;
+        DEBUG("GENERIC: successfully received: '%s'\n", Str_trunc(buf, STRLEN));
 }
 
 
@@ -84,35 +135,16 @@ void check_generic(Socket_T socket) {
                         }
                         FREE(X);
                 } else if (g->expect != NULL) {
-                        /* Since the protocol is unknown we need to wait on EOF. To avoid waiting
-                         timeout seconds on EOF we first read one byte to fill the socket's read
-                         buffer and then set a low timeout on next read which reads remaining bytes
-                         as well as wait on EOF */
-                        int first_byte = Socket_readByte(socket);
-                        if (first_byte < 0) {
-                                FREE(buf);
-                                THROW(IOException, "GENERIC: error receiving data -- %s", STRERROR);
+                        TRY
+                        {
+                                _expect(socket, g, buf, Run.limits.sendExpectBuffer);
                         }
-                        *buf = first_byte;
-
-                        int timeout = Socket_getTimeout(socket);
-                        Socket_setTimeout(socket, 200);
-                        int n = Socket_read(socket, buf + 1, Run.limits.sendExpectBuffer - 1) + 1;
-                        buf[n] = 0;
-                        if (n > 0)
-                                _escapeZeroInExpectBuffer(buf, Run.limits.sendExpectBuffer, n);
-                        Socket_setTimeout(socket, timeout); // Reset back original timeout for next send/expect
-                        int regex_return = regexec(g->expect, buf, 0, NULL, 0);
-                        if (regex_return != 0) {
-                                char e[STRLEN];
-                                regerror(regex_return, g->expect, e, STRLEN);
-                                char error[STRLEN];
-                                snprintf(error, sizeof(error), "GENERIC: received unexpected data [%s] -- %s", Str_trunc(Str_trim(buf), sizeof(error) - 128), e);
+                        ELSE
+                        {
                                 FREE(buf);
-                                THROW(ProtocolException, "%s", error);
-                        } else {
-                                DEBUG("GENERIC: successfully received: '%s'\n", Str_trunc(buf, STRLEN));
+                                RETHROW;
                         }
+                        END_TRY;
                 } else {
                         /* This should not happen */
                         FREE(buf);
@@ -36,6 +36,7 @@
 #include "util/Str.h"
 
 // libmonit
+#include "system/Time.h"
 #include "exceptions/IOException.h"
 #include "exceptions/ProtocolException.h"
 
@@ -55,6 +56,44 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+#define CHUNK_SIZE 8192
+#define REGEX_CHECK 4096     /**< Content length of the first early regex test */
+
+
+/**
+ * Response body reader. The body is delimited by the Content-Length header,
+ * by the chunked transfer encoding or by the connection close
+ */
+typedef struct Body_T {
+        Socket_T socket;
+        boolean_t chunked;
+        boolean_t done;
+        boolean_t started;            /**< The status line and headers were read */
+        long long remaining;   /**< Bytes left in the body or in the current chunk, -1 if not known */
+} Body_T;
+
+
+/**
+ * Tests of the response body, which are fed from one read of the body
+ */
+typedef struct Content_T {
+        Request_T request;
+        char *checksum;
+        Hash_Type hashtype;
+        md5_context_t md5;
+        sha1_context_t sha1;
+        char *buffer;                     /**< Body for the content test */
+        int length;
+        int size;                       /**< Maximum tested content length */
+        int check;           /**< Content length of the next early regex test */
+        boolean_t decided;        /**< The content test result is known */
+        int regex_return;
+} Content_T;
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -71,147 +110,234 @@ static boolean_t _hasHeader(List_T list, const char *name) {
 }
 
 
-static void _checkResponseContent(Socket_T socket, int content_length, Request_T R) {
-        boolean_t rv = false;
+static void _readChunkSize(Body_T *B) {
+        char buf[STRLEN], *end;
+        if (! Socket_readLine(B->socket, buf, sizeof(buf)))
+                THROW(IOException, "HTTP: Error receiving chunk size -- %s", STRERROR);
+        long long size = strtoll(buf, &end, 16);
+        if (end == buf || size < 0)
+                THROW(ProtocolException, "HTTP error: Invalid chunk size '%s'", Str_chomp(buf));
+        if (size == 0) {
+                // Last chunk, skip the trailer
+                while (Socket_readLine(B->socket, buf, sizeof(buf)) && ! ((buf[0] == '\r' && buf[1] == '\n') || buf[0] == '\n'))
+                        ;
+                B->done = true;
+        }
+        B->remaining = size;
+}
 
-        if (content_length == 0)
-                THROW(ProtocolException, "HTTP error: No content returned from server");
-        else if (content_length < 0 || content_length > Run.limits.httpContentBuffer) /* content_length < 0 if no Content-Length header was found */
-                content_length = Run.limits.httpContentBuffer;
 
-        char error[STRLEN];
-        int size = 0, length = content_length, buflen = content_length + 1;
-        char *buf = ALLOC(buflen);
-        do {
-                int n = Socket_read(socket, &buf[size], length);
-                if (n <= 0)
-                        break;
-                size += n;
-                length -= n;
-        } while (length > 0);
+/**
+ * Read the decoded body data
+ * @return The number of bytes read or 0 at the end of the body
+ */
+static int _readBody(Body_T *B, char *buf, int size) {
+        while (! B->done) {
+                if (B->chunked && B->remaining == 0) {
+                        _readChunkSize(B);
+                        continue;
+                }
+                if (B->remaining >= 0 && B->remaining < size)
+                        size = (int)B->remaining;
+                int n = Socket_read(B->socket, buf, size);
+                if (n <= 0) {
+                        if (B->remaining > 0)
+                                DEBUG("HTTP warning: Response body is truncated, %lld bytes are missing\n", B->remaining);
+                        B->done = true;
+                        return 0;
+                }
+                if (B->remaining > 0 && (B->remaining -= n) == 0) {
+                        if (B->chunked)
+                                Socket_readLine(B->socket, (char[3]){}, 3); // Skip CRLF past the chunk data
+                        else
+                                B->done = true;
+                }
+                return n;
+        }
+        return 0;
+}
 
-        if (size == 0) {
-                snprintf(error, sizeof(error), "Receiving data -- %s", STRERROR);
-                goto error;
+
+/**
+ * Test the regex against the content received so far. The test is done
+ * with REG_NOTEOL while more content may follow, so a match is final
+ */
+static void _testContent(Content_T *C, boolean_t complete) {
+        C->buffer[C->length] = 0;
+        C->regex_return = regexec(C->request->regex, C->buffer, 0, NULL, complete ? 0 : REG_NOTEOL);
+        C->decided = complete || C->regex_return == 0;
+        C->check = C->length * 2;
+}
+
+
+static void _updateContent(Content_T *C, const char *data, int length) {
+        if (C->checksum) {
+                if (C->hashtype == Hash_Md5)
+                        md5_append(&C->md5, (const md5_byte_t *)data, length);
+                else
+                        sha1_append(&C->sha1, (const md5_byte_t *)data, length);
+        }
+        if (C->request && ! C->decided) {
+                int n = C->length + length > C->size ? C->size - C->length : length;
+                memcpy(C->buffer + C->length, data, n);
+                C->length += n;
+                // Only the first httpContentBuffer bytes are tested, as if the content ended there
+                if (C->length == C->size)
+                        _testContent(C, true);
+                else if (C->length >= C->check)
+                        _testContent(C, false);
         }
-        buf[size] = 0;
+}
+
 
-        int regex_return = regexec(R->regex, buf, 0, NULL, 0);
-        FREE(buf);
-        switch (R->operator) {
+static void _checkContent(Content_T *C) {
+        if (! C->decided) {
+                if (C->length == 0)
+                        THROW(ProtocolException, "HTTP error: No content returned from server");
+                _testContent(C, true);
+        }
+        char error[STRLEN];
+        switch (C->request->operator) {
                 case Operator_Equal:
-                        if (regex_return == 0) {
-                                rv = true;
+                        if (C->regex_return == 0) {
                                 DEBUG("HTTP: Regular expression matches\n");
+                                return;
                         } else {
                                 char errbuf[STRLEN];
-                                regerror(regex_return, NULL, errbuf, sizeof(errbuf));
+                                regerror(C->regex_return, NULL, errbuf, sizeof(errbuf));
                                 snprintf(error, sizeof(error), "Regular expression doesn't match: %s", errbuf);
                         }
                         break;
                 case Operator_NotEqual:
-                        if (regex_return == 0) {
+                        if (C->regex_return == 0) {
                                 snprintf(error, sizeof(error), "Regular expression matches");
                         } else {
-                                rv = true;
                                 DEBUG("HTTP: Regular expression doesn't match\n");
+                                return;
                         }
                         break;
                 default:
                         snprintf(error, sizeof(error), "Invalid content operator");
                         break;
         }
-
-error:
-        if (! rv)
-                THROW(ProtocolException, "HTTP error: %s", error);
+        THROW(ProtocolException, "HTTP error: %s", error);
 }
 
 
-static void _checkResponseChecksum(Socket_T socket, int content_length, char *checksum, Hash_Type hashtype) {
-        int n, keylength = 0;
+static void _checkChecksum(Content_T *C) {
         MD_T result, hash;
-        md5_context_t ctx_md5;
-        sha1_context_t ctx_sha1;
-        char buf[8192];
-
-        if (content_length <= 0) {
-                DEBUG("HTTP warning: Response does not contain a valid Content-Length -- cannot compute checksum\n");
-                return;
+        int keylength;
+        if (C->hashtype == Hash_Md5) {
+                md5_finish(&C->md5, (md5_byte_t *)hash);
+                keylength = 16; /* Raw key bytes not string chars! */
+        } else {
+                sha1_finish(&C->sha1, (md5_byte_t *)hash);
+                keylength = 20; /* Raw key bytes not string chars! */
         }
+        if (strncasecmp(Util_digest2Bytes((unsigned char *)hash, keylength, result), C->checksum, keylength * 2) != 0)
+                THROW(ProtocolException, "HTTP checksum error: Document checksum mismatch");
+        DEBUG("HTTP: Succeeded testing document checksum\n");
+}
 
-        switch (hashtype) {
-                case Hash_Md5:
-                        md5_init(&ctx_md5);
-                        while (content_length > 0) {
-                                if ((n = Socket_read(socket, buf, content_length > sizeof(buf) ? sizeof(buf) : content_length)) < 0)
-                                        break;
-                                md5_append(&ctx_md5, (const md5_byte_t *)buf, n);
-                                content_length -= n;
-                        }
-                        md5_finish(&ctx_md5, (md5_byte_t *)hash);
-                        keylength = 16; /* Raw key bytes not string chars! */
-                        break;
-                case Hash_Sha1:
-                        sha1_init(&ctx_sha1);
-                        while (content_length > 0) {
-                                if ((n = Socket_read(socket, buf, content_length > sizeof(buf) ? sizeof(buf) : content_length)) < 0)
-                                        break;
-                                sha1_append(&ctx_sha1, (md5_byte_t *)buf, n);
-                                content_length -= n;
-                        }
-                        sha1_finish(&ctx_sha1, (md5_byte_t *)hash);
-                        keylength = 20; /* Raw key bytes not string chars! */
-                        break;
-                default:
+
+/**
+ * Read the body once and feed it to the content and checksum tests. The
+ * read stops as soon as the results of all tests are known
+ */
+static void _checkBody(Body_T *B, Port_T P) {
+        Content_T C = {
+                .request = P->url_request && P->url_request->regex ? P->url_request : NULL,
+                .checksum = P->parameters.http.checksum,
+                .hashtype = P->parameters.http.hashtype,
+                .check = REGEX_CHECK
+        };
+        if (! C.request && ! C.checksum)
+                return;
+        if (C.checksum) {
+                if (C.hashtype == Hash_Md5)
+                        md5_init(&C.md5);
+                else if (C.hashtype == Hash_Sha1)
+                        sha1_init(&C.sha1);
+                else
                         THROW(ProtocolException, "HTTP checksum error: Unknown hash type");
         }
-        if (strncasecmp(Util_digest2Bytes((unsigned char *)hash, keylength, result), checksum, keylength * 2) != 0)
-                THROW(ProtocolException, "HTTP checksum error: Document checksum mismatch");
-        DEBUG("HTTP: Succeeded testing document checksum\n");
+        if (C.request) {
+                // Allocate the buffer for the whole tested content at once (the Content-Length or the limit)
+                C.size = B->done ? 0 : ! B->chunked && B->remaining >= 0 && B->remaining < Run.limits.httpContentBuffer ? (int)B->remaining : Run.limits.httpContentBuffer;
+                C.buffer = ALLOC(C.size + 1);
+        }
+        TRY
+        {
+                char buf[CHUNK_SIZE];
+                int n;
+                while ((C.checksum || ! C.decided) && (n = _readBody(B, buf, sizeof(buf))) > 0)
+                        _updateContent(&C, buf, n);
+                if (C.request)
+                        _checkContent(&C);
+                if (C.checksum)
+                        _checkChecksum(&C);
+        }
+        FINALLY
+        {
+                FREE(C.buffer);
+        }
+        END_TRY;
+}
+
+
+/**
+ * Read the rest of the response body, so the next response on the
+ * connection can be read
+ * @return true if the body was read, false if it's delimited by the
+ * connection close
+ */
+static boolean_t _skipBody(Body_T *B) {
+        if (! B->done && ! B->chunked && B->remaining < 0)
+                return false;
+        char buf[CHUNK_SIZE];
+        while (_readBody(B, buf, sizeof(buf)) > 0)
+                ;
+        return true;
 }
 
 
 /**
  * Check that the server returns a valid HTTP response as well as checksum
  * or content regex if required
- * @param s A socket
+ * @param B The body reader of the response
+ * @param P The port which sent the request
  */
-static void _checkResponse(Socket_T socket, Port_T P) {
-        int status, content_length = -1;
+static void _checkResponse(Body_T *B, Port_T P) {
+        int status;
         char buf[512];
-        if (! Socket_readLine(socket, buf, sizeof(buf)))
+        if (! Socket_readLine(B->socket, buf, sizeof(buf)))
                 THROW(IOException, "HTTP: Error receiving data -- %s", STRERROR);
         Str_chomp(buf);
         if (! sscanf(buf, "%*s %d", &status))
                 THROW(ProtocolException, "HTTP error: Cannot parse HTTP status in response: %s", buf);
-        if (! Util_evalQExpression(P->parameters.http.operator, status, P->parameters.http.hasStatus ? P->parameters.http.status : 400))
-                THROW(ProtocolException, "HTTP error: Server returned status %d", status);
-        /* Get Content-Length header value */
-        while (Socket_readLine(socket, buf, sizeof(buf))) {
-                if ((buf[0] == '\r' && buf[1] == '\n') || (buf[0] == '\n'))
+        /* Get Content-Length and Transfer-Encoding header values */
+        while (Socket_readLine(B->socket, buf, sizeof(buf))) {
+                if ((buf[0] == '\r' && buf[1] == '\n') || (buf[0] == '\n')) {
+                        B->started = true;
                         break;
+                }
                 Str_chomp(buf);
                 if (Str_startsWith(buf, "Content-Length")) {
-                        if (! sscanf(buf, "%*s%*[: ]%d", &content_length))
+                        if (! sscanf(buf, "%*s%*[: ]%lld", &B->remaining))
                                 THROW(ProtocolException, "HTTP error: Parsing Content-Length response header '%s'", buf);
-                        if (content_length < 0)
+                        if (B->remaining < 0)
                                 THROW(ProtocolException, "HTTP error: Illegal Content-Length response header '%s'", buf);
+                } else if (Str_startsWith(buf, "Transfer-Encoding") && Str_sub(buf, "chunked")) {
+                        B->chunked = true;
                 }
         }
-        /* FIXME:
-         * we read the data from the socket inside _checkResponseContent() and also _checkResponseChecksum() independently => these two cannot be used together - only one wil read the data. Refactor the spaghetti code and consolidate
-         * the read function, so data are ready before we test the content (read once, allow to apply different tests / many times) */
-        /* FIXME:
-         * We don't support chuncked transfer encoding and rely on Content-Length only ... this has two problems:
-         * 1.) we read chunk headers to buffer as part of data and apply checksum test and regex test to it => technically wrong, as the pattern we're looking for may be split in different chunks and won't match, checksum completyly wrong
-         * 2.) the read of chunked data is slowed downed by read delay (https://bitbucket.org/tildeslash/monit/issues/254/hosts-check-is-too-long)
-         * I.e. implement support for Chunked encoding (see above FIXME comment - we should have one read function, which can be used to read data and reuse it for all tests)
-         */
-        if (P->url_request && P->url_request->regex)
-                _checkResponseContent(socket, content_length, P->url_request);
-        if (P->parameters.http.checksum)
-                _checkResponseChecksum(socket, content_length, P->parameters.http.checksum, P->parameters.http.hashtype);
+        if (B->chunked)
+                B->remaining = 0; // The chunked encoding overrides Content-Length (RFC 7230, 3.3.3)
+        else if (B->remaining == 0 || P->parameters.http.method == Http_Head || status == 204 || status == 304)
+                B->done = true;
+        if (! Util_evalQExpression(P->parameters.http.operator, status, P->parameters.http.hasStatus ? P->parameters.http.status : 400))
+                THROW(ProtocolException, "HTTP error: Server returned status %d", status);
+        _checkBody(B, P);
 }
 
 
@@ -225,7 +351,7 @@ static char *_getAuthHeader(Port_T P) {
 }
 
 
-static void _sendRequest(Socket_T socket, Port_T P) {
+static void _sendRequest(Socket_T socket, Port_T P, boolean_t keepalive) {
         char *auth = _getAuthHeader(P);
         StringBuffer_T sb = StringBuffer_create(168);
         //FIXME: add decompression support to InputStream and switch here to it + set Accept-Encoding to gzip, so the server can send body compressed (if we test checksum/content)
@@ -244,7 +370,7 @@ static void _sendRequest(Socket_T socket, Port_T P) {
         if (! _hasHeader(P->parameters.http.headers, "Accept"))
                 StringBuffer_append(sb, "Accept: */*\r\n");
         if (! _hasHeader(P->parameters.http.headers, "Connection"))
-                StringBuffer_append(sb, "Connection: close\r\n");
+                StringBuffer_append(sb, "Connection: %s\r\n", keepalive ? "keep-alive" : "close");
         // Add headers if we have them
         if (P->parameters.http.headers) {
                 for (list_t p = P->parameters.http.headers->head; p; p = p->next) {
@@ -269,7 +395,51 @@ void check_http(Socket_T socket) {
         Port_T P = Socket_getPort(socket);
         ASSERT(P);
 
-        _sendRequest(socket, P);
-        _checkResponse(socket, P);
+        Body_T B = {.socket = socket, .remaining = -1};
+        _sendRequest(socket, P, false);
+        _checkResponse(&B, P);
+}
+
+
+int pipeline_http(Socket_T socket, Port_T *ports, int count) {
+        ASSERT(socket);
+        ASSERT(ports);
+
+        // Send the requests back-to-back, the server closes the connection after the last one
+        for (int i = 0; i < count; i++)
+                _sendRequest(socket, ports[i], i < count - 1);
+        int64_t start = Time_micro();
+        int done = 0;
+        for (boolean_t synchronized = true; synchronized && done < count; done++) {
+                Port_T P = ports[done];
+                Body_T B = {.socket = socket, .remaining = -1};
+                TRY
+                {
+                        _checkResponse(&B, P);
+                        *P->probe.error = 0;
+                }
+                ELSE
+                {
+                        Str_copy(P->probe.error, Exception_frame.message, sizeof(P->probe.error) - 1);
+                }
+                END_TRY;
+                if (! B.started && done > 0)
+                        break; // No response, e.g. the server closed the connection after the previous one: test the rest separately
+                P->probe.done = true;
+                P->probe.response = (double)(Time_micro() - start) / 1000.;
+                // The next response follows the whole body of this one
+                TRY
+                {
+                        synchronized = B.started && _skipBody(&B);
+                }
+                ELSE
+                {
+                        synchronized = false;
+                }
+                END_TRY;
+                // The response time of the next port starts past this response
+                start = Time_micro();
+        }
+        return done;
 }
 
@@ -492,11 +492,27 @@ void check_mysql(Socket_T socket) {
                         RETHROW;
         }
         END_TRY;
-        // If we're logged in, ping and quit
+        // If we're logged in, ping and quit (keep the persistent connection open)
         if (mysql.state == MySQL_Ok) {
                 _requestPing(&mysql);
                 _response(&mysql);
-                _requestQuit(&mysql);
+                if (! mysql.port->persistent)
+                        _requestQuit(&mysql);
         }
 }
 
+
+/**
+ * MySQL ping of a persistent connection. The connection must be logged in,
+ * if the anonymous login failed, the server closed the connection and the
+ * ping fails
+ */
+void ping_mysql(Socket_T socket) {
+        ASSERT(socket);
+        mysql_t mysql = {.state = MySQL_Ok, .socket = socket, .port = Socket_getPort(socket)};
+        _requestPing(&mysql);
+        _response(&mysql);
+        if (mysql.state != MySQL_Ok)
+                THROW(ProtocolException, "MySQL ping failed");
+}
+
@@ -53,48 +53,60 @@
 #define NTP_VERSION       3 /** Version Number: 3                      */
 #define NTP_MODE_CLIENT   3 /** Mode:           Client                 */
 #define NTP_MODE_SERVER   4 /** Mode:           Server                 */
+#define NTP_ORIGINATE    24 /** Originate Timestamp offset             */
+#define NTP_TRANSMIT     40 /** Transmit Timestamp offset              */
 
 
 /* ------------------------------------------------------------------ Public */
 
 
-void check_ntp3(Socket_T socket) {
-        int  br;
-        char ntpRequest[NTPLEN] = {};
-        char ntpResponse[NTPLEN] = {};
-
-        ASSERT(socket);
-
+void encode_ntp3(Transaction_T t) {
+        ASSERT(t);
+        memset(t->request, 0, NTPLEN);
         /*
          Prepare NTP request. The first octet consists of:
          bits 0-1 ... Leap Indicator
          bits 2-4 ... Version Number
          bits 5-7 ... Mode
          */
-        ntpRequest[0]= (NTP_LEAP_NOTSYNC << 6) | (NTP_VERSION << 3) | (NTP_MODE_CLIENT);
-
-        /* Send request to NTP server */
-        if (Socket_write(socket, ntpRequest, NTPLEN) <= 0)
-                THROW(IOException, "NTP: error sending NTP request -- %s", STRERROR);
-
-        /* Receive and validate response */
-        if ((br = Socket_read(socket, ntpResponse, NTPLEN)) <= 0)
-                THROW(IOException, "NTP: did not receive answer from server -- %s", STRERROR);
+        t->request[0] = (NTP_LEAP_NOTSYNC << 6) | (NTP_VERSION << 3) | (NTP_MODE_CLIENT);
+        /* The server copies the transmit timestamp to the originate timestamp of the response => use it to match the response */
+        t->request[NTP_TRANSMIT] = (t->id >> 24) & 0xff;
+        t->request[NTP_TRANSMIT + 1] = (t->id >> 16) & 0xff;
+        t->request[NTP_TRANSMIT + 2] = (t->id >> 8) & 0xff;
+        t->request[NTP_TRANSMIT + 3] = t->id & 0xff;
+        t->length = t->size = NTPLEN;
+}
 
-        if (br != NTPLEN)
-                THROW(ProtocolException, "NTP: Received %d bytes from server, expected %d bytes", br, NTPLEN);
 
+boolean_t decode_ntp3(Transaction_T t, const unsigned char *response, int length) {
+        ASSERT(t);
+        ASSERT(response);
+        if (length != NTPLEN)
+                THROW(ProtocolException, "NTP: Received %d bytes from server, expected %d bytes", length, NTPLEN);
+        if (memcmp(response + NTP_ORIGINATE, t->request + NTP_TRANSMIT, 8) != 0)
+                return false;
         /*
          Compare NTP response. The first octet consists of:
          bits 0-1 ... Leap Indicator
          bits 2-4 ... Version Number
          bits 5-7 ... Mode
          */
-        if ((ntpResponse[0] & 0x07) != NTP_MODE_SERVER)
+        if ((response[0] & 0x07) != NTP_MODE_SERVER)
                 THROW(ProtocolException, "NTP: Server mode error");
-        if ((ntpResponse[0] & 0x38) != NTP_VERSION << 3)
+        if ((response[0] & 0x38) != NTP_VERSION << 3)
                 THROW(ProtocolException, "NTP: Server protocol version error");
-        if ((ntpResponse[0] & 0xc0) == NTP_LEAP_NOTSYNC << 6)
+        if ((response[0] & 0xc0) == NTP_LEAP_NOTSYNC << 6)
                 THROW(ProtocolException, "NTP: Server not synchronized");
+        return true;
+}
+
+
+void check_ntp3(Socket_T socket) {
+        ASSERT(socket);
+        struct Transaction_T t = {.port = Socket_getPort(socket), .id = (uint32_t)random()};
+        ASSERT(t.port);
+        encode_ntp3(&t);
+        Protocol_exchange(socket, &t);
 }
 
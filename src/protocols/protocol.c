@@ -38,9 +38,15 @@
 
 #include "protocol.h"
 
+// libmonit
+#include "system/Net.h"
+#include "system/Time.h"
+#include "exceptions/IOException.h"
+#include "exceptions/ProtocolException.h"
+
 static Protocol_T protocols[] = {
         &(struct Protocol_T){"DEFAULT",         check_default},
-        &(struct Protocol_T){"HTTP",            check_http},
+        &(struct Protocol_T){"HTTP",            check_http,             NULL,   NULL,           NULL,           pipeline_http},
         &(struct Protocol_T){"FTP",             check_ftp},
         &(struct Protocol_T){"SMTP",            check_smtp},
         &(struct Protocol_T){"POP",             check_pop},
@@ -54,20 +60,20 @@ static Protocol_T protocols[] = {
         &(struct Protocol_T){"RSYNC",           check_rsync},
         &(struct Protocol_T){"generic",         check_generic},
         &(struct Protocol_T){"APACHESTATUS",    check_apache_status},
-        &(struct Protocol_T){"NTP3",            check_ntp3},
-        &(struct Protocol_T){"MYSQL",           check_mysql},
-        &(struct Protocol_T){"DNS",             check_dns},
+        &(struct Protocol_T){"NTP3",            check_ntp3,             NULL,   encode_ntp3,    decode_ntp3},
+        &(struct Protocol_T){"MYSQL",           check_mysql,            ping_mysql},
+        &(struct Protocol_T){"DNS",             check_dns,              NULL,   encode_dns,     decode_dns},
         &(struct Protocol_T){"POSTFIX-POLICY",  check_postfix_policy},
         &(struct Protocol_T){"TNS",             check_tns},
         &(struct Protocol_T){"PGSQL",           check_pgsql},
         &(struct Protocol_T){"CLAMAV",          check_clamav},
-        &(struct Protocol_T){"SIP",             check_sip},
+        &(struct Protocol_T){"SIP",             check_sip,              NULL,   encode_sip,     decode_sip},
         &(struct Protocol_T){"LMTP",            check_lmtp},
         &(struct Protocol_T){"GPS",             check_gps},
-        &(struct Protocol_T){"RADIUS",          check_radius},
-        &(struct Protocol_T){"MEMCACHE",        check_memcache},
+        &(struct Protocol_T){"RADIUS",          check_radius,           NULL,   encode_radius,  decode_radius},
+        &(struct Protocol_T){"MEMCACHE",        check_memcache,         check_memcache},
         &(struct Protocol_T){"WEBSOCKET",       check_websocket},
-        &(struct Protocol_T){"REDIS",           check_redis},
+        &(struct Protocol_T){"REDIS",           check_redis,            ping_redis},
         &(struct Protocol_T){"MONGODB",         check_mongodb},
         &(struct Protocol_T){"SIEVE",           check_sieve},
         &(struct Protocol_T){"SPAMASSASSIN",    check_spamassassin},
@@ -85,3 +91,31 @@ Protocol_T Protocol_get(Protocol_Type type) {
 }
 
 
+void Protocol_exchange(Socket_T socket, Transaction_T t) {
+        ASSERT(socket);
+        ASSERT(t);
+        Protocol_T protocol = t->port->protocol;
+        unsigned char response[UDP_MAXSIZE];
+        if (Socket_write(socket, t->request, t->length) < 0)
+                THROW(IOException, "%s: error sending request -- %s", protocol->name, STRERROR);
+        if (Socket_getType(socket) == Socket_Udp && ! Socket_isSecure(socket)) {
+                // Read one datagram at a time and skip late responses to the previous requests
+                int64_t deadline = Time_milli() + Socket_getTimeout(socket);
+                for (int64_t now = Time_milli(); now < deadline; now = Time_milli()) {
+                        ssize_t n = Net_read(Socket_getSocket(socket), response, sizeof(response), deadline - now);
+                        if (n < 0)
+                                THROW(IOException, "%s: error receiving response -- %s", protocol->name, STRERROR);
+                        if (n == 0)
+                                break;
+                        if (protocol->decode(t, response, (int)n))
+                                return;
+                }
+                THROW(IOException, "%s: no response within %s", protocol->name, Str_milliToTime(Socket_getTimeout(socket), (char[23]){}));
+        }
+        int n = Socket_read(socket, response, MIN(t->size, (int)sizeof(response)));
+        if (n <= 0)
+                THROW(IOException, "%s: error receiving response -- %s", protocol->name, STRERROR);
+        if (! protocol->decode(t, response, n))
+                THROW(ProtocolException, "%s: response does not match the request", protocol->name);
+}
+
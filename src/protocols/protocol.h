@@ -103,6 +103,21 @@ void check_radius(Socket_T);
 void check_memcache(Socket_T);
 void check_websocket(Socket_T);
 
+void encode_dns(Transaction_T);
+void encode_ntp3(Transaction_T);
+void encode_radius(Transaction_T);
+void encode_sip(Transaction_T);
+
+boolean_t decode_dns(Transaction_T, const unsigned char *, int);
+boolean_t decode_ntp3(Transaction_T, const unsigned char *, int);
+boolean_t decode_radius(Transaction_T, const unsigned char *, int);
+boolean_t decode_sip(Transaction_T, const unsigned char *, int);
+
+void ping_mysql(Socket_T);
+void ping_redis(Socket_T);
+
+int pipeline_http(Socket_T, Port_T *, int);
+
 
 /*
  * Returns a protocol object for the given protocol type
@@ -110,4 +125,13 @@ void check_websocket(Socket_T);
 Protocol_T Protocol_get(Protocol_Type type);
 
 
+/*
+ * Send the request encoded by the port's protocol and decode the response.
+ * Responses of UDP sockets are read one datagram at a time and datagrams
+ * which do not match the request are skipped. Throws IOException or
+ * ProtocolException if the exchange failed
+ */
+void Protocol_exchange(Socket_T socket, Transaction_T t);
+
+
 #endif
@@ -52,21 +52,27 @@
  *
  *
  */
-void check_radius(Socket_T socket) {
-        int i, length, left;
-        int secret_len;
-        Port_T P;
-        md5_context_t ctx;
-        char *secret;
-        unsigned char *attr;
-        unsigned char  digest[16];
-        unsigned char  response[STRLEN];
-        unsigned char  request[38] = {
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static const char *_getSecret(Port_T P) {
+        return P->parameters.radius.secret ? P->parameters.radius.secret : "testing123";
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void encode_radius(Transaction_T t) {
+        ASSERT(t);
+        unsigned char request[38] = {
                 /* Status-Server */
                 0x0c,
 
-                /* Code, we always use zero */
-                0x00,
+                /* Packet identifier, matches the response to the request */
+                t->id & 0xff,
 
                 /* Packet length */
                 0x00,
@@ -115,47 +121,51 @@ void check_radius(Socket_T socket) {
                 0x00
         };
 
-        ASSERT(socket);
-
-        P = Socket_getPort(socket);
-        ASSERT(P);
-
-        secret = P->parameters.radius.secret ? P->parameters.radius.secret : "testing123";
-        secret_len = (int)strlen(secret);
+        const char *secret = _getSecret(t->port);
 
         /* get 16 bytes of random data */
-        for (i = 0; i < 16; i++)
+        for (int i = 0; i < 16; i++)
                 request[i + 4] = ((unsigned int)random()) & 0xff;
 
         /* sign the packet */
-        Util_hmacMD5(request, sizeof(request), (unsigned char *)secret, secret_len, request + 22);
+        Util_hmacMD5(request, sizeof(request), (unsigned char *)secret, (int)strlen(secret), request + 22);
+
+        memcpy(t->request, request, sizeof(request));
+        t->length = sizeof(request);
+        t->size = STRLEN;
+}
 
-        if (Socket_write(socket, (unsigned char *)request, sizeof(request)) < 0)
-                THROW(IOException, "RADIUS: error sending query -- %s", STRERROR);
+
+boolean_t decode_radius(Transaction_T t, const unsigned char *data, int length) {
+        ASSERT(t);
+        ASSERT(data);
+        md5_context_t ctx;
+        unsigned char digest[16];
+        unsigned char response[UDP_MAXSIZE];
 
         /* the response should have at least 20 bytes */
-        if ((length = Socket_read(socket, (unsigned char *)response, sizeof(response))) < 20)
-                THROW(IOException, "RADIUS: error receiving response -- %s", STRERROR);
+        if (length < 20)
+                THROW(IOException, "RADIUS: error receiving response -- received %d bytes", length);
+
+        /* compare the packet ID (it should be the same as in our request) */
+        if (data[1] != t->request[1])
+                return false;
 
         /* compare the response code (should be Access-Accept or Accounting-Response) */
-        if ((response[0] != 2) && (response[0] != 5))
+        if ((data[0] != 2) && (data[0] != 5))
                 THROW(ProtocolException, "RADIUS: Invalid reply code -- error occurred");
 
-        /* compare the packet ID (it should be the same as in our request) */
-        if (response[1] != 0x00)
-                THROW(ProtocolException, "RADIUS: ID mismatch");
-
         /* check the length */
-        if (response[2] != 0)
+        if (data[2] != 0)
                 THROW(ProtocolException, "RADIUS: message is too long");
 
         /* check length against packet data */
-        if (response[3] != length)
+        if (data[3] != length)
                 THROW(ProtocolException, "RADIUS: message has invalid length");
 
         /* validate that it is a well-formed packet */
-        attr = response + 20;
-        left = length - 20;
+        const unsigned char *attr = data + 20;
+        int left = length - 20;
         while (left > 0) {
                 if (left < 2)
                         THROW(ProtocolException, "RADIUS: message is malformed");
@@ -171,18 +181,30 @@ void check_radius(Socket_T socket) {
                         /* FIXME: validate it */
                 }
                 left -= attr[1];
+                attr += attr[1];
         }
 
         /* save the reply authenticator, and copy the request authenticator over */
+        memcpy(response, data, length);
         memcpy(digest, response + 4, 16);
-        memcpy(response + 4, request + 4, 16);
+        memcpy(response + 4, t->request + 4, 16);
 
+        const char *secret = _getSecret(t->port);
         md5_init(&ctx);
         md5_append(&ctx, (const md5_byte_t *)response, length);
-        md5_append(&ctx, (const md5_byte_t *)secret, secret_len);
+        md5_append(&ctx, (const md5_byte_t *)secret, (int)strlen(secret));
         md5_finish(&ctx, response + 4);
 
         if (memcmp(digest, response + 4, 16) != 0)
                 LogInfo("RADIUS: message fails authentication");
+        return true;
 }
 
+
+void check_radius(Socket_T socket) {
+        ASSERT(socket);
+        struct Transaction_T t = {.port = Socket_getPort(socket), .id = (uint32_t)random()};
+        ASSERT(t.port);
+        encode_radius(&t);
+        Protocol_exchange(socket, &t);
+}
@@ -67,43 +67,61 @@
  */
 
 
-/* -------------------------------------------------------------- Public*/
+/* ----------------------------------------------------------------- Private */
 
-void check_sip(Socket_T socket) {
-        ASSERT(socket);
 
-        Port_T P = Socket_getPort(socket);
-        ASSERT(P);
-        const char *target = P->parameters.sip.target ? P->parameters.sip.target : "monit@foo.bar";
+static void _checkStatus(const char *line) {
+        DEBUG("Response from SIP server: %s\n", line);
 
-        int port = Socket_getLocalPort(socket);
-        char *proto = Socket_isSecure(socket) ? "sips" : "sip";
+        int status;
+        if (sscanf(line, "%*s %d", &status) != 1)
+                THROW(ProtocolException, "SIP error: cannot parse SIP status in response: %s", line);
 
-        char *transport = "";
-        char *rport = "";
-        switch (Socket_getType(socket)) {
-                case Socket_Udp:
-                        transport = "UDP";
-                        rport = ";rport";
-                        break;
-                case Socket_Tcp:
-                        transport = "TCP";
-                        break;
-                default:
-                        THROW(IOException, "Unsupported socket type, only TCP and UDP are supported");
-                        break;
+        if (status >= 400)
+                THROW(ProtocolException, "SIP error: Server returned status %d", status);
+
+        if (status >= 300 && status < 400)
+                THROW(ProtocolException, "SIP info: Server redirection. Returned status %d", status);
+
+        if (status > 100 && status < 200)
+                THROW(ProtocolException, "SIP error: Provisional response . Returned status %d", status);
+}
+
+
+/* Returns true if the message has the Call-ID header (or its compact form) with the given value */
+static boolean_t _hasCallId(char *message, uint32_t id) {
+        char value[11];
+        snprintf(value, sizeof(value), "%u", id);
+        for (char *line = strtok(message, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+                char *v = NULL;
+                if (Str_startsWith(line, "Call-ID:"))
+                        v = line + 8;
+                else if (Str_startsWith(line, "i:"))
+                        v = line + 2;
+                if (v && Str_isEqual(Str_trim(v), value))
+                        return true;
         }
+        return false;
+}
+
+
+/* -------------------------------------------------------------- Public*/
 
-        char buf[STRLEN];
-        const char *myip = Socket_getLocalHost(socket, buf, sizeof(buf));
 
-        if (Socket_print(socket,
+void encode_sip(Transaction_T t) {
+        ASSERT(t);
+        Port_T P = t->port;
+        const char *target = P->parameters.sip.target ? P->parameters.sip.target : "monit@foo.bar";
+        const char *proto = P->target.net.ssl.options.flags ? "sips" : "sip";
+        const char *transport = P->type == Socket_Udp ? "UDP" : "TCP";
+        const char *rport = P->type == Socket_Udp ? ";rport" : "";
+        int length = snprintf((char *)t->request, sizeof(t->request),
                          "OPTIONS %s:%s SIP/2.0\r\n"
                          "Via: SIP/2.0/%s %s:%d;branch=z9hG4bKh%ld%s\r\n"
                          "Max-Forwards: %d\r\n"
                          "To: <%s:%s>\r\n"
                          "From: monit <%s:monit@%s>;tag=%ld\r\n"
-                         "Call-ID: %ld\r\n"
+                         "Call-ID: %u\r\n"
                          "CSeq: 63104 OPTIONS\r\n"
                          "Contact: <%s:%s:%d>\r\n"
                          "Accept: application/sdp\r\n"
@@ -112,42 +130,69 @@ void check_sip(Socket_T socket) {
                          proto,                        // protocol
                          target,                       // to
                          transport,                    // via transport udp|tcp
-                         myip,                         // who its from
-                         port,                         // our port
+                         t->local,                     // who its from
+                         t->localPort,                 // our port
                          random(),                     // branch
                          rport,                        // rport option
                          P->parameters.sip.maxforward ? P->parameters.sip.maxforward : 70, // maximum forwards
                          proto,                        // protocol
                          target,                       // to
                          proto,                        // protocol
-                         myip,                         // from host
+                         t->local,                     // from host
                          random(),                     // tag
-                         random(),                     // call id
+                         t->id,                        // call id
                          proto,                        // protocol
-                         myip,                         // contact host
-                         port,                         // contact port
+                         t->local,                     // contact host
+                         t->localPort,                 // contact port
                          VERSION                       // user agent
-                         ) < 0) {
-                THROW(IOException, "SIP: error sending data -- %s", STRERROR);
-        }
-
-        if (! Socket_readLine(socket, buf, sizeof(buf)))
-                THROW(IOException, "SIP: error receiving data -- %s", STRERROR);
-
-        Str_chomp(buf);
-
-        DEBUG("Response from SIP server: %s\n", buf);
+                         );
+        if (length < 0 || length >= sizeof(t->request))
+                THROW(ProtocolException, "SIP: request too long");
+        t->length = length;
+}
 
-        int status;
-        if (! sscanf(buf, "%*s %d", &status))
-                THROW(ProtocolException, "SIP error: cannot parse SIP status in response: %s", buf);
 
-        if (status >= 400)
-                THROW(ProtocolException, "SIP error: Server returned status %d", status);
+boolean_t decode_sip(Transaction_T t, const unsigned char *response, int length) {
+        ASSERT(t);
+        ASSERT(response);
+        char message[UDP_MAXSIZE + 1];
+        length = MIN(length, UDP_MAXSIZE);
+        memcpy(message, response, length);
+        message[length] = 0;
+        char *end = strpbrk(message, "\r\n");
+        char line[STRLEN];
+        snprintf(line, sizeof(line), "%.*s", end ? (int)(end - message) : length, message);
+        if (! _hasCallId(message, t->id))
+                return false;
+        _checkStatus(line);
+        return true;
+}
 
-        if (status >= 300 && status < 400)
-                THROW(ProtocolException, "SIP info: Server redirection. Returned status %d", status);
 
-        if (status > 100 && status < 200)
-                THROW(ProtocolException, "SIP error: Provisional response . Returned status %d", status);
+void check_sip(Socket_T socket) {
+        ASSERT(socket);
+        switch (Socket_getType(socket)) {
+                case Socket_Udp:
+                case Socket_Tcp:
+                        break;
+                default:
+                        THROW(IOException, "Unsupported socket type, only TCP and UDP are supported");
+                        break;
+        }
+        struct Transaction_T t = {.port = Socket_getPort(socket), .id = (uint32_t)random(), .localPort = Socket_getLocalPort(socket)};
+        ASSERT(t.port);
+        Socket_getLocalHost(socket, t.local, sizeof(t.local));
+        encode_sip(&t);
+        if (Socket_getType(socket) == Socket_Udp) {
+                Protocol_exchange(socket, &t);
+        } else {
+                char buf[STRLEN];
+                if (Socket_write(socket, t.request, t.length) < 0)
+                        THROW(IOException, "SIP: error sending data -- %s", STRERROR);
+                if (! Socket_readLine(socket, buf, sizeof(buf)))
+                        THROW(IOException, "SIP: error receiving data -- %s", STRERROR);
+                Str_chomp(buf);
+                _checkStatus(buf);
+        }
 }
+
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#include "monit.h"
+#include "resolver.h"
+
+// libmonit
+#include "system/Time.h"
+
+
+/**
+ * The cache is a list of the resolved host names, most recently resolved
+ * first. The addresses are copied out of the list, so the caller does not
+ * hold the mutex while it connects.
+ *
+ * @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define RESOLVER_MAX 1024
+
+
+typedef struct Resolution_T {
+        char *hostname;
+        int family;
+        int socktype;
+        int protocol;
+        int flags;
+        int status;                    /**< getaddrinfo() error code or 0 */
+        int ttl;
+        time_t created;
+        struct addrinfo *result;
+        struct Resolution_T *next;
+} *Resolution_T;
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+static Resolution_T cache = NULL;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static boolean_t _isCacheable(int status) {
+        switch (status) {
+                case 0:
+                case EAI_NONAME:
+                case EAI_AGAIN:
+                case EAI_FAIL:
+#ifdef EAI_NODATA
+                case EAI_NODATA:
+#endif
+                        return true;
+                default:
+                        return false; // Local errors such as EAI_SYSTEM or EAI_MEMORY are not remembered
+        }
+}
+
+
+static void _setPort(struct sockaddr *addr, int port) {
+        if (addr->sa_family == AF_INET)
+                ((struct sockaddr_in *)addr)->sin_port = htons(port);
+#ifdef HAVE_IPV6
+        else if (addr->sa_family == AF_INET6)
+                ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+#endif
+}
+
+
+/* Copy the address list, each entry with its address is allocated as one block */
+static struct addrinfo *_copy(const struct addrinfo *result, int port) {
+        struct addrinfo *copy = NULL, **last = &copy;
+        for (const struct addrinfo *r = result; r; r = r->ai_next) {
+                struct addrinfo *a = CALLOC(1, sizeof(struct addrinfo) + r->ai_addrlen);
+                a->ai_flags = r->ai_flags;
+                a->ai_family = r->ai_family;
+                a->ai_socktype = r->ai_socktype;
+                a->ai_protocol = r->ai_protocol;
+                a->ai_addrlen = r->ai_addrlen;
+                a->ai_addr = (struct sockaddr *)(a + 1);
+                memcpy(a->ai_addr, r->ai_addr, r->ai_addrlen);
+                _setPort(a->ai_addr, port);
+                *last = a;
+                last = &(a->ai_next);
+        }
+        return copy;
+}
+
+
+static void _freeResolution(Resolution_T *r) {
+        if ((*r)->result)
+                freeaddrinfo((*r)->result);
+        FREE((*r)->hostname);
+        FREE(*r);
+}
+
+
+static boolean_t _isValid(Resolution_T r, time_t now) {
+        return now >= r->created && now - r->created < r->ttl; // The entry expires also if the time jumped back
+}
+
+
+/* Unlink expired entries and the oldest ones over the limit. Must be called with the mutex locked */
+static void _prune(time_t now) {
+        int n = 0;
+        for (Resolution_T *r = &cache; *r;) {
+                if (! _isValid(*r, now) || n >= RESOLVER_MAX) {
+                        Resolution_T expired = *r;
+                        *r = expired->next;
+                        _freeResolution(&expired);
+                } else {
+                        r = &((*r)->next);
+                        n++;
+                }
+        }
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+struct addrinfo *Resolver_get(const char *hostname, int port, const struct addrinfo *hints, int *status) {
+        ASSERT(hostname);
+        ASSERT(hints);
+        ASSERT(status);
+        struct addrinfo *copy = NULL;
+        boolean_t found = false;
+        LOCK(mutex)
+        {
+                time_t now = Time_now();
+                for (Resolution_T r = cache; r; r = r->next) {
+                        if (_isValid(r, now) && r->family == hints->ai_family && r->socktype == hints->ai_socktype && r->protocol == hints->ai_protocol && r->flags == hints->ai_flags && Str_isByteEqual(r->hostname, hostname)) {
+                                *status = r->status;
+                                copy = _copy(r->result, port);
+                                found = true;
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+        if (found)
+                return copy;
+        // Resolve unlocked, a concurrent lookup of the same name just replaces the entry
+        struct addrinfo *result = NULL;
+        *status = getaddrinfo(hostname, NULL, hints, &result);
+        if (*status == 0)
+                copy = _copy(result, port);
+        if (_isCacheable(*status)) {
+                Resolution_T r;
+                NEW(r);
+                r->hostname = Str_dup(hostname);
+                r->family = hints->ai_family;
+                r->socktype = hints->ai_socktype;
+                r->protocol = hints->ai_protocol;
+                r->flags = hints->ai_flags;
+                r->status = *status;
+                r->result = result;
+                r->ttl = *status ? RESOLVER_NEGATIVE_TTL : RESOLVER_TTL;
+                r->created = Time_now();
+                LOCK(mutex)
+                {
+                        r->next = cache;
+                        cache = r;
+                        _prune(r->created);
+                }
+                END_LOCK;
+        } else if (result) {
+                freeaddrinfo(result);
+        }
+        return copy;
+}
+
+
+void Resolver_free(struct addrinfo **result) {
+        ASSERT(result);
+        for (struct addrinfo *a = *result, *next = NULL; a; a = next) {
+                next = a->ai_next;
+                FREE(a);
+        }
+        *result = NULL;
+}
+
+
+void Resolver_reset() {
+        LOCK(mutex)
+        {
+                for (Resolution_T r = cache, next = NULL; r; r = next) {
+                        next = r->next;
+                        _freeResolution(&r);
+                }
+                cache = NULL;
+        }
+        END_LOCK;
+}
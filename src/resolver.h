@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_RESOLVER_H
+#define MONIT_RESOLVER_H
+
+#include "config.h"
+
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+
+
+/**
+ * Cache of host name resolutions for the network tests.
+ *
+ * The port and ping tests resolve the same host names in every cycle. The
+ * getaddrinfo() results are cached by the host name and the hints for
+ * RESOLVER_TTL seconds, failed resolutions for RESOLVER_NEGATIVE_TTL
+ * seconds, so the local resolver is queried at most once per lifetime
+ * instead of once per test. The cache is flushed by Resolver_reset() when
+ * the configuration is reloaded.
+ *
+ *  @file
+ */
+
+
+#define RESOLVER_TTL 60
+#define RESOLVER_NEGATIVE_TTL 10
+
+
+/**
+ * Resolve the host name, from the cache if possible. The port is set in
+ * the returned addresses
+ * @param hostname The host name or IP address
+ * @param port The port number or 0
+ * @param hints The getaddrinfo() hints
+ * @param status Set to the getaddrinfo() error code on failure
+ * @return A copy of the address list, which must be freed with
+ * Resolver_free() or NULL on failure
+ */
+struct addrinfo *Resolver_get(const char *hostname, int port, const struct addrinfo *hints, int *status);
+
+
+/**
+ * Free an address list returned by Resolver_get()
+ * @param result A reference to the address list. May be NULL
+ */
+void Resolver_free(struct addrinfo **result);
+
+
+/**
+ * Drop all cached resolutions
+ */
+void Resolver_reset();
+
+
+#endif
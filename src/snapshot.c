@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "snapshot.h"
+
+
+/**
+ * Copy-on-publish snapshots of the service status. The snapshot pointer
+ * is swapped under a mutex which is held only for the swap and for the
+ * reference count update, the copy and the rendering run unlocked.
+ *
+ * @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+static Snapshot_T current = NULL;
+static unsigned long long generation = 0ULL;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void *_copy(const void *p, size_t size) {
+        void *c = ALLOC(size);
+        memcpy(c, p, size);
+        return c;
+}
+
+
+static Port_T _copyPorts(Port_T list) {
+        Port_T head = NULL;
+        for (Port_T p = list, *tail = &head; p; p = p->next, tail = &(*tail)->next) {
+                *tail = _copy(p, sizeof(*p));
+                (*tail)->next = NULL;
+        }
+        return head;
+}
+
+
+static void _freePorts(Port_T *list) {
+        for (Port_T p = *list, next; p; p = next) {
+                next = p->next;
+                FREE(p);
+        }
+        *list = NULL;
+}
+
+
+static Icmp_T _copyIcmps(Icmp_T list) {
+        Icmp_T head = NULL;
+        for (Icmp_T i = list, *tail = &head; i; i = i->next, tail = &(*tail)->next) {
+                *tail = _copy(i, sizeof(*i));
+                (*tail)->next = NULL;
+        }
+        return head;
+}
+
+
+static void _freeIcmps(Icmp_T *list) {
+        for (Icmp_T i = *list, next; i; i = next) {
+                next = i->next;
+                FREE(i);
+        }
+        *list = NULL;
+}
+
+
+static Certificate_T _copyCertificates(Certificate_T list) {
+        Certificate_T head = NULL;
+        for (Certificate_T c = list, *tail = &head; c; c = c->next, tail = &(*tail)->next) {
+                *tail = _copy(c, sizeof(*c));
+                (*tail)->next = NULL;
+        }
+        return head;
+}
+
+
+static void _freeCertificates(Certificate_T *list) {
+        for (Certificate_T c = *list, next; c; c = next) {
+                next = c->next;
+                FREE(c);
+        }
+        *list = NULL;
+}
+
+
+/**
+ * Copy the service with its results. The configuration is shared with
+ * the live service, the results which validate() updates are copied
+ */
+static Service_T _copyService(Snapshot_T S, Service_T s) {
+        Service_T c = _copy(s, sizeof(*s));
+        c->eventlist = NULL;
+        memset(&(c->eventindex), 0, sizeof(c->eventindex));
+        c->next = c->next_conf = c->next_depend = NULL;
+        switch (s->type) {
+                case Service_Directory:
+                        c->inf.directory = _copy(s->inf.directory, sizeof(*(s->inf.directory)));
+                        break;
+                case Service_Fifo:
+                        c->inf.fifo = _copy(s->inf.fifo, sizeof(*(s->inf.fifo)));
+                        break;
+                case Service_File:
+                        c->inf.file = _copy(s->inf.file, sizeof(*(s->inf.file)));
+                        break;
+                case Service_Filesystem:
+                        c->inf.filesystem = _copy(s->inf.filesystem, sizeof(*(s->inf.filesystem)));
+                        break;
+                case Service_Net:
+                        NEW(c->inf.net);
+                        c->inf.net->stats = Link_copy(s->inf.net->stats);
+                        break;
+                case Service_Process:
+                        c->inf.process = _copy(s->inf.process, sizeof(*(s->inf.process)));
+                        break;
+                case Service_System:
+                        c->inf.system = &(S->systeminfo);
+                        break;
+                default:
+                        break;
+        }
+        if (s->program) {
+                c->program = _copy(s->program, sizeof(*(s->program)));
+                c->program->P = NULL;
+                c->program->inprogressOutput = NULL;
+                c->program->lastOutput = StringBuffer_new(s->program->lastOutput ? StringBuffer_toString(s->program->lastOutput) : "");
+        }
+        c->portlist = _copyPorts(s->portlist);
+        c->socketlist = _copyPorts(s->socketlist);
+        c->icmplist = _copyIcmps(s->icmplist);
+        c->certificatelist = _copyCertificates(s->certificatelist);
+        return c;
+}
+
+
+static void _freeService(Service_T *s) {
+        switch ((*s)->type) {
+                case Service_Directory:
+                        FREE((*s)->inf.directory);
+                        break;
+                case Service_Fifo:
+                        FREE((*s)->inf.fifo);
+                        break;
+                case Service_File:
+                        FREE((*s)->inf.file);
+                        break;
+                case Service_Filesystem:
+                        FREE((*s)->inf.filesystem);
+                        break;
+                case Service_Net:
+                        Link_free(&((*s)->inf.net->stats));
+                        FREE((*s)->inf.net);
+                        break;
+                case Service_Process:
+                        FREE((*s)->inf.process);
+                        break;
+                default:
+                        break;
+        }
+        if ((*s)->program) {
+                StringBuffer_free(&((*s)->program->lastOutput));
+                FREE((*s)->program);
+        }
+        _freePorts(&((*s)->portlist));
+        _freePorts(&((*s)->socketlist));
+        _freeIcmps(&((*s)->icmplist));
+        _freeCertificates(&((*s)->certificatelist));
+        FREE(*s);
+}
+
+
+static void _free(Snapshot_T *S) {
+        for (Service_T s = (*S)->servicelist, next; s; s = next) {
+                next = s->next_conf;
+                _freeService(&s);
+        }
+        FREE((*S)->services);
+        FREE(*S);
+}
+
+
+static int _compareService(const void *a, const void *b) {
+        return strcmp((*(Service_T *)a)->name, (*(Service_T *)b)->name);
+}
+
+
+static int _compareName(const void *name, const void *s) {
+        return strcmp(name, (*(Service_T *)s)->name);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Snapshot_publish() {
+        Snapshot_T S, previous;
+        NEW(S);
+        S->refcount = 1; // The reference held by the current pointer
+        S->generation = ++generation;
+        S->systeminfo = systeminfo;
+        Service_T *tail = &(S->servicelist);
+        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                *tail = _copyService(S, s);
+                tail = &((*tail)->next_conf);
+                S->count++;
+        }
+        // Index the copies by name for Snapshot_getService()
+        S->services = CALLOC(S->count ? S->count : 1, sizeof(Service_T));
+        int i = 0;
+        for (Service_T s = S->servicelist; s; s = s->next_conf)
+                S->services[i++] = s;
+        qsort(S->services, S->count, sizeof(Service_T), _compareService);
+        LOCK(mutex)
+        {
+                previous = current;
+                current = S;
+        }
+        END_LOCK;
+        Snapshot_release(&previous);
+}
+
+
+Snapshot_T Snapshot_acquire() {
+        Snapshot_T S;
+        LOCK(mutex)
+        {
+                S = current;
+                if (S)
+                        S->refcount++;
+        }
+        END_LOCK;
+        return S;
+}
+
+
+void Snapshot_release(Snapshot_T *S) {
+        if (S && *S) {
+                boolean_t last;
+                LOCK(mutex)
+                {
+                        last = --(*S)->refcount == 0;
+                }
+                END_LOCK;
+                if (last)
+                        _free(S);
+                *S = NULL;
+        }
+}
+
+
+void Snapshot_reset() {
+        Snapshot_T previous;
+        LOCK(mutex)
+        {
+                previous = current;
+                current = NULL;
+        }
+        END_LOCK;
+        Snapshot_release(&previous);
+}
+
+
+Service_T Snapshot_getService(Snapshot_T S, const char *name) {
+        ASSERT(S);
+        ASSERT(name);
+        Service_T *s = bsearch(name, S->services, S->count, sizeof(Service_T), _compareName);
+        return s ? *s : NULL;
+}
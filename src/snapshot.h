@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_SNAPSHOT_H
+#define MONIT_SNAPSHOT_H
+
+
+/**
+ * Read-only copy of the service status for the renderers.
+ *
+ * The validation thread publishes a snapshot of all service results at
+ * the end of every poll cycle by swapping the current snapshot pointer.
+ * The HTTP interface and the M/Monit heartbeat render the latest snapshot
+ * and never read the service data while validate() is changing them. A
+ * snapshot is reference counted and released by the last reader after a
+ * newer one was published.
+ *
+ * The service copies share the configuration (names, rules, actions)
+ * with the live service list, therefore the snapshot must be reset
+ * before the service list is destroyed.
+ *
+ *  @file
+ */
+
+
+typedef struct Snapshot_T {
+        int refcount;                                   /**< Number of readers */
+        unsigned long long generation;    /**< Publication number, never reused */
+        SystemInfo_T systeminfo;                         /**< System resources */
+        Service_T servicelist;   /**< Service copies linked in configuration order */
+        Service_T *services;            /**< The service copies sorted by name */
+        int count;                                   /**< Number of services */
+} *Snapshot_T;
+
+
+/**
+ * Copy the current service status and publish it as the latest snapshot
+ */
+void Snapshot_publish();
+
+
+/**
+ * Get the latest snapshot. The snapshot must be released with
+ * Snapshot_release() when the caller is done
+ * @return The latest snapshot or NULL if no snapshot was published yet
+ */
+Snapshot_T Snapshot_acquire();
+
+
+/**
+ * Release a snapshot acquired by Snapshot_acquire(). The snapshot is
+ * freed if it is not the latest one and this was the last reader
+ * @param S A reference to a snapshot. May be NULL
+ */
+void Snapshot_release(Snapshot_T *S);
+
+
+/**
+ * Drop the latest snapshot. Must be called before the service list is
+ * freed, when no reader is active
+ */
+void Snapshot_reset();
+
+
+/**
+ * Get the copy of the given service from a snapshot
+ * @param S A snapshot
+ * @param name The service name
+ * @return The service copy or NULL if not found
+ */
+Service_T Snapshot_getService(Snapshot_T S, const char *name);
+
+
+#endif
@@ -72,9 +72,14 @@
 #include <netdb.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #include "net.h"
 #include "monit.h"
 #include "socket.h"
+#include "resolver.h"
 #include "SslServer.h"
 
 // libmonit
@@ -106,6 +111,22 @@ typedef enum {
 #define RBUFFER_SIZE 1460
 
 
+typedef enum {
+        Attempt_Wait = 0,
+        Attempt_Connecting,
+        Attempt_Done
+} __attribute__((__packed__)) Attempt_State;
+
+
+/* Connection attempt to one address of the host */
+typedef struct Attempt_T {
+        struct addrinfo *addr;
+        int socket;
+        Attempt_State state;
+        int64_t started;                                /**< Start time [us] */
+} Attempt_T;
+
+
 #define T Socket_T
 struct T {
         Socket_Type type;
@@ -122,6 +143,11 @@ struct T {
         Ssl_T ssl;
         SslServer_T sslserver;
 #endif
+        struct {
+                unsigned char *data;            /**< Data returned by Socket_unread() */
+                int length;
+                int offset;
+        } unread;
         unsigned char buffer[RBUFFER_SIZE + 1];
 };
 
@@ -139,7 +165,18 @@ struct T {
 static int _fill(T S, int timeout) {
         S->offset = 0;
         S->length = 0;
-        if (S->type == Socket_Udp)
+        if (S->unread.offset < S->unread.length) {
+                // Data returned by Socket_unread() are read first
+                int n = S->unread.length - S->unread.offset < RBUFFER_SIZE ? S->unread.length - S->unread.offset : RBUFFER_SIZE;
+                memcpy(S->buffer, S->unread.data + S->unread.offset, n);
+                S->length = n;
+                if ((S->unread.offset += n) == S->unread.length) {
+                        FREE(S->unread.data);
+                        S->unread.length = S->unread.offset = 0;
+                }
+                return n;
+        }
+        if (S->type == Socket_Udp && timeout > 0)
                 timeout = 500;
         int n;
 #ifdef HAVE_OPENSSL
@@ -225,6 +262,36 @@ static boolean_t _doConnect(int s, const struct sockaddr *addr, socklen_t addrle
 }
 
 
+/*
+ * Create the client socket object for the connected socket descriptor and
+ * enable SSL if required. The descriptor is closed on error
+ */
+static T _newIpSocket(int s, const char *host, const struct sockaddr *addr, int family, int type, SslOptions_T options, int timeout) {
+        T S;
+        NEW(S);
+        S->socket = s;
+        S->type = type;
+        S->family = family == AF_INET ? Socket_Ip4 : Socket_Ip6;
+        S->timeout = timeout;
+        S->host = Str_dup(host);
+        S->port = _getPort(addr);
+        S->connection_type = Connection_Client;
+        if (options->flags == SSL_Enabled) {
+                TRY
+                {
+                        Socket_enableSsl(S, options, host);
+                }
+                ELSE
+                {
+                        Socket_free(&S);
+                        RETHROW;
+                }
+                END_TRY;
+        }
+        return S;
+}
+
+
 T _createIpSocket(const char *host, const struct sockaddr *addr, socklen_t addrlen, const struct sockaddr *localaddr, socklen_t localaddrlen, int family, int type, int protocol, SslOptions_T options, int timeout) {
         ASSERT(host);
         char error[STRLEN];
@@ -238,30 +305,8 @@ T _createIpSocket(const char *host, const struct sockaddr *addr, socklen_t addrl
                 }
                 if (Net_setNonBlocking(s)) {
                         if (fcntl(s, F_SETFD, FD_CLOEXEC) != -1) {
-                                if (_doConnect(s, addr, addrlen, timeout, error, sizeof(error))) {
-                                        T S;
-                                        NEW(S);
-                                        S->socket = s;
-                                        S->type = type;
-                                        S->family = family == AF_INET ? Socket_Ip4 : Socket_Ip6;
-                                        S->timeout = timeout;
-                                        S->host = Str_dup(host);
-                                        S->port = _getPort(addr);
-                                        S->connection_type = Connection_Client;
-                                        if (options->flags == SSL_Enabled) {
-                                                TRY
-                                                {
-                                                        Socket_enableSsl(S, options, host);
-                                                }
-                                                ELSE
-                                                {
-                                                        Socket_free(&S);
-                                                        RETHROW;
-                                                }
-                                                END_TRY;
-                                        }
-                                        return S;
-                                }
+                                if (_doConnect(s, addr, addrlen, timeout, error, sizeof(error)))
+                                        return _newIpSocket(s, host, addr, family, type, options, timeout);
                         } else {
                                 snprintf(error, sizeof(error), "Cannot set socket close on exec -- %s", STRERROR);
                         }
@@ -303,10 +348,8 @@ struct addrinfo *_resolve(const char *hostname, int port, Socket_Type type, Sock
                         LogError("Invalid socket family %d\n", family);
                         return NULL;
         }
-        char _port[6];
-        snprintf(_port, sizeof(_port), "%d", port);
-        int status = getaddrinfo(hostname, _port, &hints, &result);
-        if (status != 0) {
+        int status;
+        if (! (result = Resolver_get(hostname, port, &hints, &status))) {
                 LogError("Cannot translate '%s' to IP address -- %s\n", hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
                 return NULL;
         }
@@ -342,7 +385,7 @@ T Socket_create(const char *host, int port, Socket_Type type, Socket_Family fami
                         }
                         END_TRY;
                 }
-                freeaddrinfo(result);
+                Resolver_free(&result);
                 if (! S)
                         LogError("Cannot create socket to [%s]:%d -- %s\n", host, port, error);
         }
@@ -421,7 +464,8 @@ T Socket_createAccepted(int socket, struct sockaddr *addr, void *sslserver) {
 #ifdef HAVE_OPENSSL
                 if (sslserver) {
                         S->sslserver = sslserver;
-                        if (! (S->ssl = SslServer_newConnection(S->sslserver)) || ! SslServer_accept(S->ssl, S->socket, S->timeout)) {
+                        // The handshake is continued by Socket_readAvailable()
+                        if (! (S->ssl = SslServer_newConnection(S->sslserver)) || SslServer_accept(S->ssl, S->socket) < 0) {
                                 Socket_free(&S);
                                 return NULL;
                         }
@@ -465,6 +509,7 @@ void Socket_free(T *S) {
                 Net_shutdown((*S)->socket, SHUT_RDWR);
                 Net_close((*S)->socket);
         }
+        FREE((*S)->unread.data);
         FREE((*S)->host);
         FREE(*S);
 }
@@ -495,6 +540,12 @@ boolean_t Socket_isSecure(T S) {
 }
 
 
+boolean_t Socket_hasBufferedData(T S) {
+        ASSERT(S);
+        return S->offset < S->length || S->unread.offset < S->unread.length;
+}
+
+
 int Socket_getSocket(T S) {
         ASSERT(S);
         return S->socket;
@@ -553,17 +604,47 @@ const char *Socket_getLocalHost(T S, char *host, int hostlen) {
 }
 
 
+/**
+ * Test the persistent connection of the port with the protocol ping
+ * @return true if the connection is alive, false if it was closed and a
+ * new connection has to be created
+ */
+static boolean_t _testPersistent(Port_T p) {
+        volatile boolean_t alive = false;
+        TRY
+        {
+                p->protocol->ping(p->connection);
+                alive = true;
+        }
+        ELSE
+        {
+                DEBUG("Persistent connection to %s failed, reconnecting -- %s\n", Util_portDescription(p, (char[STRLEN]){}, STRLEN), Exception_frame.message);
+                Socket_free(&(p->connection));
+        }
+        END_TRY;
+        return alive;
+}
+
+
 static void _testUnix(Port_T p) {
-        T S = Socket_createUnix(p->target.unix.pathname, p->type, p->timeout);
+        if (p->connection && _testPersistent(p))
+                return;
+        volatile T S = Socket_createUnix(p->target.unix.pathname, p->type, p->timeout);
         if (S) {
                 S->Port = p;
                 TRY
                 {
                         p->protocol->check(S);
+                        if (p->persistent) {
+                                // Keep the connection for the next test
+                                p->connection = S;
+                                S = NULL;
+                        }
                 }
                 FINALLY
                 {
-                        Socket_free(&S);
+                        if (S)
+                                Socket_free((Socket_T *)&S);
                 }
                 END_TRY;
         } else {
@@ -572,44 +653,222 @@ static void _testUnix(Port_T p) {
 }
 
 
-static void _testIp(Port_T p) {
+/*
+ * Order the addresses for the connection attempts: interleave the address
+ * families, starting with the first (preferred) address family (RFC 8305)
+ */
+static int _orderAddresses(Port_T p, struct addrinfo *result, Attempt_T attempts[PORT_ADDRESS_MAX]) {
+        int count = 0;
+        for (struct addrinfo *r = result; r && count < PORT_ADDRESS_MAX; r = r->ai_next)
+                if (p->outgoing.addrlen == 0 || p->outgoing.addrlen == r->ai_addrlen)
+                        attempts[count++] = (Attempt_T){.addr = r, .socket = -1};
+        for (int i = 1; i < count; i++) {
+                // The family which should come next is the other one than the previous address family
+                if (attempts[i].addr->ai_family == attempts[i - 1].addr->ai_family) {
+                        for (int j = i + 1; j < count; j++) {
+                                if (attempts[j].addr->ai_family != attempts[i - 1].addr->ai_family) {
+                                        Attempt_T a = attempts[j];
+                                        memmove(&attempts[i + 1], &attempts[i], (j - i) * sizeof(Attempt_T));
+                                        attempts[i] = a;
+                                        break;
+                                }
+                        }
+                }
+        }
+        for (int i = 0; i < count; i++) {
+                struct addrinfo *r = attempts[i].addr;
+                if (getnameinfo(r->ai_addr, r->ai_addrlen, p->address[i].ip, sizeof(p->address[i].ip), NULL, 0, NI_NUMERICHOST))
+                        *p->address[i].ip = 0;
+                p->address[i].is_available = Connection_Init;
+                p->address[i].connect = 0.;
+        }
+        p->addresses = count;
+        return count;
+}
+
+
+static void _failAttempt(Port_T p, Attempt_T *attempt, int index, char *error, int errorlen, const char *reason) {
+        snprintf(error, errorlen, "%s", reason);
+        DEBUG("Socket test failed for %s -- %s\n", _addressToString(attempt->addr->ai_addr, attempt->addr->ai_addrlen, (char[STRLEN]){}, STRLEN), reason);
+        if (attempt->socket >= 0)
+                Net_close(attempt->socket);
+        attempt->socket = -1;
+        attempt->state = Attempt_Done;
+        p->address[index].is_available = Connection_Failed;
+}
+
+
+/* Start the connection attempt, return true if the connect is in progress or done */
+static boolean_t _startAttempt(Port_T p, Attempt_T *attempt, int index, boolean_t *connected, char *error, int errorlen) {
+        struct addrinfo *r = attempt->addr;
+        attempt->started = Time_micro();
+        attempt->socket = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+        if (attempt->socket < 0) {
+                _failAttempt(p, attempt, index, error, errorlen, STRERROR);
+                return false;
+        }
+        if (p->outgoing.addrlen && bind(attempt->socket, (struct sockaddr *)&(p->outgoing.addr), p->outgoing.addrlen) < 0) {
+                char e[STRLEN];
+                snprintf(e, sizeof(e), "Cannot bind to outgoing address -- %s", STRERROR);
+                _failAttempt(p, attempt, index, error, errorlen, e);
+                return false;
+        }
+        if (! Net_setNonBlocking(attempt->socket) || fcntl(attempt->socket, F_SETFD, FD_CLOEXEC) == -1) {
+                _failAttempt(p, attempt, index, error, errorlen, STRERROR);
+                return false;
+        }
+        attempt->state = Attempt_Connecting;
+        if (connect(attempt->socket, r->ai_addr, r->ai_addrlen) == 0) {
+                *connected = true;
+        } else if (errno != EINPROGRESS) {
+                _failAttempt(p, attempt, index, error, errorlen, STRERROR);
+                return false;
+        }
+        return true;
+}
+
+
+/*
+ * Race the connection attempts to the addresses. The next attempt starts
+ * if the previous one failed or didn't complete within PORT_ATTEMPT_DELAY.
+ * The first established connection wins and the other attempts in progress
+ * are cancelled, they can be started again in the next race
+ * @return The index of the connected attempt or -1 if all attempts failed
+ */
+static int _race(Port_T p, Attempt_T attempts[PORT_ADDRESS_MAX], int count, char *error, int errorlen) {
+        int winner = -1;
+        long long next = 0;
+        while (winner < 0) {
+                long long now = Time_milli();
+                int connecting = 0, waiting = -1;
+                for (int i = 0; i < count; i++) {
+                        if (attempts[i].state == Attempt_Connecting)
+                                connecting++;
+                        else if (attempts[i].state == Attempt_Wait && waiting < 0)
+                                waiting = i;
+                }
+                if (waiting >= 0 && (connecting == 0 || now >= next)) {
+                        boolean_t connected = false;
+                        if (_startAttempt(p, &attempts[waiting], waiting, &connected, error, errorlen)) {
+                                if (connected)
+                                        winner = waiting;
+                                next = now + PORT_ATTEMPT_DELAY;
+                        }
+                        continue;
+                }
+                if (connecting == 0)
+                        break;
+                struct pollfd fds[PORT_ADDRESS_MAX];
+                int index[PORT_ADDRESS_MAX], n = 0;
+                long long timeout = waiting >= 0 ? next - now : p->timeout;
+                for (int i = 0; i < count; i++) {
+                        if (attempts[i].state == Attempt_Connecting) {
+                                fds[n] = (struct pollfd){.fd = attempts[i].socket, .events = POLLIN | POLLOUT};
+                                index[n++] = i;
+                                timeout = MIN(timeout, attempts[i].started / 1000 + p->timeout - now);
+                        }
+                }
+                if (poll(fds, n, (int)MAX(timeout, 0)) < 0 && errno != EINTR) {
+                        snprintf(error, errorlen, "Poll failed: %s", STRERROR);
+                        break;
+                }
+                now = Time_milli();
+                for (int k = 0; k < n && winner < 0; k++) {
+                        int i = index[k];
+                        if (fds[k].revents) {
+                                int e = 0;
+                                socklen_t elen = sizeof(e);
+                                if (getsockopt(attempts[i].socket, SOL_SOCKET, SO_ERROR, &e, &elen) < 0)
+                                        e = errno;
+                                if (e)
+                                        _failAttempt(p, &attempts[i], i, error, errorlen, strerror(e));
+                                else
+                                        winner = i;
+                        } else if (now >= attempts[i].started / 1000 + p->timeout) {
+                                _failAttempt(p, &attempts[i], i, error, errorlen, "Connection timed out");
+                        }
+                }
+        }
+        for (int i = 0; i < count; i++) {
+                if (i == winner) {
+                        attempts[i].state = Attempt_Done;
+                        p->address[i].is_available = Connection_Ok;
+                        p->address[i].connect = (double)(Time_micro() - attempts[i].started) / 1000.;
+                } else if (attempts[i].state == Attempt_Connecting) {
+                        // Cancel the attempt
+                        Net_close(attempts[i].socket);
+                        attempts[i].socket = -1;
+                        attempts[i].state = Attempt_Wait;
+                }
+        }
+        return winner;
+}
+
+
+static void _testIp(Port_T p, Port_T *pipeline, int pipelined) {
         char error[STRLEN];
         volatile Connection_State is_available = Connection_Failed;
+        if (p->connection && _testPersistent(p)) {
+                p->connect = 0.;
+                return;
+        }
+        int64_t start = Time_micro();
         struct addrinfo *result = _resolve(p->hostname, p->target.net.port, p->type, p->family);
+        p->resolve = (double)(Time_micro() - start) / 1000.;
         if (result) {
+                Attempt_T attempts[PORT_ADDRESS_MAX];
+                int count = _orderAddresses(p, result, attempts);
+                snprintf(error, sizeof(error), "No IP address matching '%s' was found", NVLSTR(p->outgoing.ip));
                 // The host may resolve to multiple IPs and if at least one succeeded, we have no problem and don't have to flood the log with partial errors => log only the last error
-                for (struct addrinfo *r = result; r && is_available != Connection_Ok; r = r->ai_next) {
-                        if (p->outgoing.addrlen == 0 || p->outgoing.addrlen == r->ai_addrlen) {
-                                const struct sockaddr *localaddr = p->outgoing.addrlen ? (struct sockaddr *)&(p->outgoing.addr) : NULL;
-                                volatile T S = NULL;
-                                TRY
-                                {
-                                        S = _createIpSocket(p->hostname, r->ai_addr, r->ai_addrlen, localaddr, p->outgoing.addrlen, r->ai_family, r->ai_socktype, r->ai_protocol, &(p->target.net.ssl.options), p->timeout);
-                                        S->Port = p;
+                while (is_available != Connection_Ok) {
+                        start = Time_micro();
+                        int i = _race(p, attempts, count, error, sizeof(error));
+                        if (i < 0)
+                                break;
+                        volatile T S = NULL;
+                        TRY
+                        {
+                                struct addrinfo *r = attempts[i].addr;
+                                S = _newIpSocket(attempts[i].socket, p->hostname, r->ai_addr, r->ai_family, r->ai_socktype, &(p->target.net.ssl.options), p->timeout);
+                                p->connect = (double)(Time_micro() - start) / 1000.;
+                                S->Port = p;
+                                if (pipeline) {
+                                        int done = p->protocol->pipeline(S, pipeline, pipelined);
+                                        DEBUG("Pipeline to [%s]:%d tested %d of %d ports on one connection\n", p->hostname, p->target.net.port, done, pipelined);
+                                        for (int j = 0; j < done; j++) {
+                                                pipeline[j]->probe.response += p->connect;
+#ifdef HAVE_OPENSSL
+                                                pipeline[j]->target.net.ssl.certificate.validDays = Ssl_getCertificateValidDays(S->ssl);
+#endif
+                                        }
+                                } else {
                                         p->protocol->check(S);
 #ifdef HAVE_OPENSSL
                                         // Set the minimum valid days past the protocol check as if the connection uses STARTTLS to switch plain->SSL, we have no SSL certificate informations until the STARTTTLS is performed
                                         p->target.net.ssl.certificate.validDays = Ssl_getCertificateValidDays(S->ssl);
 #endif
-                                        is_available = Connection_Ok;
-
-                                }
-                                ELSE
-                                {
-                                        snprintf(error, sizeof(error), "%s", Exception_frame.message);
-                                        DEBUG("Socket test failed for %s -- %s\n", _addressToString(r->ai_addr, r->ai_addrlen, (char[STRLEN]){}, STRLEN), error);
                                 }
-                                FINALLY
-                                {
-                                        if (S)
-                                                Socket_free((Socket_T *)&S);
+                                is_available = Connection_Ok;
+                                if (p->persistent) {
+                                        // Keep the connection for the next test
+                                        p->connection = S;
+                                        S = NULL;
                                 }
-                                END_TRY;
-                        } else {
-                                snprintf(error, sizeof(error), "No IP address matching '%s' was found", p->outgoing.ip);
                         }
+                        ELSE
+                        {
+                                Str_copy(error, Exception_frame.message, sizeof(error) - 1);
+                                DEBUG("Socket test failed for %s -- %s\n", _addressToString(attempts[i].addr->ai_addr, attempts[i].addr->ai_addrlen, (char[STRLEN]){}, STRLEN), error);
+                                p->address[i].is_available = Connection_Failed;
+                        }
+                        FINALLY
+                        {
+                                if (S)
+                                        Socket_free((Socket_T *)&S);
+                        }
+                        END_TRY;
                 }
-                freeaddrinfo(result);
+                Resolver_free(&result);
                 if (is_available != Connection_Ok)
                         THROW(IOException, "%s", error);
         } else {
@@ -618,6 +877,21 @@ static void _testIp(Port_T p) {
 }
 
 
+/*
+ * Use the result of the UDP probe or of the pipeline which tested the port
+ * at the beginning of the cycle. The result is consumed. A failed UDP probe
+ * is not retried, as it retransmitted the request for the time of all the
+ * retries already, the retry of a failed pipelined test is blocking
+ */
+static void _testProbe(Port_T p) {
+        p->probe.done = false;
+        if (*p->probe.error)
+                THROW(IOException, "%s", p->probe.error);
+        p->response = p->probe.response;
+        p->addresses = 0;
+}
+
+
 /* ---------------------------------------------------------------- Public */
 
 
@@ -626,21 +900,26 @@ void Socket_test(void *P) {
         Port_T p = P;
         TRY
         {
-                int64_t start = Time_micro();
-                switch (p->family) {
-                        case Socket_Unix:
-                                _testUnix(p);
-                                break;
-                        case Socket_Ip:
-                        case Socket_Ip4:
-                        case Socket_Ip6:
-                                _testIp(p);
-                                break;
-                        default:
-                                THROW(IOException, "Invalid socket family %d\n", p->family);
-                                break;
+                p->resolve = p->connect = 0.;
+                if (p->probe.done) {
+                        _testProbe(p);
+                } else {
+                        int64_t start = Time_micro();
+                        switch (p->family) {
+                                case Socket_Unix:
+                                        _testUnix(p);
+                                        break;
+                                case Socket_Ip:
+                                case Socket_Ip4:
+                                case Socket_Ip6:
+                                        _testIp(p, NULL, 0);
+                                        break;
+                                default:
+                                        THROW(IOException, "Invalid socket family %d\n", p->family);
+                                        break;
+                        }
+                        p->response = (double)(Time_micro() - start) / 1000. - p->resolve; // Convert microseconds to milliseconds, the host name resolution is reported separately
                 }
-                p->response = (double)(Time_micro() - start) / 1000.; // Convert microseconds to milliseconds
                 p->is_available = Connection_Ok;
         }
         ELSE
@@ -653,6 +932,85 @@ void Socket_test(void *P) {
 }
 
 
+void Socket_testCertificate(void *C) {
+        ASSERT(C);
+        Certificate_T c = C;
+#ifdef HAVE_OPENSSL
+        // Skip the chain verification if the server's certificate is the one verified before, forget it until the test succeeds
+        char fingerprint[65];
+        snprintf(fingerprint, sizeof(fingerprint), "%s", c->fingerprint);
+        *c->fingerprint = 0;
+        struct SslOptions_T options = c->options;
+        options.flags = SSL_Enabled;
+        options.fingerprint = *fingerprint ? fingerprint : NULL;
+        options.noResume = true;
+        c->response = -1.;
+        struct addrinfo *result = _resolve(c->hostname, c->port, Socket_Tcp, c->family);
+        if (! result)
+                THROW(IOException, "Cannot translate '%s' to IP address", c->hostname);
+        volatile T S = NULL;
+        char error[STRLEN];
+        snprintf(error, sizeof(error), "No IP address matching '%s' was found", NVLSTR(c->outgoing.ip));
+        int64_t start = Time_micro();
+        for (struct addrinfo *r = result; r && ! S; r = r->ai_next) {
+                if (c->outgoing.addrlen == 0 || c->outgoing.addrlen == r->ai_addrlen) {
+                        TRY
+                        {
+                                S = _createIpSocket(c->hostname, r->ai_addr, r->ai_addrlen, c->outgoing.addrlen ? (struct sockaddr *)&(c->outgoing.addr) : NULL, c->outgoing.addrlen, r->ai_family, r->ai_socktype, r->ai_protocol, &options, c->timeout);
+                        }
+                        ELSE
+                        {
+                                Str_copy(error, Exception_frame.message, sizeof(error) - 1);
+                        }
+                        END_TRY;
+                }
+        }
+        Resolver_free(&result);
+        if (! S)
+                THROW(IOException, "%s", error);
+        TRY
+        {
+                if (! S->ssl)
+                        THROW(IOException, "SSL: cannot create connection");
+                c->response = (double)(Time_micro() - start) / 1000.;
+                c->verified = Ssl_isVerified(S->ssl);
+                c->chainLength = Ssl_getCertificateChain(S->ssl, c->fingerprint, c->chain, CERTIFICATE_CHAIN_MAX);
+        }
+        FINALLY
+        {
+                Socket_free((T *)&S);
+        }
+        END_TRY;
+#else
+        THROW(IOException, "SSL certificate test skipped -- Monit was not built with SSL support");
+#endif
+}
+
+
+void Socket_testPipeline(void *P, int count) {
+        ASSERT(P);
+        ASSERT(count > 0);
+        Port_T *ports = P;
+        Port_T p = ports[0];
+        for (int i = 0; i < count; i++)
+                ports[i]->probe.done = false;
+        TRY
+        {
+                p->resolve = p->connect = 0.;
+                _testIp(p, ports, count);
+        }
+        ELSE
+        {
+                // The connection failed, so did all ports
+                for (int i = 0; i < count; i++) {
+                        ports[i]->probe.done = true;
+                        snprintf(ports[i]->probe.error, sizeof(ports[i]->probe.error), "%s", Exception_frame.message);
+                }
+        }
+        END_TRY;
+}
+
+
 void Socket_enableSsl(T S, SslOptions_T options, const char *name)  {
         assert(S);
 #ifdef HAVE_OPENSSL
@@ -705,6 +1063,50 @@ int Socket_write(T S, void *b, size_t size) {
 }
 
 
+long long Socket_sendFile(T S, int fd, off_t offset, size_t size) {
+        ASSERT(S);
+        ASSERT(fd >= 0);
+        long long sent = 0LL;
+#if defined HAVE_SYS_SENDFILE_H && defined HAVE_SENDFILE
+        if (! S->ssl) {
+                while (size > 0) {
+                        ssize_t n = sendfile(S->socket, fd, &offset, size);
+                        if (n == -1) {
+                                if (errno == EINTR)
+                                        continue;
+                                if ((errno == EAGAIN || errno == EWOULDBLOCK) && Net_canWrite(S->socket, S->timeout))
+                                        continue;
+                                return -1;
+                        } else if (n == 0) {
+                                // The file was truncated
+                                break;
+                        }
+                        sent += n;
+                        size -= n;
+                }
+                return sent;
+        }
+#endif
+        char buf[16384];
+        while (size > 0) {
+                ssize_t n = pread(fd, buf, size < sizeof(buf) ? size : sizeof(buf), offset);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                } else if (n == 0) {
+                        break;
+                }
+                if (Socket_write(S, buf, n) != n)
+                        return -1;
+                offset += n;
+                sent += n;
+                size -= n;
+        }
+        return sent;
+}
+
+
 int Socket_readByte(T S) {
         ASSERT(S);
         if (S->offset >= S->length)
@@ -715,15 +1117,72 @@ int Socket_readByte(T S) {
 
 
 int Socket_read(T S, void *b, int size) {
-        int c;
         unsigned char *p = b;
         ASSERT(S);
-        while ((size-- > 0) && ((c = Socket_readByte(S)) >= 0))
-                *p++ = c;
+        while (size > 0) {
+                if (S->offset >= S->length)
+                        if (_fill(S, S->timeout) <= 0)
+                                break;
+                int n = S->length - S->offset < size ? S->length - S->offset : size;
+                memcpy(p, S->buffer + S->offset, n);
+                S->offset += n;
+                p += n;
+                size -= n;
+        }
         return (int)((long)p - (long)b);
 }
 
 
+int Socket_readAvailable(T S, void *b, int size) {
+        ASSERT(S);
+        ASSERT(b);
+        if (size <= 0)
+                return 0;
+        if (S->offset >= S->length && S->unread.offset < S->unread.length)
+                _fill(S, 0);
+        if (S->offset < S->length) {
+                int n = S->length - S->offset < size ? S->length - S->offset : size;
+                memcpy(b, S->buffer + S->offset, n);
+                S->offset += n;
+                return n;
+        }
+#ifdef HAVE_OPENSSL
+        if (S->ssl)
+                return Ssl_readAvailable(S->ssl, b, size);
+#endif
+        ssize_t n;
+        do {
+                n = read(S->socket, b, size);
+        } while (n == -1 && errno == EINTR);
+        if (n > 0)
+                return (int)n;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+        return -1;
+}
+
+
+void Socket_unread(T S, const void *b, int size) {
+        ASSERT(S);
+        ASSERT(b);
+        if (size > 0) {
+                // The data are read before the data buffered already
+                int buffered = S->length - S->offset;
+                int unread = S->unread.length - S->unread.offset;
+                unsigned char *data = ALLOC(size + buffered + unread);
+                memcpy(data, b, size);
+                memcpy(data + size, S->buffer + S->offset, buffered);
+                if (unread > 0)
+                        memcpy(data + size + buffered, S->unread.data + S->unread.offset, unread);
+                FREE(S->unread.data);
+                S->unread.data = data;
+                S->unread.length = size + buffered + unread;
+                S->unread.offset = 0;
+                S->offset = S->length = 0;
+        }
+}
+
+
 char *Socket_readLine(T S, char *s, int size) {
         int c;
         unsigned char *p = (unsigned char *)s;
@@ -101,7 +101,8 @@ T Socket_createUnix(const char *path, Socket_Type type, int timeout);
  * Factory method for creating a Socket object from an accepted
  * socket. The given socket must be a socket created from accept(2).
  * If the sslserver context is non-null the socket will support
- * ssl. This method does only support TCP sockets.
+ * ssl, the handshake is started without blocking and continued by
+ * Socket_readAvailable(). This method does only support TCP sockets.
  * @param socket The accepted socket
  * @param addr The socket address
  * @param sslserver A ssl server connection context, may be NULL
@@ -144,6 +145,14 @@ int Socket_getTimeout(T S);
 boolean_t Socket_isSecure(T S);
 
 
+/**
+ * Return true if data received from the peer are buffered and were not read yet
+ * @param S A Socket_T object
+ * @return true if the read buffer is not empty otherwise false
+ */
+boolean_t Socket_hasBufferedData(T S);
+
+
 /**
  * Get the underlying socket descriptor
  * @param S A Socket_T object
@@ -212,6 +221,28 @@ const char *Socket_getLocalHost(T S, char *host, int hostlen);
 void Socket_test(void *P);
 
 
+/**
+ * Test a Certificate_T object: connect, perform the TLS handshake only and
+ * store the server's certificate chain. The chain is verified only if the
+ * server's certificate differs from the one verified by the previous test
+ * @param C A certificate object to test
+ * @exception IOException if test failed
+ */
+void Socket_testCertificate(void *C);
+
+
+/**
+ * Test the ports on one connection using the protocol's pipeline. The ports
+ * must share the host, port, SSL options and timeout. The result of each
+ * port is stored in its probe and used by Socket_test() in this cycle, ports
+ * whose response could not be read are tested by Socket_test() as usual
+ * @param P An array of the port objects to test, the first one is used for
+ * the connection
+ * @param count The number of ports
+ */
+void Socket_testPipeline(void *P, int count);
+
+
 /**
  * Enables SSL on a connected socket.
  * @param S A connected Socket_T object
@@ -242,6 +273,20 @@ int Socket_print(T S, const char *m, ...) __attribute__((format (printf, 2, 3)))
 int Socket_write(T S, void *b, size_t size);
 
 
+/**
+ * Write size bytes from the file descriptor fd, starting at the given
+ * offset. The file is sent with sendfile(2) if the socket is not secure
+ * and the system supports it, otherwise it is read in blocks and written
+ * with Socket_write(). The file offset of fd is not changed.
+ * @param S A Socket_T object
+ * @param fd An open file descriptor of a regular file
+ * @param offset The file offset to start from
+ * @param size The number of bytes to send
+ * @return The bytes sent or -1 if an error occurred
+ */
+long long Socket_sendFile(T S, int fd, off_t offset, size_t size);
+
+
 /**
  * Read a single byte. The byte is returned as an int in the range 0
  * to 255.
@@ -275,6 +320,29 @@ int Socket_read(T S, void *b, int size);
 char *Socket_readLine(T S, char *s, int size);
 
 
+/**
+ * Read the data available without blocking. Buffered data are returned
+ * first. The socket must be in non-blocking mode.
+ * @param S A Socket_T object
+ * @param b A byte buffer
+ * @param size The size of the buffer b
+ * @return The bytes read, 0 if no data is available yet or -1 if an
+ * error occurred or the peer closed the connection
+ */
+int Socket_readAvailable(T S, void *b, int size);
+
+
+/**
+ * Push data back to the socket, the following read operations return
+ * them before the data buffered already and before reading from the
+ * socket again.
+ * @param S A Socket_T object
+ * @param b The data to push back
+ * @param size The size of the data
+ */
+void Socket_unread(T S, const void *b, int size);
+
+
 #undef T
 #endif
 
@@ -69,6 +69,14 @@
 #include <string.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
 #include <openssl/crypto.h>
 #include <openssl/x509.h>
 #include <openssl/x509_vfy.h>
@@ -94,7 +102,7 @@
  *
  *  @file
  */
-//FIXME: refactor Ssl_connect(), Ssl_write() and Ssl_read() + SslServer_accept (and the whole network layer) to be really non-blocking
+//FIXME: refactor Ssl_connect(), Ssl_write() and Ssl_read() (and the whole network layer) to be really non-blocking
 
 
 /* ------------------------------------------------------------- Definitions */
@@ -121,6 +129,41 @@
 #define SSLERROR ERR_error_string(ERR_get_error(),NULL)
 
 
+/**
+ * Number of sessions the server keeps for resumption and their lifetime in seconds
+ */
+#define SESSION_CACHE_SIZE 128
+#define SESSION_TIMEOUT    3600
+
+
+/**
+ * Client session kept for resumption, keyed by the server address, name and
+ * the certificate verification options
+ */
+typedef struct SslSession_T {
+        char *peer;
+        SSL_SESSION *session;
+        time_t created;
+        struct SslSession_T *next;
+} *SslSession_T;
+
+
+/**
+ * Client context shared by the connections with the same options
+ */
+typedef struct SslContext_T {
+        short version;
+        char *ciphers;
+        char *CACertificateFile;
+        char *CACertificatePath;
+        char *clientpemfile;
+        SSL_CTX *ctx;
+        SslSession_T sessions;               /**< Most recently created first */
+        int sessionCount;
+        struct SslContext_T *next;
+} *SslContext_T;
+
+
 #define T Ssl_T
 struct T {
         boolean_t accepted;
@@ -128,7 +171,12 @@ struct T {
         SslOptions_T options;
         SSL *handler;
         SSL_CTX *ctx;
+        SslContext_T context;                   /**< The shared client context */
+        char *peer;                             /**< Client session cache key */
         X509 *certificate;
+        X509 *resumedCertificate;  /**< Server certificate of a resumed session */
+        boolean_t verified;   /**< true if the chain was verified by the handshake */
+        char *session;                      /**< File the client session is saved to */
         char error[128];
 };
 
@@ -148,6 +196,20 @@ static Mutex_T *instanceMutexTable;
 static int session_id_context = 1;
 
 
+static struct {
+        Mutex_T mutex;
+        unsigned long long handshakes;              /**< Number of server handshakes */
+        unsigned long long resumed;     /**< Number of handshakes which resumed a session */
+        long long cpu;                         /**< Handshake CPU time in microseconds */
+} _statistics = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+static struct {
+        Mutex_T mutex;
+        SslContext_T list;
+} _contexts = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -352,6 +414,106 @@ static int _saveAndCheckServerCertificates(T C, X509_STORE_CTX *ctx) {
 }
 
 
+static char *_getFingerprint(X509 *certificate, char fingerprint[65]) {
+        unsigned int len = 0;
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        *fingerprint = 0;
+        if (X509_digest(certificate, EVP_sha256(), digest, &len))
+                for (unsigned int i = 0; i < len && i < 32; i++)
+                        snprintf(fingerprint + 2 * i, 3, "%02x", digest[i]);
+        return fingerprint;
+}
+
+
+static time_t _getValidTo(X509 *certificate) {
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+        ASN1_TIME *notAfter = X509_get_notAfter(certificate);
+#else
+        const ASN1_TIME *notAfter = X509_get0_notAfter(certificate);
+#endif
+#ifdef HAVE_ASN1_TIME_DIFF
+        int deltadays, deltaseconds;
+        if (! ASN1_TIME_diff(&deltadays, &deltaseconds, NULL, notAfter))
+                THROW(IOException, "invalid time format in certificate's notAfter field");
+        return Time_now() + deltadays * 86400 + deltaseconds;
+#else
+        volatile time_t validTo = 0;
+        ASN1_GENERALIZEDTIME *t = ASN1_TIME_to_generalizedtime((ASN1_TIME *)notAfter, NULL);
+        if (! t)
+                THROW(IOException, "invalid time format (in certificate's notAfter field)");
+        TRY
+        {
+                validTo = Time_toTimestamp((const char *)t->data);
+        }
+        ELSE
+        {
+                THROW(IOException, "invalid time format in certificate's notAfter field -- %s", t->data);
+        }
+        FINALLY
+        {
+                ASN1_STRING_free(t);
+        }
+        END_TRY;
+        return validTo;
+#endif
+}
+
+
+static boolean_t _isCurrent(X509 *certificate) {
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+        return X509_cmp_current_time(X509_get_notBefore(certificate)) < 0 && X509_cmp_current_time(X509_get_notAfter(certificate)) > 0;
+#else
+        return X509_cmp_current_time(X509_get0_notBefore(certificate)) < 0 && X509_cmp_current_time(X509_get0_notAfter(certificate)) > 0;
+#endif
+}
+
+
+/**
+ * Test the validity period of the server's certificate and the chain it sent
+ * @return true if all the certificates are valid now, otherwise false
+ */
+static boolean_t _isChainCurrent(X509_STORE_CTX *ctx, X509 *certificate) {
+        if (! _isCurrent(certificate))
+                return false;
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+        STACK_OF(X509) *chain = ctx->untrusted;
+#else
+        STACK_OF(X509) *chain = X509_STORE_CTX_get0_untrusted(ctx);
+#endif
+        for (int i = 0; chain && i < sk_X509_num(chain); i++)
+                if (! _isCurrent(sk_X509_value(chain, i)))
+                        return false;
+        return true;
+}
+
+
+/**
+ * Verify the server certificate chain unless the server's certificate has
+ * the fingerprint of the certificate verified before. The chain is verified
+ * again if any of its certificates expired (or isn't valid yet), so the
+ * expiration is reported the same way as for a new certificate
+ */
+static int _verifyChain(X509_STORE_CTX *ctx, void *arg) {
+        T C = SSL_get_app_data(X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx()));
+        if (C && C->options->fingerprint) {
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+                X509 *certificate = ctx->cert;
+#else
+                X509 *certificate = X509_STORE_CTX_get0_cert(ctx);
+#endif
+                char fingerprint[65];
+                if (certificate && IS(_getFingerprint(certificate, fingerprint), C->options->fingerprint) && _isChainCurrent(ctx, certificate)) {
+                        C->certificate = certificate;
+                        C->verified = false;
+                        return _checkChecksum(C, ctx, certificate);
+                }
+        }
+        if (C)
+                C->verified = true;
+        return X509_verify_cert(ctx);
+}
+
+
 static int _verifyServerCertificates(int preverify_ok, X509_STORE_CTX *ctx) {
         T C = SSL_get_app_data(X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx()));
         if (! C) {
@@ -440,16 +602,16 @@ static boolean_t _setServerNameIdentification(T C, const char *hostname) {
 }
 
 
-static boolean_t _setClientCertificate(T C, const char *file) {
-        if (SSL_CTX_use_certificate_chain_file(C->ctx, file) != 1) {
+static boolean_t _setClientCertificate(SSL_CTX *ctx, const char *file) {
+        if (SSL_CTX_use_certificate_chain_file(ctx, file) != 1) {
                 LogError("SSL client certificate chain loading failed: %s\n", SSLERROR);
                 return false;
         }
-        if (SSL_CTX_use_PrivateKey_file(C->ctx, file, SSL_FILETYPE_PEM) != 1) {
+        if (SSL_CTX_use_PrivateKey_file(ctx, file, SSL_FILETYPE_PEM) != 1) {
                 LogError("SSL client private key loading failed: %s\n", SSLERROR);
                 return false;
         }
-        if (SSL_CTX_check_private_key(C->ctx) != 1) {
+        if (SSL_CTX_check_private_key(ctx) != 1) {
                 LogError("SSL client private key doesn't match the certificate: %s\n", SSLERROR);
                 return false;
         }
@@ -457,6 +619,254 @@ static boolean_t _setClientCertificate(T C, const char *file) {
 }
 
 
+static boolean_t _isSameOption(const char *a, const char *b) {
+        return (a && b) ? Str_isByteEqual(a, b) : a == b;
+}
+
+
+static boolean_t _isSameContext(SslContext_T c, short version, const char *ciphers, const char *CACertificateFile, const char *CACertificatePath, const char *clientpemfile) {
+        return c->version == version && _isSameOption(c->ciphers, ciphers) && _isSameOption(c->CACertificateFile, CACertificateFile) && _isSameOption(c->CACertificatePath, CACertificatePath) && _isSameOption(c->clientpemfile, clientpemfile);
+}
+
+
+static void _freeSessions(SslContext_T c) {
+        for (SslSession_T s = c->sessions, next = NULL; s; s = next) {
+                next = s->next;
+                SSL_SESSION_free(s->session);
+                FREE(s->peer);
+                FREE(s);
+        }
+        c->sessions = NULL;
+        c->sessionCount = 0;
+}
+
+
+/**
+ * Keep a new client session for the next connection to the same server.
+ * OpenSSL calls this when the session was established, for TLSv1.3 when
+ * the session ticket arrived
+ */
+static int _newSession(SSL *ssl, SSL_SESSION *session) {
+        T C = SSL_get_app_data(ssl);
+        if (! C || ! C->context || ! C->peer)
+                return 0;
+        SslSession_T s = NULL;
+        LOCK(_contexts.mutex)
+        {
+                SslSession_T *p = &(C->context->sessions);
+                // Replace the previous session of the peer, else drop the oldest one if the cache is full
+                for (; *p; p = &((*p)->next)) {
+                        if (IS((*p)->peer, C->peer) || (! (*p)->next && C->context->sessionCount >= SESSION_CACHE_SIZE)) {
+                                s = *p;
+                                *p = s->next;
+                                C->context->sessionCount--;
+                                break;
+                        }
+                }
+                if (s) {
+                        SSL_SESSION_free(s->session);
+                        FREE(s->peer);
+                } else {
+                        NEW(s);
+                }
+                s->peer = Str_dup(C->peer);
+                s->session = session;
+                s->created = Time_now();
+                s->next = C->context->sessions;
+                C->context->sessions = s;
+                C->context->sessionCount++;
+        }
+        END_LOCK;
+        return 1; // We keep the session reference
+}
+
+
+/**
+ * Offer the cached session of the server for resumption. The cache key is
+ * the server address, the server name and the verification options, so a
+ * session verified with different options is never resumed
+ */
+static void _resumeSession(T C, const char *name) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        char host[NI_MAXHOST], port[NI_MAXSERV];
+        if (getpeername(C->socket, (struct sockaddr *)&addr, &addrlen) == 0 && getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+                C->peer = Str_cat("%s:%s/%s/%d/%d/%s", host, port, name ? name : "", _optionsVerify(C->options->verify), _optionsAllowSelfSigned(C->options->allowSelfSigned), NVLSTR(_optionsChecksum(C->options->checksum)));
+                LOCK(_contexts.mutex)
+                {
+                        for (SslSession_T s = C->context->sessions; s; s = s->next) {
+                                if (IS(s->peer, C->peer)) {
+                                        if (Time_now() - s->created < SESSION_TIMEOUT)
+                                                SSL_set_session(C->handler, s->session);
+                                        break;
+                                }
+                        }
+                }
+                END_LOCK;
+        }
+}
+
+
+/**
+ * Create a client context, which loads the CA certificates, the client
+ * certificate and sets the ciphers
+ */
+static SSL_CTX *_newContext(SslOptions_T options) {
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+        const SSL_METHOD *method = SSLv23_client_method();
+#else
+        const SSL_METHOD *method = TLS_client_method();
+#endif
+        if (! method) {
+                LogError("SSL: client method initialization failed -- %s\n", SSLERROR);
+                return NULL;
+        }
+        SSL_CTX *ctx = SSL_CTX_new(method);
+        if (! ctx) {
+                LogError("SSL: client context initialization failed -- %s\n", SSLERROR);
+                return NULL;
+        }
+        if (! _setVersion(ctx, options)) {
+                goto sslerror;
+        }
+        SSL_CTX_set_default_verify_paths(ctx);
+        const char *CACertificateFile = _optionsCACertificateFile(options->CACertificateFile);
+        const char *CACertificatePath = _optionsCACertificatePath(options->CACertificatePath);
+        if (CACertificateFile || CACertificatePath) {
+                if (! SSL_CTX_load_verify_locations(ctx, CACertificateFile, CACertificatePath)) {
+                        LogError("SSL: CA certificates loading failed -- %s\n", SSLERROR);
+                        goto sslerror;
+                }
+        }
+        const char *ClientPEMFile = _optionsClientPEMFile(options->clientpemfile);
+        if (ClientPEMFile && ! _setClientCertificate(ctx, ClientPEMFile))
+                goto sslerror;
+#ifdef SSL_OP_NO_COMPRESSION
+        SSL_CTX_set_options(ctx, SSL_OP_NO_COMPRESSION);
+#endif
+        const char *ciphers = _optionsCiphers(options->ciphers);
+        if (SSL_CTX_set_cipher_list(ctx, ciphers) != 1) {
+                LogError("SSL: client cipher list [%s] error -- no valid ciphers\n", ciphers);
+                goto sslerror;
+        }
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, _newSession);
+        SSL_CTX_set_cert_verify_callback(ctx, _verifyChain, NULL);
+        return ctx;
+sslerror:
+        SSL_CTX_free(ctx);
+        return NULL;
+}
+
+
+/**
+ * Get the shared client context for the options. The context is created on
+ * the first use and kept until Ssl_reset()
+ */
+static SslContext_T _getContext(SslOptions_T options) {
+        short version = _optionsVersion(options->version);
+        const char *ciphers = _optionsCiphers(options->ciphers);
+        const char *CACertificateFile = _optionsCACertificateFile(options->CACertificateFile);
+        const char *CACertificatePath = _optionsCACertificatePath(options->CACertificatePath);
+        const char *clientpemfile = _optionsClientPEMFile(options->clientpemfile);
+        SslContext_T c = NULL;
+        LOCK(_contexts.mutex)
+        {
+                for (c = _contexts.list; c; c = c->next)
+                        if (_isSameContext(c, version, ciphers, CACertificateFile, CACertificatePath, clientpemfile))
+                                break;
+                if (! c) {
+                        SSL_CTX *ctx = _newContext(options);
+                        if (ctx) {
+                                NEW(c);
+                                c->version = version;
+                                c->ciphers = Str_dup(ciphers);
+                                c->CACertificateFile = Str_dup(CACertificateFile);
+                                c->CACertificatePath = Str_dup(CACertificatePath);
+                                c->clientpemfile = Str_dup(clientpemfile);
+                                c->ctx = ctx;
+                                c->next = _contexts.list;
+                                _contexts.list = c;
+                        }
+                }
+        }
+        END_LOCK;
+        return c;
+}
+
+
+/**
+ * Offer the session saved by the previous connection for resumption
+ */
+static void _loadSession(T C) {
+        FILE *f = fopen(C->session, "r");
+        if (f) {
+                SSL_SESSION *session = PEM_read_SSL_SESSION(f, NULL, NULL, NULL);
+                if (session) {
+                        if (SSL_set_session(C->handler, session) != 1)
+                                DEBUG("SSL: cannot resume the session from %s -- %s\n", C->session, SSLERROR);
+                        SSL_SESSION_free(session);
+                }
+                fclose(f);
+        }
+        ERR_clear_error();
+}
+
+
+static boolean_t _isResumable(SSL_SESSION *session) {
+#if (OPENSSL_VERSION_NUMBER >= 0x10101000L) && ! defined(LIBRESSL_VERSION_NUMBER)
+        return SSL_SESSION_is_resumable(session) ? true : false;
+#else
+        return true;
+#endif
+}
+
+
+/**
+ * Save the session for the next connection. The file is replaced atomically
+ * and readable by the owner only, as it contains the session secret
+ */
+static void _saveSession(T C) {
+        SSL_SESSION *session = SSL_get1_session(C->handler);
+        if (session) {
+                if (_isResumable(session)) {
+                        boolean_t saved = false;
+                        char path[PATH_MAX];
+                        // Unique temporary file in the same directory, so concurrent monit processes don't race on it and rename is atomic
+                        snprintf(path, sizeof(path), "%s.XXXXXX", C->session);
+                        int fd = mkstemp(path);
+                        if (fd != -1) {
+                                FILE *f = fdopen(fd, "w");
+                                if (f) {
+                                        boolean_t written = PEM_write_SSL_SESSION(f, session) == 1;
+                                        saved = fclose(f) == 0 && written && rename(path, C->session) == 0;
+                                } else {
+                                        close(fd);
+                                }
+                                if (! saved)
+                                        unlink(path);
+                        }
+                        if (! saved)
+                                DEBUG("SSL: cannot save the session to %s -- %s\n", C->session, STRERROR);
+                }
+                SSL_SESSION_free(session);
+        }
+}
+
+
+/**
+ * CPU time used by the calling thread in microseconds
+ */
+static long long _threadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        struct timespec t;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) == 0)
+                return (long long)t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+#endif
+        return 0LL;
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -481,6 +891,7 @@ void Ssl_start() {
 
 
 void Ssl_stop() {
+        Ssl_reset();
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
         CRYPTO_set_id_callback(NULL);
         CRYPTO_set_locking_callback(NULL);
@@ -494,6 +905,25 @@ void Ssl_stop() {
 }
 
 
+void Ssl_reset() {
+        LOCK(_contexts.mutex)
+        {
+                for (SslContext_T c = _contexts.list, next = NULL; c; c = next) {
+                        next = c->next;
+                        _freeSessions(c);
+                        SSL_CTX_free(c->ctx); // Connections which are still open hold their own reference
+                        FREE(c->ciphers);
+                        FREE(c->CACertificateFile);
+                        FREE(c->CACertificatePath);
+                        FREE(c->clientpemfile);
+                        FREE(c);
+                }
+                _contexts.list = NULL;
+        }
+        END_LOCK;
+}
+
+
 void Ssl_threadCleanup() {
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
         ERR_remove_state(0);
@@ -516,42 +946,11 @@ T Ssl_new(SslOptions_T options) {
         T C;
         NEW(C);
         C->options = options;
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
-        const SSL_METHOD *method = SSLv23_client_method();
-#else
-        const SSL_METHOD *method = TLS_client_method();
-#endif
-        if (! method) {
-                LogError("SSL: client method initialization failed -- %s\n", SSLERROR);
-                goto sslerror;
-        }
-        if (! (C->ctx = SSL_CTX_new(method))) {
-                LogError("SSL: client context initialization failed -- %s\n", SSLERROR);
-                goto sslerror;
-        }
-        if (! _setVersion(C->ctx, options)) {
-                goto sslerror;
-        }
-        SSL_CTX_set_default_verify_paths(C->ctx);
-        const char *CACertificateFile = _optionsCACertificateFile(options->CACertificateFile);
-        const char *CACertificatePath = _optionsCACertificatePath(options->CACertificatePath);
-        if (CACertificateFile || CACertificatePath) {
-                if (! SSL_CTX_load_verify_locations(C->ctx, CACertificateFile, CACertificatePath)) {
-                        LogError("SSL: CA certificates loading failed -- %s\n", SSLERROR);
-                        goto sslerror;
-                }
-        }
-        const char *ClientPEMFile = _optionsClientPEMFile(options->clientpemfile);
-        if (ClientPEMFile && ! _setClientCertificate(C, ClientPEMFile))
-                goto sslerror;
-#ifdef SSL_OP_NO_COMPRESSION
-        SSL_CTX_set_options(C->ctx, SSL_OP_NO_COMPRESSION);
-#endif
-        const char *ciphers = _optionsCiphers(options->ciphers);
-        if (SSL_CTX_set_cipher_list(C->ctx, ciphers) != 1) {
-                LogError("SSL: client cipher list [%s] error -- no valid ciphers\n", ciphers);
+        if (options->session)
+                C->session = Str_dup(options->session);
+        if (! (C->context = _getContext(options)))
                 goto sslerror;
-        }
+        C->ctx = C->context->ctx;
         if (! (C->handler = SSL_new(C->ctx))) {
                 LogError("SSL: cannot create client handler -- %s\n", SSLERROR);
                 goto sslerror;
@@ -570,8 +969,10 @@ void Ssl_free(T *C) {
         ASSERT(C && *C);
         if ((*C)->handler)
                 SSL_free((*C)->handler);
-        if ((*C)->ctx && ! (*C)->accepted)
-                SSL_CTX_free((*C)->ctx);
+        if ((*C)->resumedCertificate)
+                X509_free((*C)->resumedCertificate);
+        FREE((*C)->peer);
+        FREE((*C)->session);
         FREE(*C);
 }
 
@@ -580,6 +981,8 @@ void Ssl_close(T C) {
         ASSERT(C);
         boolean_t retry = false;
         int timeout = Run.limits.networkTimeout;
+        if (C->session && SSL_is_init_finished(C->handler))
+                _saveSession(C);
         do {
                 int rv = SSL_shutdown(C->handler);
                 if (rv == 0) {
@@ -615,6 +1018,12 @@ void Ssl_connect(T C, int socket, int timeout, const char *name) {
         SSL_set_connect_state(C->handler);
         SSL_set_fd(C->handler, C->socket);
         _setServerNameIdentification(C, name);
+        if (C->options->noResume || (! C->session && _optionsChecksum(C->options->checksum)))
+                SSL_set_options(C->handler, SSL_OP_NO_TICKET); // Full handshake, the server presents its current certificate which is verified and checksummed
+        else if (C->session)
+                _loadSession(C);
+        else
+                _resumeSession(C, name);
         boolean_t retry = false;
         do {
                 int rv = SSL_connect(C->handler);
@@ -640,6 +1049,14 @@ void Ssl_connect(T C, int socket, int timeout, const char *name) {
                         break;
                 }
         } while (retry);
+        if (SSL_session_reused(C->handler)) {
+                // The verification callback is not called for a resumed session, take the server certificate from the session
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L) && ! defined(LIBRESSL_VERSION_NUMBER)
+                C->certificate = C->resumedCertificate = SSL_get1_peer_certificate(C->handler);
+#else
+                C->certificate = C->resumedCertificate = SSL_get_peer_certificate(C->handler);
+#endif
+        }
 }
 
 
@@ -725,44 +1142,69 @@ int Ssl_read(T C, void *b, int size, int timeout) {
 }
 
 
+int Ssl_readAvailable(T C, void *b, int size) {
+        ASSERT(C);
+        if (C->accepted && ! SSL_is_init_finished(C->handler)) {
+                int rv = SslServer_accept(C, C->socket);
+                if (rv <= 0)
+                        return rv;
+        }
+        ERR_clear_error();
+        int n = SSL_read(C->handler, b, size);
+        switch (SSL_get_error(C->handler, n)) {
+                case SSL_ERROR_NONE:
+                        return n;
+                case SSL_ERROR_WANT_READ:
+                case SSL_ERROR_WANT_WRITE:
+                        return 0;
+                case SSL_ERROR_ZERO_RETURN:
+                        return -1;
+                default:
+                        DEBUG("SSL: read error -- %s\n", SSLERROR);
+                        return -1;
+        }
+}
+
+
 int Ssl_getCertificateValidDays(T C) {
         if (C && C->certificate) {
                 // Certificates which expired already are catched in preverify => we don't need to handle them here
-                int deltadays = 0;
-#ifdef HAVE_ASN1_TIME_DIFF
-                int deltaseconds;
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
-                if (! ASN1_TIME_diff(&deltadays, &deltaseconds, NULL, X509_get_notAfter(C->certificate))) {
-#else
-                if (! ASN1_TIME_diff(&deltadays, &deltaseconds, NULL, X509_get0_notAfter(C->certificate))) {
-#endif
-                        THROW(IOException, "invalid time format in certificate's notAfter field");
-                }
-#else
-                ASN1_GENERALIZEDTIME *t = ASN1_TIME_to_generalizedtime(X509_get_notAfter(C->certificate), NULL);
-                if (! t) {
-                        THROW(IOException, "invalid time format (in certificate's notAfter field)");
-                }
-                TRY
-                {
-                        deltadays = (double)(Time_toTimestamp((const char *)t->data) - Time_now()) / 86400.;
-                }
-                ELSE
-                {
-                        THROW(IOException, "invalid time format in certificate's notAfter field -- %s", t->data);
-                }
-                FINALLY
-                {
-                        ASN1_STRING_free(t);
-                }
-                END_TRY;
-#endif
+                int deltadays = (int)((_getValidTo(C->certificate) - Time_now()) / 86400);
                 return deltadays > 0 ? deltadays : 0;
         }
         return -1;
 }
 
 
+int Ssl_getCertificateChain(T C, char fingerprint[65], SslCertificate_T *chain, int size) {
+        ASSERT(C);
+        ASSERT(chain);
+        if (! C->certificate)
+                THROW(IOException, "SSL: no server certificate");
+        _getFingerprint(C->certificate, fingerprint);
+        int count = 0;
+        // The peer chain includes the server's certificate on the client side, use the saved certificate if the chain is not available (resumed session)
+        STACK_OF(X509) *peer = SSL_get_peer_cert_chain(C->handler);
+        int length = peer ? sk_X509_num(peer) : 0;
+        if (length == 0) {
+                X509_NAME_oneline(X509_get_subject_name(C->certificate), chain[count].subject, sizeof(chain[count].subject));
+                chain[count++].validTo = _getValidTo(C->certificate);
+        }
+        for (int i = 0; i < length && count < size; i++) {
+                X509 *certificate = sk_X509_value(peer, i);
+                X509_NAME_oneline(X509_get_subject_name(certificate), chain[count].subject, sizeof(chain[count].subject));
+                chain[count++].validTo = _getValidTo(certificate);
+        }
+        return count;
+}
+
+
+boolean_t Ssl_isVerified(T C) {
+        ASSERT(C);
+        return C->verified;
+}
+
+
 char *Ssl_printOptions(SslOptions_T options, char *b, int size) {
         ASSERT(b);
         ASSERT(size > 0);
@@ -847,7 +1289,10 @@ SslServer_T SslServer_new(int socket, SslOptions_T options) {
 #ifdef SSL_OP_NO_COMPRESSION
         SSL_CTX_set_options(S->ctx, SSL_OP_NO_COMPRESSION);
 #endif
-        SSL_CTX_set_session_cache_mode(S->ctx, SSL_SESS_CACHE_OFF);
+        // Let the clients resume their sessions by the session id or a session ticket, so repeated requests skip the full handshake
+        SSL_CTX_set_session_cache_mode(S->ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(S->ctx, SESSION_CACHE_SIZE);
+        SSL_CTX_set_timeout(S->ctx, SESSION_TIMEOUT);
         const char *pemfile = _optionsServerPEMFile(options->pemfile);
         if (SSL_CTX_use_certificate_chain_file(S->ctx, pemfile) != 1) {
                 LogError("SSL: server certificate chain loading failed -- %s\n", SSLERROR);
@@ -925,38 +1370,56 @@ void SslServer_freeConnection(SslServer_T S, T *C) {
 }
 
 
-boolean_t SslServer_accept(T C, int socket, int timeout) {
+int SslServer_accept(T C, int socket) {
         ASSERT(C);
         ASSERT(socket >= 0);
-        C->socket = socket;
-        SSL_set_accept_state(C->handler);
-        SSL_set_fd(C->handler, C->socket);
-        boolean_t retry = false;
-        do {
-                int rv = SSL_accept(C->handler);
-                if (rv < 0) {
-                        switch (SSL_get_error(C->handler, rv)) {
-                                case SSL_ERROR_NONE:
-                                        break;
-                                case SSL_ERROR_WANT_READ:
-                                        retry = _retry(C->socket, &timeout, Net_canRead);
-                                        break;
-                                case SSL_ERROR_WANT_WRITE:
-                                        retry = _retry(C->socket, &timeout, Net_canWrite);
-                                        break;
-                                default:
-                                        rv = (int)SSL_get_verify_result(C->handler);
-                                        if (rv != X509_V_OK)
-                                                LogError("SSL client certificate verification error: %s\n", *C->error ? C->error : X509_verify_cert_error_string(rv));
-                                        else
-                                                LogError("SSL accept error: %s\n", SSLERROR);
-                                        return false;
-                        }
-                } else {
-                        break;
+        if (SSL_get_fd(C->handler) != socket) {
+                C->socket = socket;
+                SSL_set_accept_state(C->handler);
+                SSL_set_fd(C->handler, C->socket);
+        }
+        ERR_clear_error(); // The engine thread serves many connections, don't let SSL_get_error() see errors of another one
+        long long start = _threadCpuTime();
+        int rv = SSL_accept(C->handler);
+        long long cpu = _threadCpuTime() - start;
+        LOCK(_statistics.mutex)
+        {
+                _statistics.cpu += cpu;
+                if (rv > 0) {
+                        _statistics.handshakes++;
+                        if (SSL_session_reused(C->handler))
+                                _statistics.resumed++;
                 }
-        } while (retry);
-        return true;
+        }
+        END_LOCK;
+        if (rv > 0)
+                return 1;
+        switch (SSL_get_error(C->handler, rv)) {
+                case SSL_ERROR_WANT_READ:
+                case SSL_ERROR_WANT_WRITE:
+                        return 0;
+                default:
+                        rv = (int)SSL_get_verify_result(C->handler);
+                        if (rv != X509_V_OK)
+                                LogError("SSL client certificate verification error: %s\n", *C->error ? C->error : X509_verify_cert_error_string(rv));
+                        else
+                                LogError("SSL accept error: %s\n", SSLERROR);
+                        return -1;
+        }
+}
+
+
+void SslServer_getStatistics(unsigned long long *handshakes, unsigned long long *resumed, double *cpu) {
+        ASSERT(handshakes);
+        ASSERT(resumed);
+        ASSERT(cpu);
+        LOCK(_statistics.mutex)
+        {
+                *handshakes = _statistics.handshakes;
+                *resumed = _statistics.resumed;
+                *cpu = (double)_statistics.cpu / 1000.;
+        }
+        END_LOCK;
 }
 
 #endif
@@ -58,9 +58,19 @@ typedef struct SslOptions_T {
         char *ciphers;                               /**< Allowed SSL ciphers list */
         char *CACertificateFile;             /**< Path to CA certificates PEM file */
         char *CACertificatePath;            /**< Path to CA certificates directory */
+        char *session;    /**< Optional file to save the client session for resumption */
+        char *fingerprint; /**< SHA-256 fingerprint of the server certificate verified before, the chain verification is skipped while it's unchanged */
+        boolean_t noResume;    /**< true if a cached session must not be resumed */
 } *SslOptions_T;
 
 
+/** Certificate of the server's certificate chain */
+typedef struct SslCertificate_T {
+        char subject[256];                              /**< Certificate subject */
+        time_t validTo;                             /**< Expiry time (notAfter) */
+} SslCertificate_T;
+
+
 #define T Ssl_T
 typedef struct T *T;
 
@@ -83,6 +93,14 @@ void Ssl_start();
 void Ssl_stop();
 
 
+/**
+ * Free the cached client contexts and sessions. The contexts are shared by
+ * the connections with the same SSL options and are created on the first
+ * use, the next connection after the reset loads the CA certificates again
+ */
+void Ssl_reset();
+
+
 /**
  * Cleanup thread's error queue.
  */
@@ -152,6 +170,18 @@ int Ssl_write(T C, void *b, int size, int timeout);
 int Ssl_read(T C, void *b, int size, int timeout);
 
 
+/**
+ * Read the data available on an encrypted channel without blocking. The
+ * handshake of an accepted connection is continued first if not done yet.
+ * @param C An SSL connection object
+ * @param b A byte buffer
+ * @param size The size of the buffer b
+ * @return Number of bytes read, 0 if no data is available yet or -1 if
+ * failed or the peer closed the connection
+ */
+int Ssl_readAvailable(T C, void *b, int size);
+
+
 /**
  * Get days the certificate remains valid.
  * @param C An SSL connection object
@@ -161,6 +191,30 @@ int Ssl_read(T C, void *b, int size, int timeout);
 int Ssl_getCertificateValidDays(T C);
 
 
+/**
+ * Get the server certificate chain of the connection, starting with the
+ * server's certificate
+ * @param C An SSL connection object
+ * @param fingerprint Buffer for the SHA-256 fingerprint of the server's
+ * certificate (hex string)
+ * @param chain Array for the chain certificates
+ * @param size The size of the chain array
+ * @return Number of certificates stored in the chain array
+ * @exception IOException if failed
+ */
+int Ssl_getCertificateChain(T C, char fingerprint[65], SslCertificate_T *chain, int size);
+
+
+/**
+ * Test if the certificate chain was verified by the handshake. The
+ * verification is skipped if the server's certificate has the fingerprint
+ * set in the SSL options
+ * @param C An SSL connection object
+ * @return true if the chain was verified, false if skipped
+ */
+boolean_t Ssl_isVerified(T C);
+
+
 /**
  * Print SSL options string representation to the given buffer.
  * @param options SSL options object
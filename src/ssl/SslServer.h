@@ -66,13 +66,24 @@ void SslServer_freeConnection(T S, Ssl_T *C);
 
 
 /**
- * Embed an accepted socket in an existing SSL connection
- * @param C An SSL connection object 
+ * Embed an accepted socket in an existing SSL connection and continue the
+ * handshake without blocking. Call again when the socket is readable,
+ * until the handshake completes.
+ * @param C An SSL connection object
  * @param socket An accepted socket
- * @param timeout Milliseconds to wait for connection to be established
- * @return true if succeeded or false if failed
+ * @return 1 if the handshake completed, 0 if it waits for the client or
+ * -1 if failed
  */
-boolean_t SslServer_accept(Ssl_T C, int socket, int timeout);
+int SslServer_accept(Ssl_T C, int socket);
+
+
+/**
+ * Get the statistics of the handshakes accepted by all SSL servers
+ * @param handshakes Output: number of successful handshakes
+ * @param resumed Output: number of handshakes which resumed a session
+ * @param cpu Output: CPU time spent in the handshakes in milliseconds
+ */
+void SslServer_getStatistics(unsigned long long *handshakes, unsigned long long *resumed, double *cpu);
 
 
 #undef T
@@ -32,6 +32,10 @@
 #include <stdio.h>
 #endif
 
+#ifdef HAVE_STDDEF_H
+#include <stddef.h>
+#endif
+
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -48,12 +52,24 @@
 #include <errno.h>
 #endif
 
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 
 #include "monit.h"
 #include "state.h"
 
 // libmonit
+#include "io/File.h"
 #include "exceptions/IOException.h"
 
 
@@ -83,8 +99,29 @@
  *
  *    5.) size, checksum, timestamp, permissions, link speed for the change observation test
  *
+ *    6.) notification rate limiter state
+ *        Keep the global notification rate limit across Monit restarts, so
+ *        restarting Monit during notification storm doesn't flood the
+ *        recipients.
+ *
  * Data is stored in binary form in the statefile using the following format:
- *    <MAGIC><VERSION>{<SERVICE_STATE>}+
+ *    <MAGIC><VERSION><BOOTED><LIMITER><SERVICES><CHECKSUM>{<SERVICE_STATE><CHECKSUM>}*
+ *
+ * The state file has a fixed size: the header is followed by one slot per
+ * service, in the servicelist order. The header and every slot are protected
+ * by a checksum, so a record damaged by a crash is ignored on restore rather
+ * than restoring garbage. The file is mapped to memory and State_save()
+ * updates only the records which changed since the last save, a quiet poll
+ * cycle thus costs no I/O. If mmap is not available, the file is read to
+ * memory and the changed records are written to the file in place. The
+ * checksums of the changed records are invalidated and synced to disk before
+ * the records are written, the kernel may write the pages in any order. When
+ * the service list changes, the whole file is written to a temporary file
+ * which is then atomically renamed over the state file and the directory is
+ * synced.
+ *
+ * Monit <= 5.24 used the version 4 format without checksums:
+ *    <MAGIC><VERSION><BOOTED>{<SERVICE_STATE>}+
  *
  * When the persistent field needs to be added, update the State_Version along
  * with State_restore() and State_save(). The version allows to recognize the
@@ -106,10 +143,19 @@ typedef enum {
         StateVersion1,
         StateVersion2,
         StateVersion3,
-        StateVersion4
+        StateVersion4,
+        StateVersion5
 } State_Version;
 
 
+/* Extended format version 5 notification limiter state */
+typedef struct mystate5limiter {
+        double             tokens;
+        int64_t            refilled;
+        uint32_t           suppressed;
+} State5Limiter_T;
+
+
 /* Extended format version 4 */
 typedef struct mystate4 {
         char               name[STRLEN];
@@ -156,6 +202,24 @@ typedef struct mystate4 {
 } State4_T;
 
 
+/* Extended format version 5 header (the magic, version, boot time and notification limiter state protected by checksum, followed by the fixed number of service slots) */
+typedef struct mystate5header {
+        int32_t            magic;
+        int32_t            version;
+        uint64_t           booted;
+        State5Limiter_T    limiter;
+        uint32_t           services;
+        uint32_t           checksum;
+} State5Header_T;
+
+
+/* Extended format version 5 service slot (the V4 service state protected by checksum) */
+typedef struct mystate5 {
+        State4_T           state;
+        uint32_t           checksum;
+} State5_T;
+
+
 /* Extended format version 3 */
 typedef struct mystate3 {
         char               name[STRLEN];
@@ -231,6 +295,14 @@ static int file = -1;
 static uint64_t booted = 0ULL;
 
 
+// Memory mapped (or read to memory if mmap is not available) state file (version 5)
+static struct {
+        size_t size;
+        State5Header_T *header;
+        State5_T *services;
+} map = {};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -318,50 +390,109 @@ static void _updateLinkSpeed(Service_T S, int32_t duplex, int64_t speed) {
 }
 
 
-static void _restoreV4() {
-        // System header
-        if (read(file, &booted, sizeof(booted)) != sizeof(booted)) {
-                THROW(IOException, "Unable to read system boot time");
+static void _updateNotificationLimiter(State5Limiter_T *limiter) {
+        Run.notificationLimiter.tokens = limiter->tokens;
+        Run.notificationLimiter.refilled = (time_t)limiter->refilled;
+        Run.notificationLimiter.suppressed = limiter->suppressed;
+}
+
+
+static void _restoreServiceV4(State4_T *state) {
+        Service_T service = Util_getService(state->name);
+        if (service && service->type == state->type) {
+                _updateStart(service, state->nstart, state->ncycle);
+                _updateMonitor(service, state->monitor);
+                switch (service->type) {
+                        case Service_Directory:
+                                _updatePermission(service, state->priv.directory.mode);
+                                _updateTimestamp(service, state->priv.directory.atime, state->priv.directory.ctime, state->priv.directory.mtime);
+                                break;
+
+                        case Service_Fifo:
+                                _updatePermission(service, state->priv.fifo.mode);
+                                _updateTimestamp(service, state->priv.fifo.atime, state->priv.fifo.ctime, state->priv.fifo.mtime);
+                                break;
+
+                        case Service_File:
+                                _updatePermission(service, state->priv.file.mode);
+                                _updateTimestamp(service, state->priv.file.atime, state->priv.file.ctime, state->priv.file.mtime);
+                                _updateFilePosition(service, state->priv.file.inode, state->priv.file.readpos);
+                                _updateSize(service, state->priv.file.size);
+                                _updateChecksum(service, state->priv.file.hash);
+                                break;
+
+                        case Service_Filesystem:
+                                _updatePermission(service, state->priv.filesystem.mode);
+                                break;
+
+                        case Service_Net:
+                                _updateLinkSpeed(service, state->priv.net.duplex, state->priv.net.speed);
+                                break;
+
+                        default:
+                                break;
+                }
         }
-        // Services state
+}
+
+
+static void _restoreServicesV4() {
         State4_T state;
-        while (read(file, &state, sizeof(state)) == sizeof(state)) {
-                Service_T service = Util_getService(state.name);
-                if (service && service->type == state.type) {
-                        _updateStart(service, state.nstart, state.ncycle);
-                        _updateMonitor(service, state.monitor);
-                        switch (service->type) {
-                                case Service_Directory:
-                                        _updatePermission(service, state.priv.directory.mode);
-                                        _updateTimestamp(service, state.priv.directory.atime, state.priv.directory.ctime, state.priv.directory.mtime);
-                                        break;
+        while (read(file, &state, sizeof(state)) == sizeof(state))
+                _restoreServiceV4(&state);
+}
 
-                                case Service_Fifo:
-                                        _updatePermission(service, state.priv.fifo.mode);
-                                        _updateTimestamp(service, state.priv.fifo.atime, state.priv.fifo.ctime, state.priv.fifo.mtime);
-                                        break;
 
-                                case Service_File:
-                                        _updatePermission(service, state.priv.file.mode);
-                                        _updateTimestamp(service, state.priv.file.atime, state.priv.file.ctime, state.priv.file.mtime);
-                                        _updateFilePosition(service, state.priv.file.inode, state.priv.file.readpos);
-                                        _updateSize(service, state.priv.file.size);
-                                        _updateChecksum(service, state.priv.file.hash);
-                                        break;
+/**
+ * Checksum of the state record (FNV-1a)
+ * @param data The record
+ * @param length The record length
+ * @return The checksum
+ */
+static uint32_t _checksum(const void *data, size_t length) {
+        uint32_t hash = 2166136261U;
+        for (const unsigned char *p = data; length--; p++) {
+                hash ^= *p;
+                hash *= 16777619U;
+        }
+        return hash;
+}
 
-                                case Service_Filesystem:
-                                        _updatePermission(service, state.priv.filesystem.mode);
-                                        break;
 
-                                case Service_Net:
-                                        _updateLinkSpeed(service, state.priv.net.duplex, state.priv.net.speed);
-                                        break;
+static uint32_t _headerChecksum(State5Header_T *header) {
+        return _checksum(header, offsetof(State5Header_T, checksum));
+}
 
-                                default:
-                                        break;
-                        }
-                }
+
+static void _restoreV5() {
+        // System header
+        State5Header_T header;
+        if (lseek(file, 0L, SEEK_SET) == -1 || read(file, &header, sizeof(header)) != sizeof(header)) {
+                THROW(IOException, "Unable to read header");
+        }
+        if (header.checksum != _headerChecksum(&header)) {
+                THROW(IOException, "Header checksum mismatch");
+        }
+        booted = header.booted;
+        _updateNotificationLimiter(&header.limiter);
+        // Services state
+        State5_T slot;
+        for (uint32_t i = 0; i < header.services && read(file, &slot, sizeof(slot)) == sizeof(slot); i++) {
+                if (slot.checksum == _checksum(&slot.state, sizeof(slot.state)))
+                        _restoreServiceV4(&slot.state);
+                else
+                        LogWarning("State file '%s': service state record #%u checksum mismatch -- skipped\n", Run.files.state, i);
+        }
+}
+
+
+static void _restoreV4() {
+        // System header
+        if (read(file, &booted, sizeof(booted)) != sizeof(booted)) {
+                THROW(IOException, "Unable to read system boot time");
         }
+        // Services state
+        _restoreServicesV4();
 }
 
 
@@ -485,21 +616,276 @@ static void _restoreV0(int services) {
 }
 
 
+static void _fillState(Service_T service, State4_T *state) {
+        memset(state, 0, sizeof(State4_T));
+        snprintf(state->name, sizeof(state->name), "%s", service->name);
+        state->type = service->type;
+        state->monitor = service->monitor & ~Monitor_Waiting;
+        state->nstart = service->nstart;
+        state->ncycle = service->ncycle;
+        switch (service->type) {
+                case Service_Directory:
+                        state->priv.directory.atime = (uint64_t)service->inf.directory->timestamp.access;
+                        state->priv.directory.ctime = (uint64_t)service->inf.directory->timestamp.change;
+                        state->priv.directory.mtime = (uint64_t)service->inf.directory->timestamp.modify;
+                        if (service->perm) {
+                                state->priv.directory.mode = service->perm->perm;
+                        }
+                        break;
+
+                case Service_Fifo:
+                        state->priv.fifo.atime = (uint64_t)service->inf.fifo->timestamp.access;
+                        state->priv.fifo.ctime = (uint64_t)service->inf.fifo->timestamp.change;
+                        state->priv.fifo.mtime = (uint64_t)service->inf.fifo->timestamp.modify;
+                        if (service->perm) {
+                                state->priv.fifo.mode = service->perm->perm;
+                        }
+                        break;
+
+                case Service_File:
+                        state->priv.file.inode = service->inf.file->inode;
+                        state->priv.file.readpos = service->inf.file->readpos;
+                        state->priv.file.size = (uint64_t)service->inf.file->size;
+                        state->priv.file.atime = (uint64_t)service->inf.file->timestamp.access;
+                        state->priv.file.ctime = (uint64_t)service->inf.file->timestamp.change;
+                        state->priv.file.mtime = (uint64_t)service->inf.file->timestamp.modify;
+                        if (service->checksum) {
+                                strncpy(state->priv.file.hash, service->inf.file->cs_sum, sizeof(state->priv.file.hash) - 1);
+                        }
+                        if (service->perm) {
+                                state->priv.file.mode = service->perm->perm;
+                        }
+                        break;
+
+                case Service_Filesystem:
+                        if (service->perm) {
+                                state->priv.filesystem.mode = service->perm->perm;
+                        }
+                        break;
+
+                case Service_Net:
+                        if (service->linkspeedlist) {
+                                state->priv.net.duplex = service->linkspeedlist->duplex;
+                                state->priv.net.speed = service->linkspeedlist->speed;
+                        }
+                        break;
+
+                default:
+                        break;
+        }
+}
+
+
+static void _fillHeader(State5Header_T *header, int services) {
+        memset(header, 0, sizeof(State5Header_T));
+        header->magic = 0;
+        header->version = StateVersion5;
+        header->booted = systeminfo.booted;
+        header->limiter.tokens = Run.notificationLimiter.tokens;
+        header->limiter.refilled = (int64_t)Run.notificationLimiter.refilled;
+        header->limiter.suppressed = Run.notificationLimiter.suppressed;
+        header->services = services;
+        header->checksum = _headerChecksum(header);
+}
+
+
+static void _release() {
+#ifdef HAVE_SYS_MMAN_H
+        if (munmap(map.header, map.size) == -1)
+                LogError("State file '%s': unmap error -- %s\n", Run.files.state, STRERROR);
+#else
+        FREE(map.header);
+#endif
+        map.header = NULL;
+        map.services = NULL;
+        map.size = 0;
+}
+
+
+static void _unmap() {
+        if (map.header) {
+#ifdef HAVE_SYS_MMAN_H
+                if (msync(map.header, map.size, MS_SYNC) == -1)
+                        LogError("State file '%s': sync error -- %s\n", Run.files.state, STRERROR);
+#endif
+                _release();
+        }
+}
+
+
+/**
+ * Write the changed record to the state file. The mapped memory is written
+ * by the kernel, only the state file read to memory needs to be written
+ * @param record The record in the state file memory
+ * @param length The record length
+ * @exception IOException if the record cannot be written
+ */
+static void _write(void *record, size_t length) {
+#ifndef HAVE_SYS_MMAN_H
+        if (lseek(file, (off_t)((char *)record - (char *)map.header), SEEK_SET) == -1 || write(file, record, length) != (ssize_t)length) {
+                THROW(IOException, "Unable to write -- %s", STRERROR);
+        }
+#endif
+}
+
+
+/**
+ * Synchronously write the invalidated checksums, so they reach the disk before
+ * the changed records
+ * @exception IOException if the sync failed
+ */
+static void _sync() {
+#ifdef HAVE_SYS_MMAN_H
+        if (msync(map.header, map.size, MS_SYNC) == -1) {
+#else
+        if (fsync(file) == -1) {
+#endif
+                THROW(IOException, "Unable to sync -- %s", STRERROR);
+        }
+}
+
+
+/**
+ * Sync the state file directory, so the created or renamed state file is not
+ * lost on crash
+ * @exception IOException if the directory cannot be synced
+ */
+static void _syncDirectory() {
+        char path[PATH_MAX];
+        Str_copy(path, Run.files.state, sizeof(path) - 1);
+        int fd = open(File_dirname(path), O_RDONLY);
+        if (fd == -1) {
+                THROW(IOException, "Unable to open directory %s -- %s", path, STRERROR);
+        }
+        int rv = fsync(fd);
+        int error = errno;
+        close(fd);
+        if (rv == -1) {
+                THROW(IOException, "Unable to sync directory %s -- %s", path, strerror(error));
+        }
+}
+
+
+/**
+ * Schedule the write of changed pages, the synchronous flush is done in
+ * State_close(). The changed records of the state file read to memory were
+ * written already
+ * @exception IOException if the sync failed
+ */
+static void _flush() {
+#ifdef HAVE_SYS_MMAN_H
+        if (msync(map.header, map.size, MS_ASYNC) == -1) {
+                THROW(IOException, "Unable to sync -- %s", STRERROR);
+        }
+#endif
+}
+
+
+/**
+ * Map the state file to memory (or read it if mmap is not available). The file
+ * must be in the version 5 format with a slot for every service in the
+ * servicelist order and with valid checksums
+ * @param services The number of services
+ * @return true if the state file was mapped, otherwise false
+ */
+static boolean_t _map(int services) {
+        struct stat sb;
+        size_t size = sizeof(State5Header_T) + services * sizeof(State5_T);
+        if (fstat(file, &sb) == -1 || sb.st_size != (off_t)size)
+                return false;
+#ifdef HAVE_SYS_MMAN_H
+        void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (base == MAP_FAILED)
+                return false;
+#else
+        void *base = ALLOC(size);
+        if (lseek(file, 0L, SEEK_SET) == -1 || read(file, base, size) != (ssize_t)size) {
+                FREE(base);
+                return false;
+        }
+#endif
+        map.size = size;
+        map.header = base;
+        map.services = (State5_T *)(map.header + 1);
+        boolean_t valid = map.header->magic == 0 && map.header->version == StateVersion5 && map.header->services == (uint32_t)services && map.header->checksum == _headerChecksum(map.header);
+        int i = 0;
+        for (Service_T service = servicelist; service && valid; service = service->next, i++) {
+                State5_T *slot = &map.services[i];
+                valid = slot->state.type == service->type && strncmp(slot->state.name, service->name, sizeof(slot->state.name) - 1) == 0 && slot->checksum == _checksum(&slot->state, sizeof(slot->state));
+        }
+        if (! valid)
+                _release();
+        return valid;
+}
+
+
+/**
+ * Write the complete state file to a temporary file, atomically replace the
+ * state file with it and map it to memory
+ * @param services The number of services
+ * @exception IOException if the state file cannot be written
+ */
+static void _rebuild(int services) {
+        _unmap();
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s.tmp", Run.files.state);
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+                THROW(IOException, "Unable to create %s -- %s", path, STRERROR);
+        }
+        State5Header_T header;
+        _fillHeader(&header, services);
+        boolean_t written = write(fd, &header, sizeof(header)) == sizeof(header);
+        for (Service_T service = servicelist; service && written; service = service->next) {
+                State5_T slot;
+                memset(&slot, 0, sizeof(slot));
+                _fillState(service, &slot.state);
+                slot.checksum = _checksum(&slot.state, sizeof(slot.state));
+                written = write(fd, &slot, sizeof(slot)) == sizeof(slot);
+        }
+        if (! written || fsync(fd) == -1 || rename(path, Run.files.state) == -1) {
+                int error = errno;
+                close(fd);
+                unlink(path);
+                THROW(IOException, "Unable to write %s -- %s", path, strerror(error));
+        }
+        close(file);
+        file = fd;
+        _syncDirectory();
+        if (! _map(services)) {
+                THROW(IOException, "Unable to map -- %s", STRERROR);
+        }
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
 boolean_t State_open() {
         State_close();
+        boolean_t created = ! File_exist(Run.files.state);
         if ((file = open(Run.files.state, O_RDWR | O_CREAT, 0600)) == -1) {
                 LogError("State file '%s': cannot open for write -- %s\n", Run.files.state, STRERROR);
                 return false;
         }
+        if (created) {
+                TRY
+                {
+                        _syncDirectory();
+                }
+                ELSE
+                {
+                        LogError("State file '%s': %s\n", Run.files.state, Exception_frame.message);
+                }
+                END_TRY;
+        }
         atexit(State_close);
         return true;
 }
 
 
 void State_close() {
+        _unmap();
         if (file != -1) {
                 if (close(file) == -1)
                         LogError("State file '%s': close error -- %s\n", Run.files.state, STRERROR);
@@ -512,93 +898,60 @@ void State_close() {
 void State_save() {
         TRY
         {
-                if (ftruncate(file, 0L) == -1) {
-                        THROW(IOException, "Unable to truncate");
-                }
-                if (lseek(file, 0L, SEEK_SET) == -1) {
-                        THROW(IOException, "Unable to seek");
-                }
-                int32_t magic = 0;
-                if (write(file, &magic, sizeof(magic)) != sizeof(magic)) {
-                        THROW(IOException, "Unable to write magic");
-                }
-                // Save always using the latest format version
-                int32_t version = StateVersion4;
-                if (write(file, &version, sizeof(version)) != sizeof(version)) {
-                        THROW(IOException, "Unable to write format version");
-                }
-                if (write(file, &systeminfo.booted, sizeof(systeminfo.booted)) != sizeof(systeminfo.booted)) {
-                        THROW(IOException, "Unable to write system boot time");
+                int services = 0;
+                for (Service_T service = servicelist; service; service = service->next)
+                        services++;
+                // Save always using the latest format version. If the service list changed, the state file is rewritten, otherwise only changed records are updated in place
+                if (map.header && map.header->services != (uint32_t)services)
+                        _unmap();
+                if (! map.header && ! _map(services))
+                        _rebuild(services);
+                // Invalidate the checksums of the changed records first and sync them, so a partially updated record is not restored after crash
+                boolean_t dirty = false;
+                State5Header_T header;
+                _fillHeader(&header, services);
+                if (memcmp(map.header, &header, sizeof(header))) {
+                        map.header->checksum = ~_headerChecksum(map.header);
+                        _write(&map.header->checksum, sizeof(map.header->checksum));
+                        dirty = true;
                 }
-                for (Service_T service = servicelist; service; service = service->next) {
+                int i = 0;
+                for (Service_T service = servicelist; service; service = service->next, i++) {
+                        State5_T *slot = &map.services[i];
                         State4_T state;
-                        memset(&state, 0, sizeof(state));
-                        snprintf(state.name, sizeof(state.name), "%s", service->name);
-                        state.type = service->type;
-                        state.monitor = service->monitor & ~Monitor_Waiting;
-                        state.nstart = service->nstart;
-                        state.ncycle = service->ncycle;
-                        switch (service->type) {
-                                case Service_Directory:
-                                        state.priv.directory.atime = (uint64_t)service->inf.directory->timestamp.access;
-                                        state.priv.directory.ctime = (uint64_t)service->inf.directory->timestamp.change;
-                                        state.priv.directory.mtime = (uint64_t)service->inf.directory->timestamp.modify;
-                                        if (service->perm) {
-                                                state.priv.directory.mode = service->perm->perm;
-                                        }
-                                        break;
-
-                                case Service_Fifo:
-                                        state.priv.fifo.atime = (uint64_t)service->inf.fifo->timestamp.access;
-                                        state.priv.fifo.ctime = (uint64_t)service->inf.fifo->timestamp.change;
-                                        state.priv.fifo.mtime = (uint64_t)service->inf.fifo->timestamp.modify;
-                                        if (service->perm) {
-                                                state.priv.fifo.mode = service->perm->perm;
-                                        }
-                                        break;
-
-                                case Service_File:
-                                        state.priv.file.inode = service->inf.file->inode;
-                                        state.priv.file.readpos = service->inf.file->readpos;
-                                        state.priv.file.size = (uint64_t)service->inf.file->size;
-                                        state.priv.file.atime = (uint64_t)service->inf.file->timestamp.access;
-                                        state.priv.file.ctime = (uint64_t)service->inf.file->timestamp.change;
-                                        state.priv.file.mtime = (uint64_t)service->inf.file->timestamp.modify;
-                                        if (service->checksum) {
-                                                strncpy(state.priv.file.hash, service->inf.file->cs_sum, sizeof(state.priv.file.hash) - 1);
-                                        }
-                                        if (service->perm) {
-                                                state.priv.file.mode = service->perm->perm;
-                                        }
-                                        break;
-
-                                case Service_Filesystem:
-                                        if (service->perm) {
-                                                state.priv.filesystem.mode = service->perm->perm;
-                                        }
-                                        break;
-
-                                case Service_Net:
-                                        if (service->linkspeedlist) {
-                                                state.priv.net.duplex = service->linkspeedlist->duplex;
-                                                state.priv.net.speed = service->linkspeedlist->speed;
-                                        }
-                                        break;
-
-                                default:
-                                        break;
-                        }
-                        if (write(file, &state, sizeof(state)) != sizeof(state)) {
-                                THROW(IOException, "Unable to write service state");
+                        _fillState(service, &state);
+                        if (memcmp(&slot->state, &state, sizeof(state))) {
+                                slot->checksum = ~_checksum(&slot->state, sizeof(slot->state));
+                                _write(&slot->checksum, sizeof(slot->checksum));
+                                dirty = true;
                         }
                 }
-                if (fsync(file)) {
-                        THROW(IOException, "Unable to sync -- %s", STRERROR);
+                if (dirty) {
+                        _sync();
+                        // Write the changed records
+                        if (memcmp(map.header, &header, sizeof(header))) {
+                                *map.header = header;
+                                _write(map.header, sizeof(header));
+                        }
+                        i = 0;
+                        for (Service_T service = servicelist; service; service = service->next, i++) {
+                                State5_T *slot = &map.services[i];
+                                State4_T state;
+                                _fillState(service, &state);
+                                if (memcmp(&slot->state, &state, sizeof(state))) {
+                                        slot->state = state;
+                                        slot->checksum = _checksum(&slot->state, sizeof(slot->state));
+                                        _write(slot, sizeof(State5_T));
+                                }
+                        }
+                        _flush();
                 }
         }
         ELSE
         {
                 LogError("State file '%s': %s\n", Run.files.state, Exception_frame.message);
+                // Validate the state file again on the next save, the memory may not match the file
+                _unmap();
         }
         END_TRY;
 }
@@ -640,6 +993,9 @@ void State_restore() {
                                 case StateVersion4:
                                         _restoreV4();
                                         break;
+                                case StateVersion5:
+                                        _restoreV5();
+                                        break;
                                 default:
                                         LogWarning("State file '%s': incompatible version %d\n", Run.files.state, version);
                                         break;
@@ -133,6 +133,21 @@ struct ad_user {
 };
 
 
+/* Name index of services or service groups: an open addressing table (linear probing) which is kept at most half full */
+typedef struct NameIndex_T {
+        unsigned int size;
+        unsigned int count;
+        struct {
+                const char *name;
+                void *value;
+        } *slots;
+} NameIndex_T;
+
+
+static NameIndex_T serviceIndex = {};
+static NameIndex_T serviceGroupIndex = {};
+
+
 /* Unsafe URL characters: [00-1F, 7F-FF] <>\"#%}{|\\^[] ` */
 static const unsigned char urlunsafe[256] = {
         1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -242,6 +257,55 @@ static char x2c(char *hex) {
 }
 
 
+static void _indexInsert(NameIndex_T *index, const char *name, void *value) {
+        unsigned int mask = index->size - 1;
+        unsigned int i = Str_hash(name) & mask;
+        while (index->slots[i].name) {
+                if (IS(index->slots[i].name, name)) {
+                        // Keep the first object with the name, like the linear search did
+                        return;
+                }
+                i = (i + 1) & mask;
+        }
+        index->slots[i].name = name;
+        index->slots[i].value = value;
+        index->count++;
+}
+
+
+static void _indexPut(NameIndex_T *index, const char *name, void *value) {
+        if ((index->count + 1) * 2 > index->size) {
+                NameIndex_T old = *index;
+                index->size = index->size ? index->size * 2 : 64;
+                index->count = 0;
+                index->slots = CALLOC(index->size, sizeof(*(index->slots)));
+                for (unsigned int i = 0; i < old.size; i++)
+                        if (old.slots[i].name)
+                                _indexInsert(index, old.slots[i].name, old.slots[i].value);
+                FREE(old.slots);
+        }
+        _indexInsert(index, name, value);
+}
+
+
+static void *_indexGet(NameIndex_T *index, const char *name) {
+        if (index->size) {
+                unsigned int mask = index->size - 1;
+                for (unsigned int i = Str_hash(name) & mask; index->slots[i].name; i = (i + 1) & mask)
+                        if (IS(index->slots[i].name, name))
+                                return index->slots[i].value;
+        }
+        return NULL;
+}
+
+
+static void _indexReset(NameIndex_T *index) {
+        FREE(index->slots);
+        index->size = 0;
+        index->count = 0;
+}
+
+
 /**
  * Print registered events list
  */
@@ -774,10 +838,33 @@ void Util_hmacMD5(const unsigned char *data, int datalen, const unsigned char *k
 
 Service_T Util_getService(const char *name) {
         ASSERT(name);
-        for (Service_T s = servicelist; s; s = s->next)
-                if (IS(s->name, name))
-                        return s;
-        return NULL;
+        return _indexGet(&serviceIndex, name);
+}
+
+
+ServiceGroup_T Util_getServiceGroup(const char *name) {
+        ASSERT(name);
+        return _indexGet(&serviceGroupIndex, name);
+}
+
+
+void Util_indexService(Service_T s) {
+        ASSERT(s);
+        ASSERT(s->name);
+        _indexPut(&serviceIndex, s->name, s);
+}
+
+
+void Util_indexServiceGroup(ServiceGroup_T g) {
+        ASSERT(g);
+        ASSERT(g->name);
+        _indexPut(&serviceGroupIndex, g->name, g);
+}
+
+
+void Util_resetServiceIndex() {
+        _indexReset(&serviceIndex);
+        _indexReset(&serviceGroupIndex);
 }
 
 
@@ -819,6 +906,10 @@ void Util_printRunList() {
         printf(" %-18s =   stopTimeout:       %s\n", " ", Str_milliToTime(Run.limits.stopTimeout, (char[23]){}));
         printf(" %-18s =   startTimeout:      %s\n", " ", Str_milliToTime(Run.limits.startTimeout, (char[23]){}));
         printf(" %-18s =   restartTimeout:    %s\n", " ", Str_milliToTime(Run.limits.restartTimeout, (char[23]){}));
+        if (Run.limits.notificationRate)
+                printf(" %-18s =   notifications:     %u per %s\n", " ", Run.limits.notificationRate, Str_milliToTime(Run.limits.notificationWindow * 1000., (char[23]){}));
+        if (Run.limits.eventNotificationRate)
+                printf(" %-18s =   eventNotifications: %u per %s\n", " ", Run.limits.eventNotificationRate, Str_milliToTime(Run.limits.eventNotificationWindow * 1000., (char[23]){}));
         printf(" %-18s = }\n", " ");
         printf(" %-18s = %s\n", "On reboot", onrebootnames[Run.onreboot]);
         printf(" %-18s = %d seconds with start delay %d seconds\n", "Poll time", Run.polltime, Run.startdelay);
@@ -885,6 +976,8 @@ void Util_printRunList() {
                 printf(" with timeout %s", Str_milliToTime(Run.mailserver_timeout, (char[23]){}));
                 if (Run.mail_hostname)
                         printf(" using '%s' as my hostname", Run.mail_hostname);
+                if (Run.mailserver_idle > 0)
+                        printf(" and idle session reuse for %ds", Run.mailserver_idle);
                 printf("\n");
         }
 
@@ -1100,6 +1193,14 @@ void Util_printService(Service_T s) {
                 }
         }
 
+        for (Certificate_T o = s->certificatelist; o; o = o->next) {
+                StringBuffer_clear(buf);
+                if (o->minimumDays > 0)
+                        printf(" %-20s = %s\n", "Certificate", StringBuffer_toString(Util_printRule(buf, o->action, "if failed [%s]:%d with timeout %s or valid < %d days, every %d cycle(s)", o->hostname, o->port, Str_milliToTime(o->timeout, (char[23]){}), o->minimumDays, o->every)));
+                else
+                        printf(" %-20s = %s\n", "Certificate", StringBuffer_toString(Util_printRule(buf, o->action, "if failed [%s]:%d with timeout %s, every %d cycle(s)", o->hostname, o->port, Str_milliToTime(o->timeout, (char[23]){}), o->every)));
+        }
+
         for (Port_T o = s->portlist; o; o = o->next) {
                 StringBuffer_T buf2 = StringBuffer_create(64);
                 StringBuffer_append(buf2, "if failed [%s]:%d%s",
@@ -1356,6 +1457,30 @@ void Util_printService(Service_T s) {
                                 printf(" %-20s = ", "Disk write limit");
                                 break;
 
+                        case Resource_IcmpLoss:
+                                printf(" %-20s = ", "Ping loss limit");
+                                break;
+
+                        case Resource_IcmpJitter:
+                                printf(" %-20s = ", "Ping jitter limit");
+                                break;
+
+                        case Resource_IcmpResponseMinimum:
+                                printf(" %-20s = ", "Ping min. response time limit");
+                                break;
+
+                        case Resource_IcmpResponseAverage:
+                                printf(" %-20s = ", "Ping avg. response time limit");
+                                break;
+
+                        case Resource_IcmpResponseMaximum:
+                                printf(" %-20s = ", "Ping max. response time limit");
+                                break;
+
+                        case Resource_IcmpResponsePercentile95:
+                                printf(" %-20s = ", "Ping p95 response time limit");
+                                break;
+
                         default:
                                 break;
                 }
@@ -1398,6 +1523,18 @@ void Util_printService(Service_T s) {
                                 printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %.0f operations/s", operatornames[o->operator], o->limit)));
                                 break;
 
+                        case Resource_IcmpLoss:
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %.1f%%", operatornames[o->operator], o->limit)));
+                                break;
+
+                        case Resource_IcmpJitter:
+                        case Resource_IcmpResponseMinimum:
+                        case Resource_IcmpResponseAverage:
+                        case Resource_IcmpResponseMaximum:
+                        case Resource_IcmpResponsePercentile95:
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %s", operatornames[o->operator], Str_milliToTime(o->limit, (char[23]){}))));
+                                break;
+
                         default:
                                 break;
                 }
@@ -1893,8 +2030,7 @@ void Util_monitorUnset(Service_T s) {
         if (s->every.type == Every_SkipCycles)
                 s->every.spec.cycle.counter = 0;
         s->error = Event_Null;
-        if (s->eventlist)
-                gc_event(&s->eventlist);
+        gc_service_events(s);
         Util_resetInfo(s);
         State_save();
 }
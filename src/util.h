@@ -131,6 +131,36 @@ void Util_hmacMD5(const unsigned char *data, int datalen, const unsigned char *k
 Service_T Util_getService(const char *name);
 
 
+/**
+ * @param name A service group name as stated in the config file
+ * @return the named service group or NULL if not found
+ */
+ServiceGroup_T Util_getServiceGroup(const char *name);
+
+
+/**
+ * Add the service to the service name index used by Util_getService().
+ * The parser adds each service when it is appended to the service list.
+ * @param s A service object
+ */
+void Util_indexService(Service_T s);
+
+
+/**
+ * Add the service group to the index used by Util_getServiceGroup()
+ * @param g A service group object
+ */
+void Util_indexServiceGroup(ServiceGroup_T g);
+
+
+/**
+ * Clear the service and service group name indexes. Called by the
+ * garbage collector before the service list is freed, the indexes are
+ * rebuilt when the control file is parsed again.
+ */
+void Util_resetServiceIndex();
+
+
 /**
  * @param name A service name as stated in the config file
  * @return true if the service name exist in the
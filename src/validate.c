@@ -143,7 +143,7 @@ static void _programOutput(InputStream_T I, StringBuffer_T S) {
 static State_Type _checkConnection(Service_T s, Port_T p) {
         ASSERT(s);
         ASSERT(p);
-        volatile int retry_count = p->retry;
+        volatile int retry_count = p->probe.done && p->type == Socket_Udp ? 1 : p->retry; // The UDP probe retransmitted the request for the time of all retries already
         volatile State_Type rv = State_Succeeded;
         char buf[STRLEN];
         char report[STRLEN] = {};
@@ -181,6 +181,52 @@ retry:
 }
 
 
+/**
+ * Test the TLS certificate chain, the test is performed every c->every cycles
+ */
+static State_Type _checkCertificate(Service_T s, Certificate_T c) {
+        ASSERT(s);
+        ASSERT(c);
+        if (c->is_available != Connection_Init && ++c->cycle < c->every) {
+                DEBUG("'%s' certificate test at [%s]:%d skipped, %d of %d cycles\n", s->name, c->hostname, c->port, c->cycle, c->every);
+                return c->is_available == Connection_Failed ? State_Failed : State_Succeeded;
+        }
+        c->cycle = 0;
+        volatile State_Type rv = State_Succeeded;
+        TRY
+        {
+                Socket_testCertificate(c);
+                c->is_available = Connection_Ok;
+                DEBUG("'%s' certificate test at [%s]:%d succeeded [handshake time %s, chain of %d certificates %s]\n", s->name, c->hostname, c->port, Str_milliToTime(c->response, (char[23]){}), c->chainLength, c->verified ? "verified" : "unchanged");
+        }
+        ELSE
+        {
+                rv = State_Failed;
+                c->is_available = Connection_Failed;
+                Event_post(s, Event_Connection, State_Failed, c->action, "failed certificate test at [%s]:%d -- %s", c->hostname, c->port, Exception_frame.message);
+        }
+        END_TRY;
+        if (rv == State_Failed)
+                return rv;
+        Event_post(s, Event_Connection, State_Succeeded, c->action, "certificate test succeeded at [%s]:%d", c->hostname, c->port);
+        if (c->minimumDays > 0) {
+                // The chain expires with its first certificate
+                int first = 0;
+                for (int i = 1; i < c->chainLength; i++)
+                        if (c->chain[i].validTo < c->chain[first].validTo)
+                                first = i;
+                int days = (int)((c->chain[first].validTo - Time_now()) / 86400);
+                if (days < c->minimumDays) {
+                        Event_post(s, Event_Timestamp, State_Failed, c->action, "certificate %s expiry in %d days matches check limit [valid > %d days]", c->chain[first].subject, days, c->minimumDays);
+                        rv = State_Failed;
+                } else {
+                        Event_post(s, Event_Timestamp, State_Succeeded, c->action, "certificate chain valid days test succeeded [valid for %d days]", days);
+                }
+        }
+        return rv;
+}
+
+
 /**
  * Test process state (e.g. Zombie)
  */
@@ -541,6 +587,72 @@ static State_Type _checkSystemResources(Service_T s, Resource_T r) {
 }
 
 
+/**
+ * Test the ping statistics of the host against the resource limit. Every ping test of the host with data in the statistics window is tested
+ */
+static State_Type _checkIcmpResources(Service_T s, Resource_T r) {
+        ASSERT(s);
+        ASSERT(r);
+        State_Type rv = State_Init;
+        char report[STRLEN] = {};
+        for (Icmp_T icmp = s->icmplist; icmp && rv != State_Failed; icmp = icmp->next) {
+                if (! icmp->window.count)
+                        continue;
+                const char *name = NULL;
+                double value = 0.;
+                switch (r->resource_id) {
+                        case Resource_IcmpLoss:
+                                if (Util_evalDoubleQExpression(r->operator, icmp->statistics.loss, r->limit)) {
+                                        rv = State_Failed;
+                                        snprintf(report, STRLEN, "ping loss of %.1f%% in the last %d requests matches resource limit [loss %s %.1f%%]", icmp->statistics.loss, icmp->window.count, operatorshortnames[r->operator], r->limit);
+                                } else {
+                                        rv = State_Succeeded;
+                                        snprintf(report, STRLEN, "ping loss check succeeded [current loss = %.1f%%]", icmp->statistics.loss);
+                                }
+                                continue;
+                        case Resource_IcmpJitter:
+                                name = "jitter";
+                                value = icmp->statistics.jitter;
+                                break;
+                        case Resource_IcmpResponseMinimum:
+                                name = "minimum response time";
+                                value = icmp->statistics.minimum;
+                                break;
+                        case Resource_IcmpResponseAverage:
+                                name = "average response time";
+                                value = icmp->statistics.average;
+                                break;
+                        case Resource_IcmpResponseMaximum:
+                                name = "maximum response time";
+                                value = icmp->statistics.maximum;
+                                break;
+                        case Resource_IcmpResponsePercentile95:
+                                name = "95th percentile response time";
+                                value = icmp->statistics.percentile95;
+                                break;
+                        default:
+                                LogError("'%s' error -- unknown resource ID: [%d]\n", s->name, r->resource_id);
+                                return State_Failed;
+                }
+                if (icmp->statistics.average < 0.) {
+                        // No reply in the window, the failed ping test reports the error
+                        continue;
+                } else if (Util_evalDoubleQExpression(r->operator, value, r->limit)) {
+                        rv = State_Failed;
+                        snprintf(report, STRLEN, "ping %s of %s matches resource limit [%s %s %s]", name, Str_milliToTime(value, (char[23]){}), name, operatorshortnames[r->operator], Str_milliToTime(r->limit, (char[23]){}));
+                } else {
+                        rv = State_Succeeded;
+                        snprintf(report, STRLEN, "ping %s check succeeded [current %s = %s]", name, name, Str_milliToTime(value, (char[23]){}));
+                }
+        }
+        if (rv == State_Init)
+                DEBUG("'%s' ping statistics check skipped (no replies)\n", s->name);
+        else
+                Event_post(s, Event_Resource, rv, r->action, "%s", report);
+        return rv;
+}
+
+
 /**
  * Test for associated path checksum change
  */
@@ -1231,6 +1343,137 @@ static boolean_t _checkSkip(Service_T s) {
 }
 
 
+/**
+ * Returns true if the service is due to be checked in this cycle according to the every statement. Unlike _checkSkip it doesn't change the service state
+ */
+static boolean_t _isDue(Service_T s) {
+        time_t now = Time_now();
+        switch (s->every.type) {
+                case Every_SkipCycles:
+                        return s->every.spec.cycle.counter + 1 >= s->every.spec.cycle.number;
+                case Every_Cron:
+                        return (now - s->every.last_run) > 59 && Time_incron(s->every.spec.cron, now);
+                case Every_NotInCron:
+                        return ! Time_incron(s->every.spec.cron, now);
+                default:
+                        return true;
+        }
+}
+
+
+/**
+ * Ping the hosts of all ping tests due in this cycle at once, so the timeouts of unreachable hosts don't add up
+ */
+static void _pingHosts() {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                for (Icmp_T icmp = s->icmplist; icmp; icmp = icmp->next) {
+                        icmp->swept = false; // Drop the result of a sweep whose service check was skipped
+                        if (icmp->type == ICMP_ECHO && s->type == Service_Host && s->monitor && _isDue(s))
+                                count++;
+                }
+        }
+        if (count) {
+                IcmpEcho_T *echo = CALLOC(count, sizeof(IcmpEcho_T));
+                int i = 0;
+                for (Service_T s = servicelist; s; s = s->next)
+                        if (s->type == Service_Host && s->monitor && _isDue(s))
+                                for (Icmp_T icmp = s->icmplist; icmp; icmp = icmp->next)
+                                        if (icmp->type == ICMP_ECHO)
+                                                echo[i++] = (IcmpEcho_T){.hostname = s->path, .icmp = icmp};
+                icmp_sweep(echo, count);
+                for (i = 0; i < count; i++)
+                        echo[i].icmp->swept = true;
+                FREE(echo);
+        }
+}
+
+
+/*
+ * Returns true if the port can be tested by the UDP probe
+ */
+static boolean_t _isProbed(Port_T p) {
+        return p->type == Socket_Udp && p->family != Socket_Unix && p->protocol->encode && ! p->target.net.ssl.options.flags && ! p->persistent;
+}
+
+
+/**
+ * Test the UDP ports of all services which will be checked in this cycle at once
+ */
+static void _probeUdpPorts() {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                for (Port_T p = s->portlist; p; p = p->next) {
+                        p->probe.done = false; // Drop the result of a probe whose service check was skipped
+                        if (_isProbed(p) && s->monitor && _isDue(s))
+                                count++;
+                }
+        }
+        if (count) {
+                Port_T *ports = CALLOC(count, sizeof(Port_T));
+                int i = 0;
+                for (Service_T s = servicelist; s; s = s->next)
+                        if (s->monitor && _isDue(s))
+                                for (Port_T p = s->portlist; p; p = p->next)
+                                        if (_isProbed(p))
+                                                ports[i++] = p;
+                udp_sweep(ports, count);
+                FREE(ports);
+        }
+}
+
+
+/*
+ * Returns true if the port can share a connection with other ports
+ */
+static boolean_t _isPipelined(Port_T p) {
+        return p->protocol->pipeline && p->type == Socket_Tcp && p->family != Socket_Unix && ! p->persistent && ! p->probe.done;
+}
+
+
+static boolean_t _isSameValue(const char *a, const char *b) {
+        return a == b || Str_isByteEqual(a, b);
+}
+
+
+/*
+ * Returns true if the ports connect to the same server with the same options
+ */
+static boolean_t _isSameConnection(Port_T a, Port_T b) {
+        SslOptions_T x = &(a->target.net.ssl.options), y = &(b->target.net.ssl.options);
+        return a->protocol == b->protocol && a->family == b->family && a->target.net.port == b->target.net.port && a->timeout == b->timeout && IS(a->hostname, b->hostname) && _isSameValue(a->outgoing.ip, b->outgoing.ip)
+                && x->flags == y->flags && x->verify == y->verify && x->allowSelfSigned == y->allowSelfSigned && x->version == y->version && x->checksumType == y->checksumType
+                && _isSameValue(x->checksum, y->checksum) && _isSameValue(x->pemfile, y->pemfile) && _isSameValue(x->clientpemfile, y->clientpemfile) && _isSameValue(x->ciphers, y->ciphers)
+                && _isSameValue(x->CACertificateFile, y->CACertificateFile) && _isSameValue(x->CACertificatePath, y->CACertificatePath) && _isSameValue(x->session, y->session);
+}
+
+
+/**
+ * Test the ports of the service which connect to the same server with the
+ * same options on one connection, the requests are pipelined
+ */
+static void _pipelinePorts(Service_T s) {
+        for (Port_T p = s->portlist; p; p = p->next) {
+                if (! _isPipelined(p))
+                        continue;
+                int count = 1;
+                for (Port_T q = p->next; q; q = q->next)
+                        if (_isPipelined(q) && _isSameConnection(p, q))
+                                count++;
+                if (count > 1) {
+                        Port_T *ports = CALLOC(count, sizeof(Port_T));
+                        int i = 0;
+                        ports[i++] = p;
+                        for (Port_T q = p->next; q; q = q->next)
+                                if (_isPipelined(q) && _isSameConnection(p, q))
+                                        ports[i++] = q;
+                        Socket_testPipeline(ports, count);
+                        FREE(ports);
+                }
+        }
+}
+
+
 /**
  * Returns true if scheduled action was performed
  */
@@ -1269,6 +1512,9 @@ int validate() {
                         _doScheduledAction(s);
         }
 
+        _pingHosts();
+        _probeUdpPorts();
+
         int errors = 0;
         /* Check the services */
         for (Service_T s = servicelist; s; s = s->next) {
@@ -1287,6 +1533,8 @@ int validate() {
                         gettimeofday(&s->collected, NULL);
                 }
         }
+        Event_notification_summary();
+        handle_alert_idle();
         return errors;
 }
 
@@ -1348,6 +1596,8 @@ State_Type check_process(Service_T s) {
                 }
         }
         int64_t uptimeMilli = s->inf.process->uptime * 1000;
+        if (! s->start || uptimeMilli > s->start->timeout)
+                _pipelinePorts(s);
         for (Port_T pp = s->portlist; pp; pp = pp->next) {
                 //FIXME: instead of pause, try to test, but ignore any errors in the start timeout timeframe ... will allow to display the port response time as soon as available, instead of waiting for 30+ seconds
                 /* pause port tests in the start timeout timeframe while the process is starting (it may take some time to the process before it starts accepting connections) */
@@ -1672,7 +1922,10 @@ State_Type check_remote_host(Service_T s) {
         for (Icmp_T icmp = s->icmplist; icmp; icmp = icmp->next) {
                 switch (icmp->type) {
                         case ICMP_ECHO:
-                                icmp->response = icmp_echo(s->path, icmp->family, &(icmp->outgoing), icmp->size, icmp->timeout, icmp->count);
+                                // The response is collected by the ping sweep at the beginning of the cycle, ping the host now if the sweep didn't include it
+                                if (! icmp->swept)
+                                        icmp_sweep(&(IcmpEcho_T){.hostname = s->path, .icmp = icmp}, 1);
+                                icmp->swept = false;
                                 if (icmp->response == -2) {
                                         icmp->is_available = Connection_Init;
 #ifdef SOLARIS
@@ -1695,15 +1948,24 @@ State_Type check_remote_host(Service_T s) {
                                 return State_Failed;
                 }
         }
+        /* Test the ping statistics */
+        for (Resource_T r = s->resourcelist; r; r = r->next)
+                if (_checkIcmpResources(s, r) == State_Failed)
+                        rv = State_Failed;
         /* If we could not ping the host we assume it's down and do not continue to check any port connections  */
-        if (last_ping && last_ping->is_available == Connection_Failed && s->portlist) {
+        if (last_ping && last_ping->is_available == Connection_Failed && (s->portlist || s->certificatelist)) {
                 DEBUG("'%s' icmp ping failed, skipping any port connection tests\n", s->name);
                 return State_Failed;
         }
         /* Test each host:port and protocol in the service's portlist */
+        _pipelinePorts(s);
         for (Port_T p = s->portlist; p; p = p->next)
                 if (_checkConnection(s, p) == State_Failed)
                         rv = State_Failed;
+        /* Test the TLS certificates */
+        for (Certificate_T c = s->certificatelist; c; c = c->next)
+                if (_checkCertificate(s, c) == State_Failed)
+                        rv = State_Failed;
         return rv;
 }
 
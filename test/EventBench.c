@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monit.h"
+#include "event.h"
+#include "Bootstrap.h"
+
+// libmonit
+#include "system/Time.h"
+#include "exceptions/assert.h"
+
+// The monit objects are linked with main renamed to monit_main
+#undef main
+
+
+/**
+ * Event index microbenchmark. Posts repeated events to a service with
+ * many pending events and compares the indexed lookup of Event_post()
+ * with the walk of the service eventlist used before the index.
+ */
+
+
+#define EVENTS 1000
+#define ROUNDS 20
+
+
+static EventAction_T _newAction() {
+        EventAction_T ea;
+        NEW(ea);
+        NEW(ea->failed);
+        NEW(ea->succeeded);
+        ea->failed->id = ea->succeeded->id = Action_Ignored;
+        ea->failed->count = ea->failed->cycles = 1;
+        ea->succeeded->count = ea->succeeded->cycles = 1;
+        return ea;
+}
+
+
+// The eventlist walk which Event_post() did before the index
+static Event_T _walk(Service_T s, long id, EventAction_T action) {
+        for (Event_T e = s->eventlist; e; e = e->next)
+                if (e->id == id && e->action == action)
+                        return e;
+        return NULL;
+}
+
+
+// Changes of the event state are logged to stdout and stderr, hide them
+static void _quiet(boolean_t quiet) {
+        static int saved[2] = {-1, -1};
+        fflush(stdout);
+        fflush(stderr);
+        for (int fd = STDOUT_FILENO; fd <= STDERR_FILENO; fd++) {
+                int i = fd - STDOUT_FILENO;
+                if (quiet) {
+                        int null = open("/dev/null", O_WRONLY);
+                        saved[i] = dup(fd);
+                        dup2(null, fd);
+                        close(null);
+                } else if (saved[i] >= 0) {
+                        dup2(saved[i], fd);
+                        close(saved[i]);
+                        saved[i] = -1;
+                }
+        }
+}
+
+
+static int _length(Event_T list) {
+        int n = 0;
+        for (Event_T e = list; e; e = e->next)
+                n++;
+        return n;
+}
+
+
+int main(void) {
+        setbuf(stdout, NULL);
+        Bootstrap();
+        prog = "EventBench";
+        printf("============> Start Event Tests\n\n");
+
+        Service_T s;
+        NEW(s);
+        s->name = "bench";
+        s->type = Service_Host;
+        s->monitor = Monitor_Yes;
+        EventAction_T actions[EVENTS];
+        for (int i = 0; i < EVENTS; i++)
+                actions[i] = _newAction();
+
+        printf("=> Test1: post %d events\n", EVENTS);
+        {
+                _quiet(true);
+                for (int i = 0; i < EVENTS; i++)
+                        Event_post(s, Event_Connection, State_Failed, actions[i], "test %d", i);
+                _quiet(false);
+                assert(_length(s->eventlist) == EVENTS);
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: repeated events are found, no new event is created\n");
+        {
+                _quiet(true);
+                for (int i = 0; i < EVENTS; i++) {
+                        Event_post(s, Event_Connection, State_Failed, actions[i], "test %d", i);
+                        Event_post(s, Event_Resource, State_Failed, actions[i], "test %d", i);
+                }
+                _quiet(false);
+                assert(_length(s->eventlist) == EVENTS * 2);
+                for (int i = 0; i < EVENTS; i++)
+                        assert(_walk(s, Event_Resource, actions[i])->count == 1);
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("=> Test3: lookup time with %d pending events\n", EVENTS * 2);
+        {
+                // Recover the events first (logged), the following succeeded events are neither formatted nor logged and the lookup dominates
+                _quiet(true);
+                for (int i = 0; i < EVENTS; i++)
+                        Event_post(s, Event_Connection, State_Succeeded, actions[i], "test %d", i);
+                _quiet(false);
+                long long start = Time_micro();
+                for (int r = 0; r < ROUNDS; r++)
+                        for (int i = 0; i < EVENTS; i++)
+                                Event_post(s, Event_Connection, State_Succeeded, actions[i], "test %d", i);
+                long long indexed = Time_micro() - start;
+                start = Time_micro();
+                for (int r = 0; r < ROUNDS; r++)
+                        for (int i = 0; i < EVENTS; i++)
+                                assert(_walk(s, Event_Connection, actions[i]));
+                long long walked = Time_micro() - start;
+                assert(_length(s->eventlist) == EVENTS * 2);
+                printf("\tEvent_post with the index: %.3f us per event\n", (double)indexed / (ROUNDS * EVENTS));
+                printf("\tEventlist walk (lookup only): %.3f us per event\n", (double)walked / (ROUNDS * EVENTS));
+        }
+        printf("=> Test3: OK\n\n");
+
+        printf("============> Event Tests: OK\n\n");
+        return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monit.h"
+#include "protocol.h"
+#include "Bootstrap.h"
+
+// libmonit
+#include "system/Time.h"
+#include "exceptions/assert.h"
+
+// The monit objects are linked with main renamed to monit_main
+#undef main
+
+
+/**
+ * OpenMetrics export microbenchmark. Renders the /metrics page for many
+ * synthetic process services, each with one port test, and reports the
+ * CPU time and the size of one scrape.
+ */
+
+
+#define SERVICES 2000
+#define ROUNDS 20
+
+
+static Service_T _newService(int i, Service_T next) {
+        Service_T s;
+        NEW(s);
+        s->name = Str_cat("process%d", i);
+        s->type = Service_Process;
+        s->monitor = Monitor_Yes;
+        gettimeofday(&s->collected, NULL);
+        NEW(s->inf.process);
+        Util_resetInfo(s);
+        s->inf.process->pid = s->inf.process->ppid = 1000 + i;
+        s->inf.process->uptime = 3600 + i;
+        s->inf.process->threads = 4;
+        s->inf.process->children = 2;
+        s->inf.process->mem = s->inf.process->total_mem = 1048576ULL * (i + 1);
+        s->inf.process->mem_percent = s->inf.process->total_mem_percent = 1.5;
+        s->inf.process->cpu_percent = s->inf.process->total_cpu_percent = 0.5;
+        Port_T p;
+        NEW(p);
+        p->hostname = Str_dup("localhost");
+        p->target.net.port = 8000 + i % 1000;
+        p->protocol = Protocol_get(Protocol_HTTP);
+        p->is_available = Connection_Ok;
+        p->response = 1.2;
+        p->resolve = 0.1;
+        p->connect = 0.3;
+        s->portlist = p;
+        s->next = s->next_conf = next;
+        return s;
+}
+
+
+int main(void) {
+        setbuf(stdout, NULL);
+        Bootstrap();
+        prog = "MetricsBench";
+        Run.flags |= Run_ProcessEngineEnabled;
+        printf("============> Start Metrics Tests\n\n");
+
+        for (int i = SERVICES - 1; i >= 0; i--)
+                servicelist_conf = servicelist = _newService(i, servicelist);
+
+        printf("=> Test1: every service is exported\n");
+        {
+                StringBuffer_T B = StringBuffer_create(65536);
+                status_metrics(B, false, NULL, NULL);
+                const char *metrics = StringBuffer_toString(B);
+                assert(Str_sub(metrics, "monit_process_uptime_seconds{service=\"process0\",type=\"process\"} 3600\n"));
+                assert(Str_sub(metrics, "monit_port_up{service=\"process1999\",type=\"process\",hostname=\"localhost\",port=\"8999\",protocol=\"HTTP\"} 1\n"));
+                StringBuffer_free(&B);
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: scrape time with %d services\n", SERVICES);
+        {
+                StringBuffer_T B = StringBuffer_create(65536);
+                size_t length = 0;
+                long long start = Time_micro();
+                for (int r = 0; r < ROUNDS; r++) {
+                        StringBuffer_clear(B);
+                        status_metrics(B, r % 2, NULL, NULL);
+                        length = StringBuffer_length(B);
+                }
+                long long elapsed = Time_micro() - start;
+                StringBuffer_free(&B);
+                printf("\tstatus_metrics: %.1f ms per scrape, %.1f kB\n", (double)elapsed / ROUNDS / 1000., length / 1024.);
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("============> Metrics Tests: OK\n\n");
+        return 0;
+}
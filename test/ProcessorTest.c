@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "monit.h"
+#include "processor.h"
+#include "Bootstrap.h"
+
+// libmonit
+#include "exceptions/assert.h"
+
+// The monit objects are linked with main renamed to monit_main
+#undef main
+
+
+/**
+ * Unit tests of the HTTP request framing and the JSON escaping.
+ */
+
+
+int main(void) {
+        setbuf(stdout, NULL);
+        Bootstrap();
+        prog = "ProcessorTest";
+        Processor_setHttpPostLimit();
+        printf("============> Start Processor Tests\n\n");
+
+        printf("=> Test1: HTTP request length\n");
+        {
+                const char *get = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+                assert(Processor_getRequestLength(get, (int)strlen(get)) == (int)strlen(get));
+                // Incomplete headers
+                assert(Processor_getRequestLength(get, (int)strlen(get) - 2) == 0);
+                assert(Processor_getRequestLength("GE", 2) == 0);
+                // Pipelined requests, only the first one is counted
+                const char *pipelined = "GET /a HTTP/1.1\n\nGET /b HTTP/1.1\n\n";
+                assert(Processor_getRequestLength(pipelined, (int)strlen(pipelined)) == 17);
+                // An empty request line is passed to the processor which rejects it
+                assert(Processor_getRequestLength("\r\nGET", 5) == 2);
+                // The POST body is part of the request
+                const char *post = "POST /_doaction HTTP/1.1\r\ncontent-length: 8\r\n\r\naction=x";
+                assert(Processor_getRequestLength(post, (int)strlen(post)) == (int)strlen(post));
+                assert(Processor_getRequestLength(post, (int)strlen(post) - 1) == 0);
+                // The body of a POST larger than the limit isn't waited for, the processor rejects the request
+                const char *large = "POST / HTTP/1.1\r\nContent-Length: 100000\r\n\r\n";
+                assert(Processor_getRequestLength(large, (int)strlen(large)) == (int)strlen(large));
+                // The body of other methods is part of the request too, so it's never taken for the next request
+                const char *body = "GET / HTTP/1.1\r\nContent-Length: 15\r\n\r\nGET /x HTTP/1.1";
+                assert(Processor_getRequestLength(body, (int)strlen(body)) == (int)strlen(body));
+                assert(Processor_getRequestLength(body, (int)strlen(body) - 1) == 0);
+                // Too large headers
+                int length = REQ_HEADERLIMIT + 16;
+                char *headers = CALLOC(1, length + 1);
+                memset(headers, 'x', length);
+                assert(Processor_getRequestLength(headers, length) == -1);
+                FREE(headers);
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: JSON escaping\n");
+        {
+                StringBuffer_T sb = StringBuffer_create(64);
+                escapeJSON(sb, "say \"hi\"\\\n\tend");
+                printf("\tResult: %s\n", StringBuffer_toString(sb));
+                assert(Str_isEqual(StringBuffer_toString(sb), "say \\\"hi\\\"\\\\\\n\\u0009end"));
+                StringBuffer_free(&sb);
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("============> Processor Tests: OK\n\n");
+        return 0;
+}
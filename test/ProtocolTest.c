@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "monit.h"
+#include "protocol.h"
+#include "Bootstrap.h"
+
+// libmonit
+#include "exceptions/assert.h"
+#include "exceptions/IOException.h"
+#include "exceptions/ProtocolException.h"
+
+// The monit objects are linked with main renamed to monit_main
+#undef main
+
+
+/**
+ * Unit tests of the DNS and NTP request encoders and response decoders
+ * shared by the UDP probe and the blocking protocol tests.
+ */
+
+
+static boolean_t _throws(boolean_t (*decode)(Transaction_T, const unsigned char *, int), Transaction_T t, const unsigned char *response, int length) {
+        volatile boolean_t thrown = false;
+        TRY
+        {
+                decode(t, response, length);
+        }
+        ELSE
+        {
+                thrown = true;
+        }
+        END_TRY;
+        return thrown;
+}
+
+
+int main(void) {
+        setbuf(stdout, NULL);
+        Bootstrap();
+        prog = "ProtocolTest";
+        printf("============> Start Protocol Tests\n\n");
+
+        printf("=> Test1: DNS\n");
+        {
+                struct Port_T port = {.type = Socket_Udp};
+                struct Transaction_T t = {.port = &port, .id = 0x1234};
+                encode_dns(&t);
+                assert(t.length == 17);
+                assert(t.request[0] == 0x12 && t.request[1] == 0x34);
+                unsigned char response[17];
+                memcpy(response, t.request, sizeof(response));
+                response[2] |= 0x80; // Response
+                response[7] = 0x01;  // One answer
+                assert(decode_dns(&t, response, sizeof(response)));
+                // A response to another request is skipped
+                response[1] = 0x35;
+                assert(! decode_dns(&t, response, sizeof(response)));
+                response[1] = 0x34;
+                // Server failure
+                response[3] = 0x02;
+                assert(_throws(decode_dns, &t, response, sizeof(response)));
+                assert(_throws(decode_dns, &t, response, 11));
+                // Via TCP the request has the length prefix
+                port.type = Socket_Tcp;
+                encode_dns(&t);
+                assert(t.length == 19 && t.request[1] == 17);
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: NTP\n");
+        {
+                struct Port_T port = {.type = Socket_Udp};
+                struct Transaction_T t = {.port = &port, .id = 0xdeadbeef};
+                encode_ntp3(&t);
+                assert(t.length == 48);
+                unsigned char response[48] = {};
+                response[0] = (0 << 6) | (3 << 3) | 4; // Synchronized, version 3, server mode
+                memcpy(response + 24, t.request + 40, 8); // The server copies the transmit timestamp to the originate timestamp
+                assert(decode_ntp3(&t, response, sizeof(response)));
+                response[27] ^= 0xff;
+                assert(! decode_ntp3(&t, response, sizeof(response)));
+                response[27] ^= 0xff;
+                response[0] |= 3 << 6; // Not synchronized
+                assert(_throws(decode_ntp3, &t, response, sizeof(response)));
+                assert(_throws(decode_ntp3, &t, response, 47));
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("============> Protocol Tests: OK\n\n");
+        return 0;
+}
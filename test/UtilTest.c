@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "monit.h"
+#include "Bootstrap.h"
+
+// libmonit
+#include "exceptions/assert.h"
+
+// The monit objects are linked with main renamed to monit_main
+#undef main
+
+
+/**
+ * Unit tests of the service and service group name index.
+ */
+
+
+#define SLOTS 64        // The initial size of the index
+#define COLLISIONS 5
+#define SERVICES 1000
+
+
+static Service_T _newService(const char *name) {
+        Service_T s;
+        NEW(s);
+        s->name = Str_dup(name);
+        s->type = Service_Host;
+        return s;
+}
+
+
+// Find names which hash to the same slot of the initial index
+static void _collidingNames(char names[COLLISIONS + 1][STRLEN]) {
+        unsigned int slot = Str_hash("collision0") & (SLOTS - 1);
+        snprintf(names[0], STRLEN, "collision0");
+        for (int i = 1, n = 1; n <= COLLISIONS; i++) {
+                char name[STRLEN];
+                snprintf(name, sizeof(name), "collision%d", i);
+                if ((Str_hash(name) & (SLOTS - 1)) == slot)
+                        snprintf(names[n++], STRLEN, "%s", name);
+        }
+}
+
+
+int main(void) {
+        setbuf(stdout, NULL);
+        Bootstrap();
+        prog = "UtilTest";
+        printf("============> Start Util Tests\n\n");
+
+        char names[COLLISIONS + 1][STRLEN];
+        _collidingNames(names);
+        Service_T colliding[COLLISIONS];
+        for (int i = 0; i < COLLISIONS; i++)
+                colliding[i] = _newService(names[i]);
+
+        printf("=> Test1: lookup of colliding names\n");
+        {
+                assert(Util_getService("collision0") == NULL);
+                for (int i = 0; i < COLLISIONS; i++)
+                        Util_indexService(colliding[i]);
+                for (int i = 0; i < COLLISIONS; i++)
+                        assert(Util_getService(names[i]) == colliding[i]);
+                // A name in the same probe chain which isn't indexed
+                assert(Util_getService(names[COLLISIONS]) == NULL);
+                assert(! Util_existService(names[COLLISIONS]));
+                // The first service with the name is kept
+                Util_indexService(_newService(names[0]));
+                assert(Util_getService(names[0]) == colliding[0]);
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: lookup after resize\n");
+        {
+                Service_T services[SERVICES];
+                for (int i = 0; i < SERVICES; i++) {
+                        char name[STRLEN];
+                        snprintf(name, sizeof(name), "service%d", i);
+                        services[i] = _newService(name);
+                        Util_indexService(services[i]);
+                }
+                for (int i = 0; i < SERVICES; i++)
+                        assert(Util_getService(services[i]->name) == services[i]);
+                for (int i = 0; i < COLLISIONS; i++)
+                        assert(Util_getService(names[i]) == colliding[i]);
+                assert(Util_getService(names[COLLISIONS]) == NULL);
+                assert(Util_getService("service1000") == NULL);
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("=> Test3: lookup after reset\n");
+        {
+                ServiceGroup_T g;
+                NEW(g);
+                g->name = Str_dup("group");
+                Util_indexServiceGroup(g);
+                assert(Util_getServiceGroup("group") == g);
+                Util_resetServiceIndex();
+                assert(Util_getService(names[0]) == NULL);
+                assert(Util_getService("service0") == NULL);
+                assert(Util_getServiceGroup("group") == NULL);
+                // The index is rebuilt when the control file is parsed again, a reused name gets the new service
+                Service_T s = _newService(names[0]);
+                Util_indexService(s);
+                assert(Util_getService(names[0]) == s);
+                assert(Util_getService(names[1]) == NULL);
+                Util_indexServiceGroup(g);
+                assert(Util_getServiceGroup("group") == g);
+        }
+        printf("=> Test3: OK\n\n");
+
+        printf("============> Util Tests: OK\n\n");
+        return 0;
+}